@@ -0,0 +1,183 @@
+/**
+ * algostrategy.hpp
+ * Defines the strategies algo execution decides its orders by.
+ *
+ * A strategy is a class with a Decide member that, given the book, its top and the latest
+ * microstructure signals of a product, says whether to send a buy and a sell and at what
+ * prices and quantity, and a GetBookDepth member saying how many levels of each side of the
+ * book Decide reads, so that updates to deeper levels need not be decided on. Algo
+ * execution takes the strategy as a template parameter, so Decide is inlined into the
+ * market data callback, and each group of products a strategy runs on is its own
+ * instantiation. Parameters are stored under a sequence lock, so they can be set while
+ * Decide runs on another thread, and Decide reads them with no lock and no virtual call.
+ */
+#ifndef ALGO_STRATEGY_HPP
+#define ALGO_STRATEGY_HPP
+
+#include <atomic>
+#include <mutex>
+#include <stdint.h>
+
+#include "bondreferencedata.hpp"
+#include "marketdataservice.hpp"
+#include "booksignalservice.hpp"
+#include "matchingengine.hpp"
+#include "tickprice.hpp"
+
+using namespace std;
+
+// Products a strategy runs on, a bit for each product index
+typedef unsigned ProductGroup;
+const ProductGroup ALL_PRODUCTS = (1u << BOND_COUNT) - 1;
+const ProductGroup FRONT_END = 0x07;      // 2Y, 3Y and 5Y
+const ProductGroup LONG_END = 0x38;       // 7Y, 10Y and 30Y
+
+// Is a product in a group?
+inline bool IsInGroup(ProductGroup group, int productIndex)
+{
+  return productIndex >= 0 && productIndex < BOND_COUNT && ((group >> productIndex) & 1) != 0;
+}
+
+/**
+ * The orders a strategy decides on: a buy and a sell of a quantity.
+ */
+struct StrategyOrders
+{
+  TickPrice buyPrice;
+  TickPrice sellPrice;
+  long quantity;
+  OrderType orderType;
+};
+
+/**
+ * Parameters of spread capture.
+ */
+struct SpreadCaptureParameters
+{
+  long maxSpreadTicks;        // widest touch executed on
+  double sizeShare;           // of the best bid size sent on each side
+  long maxQuantity;           // 0 for no cap
+  OrderType orderType;
+};
+
+/**
+ * Buys at the bid and sells at the offer of a level of the book when the pair is at most a
+ * number of ticks wide, capturing the spread. Each level of the market data feed is a bid
+ * and offer pair, and the pair executed on is the narrowest at least a tick wide, the
+ * shallowest on a tie, so a locked or crossed pair does not hide one to capture. By default
+ * only a pair one tick wide is executed on, for the size at its bid.
+ */
+class SpreadCaptureStrategy
+{
+
+public:
+
+  // ctor for the default parameters
+  SpreadCaptureStrategy();
+
+  // Store new parameters, for Decide calls from then on
+  void SetParameters(const SpreadCaptureParameters &parameters);
+
+  // Get the current parameters
+  SpreadCaptureParameters GetParameters() const;
+
+  // Levels of each side of the book Decide reads: every level pair may be the one captured
+  int GetBookDepth() const
+  {
+    return MARKET_DATA_DEPTH;
+  }
+
+  // Decide the orders to send on a book. Returns false to send none.
+  bool Decide(int, const BondOrderBook &book, const TopOfBook &, const BookSignals &, StrategyOrders &orders) const
+  {
+    SpreadCaptureParameters parameters = GetParameters();
+    int pairs = book.GetBidLevels() < book.GetOfferLevels() ? book.GetBidLevels() : book.GetOfferLevels();
+    int best = -1;
+    int64_t spread = 0;
+    for(int i = 0; i<pairs; i++)
+    {
+      int64_t width = (book.GetOfferPrice(i) - book.GetBidPrice(i)).GetTicks();
+      if(width >= 1 && (best < 0 || width < spread))
+      {
+        best = i;
+        spread = width;
+      }
+    }
+    if(best < 0 || spread > parameters.maxSpreadTicks)
+    {
+      return false;
+    }
+    long bidSize = book.GetBidSize(best);
+    long quantity = parameters.sizeShare == 1 ? bidSize : long(bidSize * parameters.sizeShare);
+    if(parameters.maxQuantity > 0 && quantity > parameters.maxQuantity)
+    {
+      quantity = parameters.maxQuantity;
+    }
+    if(quantity <= 0)
+    {
+      return false;
+    }
+    orders.buyPrice = book.GetBidPrice(best);
+    orders.sellPrice = book.GetOfferPrice(best);
+    orders.quantity = quantity;
+    orders.orderType = parameters.orderType;
+    return true;
+  }
+
+private:
+  SpreadCaptureStrategy(const SpreadCaptureStrategy &);
+  SpreadCaptureStrategy& operator=(const SpreadCaptureStrategy &);
+
+  // The parameters, as relaxed atomics under a sequence lock: the version is odd while a
+  // writer is storing them, and a reader that overlaps a write retries
+  atomic<uint64_t> version;
+  atomic<long> maxSpreadTicks;
+  atomic<double> sizeShare;
+  atomic<long> maxQuantity;
+  atomic<int> orderType;
+  mutex editing;                                // between writers only
+
+};
+
+SpreadCaptureStrategy::SpreadCaptureStrategy() : version(0)
+{
+  SpreadCaptureParameters initial = SpreadCaptureParameters();
+  initial.maxSpreadTicks = 1;
+  initial.sizeShare = 1;
+  initial.maxQuantity = 0;
+  initial.orderType = LIMIT;
+  SetParameters(initial);
+}
+
+void SpreadCaptureStrategy::SetParameters(const SpreadCaptureParameters &parameters)
+{
+  lock_guard<mutex> lock(editing);
+  uint64_t current = version.load(memory_order_relaxed);
+  version.store(current + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  maxSpreadTicks.store(parameters.maxSpreadTicks, memory_order_relaxed);
+  sizeShare.store(parameters.sizeShare, memory_order_relaxed);
+  maxQuantity.store(parameters.maxQuantity, memory_order_relaxed);
+  orderType.store(parameters.orderType, memory_order_relaxed);
+  version.store(current + 2, memory_order_release);
+}
+
+SpreadCaptureParameters SpreadCaptureStrategy::GetParameters() const
+{
+  SpreadCaptureParameters parameters;
+  uint64_t before, after;
+  do
+  {
+    before = version.load(memory_order_acquire);
+    parameters.maxSpreadTicks = maxSpreadTicks.load(memory_order_relaxed);
+    parameters.sizeShare = sizeShare.load(memory_order_relaxed);
+    parameters.maxQuantity = maxQuantity.load(memory_order_relaxed);
+    parameters.orderType = OrderType(orderType.load(memory_order_relaxed));
+    atomic_thread_fence(memory_order_acquire);
+    after = version.load(memory_order_relaxed);
+  }
+  while((before & 1) != 0 || before != after);
+  return parameters;
+}
+
+#endif
@@ -0,0 +1,357 @@
+/**
+ * barservice.hpp
+ * Defines the data types and Service for open/high/low/close bars.
+ *
+ * The service keeps one open bar per product for each configured series. Each series is
+ * over one source of ticks, internal prices or fills, so the two are never mixed in a bar.
+ * A series closes its bars on the tick clock (time bars), after a number of ticks (tick
+ * bars) or once a volume has traded (volume bars). A tick updates one bar per series in
+ * O(1), and closed bars go to the listeners, e.g. the binary bar file writer below. Time
+ * bars of products that stop ticking are closed by calling CloseElapsedBars from a timer.
+ */
+#ifndef BAR_SERVICE_HPP
+#define BAR_SERVICE_HPP
+
+#include <vector>
+#include <mutex>
+#include <cmath>
+#include <cstdlib>
+#include <stdint.h>
+
+#include "soa.hpp"
+#include "bondreferencedata.hpp"
+#include "binaryfeed.hpp"
+#include "pricingservice.hpp"
+#include "executionservice.hpp"
+#include "priceanalyticsservice.hpp"
+
+using namespace std;
+
+// How a series decides that a bar is complete
+enum BarType { TIME_BARS, TICK_BARS, VOLUME_BARS };
+
+// Where the ticks of a series come from: internal price mids, unsized, or fills
+enum BarSource { BAR_SOURCE_PRICING, BAR_SOURCE_FILLS };
+const int BAR_SOURCES = 2;
+
+/**
+ * An open/high/low/close bar of a product.
+ */
+struct Bar
+{
+  int productIndex;
+  int series;                 // id returned by AddSeries
+  BarType type;
+  BarSource source;
+  int64_t startNanos;         // tick clock of the first tick
+  int64_t endNanos;           // tick clock of the last tick
+  double open;
+  double high;
+  double low;
+  double close;
+  long volume;
+  long tickCount;             // 0 while the bar has not ticked
+};
+
+class BondBarService
+{
+
+public:
+
+  BondBarService() {}
+
+  // Add a series of bars over every product, from the ticks of a source, and get its id. A
+  // bar closes at the end of each interval nanoseconds of the tick clock for TIME_BARS,
+  // after interval ticks for TICK_BARS and once interval volume has traded for VOLUME_BARS.
+  int AddSeries(BarType type, int64_t interval, BarSource source);
+
+  // Record a tick of a product from a source at a time in nanoseconds, in the series of
+  // that source
+  void OnTick(int productIndex, BarSource source, int64_t nanos, double price, long size);
+
+  // Close the time bars whose interval ended at or before a time on the tick clock, for
+  // products that have stopped ticking
+  void CloseElapsedBars(int64_t nanos);
+
+  // Close every open bar, e.g. at the end of a replay
+  void Flush();
+
+  // Get the open bar of a product in a series
+  Bar GetOpenBar(int series, int productIndex) const;
+
+  // Add a listener to the Service for callbacks on closed bars
+  virtual void AddListener(ServiceListener<Bar> *listener);
+
+  // Get all listeners on the Service.
+  virtual const vector< ServiceListener<Bar>* >& GetListeners() const;
+
+private:
+
+  struct Series
+  {
+    BarType type;
+    int64_t interval;
+    BarSource source;
+  };
+
+  // Hand a bar to the listeners and reset it
+  void CloseBar(Bar &bar);
+
+  vector<Series> series;
+  vector<Bar> openBars;       // BOND_COUNT per series
+  vector< ServiceListener<Bar>* > BarListeners;
+
+  // Ticks come from both the pricing and execution services, which may be on different
+  // threads. Recursive so that listeners can read open bars while a bar is closed.
+  mutable recursive_mutex lock;
+
+};
+
+int BondBarService::AddSeries(BarType type, int64_t interval, BarSource source)
+{
+  lock_guard<recursive_mutex> guard(lock);
+  Series added = { type, interval > 0 ? interval : 1, source };
+  series.push_back(added);
+  for(int p = 0; p<BOND_COUNT; p++)
+  {
+    Bar bar = Bar();
+    bar.productIndex = p;
+    bar.series = series.size() - 1;
+    bar.type = type;
+    bar.source = source;
+    openBars.push_back(bar);
+  }
+  return series.size() - 1;
+}
+
+void BondBarService::OnTick(int productIndex, BarSource source, int64_t nanos, double price, long size)
+{
+  if(productIndex < 0 || productIndex >= BOND_COUNT || price <= 0)
+  {
+    return;
+  }
+
+  lock_guard<recursive_mutex> guard(lock);
+  for(int s = 0; s<series.size(); s++)
+  {
+    const Series &spec = series[s];
+    if(spec.source != source)
+    {
+      continue;
+    }
+    Bar &bar = openBars[s * BOND_COUNT + productIndex];
+
+    // A time bar closes on the first tick of a later interval. A late tick from another
+    // thread's clock is folded into the open bar.
+    if(spec.type == TIME_BARS && bar.tickCount > 0 && nanos / spec.interval > bar.startNanos / spec.interval)
+    {
+      CloseBar(bar);
+    }
+
+    if(bar.tickCount == 0)
+    {
+      bar.startNanos = nanos;
+      bar.open = price;
+      bar.high = price;
+      bar.low = price;
+    }
+    bar.endNanos = nanos > bar.endNanos ? nanos : bar.endNanos;
+    bar.high = fmax(bar.high, price);
+    bar.low = fmin(bar.low, price);
+    bar.close = price;
+    bar.volume += size;
+    bar.tickCount++;
+
+    // Tick and volume bars close on the tick that completes them
+    if((spec.type == TICK_BARS && bar.tickCount >= spec.interval) || (spec.type == VOLUME_BARS && bar.volume >= spec.interval))
+    {
+      CloseBar(bar);
+    }
+  }
+}
+
+void BondBarService::CloseElapsedBars(int64_t nanos)
+{
+  lock_guard<recursive_mutex> guard(lock);
+  for(int s = 0; s<series.size(); s++)
+  {
+    if(series[s].type != TIME_BARS)
+    {
+      continue;
+    }
+    for(int p = 0; p<BOND_COUNT; p++)
+    {
+      Bar &bar = openBars[s * BOND_COUNT + p];
+      if(bar.tickCount > 0 && nanos / series[s].interval > bar.startNanos / series[s].interval)
+      {
+        CloseBar(bar);
+      }
+    }
+  }
+}
+
+void BondBarService::Flush()
+{
+  lock_guard<recursive_mutex> guard(lock);
+  for(int i = 0; i<openBars.size(); i++)
+  {
+    if(openBars[i].tickCount > 0)
+    {
+      CloseBar(openBars[i]);
+    }
+  }
+}
+
+Bar BondBarService::GetOpenBar(int series, int productIndex) const
+{
+  lock_guard<recursive_mutex> guard(lock);
+  return openBars[series * BOND_COUNT + productIndex];
+}
+
+void BondBarService::AddListener(ServiceListener<Bar> *listener)
+{
+  BarListeners.push_back(listener);
+}
+
+const vector< ServiceListener<Bar>* >& BondBarService::GetListeners() const
+{
+  return BarListeners;
+}
+
+void BondBarService::CloseBar(Bar &bar)
+{
+  Bar closed = bar;
+  bar.startNanos = 0;
+  bar.endNanos = 0;
+  bar.volume = 0;
+  bar.tickCount = 0;
+  for(int i = 0; i<BarListeners.size(); i++)
+  {
+    BarListeners[i]->ProcessAdd(closed);
+  }
+}
+
+
+/**
+ * Persists closed bars as 64 byte records of the binary feed format. The file can be
+ * read back with BinaryFeedReader<BarFeedRecord> or turned into text with feedconverter.
+ */
+class BondBarHistoricalDataListener : public ServiceListener<Bar>
+{
+  public:
+
+    BondBarHistoricalDataListener(const char *path):writer(path){};
+
+  // Listener callback to process an add event to the Service
+  virtual void ProcessAdd(Bar &data)
+  {
+    if(!writer.IsValid())
+    {
+      return;
+    }
+    BarFeedRecord record = BarFeedRecord();
+    record.productIndex = data.productIndex;
+    record.barType = data.type;
+    record.series = data.series;
+    record.source = data.source;
+    record.tickCount = data.tickCount;
+    record.startNanos = data.startNanos;
+    record.endNanos = data.endNanos;
+    record.open = data.open;
+    record.high = data.high;
+    record.low = data.low;
+    record.close = data.close;
+    record.volume = data.volume;
+    writer.Write(record);
+  }
+
+  // Listener callback to process a remove event to the Service
+  virtual void ProcessRemove(Bar &data)
+  {
+
+  }
+
+  // Listener callback to process an update event to the Service
+  virtual void ProcessUpdate(Bar &data)
+  {
+    ProcessAdd(data);
+  }
+
+  // Write the record count and close the file
+  void Close()
+  {
+    writer.Close();
+  }
+
+  private:
+
+  BinaryFeedWriter<BarFeedRecord> writer;
+
+};
+
+
+/**
+ * Feeds internal prices into the bars as unsized ticks at the mid.
+ */
+class BondPricingBarServiceListener : public ServiceListener< Price<Bond> >
+{
+  public:
+
+    BondPricingBarServiceListener(BondBarService* BarService_):BarService(BarService_){};
+
+  // Listener callback to process an add event to the Service
+  virtual void ProcessAdd(Price<Bond> &data)
+  {
+    int index = GetBondIndex(data.GetProduct().GetProductId());
+    BarService->OnTick(index, BAR_SOURCE_PRICING, BondPriceAnalyticsService::Now(), data.GetMid(), 0);
+  }
+
+  // Listener callback to process a remove event to the Service
+  virtual void ProcessRemove(Price<Bond> &data)
+  {
+
+  }
+
+  // Listener callback to process an update event to the Service
+  virtual void ProcessUpdate(Price<Bond> &data)
+  {
+    ProcessAdd(data);
+  }
+
+  private:
+
+  BondBarService* BarService;
+
+};
+
+
+/**
+ * Feeds fills into the bars as ticks at the fill price, sized by the quantity filled. Orders
+ * resting at a venue do not tick until they fill.
+ */
+class BondExecutionBarServiceListener : public VenueExecutionListener
+{
+  public:
+
+    BondExecutionBarServiceListener(BondBarService* BarService_):BarService(BarService_){};
+
+  // An order sent to a venue
+  virtual void OnVenueOrder(const ExecutionOrder<Bond> &order, Market venue)
+  {
+
+  }
+
+  // A fill of an order sent to a venue
+  virtual void OnVenueFill(const ExecutionOrder<Bond> &order, Market venue, TickPrice price, long quantity)
+  {
+    int index = GetBondIndex(order.GetProduct().GetProductId());
+    BarService->OnTick(index, BAR_SOURCE_FILLS, BondPriceAnalyticsService::Now(), price.ToDouble(), labs(quantity));
+  }
+
+  private:
+
+  BondBarService* BarService;
+
+};
+
+#endif
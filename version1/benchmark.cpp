@@ -0,0 +1,1930 @@
+/**
+ * benchmark.cpp
+ * Throughput benchmarks for the trading system components.
+ *
+ * Usage: ./benchmark [lines]
+ * Writes generator sized input files (bench_*.txt, and bench_*.bin in the binary feed
+ * format) to the working directory and reports lines per second for each scenario.
+ */
+
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <thread>
+#include <atomic>
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <functional>
+#include <time.h>
+
+#include "csvingest.hpp"
+#include "binaryfeed.hpp"
+#include "pricingservice.hpp"
+#include "streamingservice.hpp"
+#include "priceconflation.hpp"
+#include "fairvalueengine.hpp"
+#include "priceanalyticsservice.hpp"
+#include "barservice.hpp"
+#include "booksignalservice.hpp"
+#include "feedhandler.hpp"
+#include "orderidservice.hpp"
+#include "matchingengine.hpp"
+#include "smartorderrouter.hpp"
+#include "timerwheel.hpp"
+#include "orderstore.hpp"
+#include "pretraderisk.hpp"
+#include "stoptrigger.hpp"
+#include "executionanalytics.hpp"
+#include "algostrategy.hpp"
+#include "marketdataservice.hpp"
+
+using namespace std;
+using namespace std::chrono;
+
+// Keeps the parsed values alive so the parsers cannot be optimised away
+volatile double sink;
+
+// Write price.txt style lines the way generatePricefile.py does
+void GeneratePriceFile(const char *path, long lines)
+{
+  FILE *file = fopen(path, "w");
+  for(long count = 0; count < lines; count++)
+  {
+    int product = count * BOND_COUNT / lines;
+    int bid = 99 + rand() % 2;
+    double spread = (2 + rand() % 3) / 256.0;
+    double mid = (bid + bid + spread) / 2;
+    fprintf(file, "%s,%s,%.12g,%.12g\n", GetBondTenor(product), GetBondCusip(product), mid, spread);
+  }
+  fclose(file);
+}
+
+// Write marketdata_backup.txt style lines the way generateMarketDatafile.py does
+void GenerateMarketDataFile(const char *path, long lines)
+{
+  FILE *file = fopen(path, "w");
+  for(long count = 0; count < lines; count++)
+  {
+    int product = count * BOND_COUNT / lines;
+    fprintf(file, "%s,first,%s", GetBondTenor(product), GetBondCusip(product));
+    for(int level = 1; level <= MARKET_DATA_DEPTH; level++)
+    {
+      int bid = 99 + rand() % 2;
+      double offer = bid + (1 + rand() % 4) / 256.0;
+      fprintf(file, ",%d,%.12g,%d", bid, offer, level * 10000000);
+    }
+    fprintf(file, "\n");
+  }
+  fclose(file);
+}
+
+// Write trades.txt style lines the way generateTradefile.py does
+void GenerateTradeFile(const char *path, long lines)
+{
+  FILE *file = fopen(path, "w");
+  for(long count = 0; count < lines; count++)
+  {
+    int product = count * BOND_COUNT / lines;
+    fprintf(file, "%s,%s%03ld,%d-%02d%d,TRSY%d,%d,%s\n", GetBondTenor(product), GetBondCusip(product), count % 1000,
+      99 + rand() % 2, rand() % 32, rand() % 8, 1 + rand() % 3, 1000000 + rand() % 2000000, rand() % 2 ? "BUY" : "SELL");
+  }
+  fclose(file);
+}
+
+// Write inquiries.txt style lines the way generateInquiries.py does
+void GenerateInquiryFile(const char *path, long lines)
+{
+  FILE *file = fopen(path, "w");
+  for(long count = 0; count < lines; count++)
+  {
+    int product = count * BOND_COUNT / lines;
+    fprintf(file, "%s%ld,%s,%s,%d,0,RECEIVED\n", GetBondCusip(product), count, GetBondTenor(product),
+      rand() % 2 ? "BUY" : "SELL", 1000000 + rand() % 2000000);
+  }
+  fclose(file);
+}
+
+// Parse with getline into a stringstream and getline per field, as the connectors used to
+double LegacyParse(const char *path, int fieldsPerLine, long &lines)
+{
+  double checksum = 0;
+  lines = 0;
+  string line;
+  ifstream file(path);
+  while(getline(file, line))
+  {
+    stringstream linestream(line);
+    vector<string> fields(fieldsPerLine);
+    for(int i = 0; i<fieldsPerLine; i++)
+    {
+      getline(linestream, fields[i], ',');
+    }
+    for(int i = 0; i<fieldsPerLine; i++)
+    {
+      const string &field = fields[i];
+      if(field.find('-') != string::npos)
+      {
+        checksum += atol(field.substr(0, field.find('-')).c_str());
+      }
+      else if(!field.empty() && field[0] >= '0' && field[0] <= '9')
+      {
+        checksum += stod(field);
+      }
+    }
+    lines++;
+  }
+  return checksum;
+}
+
+double IngestPrices(const char *path, long &lines)
+{
+  double checksum = 0;
+  lines = 0;
+  MappedFile file(path);
+  CsvReader reader(file.GetData(), file.GetSize());
+  CsvField fields[4];
+  int fieldCount;
+  PriceRecord record;
+  while(reader.NextLine(fields, 4, fieldCount))
+  {
+    if(ParsePriceRecord(fields, fieldCount, record))
+    {
+      checksum += record.mid + record.bidOfferSpread;
+    }
+    lines++;
+  }
+  return checksum;
+}
+
+double IngestMarketData(const char *path, long &lines)
+{
+  double checksum = 0;
+  lines = 0;
+  MappedFile file(path);
+  CsvReader reader(file.GetData(), file.GetSize());
+  CsvField fields[3 + 3 * MARKET_DATA_DEPTH];
+  int fieldCount;
+  MarketDataRecord record;
+  while(reader.NextLine(fields, 3 + 3 * MARKET_DATA_DEPTH, fieldCount))
+  {
+    if(ParseMarketDataRecord(fields, fieldCount, record))
+    {
+      for(int i = 0; i<MARKET_DATA_DEPTH; i++)
+      {
+        checksum += record.bidPrices[i] + record.offerPrices[i] + record.quantities[i];
+      }
+    }
+    lines++;
+  }
+  return checksum;
+}
+
+double IngestTrades(const char *path, long &lines)
+{
+  double checksum = 0;
+  lines = 0;
+  MappedFile file(path);
+  CsvReader reader(file.GetData(), file.GetSize());
+  CsvField fields[6];
+  int fieldCount;
+  TradeRecord record;
+  while(reader.NextLine(fields, 6, fieldCount))
+  {
+    if(ParseTradeRecord(fields, fieldCount, record))
+    {
+      checksum += record.price.GetTicks() + record.quantity;
+    }
+    lines++;
+  }
+  return checksum;
+}
+
+double IngestInquiries(const char *path, long &lines)
+{
+  double checksum = 0;
+  lines = 0;
+  MappedFile file(path);
+  CsvReader reader(file.GetData(), file.GetSize());
+  CsvField fields[6];
+  int fieldCount;
+  InquiryRecord record;
+  while(reader.NextLine(fields, 6, fieldCount))
+  {
+    if(ParseInquiryRecord(fields, fieldCount, record))
+    {
+      checksum += record.quantity + record.price;
+    }
+    lines++;
+  }
+  return checksum;
+}
+
+// Best of a few runs, since a shared box makes single runs noisy
+const int RUNS = 3;
+
+void CompareIngest(const char *name, const char *path, int fieldsPerLine, double (*ingest)(const char*, long&))
+{
+  long legacyLines, ingestLines;
+  double legacySeconds = 1e9, ingestSeconds = 1e9;
+
+  for(int run = 0; run < RUNS; run++)
+  {
+    high_resolution_clock::time_point start = high_resolution_clock::now();
+    sink = LegacyParse(path, fieldsPerLine, legacyLines);
+    legacySeconds = min(legacySeconds, duration<double>(high_resolution_clock::now() - start).count());
+
+    start = high_resolution_clock::now();
+    sink = ingest(path, ingestLines);
+    ingestSeconds = min(ingestSeconds, duration<double>(high_resolution_clock::now() - start).count());
+  }
+
+  printf("%-12s legacy %10.0f lines/s   ingest %11.0f lines/s   speedup %5.1fx\n", name,
+    legacyLines / legacySeconds, ingestLines / ingestSeconds, legacySeconds / ingestSeconds);
+}
+
+double ReplayPrices(const char *path, long &lines)
+{
+  double checksum = 0;
+  BinaryFeedReader<PriceFeedRecord> reader(path);
+  for(const PriceFeedRecord *record = reader.Begin(); record != reader.End(); record++)
+  {
+    checksum += record->mid + record->bidOfferSpread;
+  }
+  lines = reader.GetCount();
+  return checksum;
+}
+
+double ReplayMarketData(const char *path, long &lines)
+{
+  double checksum = 0;
+  BinaryFeedReader<OrderBookFeedRecord> reader(path);
+  for(const OrderBookFeedRecord *record = reader.Begin(); record != reader.End(); record++)
+  {
+    for(int i = 0; i<MARKET_DATA_DEPTH; i++)
+    {
+      checksum += record->bidPrices[i] + record->offerPrices[i] + record->quantities[i];
+    }
+  }
+  lines = reader.GetCount();
+  return checksum;
+}
+
+double ReplayTrades(const char *path, long &lines)
+{
+  double checksum = 0;
+  BinaryFeedReader<TradeFeedRecord> reader(path);
+  for(const TradeFeedRecord *record = reader.Begin(); record != reader.End(); record++)
+  {
+    checksum += record->priceTicks + record->quantity;
+  }
+  lines = reader.GetCount();
+  return checksum;
+}
+
+double ReplayInquiries(const char *path, long &lines)
+{
+  double checksum = 0;
+  BinaryFeedReader<InquiryFeedRecord> reader(path);
+  for(const InquiryFeedRecord *record = reader.Begin(); record != reader.End(); record++)
+  {
+    checksum += record->quantity + record->price;
+  }
+  lines = reader.GetCount();
+  return checksum;
+}
+
+// Touch every word of a mapped file: the memory bandwidth bound for a replay
+double ReadMapped(const char *path, size_t &bytes)
+{
+  MappedFile file(path);
+  const uint64_t *words = reinterpret_cast<const uint64_t*>(file.GetData());
+  size_t count = file.GetSize() / sizeof(uint64_t);
+  uint64_t checksum = 0;
+  for(size_t i = 0; i < count; i++)
+  {
+    checksum += words[i];
+  }
+  bytes = file.GetSize();
+  return double(checksum);
+}
+
+void CompareReplay(const char *name, const char *textPath, const char *binaryPath,
+  double (*ingest)(const char*, long&), double (*replay)(const char*, long&))
+{
+  long ingestLines, replayLines;
+  size_t bytes;
+  double ingestSeconds = 1e9, replaySeconds = 1e9, readSeconds = 1e9;
+
+  for(int run = 0; run < RUNS; run++)
+  {
+    high_resolution_clock::time_point start = high_resolution_clock::now();
+    sink = ingest(textPath, ingestLines);
+    ingestSeconds = min(ingestSeconds, duration<double>(high_resolution_clock::now() - start).count());
+
+    start = high_resolution_clock::now();
+    sink = replay(binaryPath, replayLines);
+    replaySeconds = min(replaySeconds, duration<double>(high_resolution_clock::now() - start).count());
+
+    start = high_resolution_clock::now();
+    sink = ReadMapped(binaryPath, bytes);
+    readSeconds = min(readSeconds, duration<double>(high_resolution_clock::now() - start).count());
+  }
+
+  printf("%-12s text %11.0f lines/s   binary %11.0f records/s (%5.2f GB/s, %3.0f%% of plain read)   speedup %5.1fx\n", name,
+    ingestLines / ingestSeconds, replayLines / replaySeconds, bytes / replaySeconds / 1e9,
+    100 * readSeconds / replaySeconds, ingestSeconds / replaySeconds);
+}
+
+// CPU time used by the calling thread
+double ThreadSeconds()
+{
+  timespec now;
+  clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+  return now.tv_sec + now.tv_nsec * 1e-9;
+}
+
+// A consumer thread that drains the cache whenever it is ready, until the replay is over
+void DrainPrices(BondPriceConflationCache *cache, int consumer, atomic<bool> *done, double *seconds)
+{
+  double start = ThreadSeconds();
+  while(!done->load())
+  {
+    if(cache->Drain(consumer) == 0)
+    {
+      this_thread::sleep_for(chrono::microseconds(100));
+    }
+  }
+  cache->Drain(consumer);
+  *seconds = ThreadSeconds() - start;
+}
+
+// Replay a binary price feed through the algo stream and GUI consumers, first with every
+// tick pushed to both, then through the conflation cache with each consumer on its own thread
+void CompareConflation(const char *path)
+{
+  cout.setstate(ios_base::badbit);
+  GUIServiceConnector guiConnector;
+
+  // Pricing alone, to separate the pricing cost from the consumers' cost
+  BondPricingService bareService;
+  BondPricingServiceBinaryConnector bareConnector(bareService, path);
+  double start = ThreadSeconds();
+  bareConnector.Subscribe();
+  double pricingSeconds = ThreadSeconds() - start;
+
+  BondPricingService directService;
+  BondAlgoStreamService directAlgoStream;
+  GUIService directGUI(guiConnector);
+  BondPricingAlgoStreamServiceListener directAlgoListener(&directAlgoStream);
+  BondPricingGUIServiceListener directGUIListener(&directGUI);
+  directService.AddListener(&directAlgoListener);
+  directService.AddListener(&directGUIListener);
+  BondPricingServiceBinaryConnector directConnector(directService, path);
+  start = ThreadSeconds();
+  directConnector.Subscribe();
+  double directSeconds = ThreadSeconds() - start - pricingSeconds;
+
+  BondPricingService conflatedService;
+  BondAlgoStreamService conflatedAlgoStream;
+  GUIService conflatedGUI(guiConnector);
+  BondPricingAlgoStreamServiceListener conflatedAlgoListener(&conflatedAlgoStream);
+  BondPricingGUIServiceListener conflatedGUIListener(&conflatedGUI);
+  BondPriceConflationCache cache;
+  int algoConsumer = cache.AddConsumer(&conflatedAlgoListener);
+  int guiConsumer = cache.AddConsumer(&conflatedGUIListener);
+  conflatedService.AddListener(&cache);
+
+  atomic<bool> done(false);
+  double algoSeconds = 0, guiSeconds = 0;
+  thread algoThread(DrainPrices, &cache, algoConsumer, &done, &algoSeconds);
+  thread guiThread(DrainPrices, &cache, guiConsumer, &done, &guiSeconds);
+  BondPricingServiceBinaryConnector conflatedConnector(conflatedService, path);
+  conflatedConnector.Subscribe();
+  done = true;
+  algoThread.join();
+  guiThread.join();
+  cout.clear();
+  remove("gui.txt");
+
+  printf("prices       %llu written   algo stream %llu delivered (%.0f:1)   gui %llu delivered (%.0f:1)\n",
+    (unsigned long long)cache.GetWrites(),
+    (unsigned long long)cache.GetDeliveries(algoConsumer), cache.GetConflationRatio(algoConsumer),
+    (unsigned long long)cache.GetDeliveries(guiConsumer), cache.GetConflationRatio(guiConsumer));
+  printf("consumer CPU direct %.3f s   conflated %.3f s   saved %.1f%%\n", directSeconds,
+    algoSeconds + guiSeconds, 100 * (1 - (algoSeconds + guiSeconds) / directSeconds));
+}
+
+// Replay a binary price feed into the pricing service while another thread polls every
+// product for a new version and copies out the ones that changed
+void MeasureVersionedPrices(const char *path)
+{
+  BondPricingService service;
+  BondPricingServiceBinaryConnector connector(service, path);
+  atomic<bool> done(false), polling(false);
+  long polls = 0, copies = 0;
+  double pollSeconds = 0;
+  thread poller([&]()
+  {
+    uint64_t seen[BOND_COUNT] = { 0 };
+    double mids = 0;
+    high_resolution_clock::time_point start = high_resolution_clock::now();
+    polling.store(true);
+    // A last pass once the writer is done copies whatever it wrote since the one before
+    for(bool last = false; !last; )
+    {
+      last = done.load();
+      for(int p = 0; p<BOND_COUNT; p++, polls++)
+      {
+        if(service.HasChangedSince(p, seen[p]))
+        {
+          VersionedPrice latest = service.GetVersionedPrice(p);
+          seen[p] = latest.sequence;
+          mids += latest.price.GetMid();
+          copies++;
+        }
+      }
+    }
+    pollSeconds = duration<double>(high_resolution_clock::now() - start).count();
+    sink = long(mids);
+  });
+  // The feed is only replayed once the poller is running, or a short one could be over first
+  while(!polling.load())
+  {
+    this_thread::yield();
+  }
+  high_resolution_clock::time_point start = high_resolution_clock::now();
+  connector.Subscribe();
+  double writeSeconds = duration<double>(high_resolution_clock::now() - start).count();
+  done = true;
+  poller.join();
+
+  uint64_t written = service.GetSequence();
+  printf("writer %6.1f ns per price   poller %5.1f ns per poll, %ld changed prices copied of %llu written\n",
+    written > 0 ? writeSeconds / written * 1e9 : 0.0, polls > 0 ? pollSeconds / polls * 1e9 : 0.0, copies,
+    (unsigned long long)written);
+}
+
+// Build a book from every record of a binary market data feed and store it as the latest
+// book of its product, as the market data service does, then time copying stored books
+// out, as a listener taking a book by value does. Vector stacks against the fixed-depth book.
+void CompareOrderBooks(const char *path)
+{
+  BinaryFeedReader<OrderBookFeedRecord> reader(path);
+  long count = reader.GetCount();
+  double vectorUpdate = 1e9, vectorCopy = 1e9, fixedUpdate = 1e9, fixedCopy = 1e9;
+  for(int run = 0; run < RUNS; run++)
+  {
+    OrderBook<Bond> vectorBooks[BOND_COUNT];
+    OrderBook<Bond> vectorCopies[64];
+    high_resolution_clock::time_point start = high_resolution_clock::now();
+    for(const OrderBookFeedRecord *record = reader.Begin(); record != reader.End(); record++)
+    {
+      vector<Order> bidStack, offerStack;
+      bidStack.reserve(MARKET_DATA_DEPTH);
+      offerStack.reserve(MARKET_DATA_DEPTH);
+      for(int i = 0; i<MARKET_DATA_DEPTH; i++)
+      {
+        bidStack.push_back(Order(record->bidPrices[i],record->quantities[i],BID));
+        offerStack.push_back(Order(record->offerPrices[i],record->quantities[i],OFFER));
+      }
+      vectorBooks[record->productIndex] = OrderBook<Bond>(GetReferenceBond(record->productIndex),bidStack,offerStack);
+    }
+    high_resolution_clock::time_point updated = high_resolution_clock::now();
+    for(long i = 0; i < count; i++)
+    {
+      vectorCopies[i & 63] = vectorBooks[i % BOND_COUNT];
+    }
+    sink = vectorCopies[count & 63].GetBidStack()[0].GetPrice();
+    vectorUpdate = min(vectorUpdate, duration<double>(updated - start).count());
+    vectorCopy = min(vectorCopy, duration<double>(high_resolution_clock::now() - updated).count());
+
+    BondOrderBook fixedBooks[BOND_COUNT];
+    BondOrderBook fixedCopies[64];
+    start = high_resolution_clock::now();
+    for(const OrderBookFeedRecord *record = reader.Begin(); record != reader.End(); record++)
+    {
+      BondOrderBook book(record->productIndex);
+      for(int i = 0; i<MARKET_DATA_DEPTH; i++)
+      {
+        book.SetBid(i,TickPrice::FromDouble(record->bidPrices[i]),record->quantities[i]);
+        book.SetOffer(i,TickPrice::FromDouble(record->offerPrices[i]),record->quantities[i]);
+      }
+      fixedBooks[record->productIndex] = book;
+    }
+    updated = high_resolution_clock::now();
+    for(long i = 0; i < count; i++)
+    {
+      fixedCopies[i & 63] = fixedBooks[i % BOND_COUNT];
+    }
+    sink = fixedCopies[count & 63].GetBidPrice(0).ToDouble();
+    fixedUpdate = min(fixedUpdate, duration<double>(updated - start).count());
+    fixedCopy = min(fixedCopy, duration<double>(high_resolution_clock::now() - updated).count());
+  }
+  printf("vector stacks   %4.0f ns per update   %4.0f ns per copy   %3d byte book + heap\n",
+    vectorUpdate / count * 1e9, vectorCopy / count * 1e9, int(sizeof(OrderBook<Bond>)));
+  printf("fixed depth     %4.0f ns per update   %4.0f ns per copy   %3d byte book\n",
+    fixedUpdate / count * 1e9, fixedCopy / count * 1e9, int(sizeof(BondOrderBook)));
+}
+
+// Counts the books a market data service sends out, and those whose top level is unchanged
+class BookCounter : public ServiceListener<BondOrderBook>
+{
+public:
+  BookCounter() : books(0), deepOnly(0) {}
+  virtual void ProcessAdd(BondOrderBook &data) { books++; }
+  virtual void ProcessRemove(BondOrderBook &data) {}
+  virtual void ProcessUpdate(BondOrderBook &data)
+  {
+    books++;
+    deepOnly += data.GetChangedLevel(BID) > 0 && data.GetChangedLevel(OFFER) > 0;
+  }
+  long books;
+  long deepOnly;
+};
+
+// Replay a binary market data feed into the market data service as whole snapshots, then
+// diffed into level updates applied in place
+void CompareBookUpdates(const char *path)
+{
+  BinaryFeedReader<OrderBookFeedRecord> reader(path);
+  long count = reader.GetCount();
+  std::streambuf *console = cout.rdbuf(0);       // OnMessage logs every listener call
+  for(int updates = 0; updates < 2; updates++)
+  {
+    double seconds = 1e9;
+    BookCounter counter;
+    long levelUpdates = 0;
+    for(int run = 0; run < RUNS; run++)
+    {
+      BondMarketDataService marketdataService;
+      counter = BookCounter();
+      marketdataService.AddListener(&counter);
+      BondOrderBookDiffer differ;
+
+      high_resolution_clock::time_point start = high_resolution_clock::now();
+      for(const OrderBookFeedRecord *record = reader.Begin(); record != reader.End(); record++)
+      {
+        BondOrderBook book(record->productIndex);
+        for(int i = 0; i<MARKET_DATA_DEPTH; i++)
+        {
+          book.SetBid(i,TickPrice::FromDouble(record->bidPrices[i]),record->quantities[i]);
+          book.SetOffer(i,TickPrice::FromDouble(record->offerPrices[i]),record->quantities[i]);
+        }
+        if(updates)
+        {
+          differ.Send(marketdataService, book);
+        }
+        else
+        {
+          marketdataService.OnMessage(book);
+        }
+      }
+      seconds = min(seconds, duration<double>(high_resolution_clock::now() - start).count());
+    }
+    cout.rdbuf(console);
+    if(updates)
+    {
+      // Count the level updates outside the timed loop
+      BondOrderBook previous[BOND_COUNT];
+      BookUpdate levels[2 * MARKET_DATA_DEPTH];
+      for(const OrderBookFeedRecord *record = reader.Begin(); record != reader.End(); record++)
+      {
+        BondOrderBook book(record->productIndex);
+        for(int i = 0; i<MARKET_DATA_DEPTH; i++)
+        {
+          book.SetBid(i,TickPrice::FromDouble(record->bidPrices[i]),record->quantities[i]);
+          book.SetOffer(i,TickPrice::FromDouble(record->offerPrices[i]),record->quantities[i]);
+        }
+        levelUpdates += DiffOrderBooks(previous[record->productIndex], book, levels);
+        previous[record->productIndex] = book;
+      }
+      printf("level updates   %4.0f ns per book   %4.1f updates per book   %5.1f%% of books with the top level unchanged\n",
+        seconds / count * 1e9, double(levelUpdates) / count, 100.0 * counter.deepOnly / counter.books);
+    }
+    else
+    {
+      printf("snapshots       %4.0f ns per book\n", seconds / count * 1e9);
+    }
+    cout.rdbuf(0);
+  }
+  cout.rdbuf(console);
+}
+
+// Keep replaying a binary market data feed's books into a top of book cache until told to stop
+void WriteTopOfBooks(TopOfBookCache *cache, const vector<BondOrderBook> *books, atomic<bool> *done, atomic<long> *writes)
+{
+  for(long i = 0; !done->load(memory_order_relaxed); i++, writes->fetch_add(1, memory_order_relaxed))
+  {
+    const BondOrderBook &book = (*books)[i % books->size()];
+    cache->Update(book.GetProductIndex(), GetTopOfBook(book));
+  }
+}
+
+// Time reading the top of book by scanning a stored book against reading the seqlock cache,
+// alone and with a market data thread writing to the cache the whole time
+void MeasureTopOfBook(const char *path, long lines)
+{
+  vector<BondOrderBook> books;
+  BinaryFeedReader<OrderBookFeedRecord> reader(path);
+  for(const OrderBookFeedRecord *record = reader.Begin(); record != reader.End() && books.size() < 4096; record++)
+  {
+    BondOrderBook book(record->productIndex);
+    for(int i = 0; i<MARKET_DATA_DEPTH; i++)
+    {
+      book.SetBid(i,TickPrice::FromDouble(record->bidPrices[i]),record->quantities[i]);
+      book.SetOffer(i,TickPrice::FromDouble(record->offerPrices[i]),record->quantities[i]);
+    }
+    books.push_back(book);
+  }
+
+  BondOrderBook latest[BOND_COUNT];
+  TopOfBookCache cache;
+  for(int i = 0; i<books.size(); i++)
+  {
+    latest[books[i].GetProductIndex()] = books[i];
+    cache.Update(books[i].GetProductIndex(), GetTopOfBook(books[i]));
+  }
+
+  double scanSeconds = 1e9, cacheSeconds = 1e9, contendedSeconds = 1e9;
+  atomic<long> writes(0);
+  for(int run = 0; run < RUNS; run++)
+  {
+    int64_t checksum = 0;
+    high_resolution_clock::time_point start = high_resolution_clock::now();
+    for(long i = 0; i < lines; i++)
+    {
+      checksum += GetTopOfBook(latest[i % BOND_COUNT]).GetSpread().GetTicks();
+    }
+    high_resolution_clock::time_point scanned = high_resolution_clock::now();
+    for(long i = 0; i < lines; i++)
+    {
+      checksum += cache.Get(i % BOND_COUNT).GetSpread().GetTicks();
+    }
+    high_resolution_clock::time_point cached = high_resolution_clock::now();
+    scanSeconds = min(scanSeconds, duration<double>(scanned - start).count());
+    cacheSeconds = min(cacheSeconds, duration<double>(cached - scanned).count());
+
+    atomic<bool> done(false);
+    writes = 0;
+    thread writer(WriteTopOfBooks, &cache, &books, &done, &writes);
+    while(writes.load() == 0)
+    {
+    }
+    start = high_resolution_clock::now();
+    for(long i = 0; i < lines; i++)
+    {
+      checksum += cache.Get(i % BOND_COUNT).GetSpread().GetTicks();
+    }
+    contendedSeconds = min(contendedSeconds, duration<double>(high_resolution_clock::now() - start).count());
+    done = true;
+    writer.join();
+    sink = checksum;
+  }
+  printf("scan book       %4.1f ns per read\n", scanSeconds / lines * 1e9);
+  printf("seqlock cache   %4.1f ns per read\n", cacheSeconds / lines * 1e9);
+  printf("while writing   %4.1f ns per read   %ld concurrent writes\n", contendedSeconds / lines * 1e9, writes.load());
+}
+
+// Aggregate a book with an ordered map per side, the obvious way
+long AggregateWithMaps(const BondOrderBook &book)
+{
+  map<int64_t, long> bids, offers;
+  for(int i = 0; i<book.GetBidLevels(); i++)
+  {
+    bids[-book.GetBidPrice(i).GetTicks()] += book.GetBidSize(i);
+  }
+  for(int i = 0; i<book.GetOfferLevels(); i++)
+  {
+    offers[book.GetOfferPrice(i).GetTicks()] += book.GetOfferSize(i);
+  }
+  return bids.begin()->second + offers.begin()->second + bids.size() + offers.size();
+}
+
+// Aggregate every book of a binary market data feed: with maps, with the rank sort and
+// merge of AggregateOrderBook, and through the market data service, aggregating on every
+// tick and then reading the cached result again
+void MeasureAggregation(const char *path)
+{
+  vector<BondOrderBook> books;
+  BinaryFeedReader<OrderBookFeedRecord> reader(path);
+  for(const OrderBookFeedRecord *record = reader.Begin(); record != reader.End(); record++)
+  {
+    BondOrderBook book(record->productIndex);
+    for(int i = 0; i<MARKET_DATA_DEPTH; i++)
+    {
+      book.SetBid(i,TickPrice::FromDouble(record->bidPrices[i]),record->quantities[i]);
+      book.SetOffer(i,TickPrice::FromDouble(record->offerPrices[i]),record->quantities[i]);
+    }
+    books.push_back(book);
+  }
+
+  double mapSeconds = 1e9, rankSeconds = 1e9, serviceSeconds = 1e9;
+  long levels = 0;
+  std::streambuf *console = cout.rdbuf(0);       // OnMessage logs every listener call
+  for(int run = 0; run < RUNS; run++)
+  {
+    long checksum = 0;
+    levels = 0;
+    high_resolution_clock::time_point start = high_resolution_clock::now();
+    for(int i = 0; i<books.size(); i++)
+    {
+      checksum += AggregateWithMaps(books[i]);
+    }
+    high_resolution_clock::time_point mapped = high_resolution_clock::now();
+    for(int i = 0; i<books.size(); i++)
+    {
+      BondOrderBook aggregated = AggregateOrderBook(books[i]);
+      levels += aggregated.GetBidLevels() + aggregated.GetOfferLevels();
+    }
+    high_resolution_clock::time_point ranked = high_resolution_clock::now();
+    mapSeconds = min(mapSeconds, duration<double>(mapped - start).count());
+    rankSeconds = min(rankSeconds, duration<double>(ranked - mapped).count());
+
+    BondMarketDataService marketdataService;
+    start = high_resolution_clock::now();
+    for(int i = 0; i<books.size(); i++)
+    {
+      marketdataService.OnMessage(books[i]);
+      const char *tenor = GetBondTenor(books[i].GetProductIndex());
+      checksum += marketdataService.AggregateDepth(tenor).GetBidSize(0);
+      checksum += marketdataService.AggregateDepth(tenor).GetOfferSize(0);
+    }
+    serviceSeconds = min(serviceSeconds, duration<double>(high_resolution_clock::now() - start).count());
+    sink = checksum;
+  }
+  cout.rdbuf(console);
+  printf("ordered maps    %4.0f ns per book\n", mapSeconds / books.size() * 1e9);
+  printf("rank and merge  %4.0f ns per book   %4.1f of %d levels left after merging\n",
+    rankSeconds / books.size() * 1e9, double(levels) / books.size(), 2 * MARKET_DATA_DEPTH);
+  printf("service         %4.0f ns per book, stored then aggregated and read twice\n", serviceSeconds / books.size() * 1e9);
+}
+
+// Merge one side of every venue's book of a product from scratch, into the sorted levels
+// of the composite book
+int MergeVenueSide(const BondOrderBook *venueBooks, PricingSide side, array<TickPrice, BondCompositeBook::DEPTH> &prices, array<long, BondCompositeBook::DEPTH> &sizes)
+{
+  array<TickPrice, BondCompositeBook::DEPTH> allPrices;
+  array<long, BondCompositeBook::DEPTH> allSizes;
+  int levels = 0;
+  for(int v = 0; v<MARKET_COUNT; v++)
+  {
+    const BondOrderBook &book = venueBooks[v];
+    int count = side == BID ? book.GetBidLevels() : book.GetOfferLevels();
+    for(int i = 0; i<count; i++, levels++)
+    {
+      allPrices[levels] = side == BID ? book.GetBidPrice(i) : book.GetOfferPrice(i);
+      allSizes[levels] = side == BID ? book.GetBidSize(i) : book.GetOfferSize(i);
+    }
+  }
+  return AggregateBookSide<BondCompositeBook::DEPTH>(allPrices, allSizes, levels, side == BID, prices, sizes);
+}
+
+// Spread the books of a binary market data feed over the venues in turn and keep a book
+// across venues: patched level by level in the market data service, against merging the
+// three venue books again on every book
+void MeasureCompositeBook(const char *path)
+{
+  vector<BondOrderBook> books;
+  BinaryFeedReader<OrderBookFeedRecord> reader(path);
+  for(const OrderBookFeedRecord *record = reader.Begin(); record != reader.End(); record++)
+  {
+    BondOrderBook book(record->productIndex);
+    for(int i = 0; i<MARKET_DATA_DEPTH; i++)
+    {
+      book.SetBid(i,TickPrice::FromDouble(record->bidPrices[i]),record->quantities[i]);
+      book.SetOffer(i,TickPrice::FromDouble(record->offerPrices[i]),record->quantities[i]);
+    }
+    books.push_back(book);
+  }
+
+  double patchSeconds = 1e9, mergeSeconds = 1e9;
+  long levels = 0, differences = 0;
+  for(int run = 0; run < RUNS; run++)
+  {
+    long checksum = 0;
+    BondMarketDataService marketdataService;
+    high_resolution_clock::time_point start = high_resolution_clock::now();
+    for(int i = 0; i<books.size(); i++)
+    {
+      marketdataService.OnMessage(books[i], Market(i % MARKET_COUNT));
+      const BondCompositeBook &composite = marketdataService.GetCompositeBook(books[i].GetProductIndex());
+      checksum += composite.GetLevel(BID, 0).size + composite.GetLevel(OFFER, 0).size;
+    }
+    high_resolution_clock::time_point patched = high_resolution_clock::now();
+
+    BondOrderBook venueBooks[BOND_COUNT][MARKET_COUNT];
+    array<TickPrice, BondCompositeBook::DEPTH> prices;
+    array<long, BondCompositeBook::DEPTH> sizes;
+    for(int i = 0; i<books.size(); i++)
+    {
+      int index = books[i].GetProductIndex();
+      venueBooks[index][i % MARKET_COUNT] = books[i];
+      int bidLevels = MergeVenueSide(venueBooks[index], BID, prices, sizes);
+      checksum += sizes[0];
+      int offerLevels = MergeVenueSide(venueBooks[index], OFFER, prices, sizes);
+      checksum += sizes[0];
+      levels += bidLevels + offerLevels;
+    }
+    high_resolution_clock::time_point merged = high_resolution_clock::now();
+    patchSeconds = min(patchSeconds, duration<double>(patched - start).count());
+    mergeSeconds = min(mergeSeconds, duration<double>(merged - patched).count());
+
+    // The patched book must end up as the merged one
+    differences = 0;
+    for(int p = 0; p<BOND_COUNT; p++)
+    {
+      const BondCompositeBook &composite = marketdataService.GetCompositeBook(p);
+      int count = MergeVenueSide(venueBooks[p], BID, prices, sizes);
+      for(int i = 0; i<count; i++)
+      {
+        differences += composite.GetLevels(BID) != count || composite.GetLevel(BID, i).price != prices[i] || composite.GetLevel(BID, i).size != sizes[i];
+      }
+      count = MergeVenueSide(venueBooks[p], OFFER, prices, sizes);
+      for(int i = 0; i<count; i++)
+      {
+        differences += composite.GetLevels(OFFER) != count || composite.GetLevel(OFFER, i).price != prices[i] || composite.GetLevel(OFFER, i).size != sizes[i];
+      }
+    }
+    sink = checksum;
+  }
+  printf("patched per venue level  %4.0f ns per book\n", patchSeconds / books.size() * 1e9);
+  printf("merged from venue books  %4.0f ns per book   %4.1f levels, %ld levels differ\n",
+    mergeSeconds / books.size() * 1e9, double(levels) / RUNS / books.size(), differences);
+}
+
+// Counts signal updates so that publishing to a listener is part of the time
+class SignalCounter : public ServiceListener<BookSignals>
+{
+public:
+  long count;
+  double sum;
+  SignalCounter() : count(0), sum(0) {}
+  virtual void ProcessAdd(BookSignals &data) { count++; sum += data.imbalance + data.topChangeRate; }
+  virtual void ProcessRemove(BookSignals &data) {}
+  virtual void ProcessUpdate(BookSignals &data) {}
+};
+
+// Update microstructure signals from every book of a binary market data feed, a
+// microsecond apart on the tick clock: the depth signals alone, and whole updates with
+// and without a listener
+void MeasureSignals(const char *path)
+{
+  vector<BondOrderBook> books;
+  BinaryFeedReader<OrderBookFeedRecord> reader(path);
+  for(const OrderBookFeedRecord *record = reader.Begin(); record != reader.End(); record++)
+  {
+    BondOrderBook book(record->productIndex);
+    for(int i = 0; i<MARKET_DATA_DEPTH; i++)
+    {
+      book.SetBid(i,TickPrice::FromDouble(record->bidPrices[i]),record->quantities[i]);
+      book.SetOffer(i,TickPrice::FromDouble(record->offerPrices[i]),record->quantities[i]);
+    }
+    books.push_back(book);
+  }
+
+  double depthSeconds = 1e9, updateSeconds = 1e9, publishSeconds = 1e9;
+  double changeRate = 0;
+  for(int run = 0; run < RUNS; run++)
+  {
+    double checksum = 0;
+    BookSignals signals = BookSignals();
+    high_resolution_clock::time_point start = high_resolution_clock::now();
+    for(int i = 0; i<books.size(); i++)
+    {
+      BondBookSignalService::ComputeDepthSignals(books[i], signals);
+      checksum += signals.imbalance + signals.depthWeightedSpread;
+    }
+    high_resolution_clock::time_point depth = high_resolution_clock::now();
+
+    BondBookSignalService signalService;
+    for(int i = 0; i<books.size(); i++)
+    {
+      signalService.OnBook(books[i], i * 1000LL);
+    }
+    high_resolution_clock::time_point updated = high_resolution_clock::now();
+
+    BondBookSignalService publishingService;
+    SignalCounter counter;
+    publishingService.AddListener(&counter);
+    for(int i = 0; i<books.size(); i++)
+    {
+      publishingService.OnBook(books[i], i * 1000LL);
+    }
+    high_resolution_clock::time_point published = high_resolution_clock::now();
+
+    depthSeconds = min(depthSeconds, duration<double>(depth - start).count());
+    updateSeconds = min(updateSeconds, duration<double>(updated - depth).count());
+    publishSeconds = min(publishSeconds, duration<double>(published - updated).count());
+    changeRate = signalService.GetSignals(0).topChangeRate;
+    sink = checksum + counter.sum;
+  }
+  printf("depth signals     %5.1f ns per update\n", depthSeconds / books.size() * 1e9);
+  printf("all signals       %5.1f ns per update\n", updateSeconds / books.size() * 1e9);
+  printf("with a listener   %5.1f ns per update   %.0f touch changes per second on 2Y\n",
+    publishSeconds / books.size() * 1e9, changeRate);
+}
+
+// Send books through the incremental feed and its handler, in batches of 64 books so the
+// rings never overrun, with every update delivered and then with one in 1000 left out and
+// one in 100 sent late. Only the handler is timed.
+void MeasureFeedHandler(const char *path)
+{
+  vector<BondOrderBook> books;
+  BinaryFeedReader<OrderBookFeedRecord> reader(path);
+  for(const OrderBookFeedRecord *record = reader.Begin(); record != reader.End(); record++)
+  {
+    BondOrderBook book(record->productIndex);
+    for(int i = 0; i<MARKET_DATA_DEPTH; i++)
+    {
+      book.SetBid(i,TickPrice::FromDouble(record->bidPrices[i]),record->quantities[i]);
+      book.SetOffer(i,TickPrice::FromDouble(record->offerPrices[i]),record->quantities[i]);
+    }
+    books.push_back(book);
+  }
+
+  const int BATCH = 64;
+  std::streambuf *console = cout.rdbuf(0);       // snapshots are applied with OnMessage
+  for(int lossy = 0; lossy < 2; lossy++)
+  {
+    double seconds = 1e9;
+    FeedHandlerStats stats = FeedHandlerStats();
+    for(int run = 0; run < RUNS; run++)
+    {
+      BondMarketDataService marketdataService;
+      BookCounter counter;
+      marketdataService.AddListener(&counter);
+      BondMarketDataFeedPublisher publisher("bench_feed", 1024, lossy ? 1000 : 0, lossy ? 100 : 0);
+      BondMarketDataFeedHandler handler(marketdataService, "bench_feed");
+      handler.Open();
+
+      double polling = 0;
+      for(int i = 0; i<books.size(); i += BATCH)
+      {
+        for(int j = i; j<i + BATCH && j<books.size(); j++)
+        {
+          publisher.Send(books[j]);
+        }
+        high_resolution_clock::time_point start = high_resolution_clock::now();
+        while(handler.GetStats().messages < publisher.GetUpdatesSent())
+        {
+          handler.Poll();
+        }
+        polling += duration<double>(high_resolution_clock::now() - start).count();
+      }
+      publisher.Close();
+      while(handler.Poll())
+      {
+      }
+      seconds = min(seconds, polling);
+      stats = handler.GetStats();
+    }
+    unlink(GetUpdateChannel("bench_feed").c_str());
+    unlink(GetSnapshotChannel("bench_feed").c_str());
+
+    printf("%s  %5.1f ns per update   %5.0f ns per book",
+      lossy ? "lossy feed " : "whole feed ", seconds / stats.messages * 1e9, seconds / books.size() * 1e9);
+    if(lossy)
+    {
+      printf("   %ld gaps, %ld reordered, recovery %.0f us mean %.0f us max",
+        stats.gaps, stats.reordered, stats.recoveries > 0 ? stats.totalRecoveryNanos / 1e3 / stats.recoveries : 0.0,
+        stats.maxRecoveryNanos / 1e3);
+    }
+    printf("\n");
+  }
+  cout.rdbuf(console);
+}
+
+// Order IDs as algo execution used to make them, from the time to the second
+string TimeOrderId()
+{
+  time_t now = time(0);
+  char text[64];
+  strftime(text, sizeof(text), "%Y-%m-%d %H-%M-%S", localtime(&now));
+  stringstream id;
+  id << hash<string>()(text);
+  return "912828F62" + id.str();
+}
+
+// Take IDs on four threads at once, and count any handed out twice
+long CountDuplicateIds(OrderIdService &orderIds, long count)
+{
+  const int THREADS = 4;
+  vector< vector<uint64_t> > ids(THREADS);
+  vector<thread> threads;
+  for(int t = 0; t<THREADS; t++)
+  {
+    threads.push_back(thread([&orderIds, &ids, t, count]()
+    {
+      ids[t].reserve(count / THREADS);
+      for(long i = 0; i<count / THREADS; i++)
+      {
+        ids[t].push_back(orderIds.NextId());
+      }
+    }));
+  }
+  vector<uint64_t> all;
+  for(int t = 0; t<THREADS; t++)
+  {
+    threads[t].join();
+    all.insert(all.end(), ids[t].begin(), ids[t].end());
+  }
+  sort(all.begin(), all.end());
+  return all.end() - unique(all.begin(), all.end());
+}
+
+// Hand out order IDs as strings from the clock, as numbers from one shared counter and
+// from per-thread blocks, and formatted from the blocks
+void MeasureOrderIds(long count)
+{
+  double timeSeconds = 1e9, sharedSeconds = 1e9, blockSeconds = 1e9, formatSeconds = 1e9;
+  long distinct = 0;
+  for(int run = 0; run < RUNS; run++)
+  {
+    uint64_t checksum = 0;
+    long timed = count / 10;
+    set<string> timeIds;
+    high_resolution_clock::time_point start = high_resolution_clock::now();
+    for(long i = 0; i<timed; i++)
+    {
+      timeIds.insert(TimeOrderId());
+    }
+    high_resolution_clock::time_point clocked = high_resolution_clock::now();
+
+    atomic<uint64_t> shared(0);
+    for(long i = 0; i<count; i++)
+    {
+      checksum += shared.fetch_add(1);
+    }
+    high_resolution_clock::time_point counted = high_resolution_clock::now();
+
+    OrderIdService orderIds(1);
+    for(long i = 0; i<count; i++)
+    {
+      checksum += orderIds.NextId();
+    }
+    high_resolution_clock::time_point blocked = high_resolution_clock::now();
+
+    char buffer[ORDER_ID_WIDTH + 1];
+    for(long i = 0; i<count; i++)
+    {
+      OrderIdService::Format(orderIds.NextId(), buffer);
+      checksum += buffer[ORDER_ID_WIDTH - 1];
+    }
+    high_resolution_clock::time_point formatted = high_resolution_clock::now();
+
+    timeSeconds = min(timeSeconds, duration<double>(clocked - start).count() / timed * count);
+    sharedSeconds = min(sharedSeconds, duration<double>(counted - clocked).count());
+    blockSeconds = min(blockSeconds, duration<double>(blocked - counted).count());
+    formatSeconds = min(formatSeconds, duration<double>(formatted - blocked).count());
+    distinct = timeIds.size();
+    sink = checksum;
+  }
+
+  OrderIdService orderIds(2);
+  long duplicates = CountDuplicateIds(orderIds, count);
+  printf("clock string    %6.1f ns per ID   %ld distinct in %ld\n", timeSeconds / count * 1e9, distinct, count / 10);
+  printf("shared counter  %6.1f ns per ID\n", sharedSeconds / count * 1e9);
+  printf("thread blocks   %6.1f ns per ID   %ld duplicates over 4 threads\n", blockSeconds / count * 1e9, duplicates);
+  printf("with format     %6.1f ns per ID\n", formatSeconds / count * 1e9);
+}
+
+// Order flow around a mid price: limit orders, cancels of recent orders, IOC, FOK, market
+// and stop orders
+vector<EngineRequest> GenerateOrderFlow(long count)
+{
+  vector<EngineRequest> flow(count);
+  uint64_t nextId = 0;
+  for(long i = 0; i<count; i++)
+  {
+    EngineRequest &request = flow[i];
+    int kind = rand() % 100;
+    request.productIndex = rand() % BOND_COUNT;
+    request.side = rand() % 2 ? BID : OFFER;
+    request.price = TickPrice::FromTicks(3200 + rand() % 11 - 5);
+    request.quantity = 1000000 * (1 + rand() % 5);
+    request.unreported = false;
+    request.type = kind < 20 && nextId > 0 ? CANCEL_ORDER : NEW_ORDER;
+    request.orderId = request.type == CANCEL_ORDER ? nextId - rand() % (nextId < 64 ? nextId : 64) : ++nextId;
+    request.orderType = kind < 75 ? LIMIT : kind < 85 ? IOC : kind < 90 ? FOK : kind < 95 ? MARKET : STOP;
+  }
+  return flow;
+}
+
+void MeasureMatchingEngine(long count)
+{
+  vector<EngineRequest> flow = GenerateOrderFlow(count);
+  double processSeconds = 1e9, threadSeconds = 1e9, cancelSeconds = 1e9;
+  long reports = 0, fills = 0, resting = 0;
+  for(int run = 0; run < RUNS; run++)
+  {
+    // On the calling thread, taking reports as they come
+    MatchingEngine engine(BROKERTEC, count);
+    ExecutionReport report;
+    reports = fills = 0;
+    high_resolution_clock::time_point start = high_resolution_clock::now();
+    for(long i = 0; i<count; i++)
+    {
+      engine.Process(flow[i]);
+      while(engine.PollReport(report))
+      {
+        reports++;
+        fills += report.type == ORDER_FILLED;
+      }
+    }
+    high_resolution_clock::time_point processed = high_resolution_clock::now();
+    resting = engine.GetOpenOrders();
+
+    // On the engine's own thread, with orders sent and reports taken by another
+    MatchingEngine threaded(BROKERTEC, count);
+    threaded.Start();
+    long received = 0;
+    high_resolution_clock::time_point threadStart = high_resolution_clock::now();
+    for(long i = 0; i<count || received < reports;)
+    {
+      if(i < count && threaded.Submit(flow[i]))
+      {
+        i++;
+      }
+      bool any = false;
+      while(threaded.PollReport(report))
+      {
+        received++;
+        any = true;
+      }
+      if(!any && i == count)
+      {
+        this_thread::yield();
+      }
+    }
+    high_resolution_clock::time_point threadEnd = high_resolution_clock::now();
+    threaded.Stop();
+
+    // Cancels of resting orders, in random order
+    MatchingEngine cancels(BROKERTEC, count);
+    vector<uint64_t> ids;
+    for(long i = 0; i<count; i++)
+    {
+      EngineRequest request = { NEW_ORDER, uint64_t(i + 1), int(i % BOND_COUNT), i % 2 ? BID : OFFER, LIMIT,
+        TickPrice::FromTicks(i % 2 ? 3200 - i % 50 : 3201 + i % 50), 1000000, true };
+      cancels.Process(request);
+      ids.push_back(request.orderId);
+    }
+    random_shuffle(ids.begin(), ids.end());
+    high_resolution_clock::time_point cancelStart = high_resolution_clock::now();
+    for(long i = 0; i<count; i++)
+    {
+      EngineRequest request = { CANCEL_ORDER, ids[i], 0, BID, LIMIT, TickPrice(), 0, true };
+      cancels.Process(request);
+    }
+    high_resolution_clock::time_point cancelEnd = high_resolution_clock::now();
+    sink = cancels.GetOpenOrders();
+
+    processSeconds = min(processSeconds, duration<double>(processed - start).count());
+    threadSeconds = min(threadSeconds, duration<double>(threadEnd - threadStart).count());
+    cancelSeconds = min(cancelSeconds, duration<double>(cancelEnd - cancelStart).count());
+  }
+  printf("in line         %6.1f ns per request  %5.2f M requests/s  %ld reports, %ld fills, %ld left open\n",
+    processSeconds / count * 1e9, count / processSeconds / 1e6, reports, fills, resting);
+  printf("engine thread   %6.1f ns per request  %5.2f M requests/s\n", threadSeconds / count * 1e9, count / threadSeconds / 1e6);
+  printf("cancel resting  %6.1f ns per cancel\n", cancelSeconds / count * 1e9);
+}
+
+// Replay a binary market data feed into the market data service as books from the three
+// venues in turn, then time planning a parent order's split across the venues on every
+// book, and routing and sending the child orders of one parent in 16
+void MeasureRouter(const char *path)
+{
+  vector<BondOrderBook> books;
+  BinaryFeedReader<OrderBookFeedRecord> reader(path);
+  for(const OrderBookFeedRecord *record = reader.Begin(); record != reader.End(); record++)
+  {
+    BondOrderBook book(record->productIndex);
+    for(int i = 0; i<MARKET_DATA_DEPTH; i++)
+    {
+      book.SetBid(i,TickPrice::FromDouble(record->bidPrices[i]),record->quantities[i]);
+      book.SetOffer(i,TickPrice::FromDouble(record->offerPrices[i]),record->quantities[i]);
+    }
+    books.push_back(book);
+  }
+
+  // Venues take turns sending books; each parent order is a buy or sell near the touch,
+  // marketable one time in two
+  std::streambuf *console = cout.rdbuf(0);       // ExecuteOrder logs 2Y trades
+  double planSeconds = 1e9, routeSeconds = 1e9;
+  long slices = 0, routed = 0, children = 0;
+  for(int run = 0; run < RUNS; run++)
+  {
+    BondMarketDataService marketdataService;
+    BondExecutionService executionService;
+    OrderIdService orderIds(1);
+    BondSmartOrderRouter router(&executionService, &marketdataService, &orderIds);
+    router.SetVenueProfile(BROKERTEC, 30000, 0.002);
+    router.SetVenueProfile(ESPEED, 50000, 0.0015);
+    router.SetVenueProfile(CME, 80000, 0.001);
+    RouteSlice plan[MARKET_COUNT];
+    double planned = 0, sent = 0;
+    slices = 0;
+    for(int i = 0; i<books.size(); i++)
+    {
+      marketdataService.OnMessage(books[i], Market(i % MARKET_COUNT));
+      int index = books[i].GetProductIndex();
+      PricingSide side = i % 2 ? BID : OFFER;
+      const BondCompositeBook &composite = marketdataService.GetCompositeBook(index);
+      TickPrice touch = composite.GetLevel(side == BID ? OFFER : BID, 0).price;
+      TickPrice limit = (i / 2) % 2 ? touch : touch + TickPrice::FromTicks(side == BID ? -1 : 1);
+      long quantity = 10000000 * (1 + i % 4);
+
+      high_resolution_clock::time_point start = high_resolution_clock::now();
+      slices += router.Plan(index, side, limit, false, quantity, true, plan);
+      high_resolution_clock::time_point planEnd = high_resolution_clock::now();
+      planned += duration<double>(planEnd - start).count();
+
+      // Routing books a trade per child, so only some orders are routed
+      if(i % 16 == 0)
+      {
+        ExecutionOrder<Bond> parent(GetReferenceBond(index), side, OrderIdService::ToString(orderIds.NextId()), LIMIT, limit,
+          side == BID ? quantity : -quantity, 0, "", false);
+        high_resolution_clock::time_point routeStart = high_resolution_clock::now();
+        router.Route(parent);
+        sent += duration<double>(high_resolution_clock::now() - routeStart).count();
+      }
+    }
+    routed = (books.size() + 15) / 16;
+    children = router.GetChildOrders();
+    planSeconds = min(planSeconds, planned);
+    routeSeconds = min(routeSeconds, sent);
+  }
+  cout.rdbuf(console);
+  printf("plan            %6.1f ns per order   %.2f venues per order\n", planSeconds / books.size() * 1e9, double(slices) / books.size());
+  printf("route and send  %6.1f ns per order   %.2f child orders per order\n", routeSeconds / routed * 1e9, double(children) / routed);
+}
+
+// TWAP parents starting evenly through ten seconds, each sending ten slices a second
+// apart, with the clock moved on a millisecond at a time for twenty seconds. Slices due are
+// found with a timer wheel, and by checking every parent on every tick.
+void MeasureSlicing()
+{
+  const int64_t SECOND = 1000000000LL, TICK = 1000000LL, TICKS = 20000;
+  for(int parents = 1000; parents <= 100000; parents *= 10)
+  {
+    double wheelSeconds = 1e9, scanSeconds = 1e9, serviceSeconds = 1e9;
+    long slices = 0;
+    for(int run = 0; run < RUNS; run++)
+    {
+      TimerWheel wheel(TICK);
+      vector<int> sent(parents, 1);
+      for(int i = 0; i<parents; i++)
+      {
+        wheel.Schedule(10 * SECOND * i / parents + SECOND, i);
+      }
+      long expired = 0;
+      high_resolution_clock::time_point start = high_resolution_clock::now();
+      for(int64_t tick = 1; tick <= TICKS; tick++)
+      {
+        wheel.Advance(tick * TICK, [&](uint64_t i)
+        {
+          expired++;
+          if(++sent[i] < 10)
+          {
+            wheel.Schedule(tick * TICK + SECOND, i);
+          }
+        });
+      }
+      high_resolution_clock::time_point wheeled = high_resolution_clock::now();
+
+      vector<int64_t> due(parents);
+      sent.assign(parents, 1);
+      for(int i = 0; i<parents; i++)
+      {
+        due[i] = 10 * SECOND * i / parents + SECOND;
+      }
+      long scanned = 0;
+      for(int64_t tick = 1; tick <= TICKS; tick++)
+      {
+        for(int i = 0; i<parents; i++)
+        {
+          if(sent[i] < 10 && due[i] <= tick * TICK)
+          {
+            sent[i]++;
+            due[i] += SECOND;
+            scanned++;
+          }
+        }
+      }
+      high_resolution_clock::time_point scanEnd = high_resolution_clock::now();
+      sink = expired + scanned;
+
+      // The service sending each slice as a child order, with no listeners
+      BondAlgoExecutionService algoExecution;
+      for(int i = 0; i<parents; i++)
+      {
+        ExecutionOrder<Bond> order(GetReferenceBond(i % BOND_COUNT), BID, OrderIdService::ToString(i + 1), LIMIT,
+          TickPrice::FromTicks(25600), 10000000, 0, "", false);
+        algoExecution.StartParent(order, TWAP, 10 * SECOND, 10, 10 * SECOND * i / parents);
+      }
+      slices = parents;
+      high_resolution_clock::time_point serviceStart = high_resolution_clock::now();
+      for(int64_t tick = 1; tick <= TICKS; tick++)
+      {
+        slices += algoExecution.OnTimer(tick * TICK);
+      }
+      high_resolution_clock::time_point serviceEnd = high_resolution_clock::now();
+
+      wheelSeconds = min(wheelSeconds, duration<double>(wheeled - start).count());
+      scanSeconds = min(scanSeconds, duration<double>(scanEnd - wheeled).count());
+      serviceSeconds = min(serviceSeconds, duration<double>(serviceEnd - serviceStart).count());
+    }
+    printf("%6d parents   wheel %7.1f ns per tick  scan %8.1f ns per tick  service %6.0f ns per slice, %ld slices\n", parents,
+      wheelSeconds / TICKS * 1e9, scanSeconds / TICKS * 1e9, serviceSeconds / (slices - parents) * 1e9, slices);
+  }
+}
+
+// Order lifecycles with 10000 orders open: each step adds an order, part fills an open one
+// and fills the oldest in full, in the store and in maps keyed by integer and string ID
+void MeasureOrderStore(long count)
+{
+  const long OPEN = 10000;
+  vector<long> partial(count);
+  srand(46);
+  for(long i = 0; i<count; i++)
+  {
+    partial[i] = i + 1 + rand() % (OPEN - 1);
+  }
+  vector<string> names(count + OPEN + 1);
+  for(long i = 1; i<names.size(); i++)
+  {
+    names[i] = OrderIdService::ToString(i);
+  }
+  OrderRecord blank = { 0, 0, 0, TickPrice::FromTicks(25600), 1000, 0, 0, BID, LIMIT, CME, STATE_NEW };
+  double storeSeconds = 1e9, hashSeconds = 1e9, treeSeconds = 1e9;
+  size_t storeBytes = 0;
+  for(int run = 0; run < RUNS; run++)
+  {
+    OrderStore store(1 << 14, 1 << 14);
+    for(long id = 1; id <= OPEN; id++)
+    {
+      store.Add(id, 0, 0, BID, LIMIT, CME, blank.price, 1000);
+    }
+    high_resolution_clock::time_point start = high_resolution_clock::now();
+    for(long i = 0; i<count; i++)
+    {
+      store.Add(i + 1 + OPEN, 0, 0, BID, LIMIT, CME, blank.price, 1000);
+      store.Fill(partial[i], blank.price, 1);
+      store.Fill(i + 1, blank.price, store.Find(i + 1)->GetLeavesQuantity());
+    }
+    high_resolution_clock::time_point stored = high_resolution_clock::now();
+    sink = store.GetDoneOrders();
+    storeBytes = store.GetMemory();
+
+    unordered_map<uint64_t, OrderRecord> hash;
+    for(long id = 1; id <= OPEN; id++)
+    {
+      hash[id] = blank;
+    }
+    high_resolution_clock::time_point hashStart = high_resolution_clock::now();
+    for(long i = 0; i<count; i++)
+    {
+      hash[i + 1 + OPEN] = blank;
+      OrderRecord &record = hash.find(partial[i])->second;
+      record.filledQuantity++;
+      record.filledTicks += blank.price.GetTicks();
+      hash.erase(i + 1);
+    }
+    high_resolution_clock::time_point hashEnd = high_resolution_clock::now();
+    sink = hash.size();
+
+    map<string, OrderRecord> tree;
+    for(long id = 1; id <= OPEN; id++)
+    {
+      tree[names[id]] = blank;
+    }
+    high_resolution_clock::time_point treeStart = high_resolution_clock::now();
+    for(long i = 0; i<count; i++)
+    {
+      tree[names[i + 1 + OPEN]] = blank;
+      OrderRecord &record = tree.find(names[partial[i]])->second;
+      record.filledQuantity++;
+      record.filledTicks += blank.price.GetTicks();
+      tree.erase(names[i + 1]);
+    }
+    high_resolution_clock::time_point treeEnd = high_resolution_clock::now();
+    sink = tree.size();
+
+    storeSeconds = min(storeSeconds, duration<double>(stored - start).count());
+    hashSeconds = min(hashSeconds, duration<double>(hashEnd - hashStart).count());
+    treeSeconds = min(treeSeconds, duration<double>(treeEnd - treeStart).count());
+  }
+  printf("order store          %7.1f ns per lifecycle step, %zu bytes per order held\n", storeSeconds / count * 1e9,
+    storeBytes / (1 << 14));
+  printf("unordered_map        %7.1f ns per lifecycle step\n", hashSeconds / count * 1e9);
+  printf("map by string ID     %7.1f ns per lifecycle step\n", treeSeconds / count * 1e9);
+}
+
+// Pre-trade checks of orders against every limit, each released as if filled, alone and
+// with another thread setting limits as fast as it can
+void MeasureRiskGate(long count)
+{
+  RiskLimits productLimits = { 50000000, 60000000.0, 200000000, 500000.0, 0 };
+  RiskLimits bookLimits = { 0, 0, 300000000, 1000000.0, 0 };
+  const int64_t now = TimerWheel::Now();
+  for(int reconfigure = 0; reconfigure < 2; reconfigure++)
+  {
+    double seconds = 1e9;
+    long passed = 0, edits = 0;
+    for(int run = 0; run < RUNS; run++)
+    {
+      BondPreTradeRiskGate gate;
+      for(int p = 0; p<BOND_COUNT; p++)
+      {
+        gate.SetProductLimits(p, productLimits);
+      }
+      for(int b = 0; b<BOOK_COUNT; b++)
+      {
+        gate.SetBookLimits(b, bookLimits);
+      }
+      atomic<bool> done(false);
+      thread writer;
+      if(reconfigure)
+      {
+        writer = thread([&]()
+        {
+          for(edits = 0; edits < 1000 && !done.load(); edits++)
+          {
+            RiskLimits limits = productLimits;
+            limits.maxPosition += edits;
+            gate.SetProductLimits(edits % BOND_COUNT, limits);
+            this_thread::yield();
+          }
+        });
+      }
+      passed = 0;
+      high_resolution_clock::time_point start = high_resolution_clock::now();
+      for(long i = 0; i<count; i++)
+      {
+        int product = i % BOND_COUNT;
+        PricingSide side = (i & 1) ? OFFER : BID;
+        if(gate.Check(product, side, TickPrice::FromTicks(25600 + i % 8), 10000000, now + i) == RISK_PASSED)
+        {
+          passed++;
+          gate.Release(product, side, 10000000);
+        }
+      }
+      high_resolution_clock::time_point end = high_resolution_clock::now();
+      done.store(true);
+      if(reconfigure)
+      {
+        writer.join();
+      }
+      sink = passed;
+      seconds = min(seconds, duration<double>(end - start).count());
+    }
+    printf("%-28s %7.1f ns per check and release, %ld of %ld passed\n",
+      reconfigure ? "while limits are set" : "limits fixed", seconds / count * 1e9, passed, count);
+  }
+}
+
+// Stops resting on both sides of a top of book walking a tick at a time, with each stop
+// triggered replaced by one further out, against scanning every stop on every update
+void MeasureStopTriggers(long updates)
+{
+  for(int resting = 10000; resting <= 100000; resting *= 10)
+  {
+    double engineSeconds = 1e9, scanSeconds = 1e9;
+    long triggered = 0;
+    for(int run = 0; run < RUNS; run++)
+    {
+      vector<int64_t> walk(updates);
+      int64_t mid = 25600;
+      srand(48);
+      for(long i = 0; i<updates; i++)
+      {
+        mid += rand() % 3 - 1;
+        walk[i] = mid;
+      }
+
+      // Stops 2 to 2000 ticks away, replaced 2000 ticks beyond the touch when triggered
+      StopTriggerEngine<PricingSide> engine;
+      vector<int64_t> buys, sells;
+      for(int i = 0; i<resting; i++)
+      {
+        int64_t away = 2 + i % 1999;
+        PricingSide side = i % 2 ? OFFER : BID;
+        engine.Add(0, side, TickPrice::FromTicks(i % 2 ? 25600 - away : 25600 + away), side);
+        (i % 2 ? sells : buys).push_back(i % 2 ? 25600 - away : 25600 + away);
+      }
+      long engineTriggered = 0;
+      high_resolution_clock::time_point start = high_resolution_clock::now();
+      for(long i = 0; i<updates; i++)
+      {
+        TopOfBook top;
+        top.bid = TickPrice::FromTicks(walk[i]);
+        top.offer = TickPrice::FromTicks(walk[i] + 1);
+        top.bidLevel = top.offerLevel = 0;
+        engineTriggered += engine.OnTopOfBook(0, top, [&](PricingSide side)
+        {
+          engine.Add(0, side, TickPrice::FromTicks(side == BID ? walk[i] + 2000 : walk[i] - 2000), side);
+        });
+      }
+      high_resolution_clock::time_point engined = high_resolution_clock::now();
+
+      long scanTriggered = 0;
+      for(long i = 0; i<updates; i++)
+      {
+        for(size_t k = 0; k<buys.size(); k++)
+        {
+          if(buys[k] <= walk[i] + 1)
+          {
+            buys[k] = walk[i] + 2000;
+            scanTriggered++;
+          }
+        }
+        for(size_t k = 0; k<sells.size(); k++)
+        {
+          if(sells[k] >= walk[i])
+          {
+            sells[k] = walk[i] - 2000;
+            scanTriggered++;
+          }
+        }
+      }
+      high_resolution_clock::time_point scanned = high_resolution_clock::now();
+      sink = engineTriggered + scanTriggered;
+      triggered = engineTriggered;
+
+      engineSeconds = min(engineSeconds, duration<double>(engined - start).count());
+      scanSeconds = min(scanSeconds, duration<double>(scanned - engined).count());
+    }
+    printf("%6d stops   buckets %7.1f ns per update  scan %8.1f ns per update, %ld triggered\n", resting,
+      engineSeconds / updates * 1e9, scanSeconds / updates * 1e9, triggered);
+  }
+}
+
+// Each order is decided on at the touch of a moving book, sent to a venue and filled,
+// joined in the service and, for comparison, through a map keyed by string order ID
+void MeasureExecutionAnalytics(long count)
+{
+  vector< ExecutionOrder<Bond> > orders;
+  vector<TopOfBook> tops(count);
+  int64_t mid = 25600;
+  srand(49);
+  for(long i = 0; i<count; i++)
+  {
+    orders.push_back(ExecutionOrder<Bond>(GetReferenceBond(i % BOND_COUNT), i % 2 ? OFFER : BID,
+      OrderIdService::ToString(i + 1), MARKET, TickPrice::FromTicks(mid), 1000000, 0, "", false));
+    mid += rand() % 3 - 1;
+    tops[i].bid = TickPrice::FromTicks(mid);
+    tops[i].offer = TickPrice::FromTicks(mid + 2);
+    tops[i].bidLevel = tops[i].offerLevel = 0;
+  }
+
+  struct Arrival
+  {
+    int64_t bid;
+    int64_t offer;
+    PricingSide side;
+  };
+  double serviceSeconds = 1e9, mapSeconds = 1e9;
+  for(int run = 0; run < RUNS; run++)
+  {
+    BondExecutionAnalyticsService analytics;
+    high_resolution_clock::time_point start = high_resolution_clock::now();
+    for(long i = 0; i<count; i++)
+    {
+      analytics.OnBook(i % BOND_COUNT, tops[i], i * 1000);
+      analytics.OnDecision(orders[i], NO_SLICING, i * 1000);
+      analytics.OnVenueOrder(orders[i], BROKERTEC);
+      analytics.OnVenueFill(orders[i], BROKERTEC, orders[i].GetSide() == BID ? tops[i].offer : tops[i].bid, 1000000);
+    }
+    high_resolution_clock::time_point serviced = high_resolution_clock::now();
+
+    map<string, Arrival> arrivals;
+    double slippage = 0;
+    for(long i = 0; i<count; i++)
+    {
+      Arrival arrival = { tops[i].bid.GetTicks(), tops[i].offer.GetTicks(), orders[i].GetSide() };
+      arrivals[orders[i].GetOrderId()] = arrival;
+      map<string, Arrival>::iterator found = arrivals.find(orders[i].GetOrderId());
+      found = arrivals.find(orders[i].GetOrderId());
+      double arrivalMid = (found->second.bid + found->second.offer) / 2.0;
+      slippage += found->second.side == BID ? found->second.offer - arrivalMid : arrivalMid - found->second.bid;
+      if(arrivals.size() > (1 << 16))
+      {
+        arrivals.erase(arrivals.begin());
+      }
+    }
+    high_resolution_clock::time_point mapped = high_resolution_clock::now();
+    sink = long(slippage) + analytics.GetSnapshot().venues[BROKERTEC].fills;
+
+    serviceSeconds = min(serviceSeconds, duration<double>(serviced - start).count());
+    mapSeconds = min(mapSeconds, duration<double>(mapped - serviced).count());
+  }
+  printf("service %6.1f ns per order  map %6.1f ns per order\n", serviceSeconds / count * 1e9, mapSeconds / count * 1e9);
+}
+
+// The same spread capture decision as the template parameter algo execution takes and
+// behind a virtual interface, as a plug-in would be without templates
+class VirtualStrategy
+{
+public:
+  virtual ~VirtualStrategy() {}
+  virtual bool Decide(int productIndex, const BondOrderBook &book, const TopOfBook &top, const BookSignals &signals, StrategyOrders &orders) const = 0;
+};
+
+class VirtualSpreadCapture : public VirtualStrategy
+{
+public:
+  virtual bool Decide(int productIndex, const BondOrderBook &book, const TopOfBook &top, const BookSignals &signals, StrategyOrders &orders) const
+  {
+    return strategy.Decide(productIndex, book, top, signals, orders);
+  }
+  SpreadCaptureStrategy strategy;
+};
+
+template<typename Strategy>
+long DecideAll(const vector<BondOrderBook> &books, const vector<TopOfBook> &tops, long count, const Strategy &strategy)
+{
+  BookSignals signals = BookSignals();
+  StrategyOrders orders;
+  long decided = 0;
+  for(long i = 0; i<count; i++)
+  {
+    size_t book = i % books.size();
+    if(strategy.Decide(i % BOND_COUNT, books[book], tops[book], signals, orders))
+    {
+      decided += orders.quantity;
+    }
+  }
+  return decided;
+}
+
+void MeasureStrategies(long count)
+{
+  // Books of five pairs whose narrowest is one tick wide but for one in 16, so it is the call
+  // and not the branch that is timed. A working set of books is cycled through.
+  const int BOOKS = 4096;
+  vector<BondOrderBook> books(BOOKS);
+  vector<TopOfBook> tops(BOOKS);
+  srand(50);
+  for(int i = 0; i<BOOKS; i++)
+  {
+    for(int level = 0; level<MARKET_DATA_DEPTH; level++)
+    {
+      books[i].SetBid(level, TickPrice::FromTicks(25600 - level), 10000000 * (level + 1));
+      books[i].SetOffer(level, TickPrice::FromTicks(25600 + level + (rand() % 16 ? 1 : 2)), 10000000 * (level + 1));
+    }
+    tops[i] = GetTopOfBook(books[i]);
+  }
+  SpreadCaptureStrategy strategy;
+  VirtualSpreadCapture virtualStrategy;
+  const VirtualStrategy * volatile plugin = &virtualStrategy;    // not devirtualised
+  SpreadCaptureParameters wider = strategy.GetParameters();
+  wider.maxSpreadTicks = 2;
+
+  double templateSeconds = 1e9, virtualSeconds = 1e9, switchingSeconds = 1e9;
+  for(int run = 0; run < RUNS; run++)
+  {
+    high_resolution_clock::time_point start = high_resolution_clock::now();
+    long decided = DecideAll(books, tops, count, strategy);
+    high_resolution_clock::time_point templated = high_resolution_clock::now();
+    decided += DecideAll(books, tops, count, *plugin);
+    high_resolution_clock::time_point virtualised = high_resolution_clock::now();
+
+    // Parameters switched on another thread all the while
+    atomic<bool> done(false);
+    thread writer([&]()
+    {
+      while(!done.load())
+      {
+        strategy.SetParameters(wider);
+        this_thread::sleep_for(microseconds(100));
+      }
+    });
+    high_resolution_clock::time_point switching = high_resolution_clock::now();
+    decided += DecideAll(books, tops, count, strategy);
+    high_resolution_clock::time_point switched = high_resolution_clock::now();
+    done.store(true);
+    writer.join();
+    sink = decided;
+
+    templateSeconds = min(templateSeconds, duration<double>(templated - start).count());
+    virtualSeconds = min(virtualSeconds, duration<double>(virtualised - templated).count());
+    switchingSeconds = min(switchingSeconds, duration<double>(switched - switching).count());
+  }
+  printf("template %5.1f ns per book  virtual %5.1f ns per book  template while switching %5.1f ns per book\n",
+    templateSeconds / count * 1e9, virtualSeconds / count * 1e9, switchingSeconds / count * 1e9);
+}
+
+// Price books from a binary market data feed with the fair-value engine, into a pricing
+// service with no listeners, and report the time from book to price
+void MeasureFairValue(const char *path, long lines)
+{
+  // Build a working set of books up front so only the engine is timed
+  const int BOOKS = 4096;
+  vector<BondOrderBook> books;
+  BinaryFeedReader<OrderBookFeedRecord> reader(path);
+  for(const OrderBookFeedRecord *record = reader.Begin(); record != reader.End() && books.size() < BOOKS; record++)
+  {
+    BondOrderBook book((books.size() * BOND_COUNT) / BOOKS);
+    for(int i = 0; i<MARKET_DATA_DEPTH; i++)
+    {
+      book.SetBid(i,TickPrice::FromDouble(record->bidPrices[i]),record->quantities[i]);
+      book.SetOffer(i,TickPrice::FromDouble(record->offerPrices[i]),record->quantities[i]);
+    }
+    books.push_back(book);
+  }
+
+  const double fractions[] = { 0, 0.5, 2 };
+  for(int f = 0; f < 3; f++)
+  {
+    BondPricingService pricingService;
+    BondFairValueEngine engine(pricingService, fractions[f]);
+    double seconds = 1e9;
+    for(int run = 0; run < RUNS; run++)
+    {
+      high_resolution_clock::time_point start = high_resolution_clock::now();
+      for(long i = 0; i < lines; i++)
+      {
+        engine.ProcessAdd(books[i % books.size()]);
+      }
+      seconds = min(seconds, duration<double>(high_resolution_clock::now() - start).count());
+    }
+    printf("threshold %3.1f ticks   %6.0f ns per book   %5.1f%% of books sent to pricing\n", fractions[f],
+      seconds / lines * 1e9, 100.0 * engine.GetPricesSent() / engine.GetBooksPriced());
+  }
+}
+
+// Feed a binary price feed into the rolling analytics as ticks a microsecond apart,
+// snapshotting every product once a simulated second
+void MeasureAnalytics(const char *path)
+{
+  BinaryFeedReader<PriceFeedRecord> reader(path);
+  double seconds = 1e9;
+  long snapshots = 0;
+  for(int run = 0; run < RUNS; run++)
+  {
+    BondPriceAnalyticsService analyticsService;
+    analyticsService.SetPublishInterval(1000000000LL);
+    int64_t nanos = 0;
+    high_resolution_clock::time_point start = high_resolution_clock::now();
+    for(const PriceFeedRecord *record = reader.Begin(); record != reader.End(); record++, nanos += 1000)
+    {
+      analyticsService.OnTick(record->productIndex, SOURCE_PRICING, nanos, record->mid, (nanos & 1024) ? 1000000 : 0);
+    }
+    for(int p = 0; p < BOND_COUNT; p++, snapshots++)
+    {
+      sink = analyticsService.GetSnapshot(p).windows[WINDOW_5M].ewmaVolatility;
+    }
+    seconds = min(seconds, duration<double>(high_resolution_clock::now() - start).count());
+  }
+  printf("analytics    %11.0f ticks/s   %4.0f ns per tick over %d windows\n",
+    reader.GetCount() / seconds, seconds / reader.GetCount() * 1e9, ANALYTICS_WINDOWS);
+}
+
+// Counts closed bars without doing anything else with them
+class BarCounter : public ServiceListener<Bar>
+{
+public:
+  BarCounter() : bars(0) {}
+  virtual void ProcessAdd(Bar &data) { bars++; sink = data.close; }
+  virtual void ProcessRemove(Bar &data) {}
+  virtual void ProcessUpdate(Bar &data) {}
+  long bars;
+};
+
+// Replay a binary price feed into time, tick and volume bars as ticks a microsecond apart,
+// sized every other 1024 ticks, then again with the closed bars persisted to a bar file
+void MeasureBars(const char *path)
+{
+  BinaryFeedReader<PriceFeedRecord> reader(path);
+  for(int persist = 0; persist < 2; persist++)
+  {
+    double seconds = 1e9;
+    long bars = 0;
+    for(int run = 0; run < RUNS; run++)
+    {
+      BondBarService barService;
+      barService.AddSeries(TIME_BARS, 1000000000LL, BAR_SOURCE_PRICING);
+      barService.AddSeries(TICK_BARS, 100, BAR_SOURCE_PRICING);
+      barService.AddSeries(VOLUME_BARS, 100000000, BAR_SOURCE_PRICING);
+      BarCounter counter;
+      barService.AddListener(&counter);
+      BondBarHistoricalDataListener barFile("bench_bars.bin");
+      if(persist)
+      {
+        barService.AddListener(&barFile);
+      }
+
+      int64_t nanos = 0;
+      high_resolution_clock::time_point start = high_resolution_clock::now();
+      for(const PriceFeedRecord *record = reader.Begin(); record != reader.End(); record++, nanos += 1000)
+      {
+        barService.OnTick(record->productIndex, BAR_SOURCE_PRICING, nanos, record->mid, (nanos & 1024) ? 1000000 : 0);
+      }
+      barService.Flush();
+      barFile.Close();
+      seconds = min(seconds, duration<double>(high_resolution_clock::now() - start).count());
+      bars = counter.bars;
+    }
+    printf("bars%-8s %11.0f ticks/s   %4.0f ns per tick over 3 series, %ld bars\n", persist ? " to file" : "",
+      reader.GetCount() / seconds, seconds / reader.GetCount() * 1e9, bars);
+  }
+}
+
+int main(int argc, char *argv[])
+{
+  long lines = argc > 1 ? atol(argv[1]) : 1000000;
+
+  GeneratePriceFile("bench_price.txt", lines);
+  GenerateMarketDataFile("bench_marketdata.txt", lines);
+  GenerateTradeFile("bench_trades.txt", lines);
+  GenerateInquiryFile("bench_inquiries.txt", lines);
+
+  printf("CSV ingest, %ld lines per file\n", lines);
+  CompareIngest("prices", "bench_price.txt", 4, IngestPrices);
+  CompareIngest("marketdata", "bench_marketdata.txt", 3 + 3 * MARKET_DATA_DEPTH, IngestMarketData);
+  CompareIngest("trades", "bench_trades.txt", 6, IngestTrades);
+  CompareIngest("inquiries", "bench_inquiries.txt", 6, IngestInquiries);
+
+  ConvertFeedToBinary("price", "bench_price.txt", "bench_price.bin");
+  ConvertFeedToBinary("marketdata", "bench_marketdata.txt", "bench_marketdata.bin");
+  ConvertFeedToBinary("trade", "bench_trades.txt", "bench_trades.bin");
+  ConvertFeedToBinary("inquiry", "bench_inquiries.txt", "bench_inquiries.bin");
+
+  printf("\nBinary replay, %ld records per file\n", lines);
+  CompareReplay("prices", "bench_price.txt", "bench_price.bin", IngestPrices, ReplayPrices);
+  CompareReplay("marketdata", "bench_marketdata.txt", "bench_marketdata.bin", IngestMarketData, ReplayMarketData);
+  CompareReplay("trades", "bench_trades.txt", "bench_trades.bin", IngestTrades, ReplayTrades);
+  CompareReplay("inquiries", "bench_inquiries.txt", "bench_inquiries.bin", IngestInquiries, ReplayInquiries);
+
+  printf("\nPrice conflation, %ld prices\n", lines);
+  CompareConflation("bench_price.bin");
+
+  printf("\nVersioned price polling, %ld prices\n", lines);
+  MeasureVersionedPrices("bench_price.bin");
+
+  printf("\nOrder book update and copy, %ld books\n", lines);
+  CompareOrderBooks("bench_marketdata.bin");
+
+  printf("\nMarket data snapshots against level updates, %ld books\n", lines);
+  CompareBookUpdates("bench_marketdata.bin");
+
+  printf("\nTop of book reads, %ld reads\n", lines);
+  MeasureTopOfBook("bench_marketdata.bin", lines);
+
+  printf("\nAggregated depth, %ld books\n", lines);
+  MeasureAggregation("bench_marketdata.bin");
+
+  printf("\nBook across venues, %ld books\n", lines);
+  MeasureCompositeBook("bench_marketdata.bin");
+
+  printf("\nMicrostructure signals, %ld books\n", lines);
+  MeasureSignals("bench_marketdata.bin");
+
+  printf("\nIncremental feed handler, %ld books\n", lines);
+  MeasureFeedHandler("bench_marketdata.bin");
+
+  printf("\nOrder IDs, %ld IDs\n", lines);
+  MeasureOrderIds(lines);
+
+  printf("\nMatching engine, %ld requests\n", lines);
+  MeasureMatchingEngine(lines);
+
+  printf("\nSmart order routing, %ld books\n", lines);
+  MeasureRouter("bench_marketdata.bin");
+
+  printf("\nSliced parent orders on a timer wheel, 20000 ticks\n");
+  MeasureSlicing();
+
+  printf("\nOrder store, %ld order lifecycles\n", lines);
+  MeasureOrderStore(lines);
+
+  printf("\nPre-trade risk checks, %ld orders\n", lines);
+  MeasureRiskGate(lines);
+
+  printf("\nStop order triggers, %ld top of book updates\n", lines / 10);
+  MeasureStopTriggers(lines / 10);
+
+  printf("\nExecution analytics, %ld orders decided, sent and filled\n", lines / 10);
+  MeasureExecutionAnalytics(lines / 10);
+
+  printf("\nAlgo execution strategies, %ld books\n", lines);
+  MeasureStrategies(lines);
+
+  printf("\nFair value from market data, %ld books\n", lines);
+  MeasureFairValue("bench_marketdata.bin", lines);
+
+  printf("\nRolling price analytics, %ld ticks\n", lines);
+  MeasureAnalytics("bench_price.bin");
+
+  printf("\nOHLC bars, %ld ticks\n", lines);
+  MeasureBars("bench_price.bin");
+
+  return 0;
+}
@@ -0,0 +1,582 @@
+/**
+ * binaryfeed.hpp
+ * Fixed-width little-endian binary record formats for the price, market data, trade and
+ * inquiry feeds and for persisted bars, with converters to and from the text files.
+ *
+ * A binary feed file is a FeedFileHeader followed by recordCount records of one type.
+ * Every record is a multiple of eight bytes with naturally aligned fields, so a mapped
+ * file can be read as an array of records with no parsing at all.
+ */
+#ifndef BINARY_FEED_HPP
+#define BINARY_FEED_HPP
+
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <cmath>
+#include <stdint.h>
+
+#include "csvingest.hpp"
+
+#if !defined(__BYTE_ORDER__) || __BYTE_ORDER__ != __ORDER_LITTLE_ENDIAN__
+#error "binary feeds are read in place and need a little-endian host"
+#endif
+
+using namespace std;
+
+// Record types of a binary feed
+enum FeedRecordType { PRICE_FEED = 1, ORDER_BOOK_FEED = 2, TRADE_FEED = 3, INQUIRY_FEED = 4, BAR_FEED = 5 };
+
+/**
+ * Header at the start of every binary feed file.
+ */
+struct FeedFileHeader
+{
+  char magic[4];          // "BFD1"
+  uint32_t recordType;    // FeedRecordType
+  uint32_t recordSize;    // sizeof the record, checked on read
+  uint32_t reserved;
+  uint64_t recordCount;
+  uint64_t padding;
+};
+
+/**
+ * A price: mid and bid/offer spread for a product.
+ */
+struct PriceFeedRecord
+{
+  static const FeedRecordType TYPE = PRICE_FEED;
+
+  uint8_t productIndex;
+  uint8_t padding[7];
+  double mid;
+  double bidOfferSpread;
+};
+
+/**
+ * A five-level order book. Level i has a bid and an offer of the same quantity.
+ */
+struct OrderBookFeedRecord
+{
+  static const FeedRecordType TYPE = ORDER_BOOK_FEED;
+
+  uint8_t productIndex;
+  uint8_t padding[7];
+  double bidPrices[MARKET_DATA_DEPTH];
+  double offerPrices[MARKET_DATA_DEPTH];
+  int64_t quantities[MARKET_DATA_DEPTH];
+};
+
+/**
+ * A booked trade. Identifiers are NUL padded.
+ */
+struct TradeFeedRecord
+{
+  static const FeedRecordType TYPE = TRADE_FEED;
+
+  uint8_t productIndex;
+  uint8_t side;           // 0 BUY, 1 SELL
+  uint8_t padding[6];
+  char tradeId[24];
+  char book[8];
+  int64_t priceTicks;     // TickPrice ticks
+  int64_t quantity;
+  uint8_t reserved[8];
+};
+
+/**
+ * A customer inquiry. Identifiers are NUL padded.
+ */
+struct InquiryFeedRecord
+{
+  static const FeedRecordType TYPE = INQUIRY_FEED;
+
+  char inquiryId[24];
+  uint8_t productIndex;
+  uint8_t side;           // 0 BUY, 1 SELL
+  uint8_t state;          // InquiryState, RECEIVED = 0
+  uint8_t padding[5];
+  int64_t quantity;
+  double price;
+};
+
+/**
+ * A closed open/high/low/close bar of a product, as written by the bar service.
+ */
+struct BarFeedRecord
+{
+  static const FeedRecordType TYPE = BAR_FEED;
+
+  uint8_t productIndex;
+  uint8_t barType;        // BarType: 0 time, 1 tick, 2 volume
+  uint8_t series;         // id of the series in the bar service
+  uint8_t source;         // BarSource: 0 internal prices, 1 fills
+  uint32_t tickCount;
+  int64_t startNanos;     // tick clock of the first tick
+  int64_t endNanos;       // tick clock of the last tick
+  double open;
+  double high;
+  double low;
+  double close;
+  int64_t volume;
+};
+
+static_assert(sizeof(FeedFileHeader) == 32, "feed header layout");
+static_assert(sizeof(PriceFeedRecord) == 24, "price record layout");
+static_assert(sizeof(OrderBookFeedRecord) == 128, "order book record layout");
+static_assert(sizeof(TradeFeedRecord) == 64, "trade record layout");
+static_assert(sizeof(InquiryFeedRecord) == 48, "inquiry record layout");
+static_assert(sizeof(BarFeedRecord) == 64, "bar record layout");
+
+// Inquiry state names in InquiryState order
+inline const char* GetInquiryStateName(int state)
+{
+  static const char* names[] = { "RECEIVED", "QUOTED", "DONE", "REJECTED", "CUSTOMER_REJECTED" };
+  return state >= 0 && state < 5 ? names[state] : "";
+}
+
+// Get the InquiryState index of a state name, or -1
+inline int GetInquiryStateIndex(const CsvField &name)
+{
+  for(int state = 0; state < 5; state++)
+  {
+    if(name.Equals(GetInquiryStateName(state)))
+    {
+      return state;
+    }
+  }
+  return -1;
+}
+
+/**
+ * Read-only view of a binary feed file as an array of records of type R.
+ */
+template<typename R>
+class BinaryFeedReader
+{
+
+public:
+
+  // ctor mapping the feed at the given path
+  BinaryFeedReader(const char *path);
+
+  // Was the file found, with a header matching R?
+  bool IsValid() const;
+
+  // Get the number of records
+  size_t GetCount() const;
+
+  // Get the first record
+  const R* Begin() const;
+
+  // Get one past the last record
+  const R* End() const;
+
+private:
+  MappedFile file;
+  const R *records;
+  size_t count;
+
+};
+
+template<typename R>
+BinaryFeedReader<R>::BinaryFeedReader(const char *path) : file(path), records(0), count(0)
+{
+  if(file.GetSize() < sizeof(FeedFileHeader))
+  {
+    return;
+  }
+
+  const FeedFileHeader *header = reinterpret_cast<const FeedFileHeader*>(file.GetData());
+  size_t available = (file.GetSize() - sizeof(FeedFileHeader)) / sizeof(R);
+  if(memcmp(header->magic, "BFD1", 4) == 0 && header->recordType == R::TYPE && header->recordSize == sizeof(R))
+  {
+    records = reinterpret_cast<const R*>(file.GetData() + sizeof(FeedFileHeader));
+    count = header->recordCount < available ? header->recordCount : available;
+  }
+}
+
+template<typename R>
+bool BinaryFeedReader<R>::IsValid() const
+{
+  return records != 0;
+}
+
+template<typename R>
+size_t BinaryFeedReader<R>::GetCount() const
+{
+  return count;
+}
+
+template<typename R>
+const R* BinaryFeedReader<R>::Begin() const
+{
+  return records;
+}
+
+template<typename R>
+const R* BinaryFeedReader<R>::End() const
+{
+  return records + count;
+}
+
+/**
+ * Writes records of type R to a binary feed file.
+ * The record count in the header is filled in on Close.
+ */
+template<typename R>
+class BinaryFeedWriter
+{
+
+public:
+
+  // ctor creating the feed at the given path
+  BinaryFeedWriter(const char *path);
+
+  ~BinaryFeedWriter();
+
+  // Was the file created?
+  bool IsValid() const;
+
+  // Append a record
+  void Write(const R &record);
+
+  // Write the header and close the file
+  void Close();
+
+private:
+  BinaryFeedWriter(const BinaryFeedWriter &);
+  BinaryFeedWriter& operator=(const BinaryFeedWriter &);
+
+  FILE *file;
+  uint64_t count;
+
+};
+
+template<typename R>
+BinaryFeedWriter<R>::BinaryFeedWriter(const char *path) : count(0)
+{
+  file = fopen(path, "wb");
+  if(file != 0)
+  {
+    FeedFileHeader header = FeedFileHeader();
+    fwrite(&header, sizeof(header), 1, file);
+  }
+}
+
+template<typename R>
+BinaryFeedWriter<R>::~BinaryFeedWriter()
+{
+  Close();
+}
+
+template<typename R>
+bool BinaryFeedWriter<R>::IsValid() const
+{
+  return file != 0;
+}
+
+template<typename R>
+void BinaryFeedWriter<R>::Write(const R &record)
+{
+  fwrite(&record, sizeof(R), 1, file);
+  count++;
+}
+
+template<typename R>
+void BinaryFeedWriter<R>::Close()
+{
+  if(file == 0)
+  {
+    return;
+  }
+
+  FeedFileHeader header = FeedFileHeader();
+  memcpy(header.magic, "BFD1", 4);
+  header.recordType = R::TYPE;
+  header.recordSize = sizeof(R);
+  header.recordCount = count;
+  fseek(file, 0, SEEK_SET);
+  fwrite(&header, sizeof(header), 1, file);
+  fclose(file);
+  file = 0;
+}
+
+// Copy a field into a NUL padded identifier, failing if it does not fit
+inline bool CopyIdentifier(char *target, size_t size, const CsvField &field)
+{
+  if(field.Length() >= size)
+  {
+    return false;
+  }
+  memset(target, 0, size);
+  memcpy(target, field.begin, field.Length());
+  return true;
+}
+
+// Length of a NUL padded identifier
+inline size_t IdentifierLength(const char *identifier, size_t size)
+{
+  const char *end = static_cast<const char*>(memchr(identifier, '\0', size));
+  return end == 0 ? size : end - identifier;
+}
+
+// Format a double with the fewest digits that read back to the same value, as Python's str does.
+// Exponent forms such as 1e+02 are passed over while more precision can still spell the number out.
+inline int FormatShortest(char *buffer, size_t size, double value)
+{
+  int length = 0;
+  for(int precision = 1; precision <= 17; precision++)
+  {
+    length = snprintf(buffer, size, "%.*g", precision, value);
+    if(strtod(buffer, 0) == value && (precision == 17 || strchr(buffer, 'e') == 0))
+    {
+      break;
+    }
+  }
+  return length;
+}
+
+inline bool ToFeedRecord(const PriceRecord &record, PriceFeedRecord &feedRecord)
+{
+  feedRecord = PriceFeedRecord();
+  feedRecord.productIndex = record.productIndex;
+  feedRecord.mid = record.mid;
+  feedRecord.bidOfferSpread = record.bidOfferSpread;
+  return true;
+}
+
+inline bool ToFeedRecord(const MarketDataRecord &record, OrderBookFeedRecord &feedRecord)
+{
+  feedRecord = OrderBookFeedRecord();
+  feedRecord.productIndex = record.productIndex;
+  for(int i = 0; i<MARKET_DATA_DEPTH; i++)
+  {
+    feedRecord.bidPrices[i] = record.bidPrices[i];
+    feedRecord.offerPrices[i] = record.offerPrices[i];
+    feedRecord.quantities[i] = record.quantities[i];
+  }
+  return true;
+}
+
+inline bool ToFeedRecord(const TradeRecord &record, TradeFeedRecord &feedRecord)
+{
+  feedRecord = TradeFeedRecord();
+  feedRecord.productIndex = record.productIndex;
+  feedRecord.side = record.isBuy ? 0 : 1;
+  feedRecord.priceTicks = record.price.GetTicks();
+  feedRecord.quantity = record.quantity;
+  return CopyIdentifier(feedRecord.tradeId, sizeof(feedRecord.tradeId), record.tradeId)
+    && CopyIdentifier(feedRecord.book, sizeof(feedRecord.book), record.book);
+}
+
+inline bool ToFeedRecord(const InquiryRecord &record, InquiryFeedRecord &feedRecord)
+{
+  feedRecord = InquiryFeedRecord();
+  int state = GetInquiryStateIndex(record.state);
+  feedRecord.productIndex = record.productIndex;
+  feedRecord.side = record.isBuy ? 0 : 1;
+  feedRecord.state = state < 0 ? 0 : state;
+  feedRecord.quantity = record.quantity;
+  feedRecord.price = record.price;
+  return CopyIdentifier(feedRecord.inquiryId, sizeof(feedRecord.inquiryId), record.inquiryId);
+}
+
+// A record read from a file is only used if its product, side and state are ones the text
+// feeds would have parsed, so that a corrupt or truncated file cannot index past the end
+// of the per-product tables
+inline bool IsValidFeedRecord(const PriceFeedRecord &record)
+{
+  return record.productIndex < BOND_COUNT;
+}
+
+inline bool IsValidFeedRecord(const OrderBookFeedRecord &record)
+{
+  return record.productIndex < BOND_COUNT;
+}
+
+inline bool IsValidFeedRecord(const TradeFeedRecord &record)
+{
+  return record.productIndex < BOND_COUNT && record.side <= 1;
+}
+
+inline bool IsValidFeedRecord(const InquiryFeedRecord &record)
+{
+  return record.productIndex < BOND_COUNT && record.side <= 1 && GetInquiryStateName(record.state)[0] != 0;
+}
+
+inline bool IsValidFeedRecord(const BarFeedRecord &record)
+{
+  return record.productIndex < BOND_COUNT && record.barType < 3 && record.source < 2;
+}
+
+// Write a record back out as a line of its text file, returning the length of the line
+inline int FormatFeedRecord(char *line, size_t size, const PriceFeedRecord &record)
+{
+  char mid[32], spread[32];
+  FormatShortest(mid, sizeof(mid), record.mid);
+  FormatShortest(spread, sizeof(spread), record.bidOfferSpread);
+  return snprintf(line, size, "%s,%s,%s,%s\n", GetBondTenor(record.productIndex), GetBondCusip(record.productIndex), mid, spread);
+}
+
+inline int FormatFeedRecord(char *line, size_t size, const OrderBookFeedRecord &record)
+{
+  int length = snprintf(line, size, "%s,first,%s", GetBondTenor(record.productIndex), GetBondCusip(record.productIndex));
+  for(int i = 0; i<MARKET_DATA_DEPTH; i++)
+  {
+    char bid[32], offer[32];
+    FormatShortest(bid, sizeof(bid), record.bidPrices[i]);
+    FormatShortest(offer, sizeof(offer), record.offerPrices[i]);
+    length += snprintf(line + length, size - length, ",%s,%s,%lld", bid, offer, (long long)record.quantities[i]);
+  }
+  return length + snprintf(line + length, size - length, "\n");
+}
+
+inline int FormatFeedRecord(char *line, size_t size, const TradeFeedRecord &record)
+{
+  char price[24];
+  TickPrice::FromTicks(record.priceTicks).Format(price);
+  return snprintf(line, size, "%s,%.*s,%s,%.*s,%lld,%s\n", GetBondTenor(record.productIndex),
+    int(IdentifierLength(record.tradeId, sizeof(record.tradeId))), record.tradeId, price,
+    int(IdentifierLength(record.book, sizeof(record.book))), record.book,
+    (long long)record.quantity, record.side == 0 ? "BUY" : "SELL");
+}
+
+inline int FormatFeedRecord(char *line, size_t size, const InquiryFeedRecord &record)
+{
+  char price[32];
+  FormatShortest(price, sizeof(price), record.price);
+  return snprintf(line, size, "%.*s,%s,%s,%lld,%s,%s\n",
+    int(IdentifierLength(record.inquiryId, sizeof(record.inquiryId))), record.inquiryId,
+    GetBondTenor(record.productIndex), record.side == 0 ? "BUY" : "SELL",
+    (long long)record.quantity, price, GetInquiryStateName(record.state));
+}
+
+inline int FormatFeedRecord(char *line, size_t size, const BarFeedRecord &record)
+{
+  static const char* barTypes[] = { "TIME", "TICK", "VOLUME" };
+  static const char* sources[] = { "PRICING", "FILLS" };
+  char open[32], high[32], low[32], close[32];
+  FormatShortest(open, sizeof(open), record.open);
+  FormatShortest(high, sizeof(high), record.high);
+  FormatShortest(low, sizeof(low), record.low);
+  FormatShortest(close, sizeof(close), record.close);
+  return snprintf(line, size, "%s,%s,%s,%u,%s,%lld,%lld,%s,%s,%s,%s,%lld,%u\n", GetBondTenor(record.productIndex),
+    GetBondCusip(record.productIndex), record.barType < 3 ? barTypes[record.barType] : "", record.series,
+    record.source < 2 ? sources[record.source] : "", (long long)record.startNanos, (long long)record.endNanos, open, high, low, close,
+    (long long)record.volume, record.tickCount);
+}
+
+// Convert a text feed to binary. Text is parsed with TextRecord and fieldCount fields per line,
+// lines that do not parse are skipped. Returns the number of records written, or -1.
+template<typename TextRecord, typename FeedRecord>
+long ConvertToBinary(const char *textPath, const char *binaryPath, int fieldCount,
+  bool (*parse)(const CsvField*, int, TextRecord&))
+{
+  MappedFile file(textPath);
+  BinaryFeedWriter<FeedRecord> writer(binaryPath);
+  if(!writer.IsValid())
+  {
+    return -1;
+  }
+
+  CsvReader reader(file.GetData(), file.GetSize());
+  vector<CsvField> fields(fieldCount);
+  int count;
+  TextRecord record;
+  FeedRecord feedRecord;
+  long written = 0;
+  while(reader.NextLine(&fields[0], fieldCount, count))
+  {
+    if(parse(&fields[0], count, record) && ToFeedRecord(record, feedRecord))
+    {
+      writer.Write(feedRecord);
+      written++;
+    }
+  }
+  writer.Close();
+  return written;
+}
+
+// Convert a binary feed back to text, skipping records that are not valid. Returns the
+// number of lines written, or -1.
+template<typename FeedRecord>
+long ConvertToText(const char *binaryPath, const char *textPath)
+{
+  BinaryFeedReader<FeedRecord> reader(binaryPath);
+  if(!reader.IsValid())
+  {
+    return -1;
+  }
+
+  FILE *file = fopen(textPath, "w");
+  if(file == 0)
+  {
+    return -1;
+  }
+
+  char line[512];
+  long written = 0;
+  for(const FeedRecord *record = reader.Begin(); record != reader.End(); record++)
+  {
+    if(!IsValidFeedRecord(*record))
+    {
+      continue;
+    }
+    written++;
+    int length = FormatFeedRecord(line, sizeof(line), *record);
+    fwrite(line, 1, length, file);
+  }
+  fclose(file);
+  return written;
+}
+
+// Convert the text feed of a record type ("price", "marketdata", "trade" or "inquiry") to binary
+inline long ConvertFeedToBinary(const string &type, const char *textPath, const char *binaryPath)
+{
+  if(type == "price")
+  {
+    return ConvertToBinary<PriceRecord, PriceFeedRecord>(textPath, binaryPath, 4, ParsePriceRecord);
+  }
+  else if(type == "marketdata")
+  {
+    return ConvertToBinary<MarketDataRecord, OrderBookFeedRecord>(textPath, binaryPath, 3 + 3 * MARKET_DATA_DEPTH, ParseMarketDataRecord);
+  }
+  else if(type == "trade")
+  {
+    return ConvertToBinary<TradeRecord, TradeFeedRecord>(textPath, binaryPath, 6, ParseTradeRecord);
+  }
+  else if(type == "inquiry")
+  {
+    return ConvertToBinary<InquiryRecord, InquiryFeedRecord>(textPath, binaryPath, 6, ParseInquiryRecord);
+  }
+  return -1;
+}
+
+// Convert the binary feed of a record type, or a bar file ("bar"), back to text
+inline long ConvertFeedToText(const string &type, const char *binaryPath, const char *textPath)
+{
+  if(type == "price")
+  {
+    return ConvertToText<PriceFeedRecord>(binaryPath, textPath);
+  }
+  else if(type == "marketdata")
+  {
+    return ConvertToText<OrderBookFeedRecord>(binaryPath, textPath);
+  }
+  else if(type == "trade")
+  {
+    return ConvertToText<TradeFeedRecord>(binaryPath, textPath);
+  }
+  else if(type == "inquiry")
+  {
+    return ConvertToText<InquiryFeedRecord>(binaryPath, textPath);
+  }
+  else if(type == "bar")
+  {
+    return ConvertToText<BarFeedRecord>(binaryPath, textPath);
+  }
+  return -1;
+}
+
+#endif
@@ -0,0 +1,106 @@
+/**
+ * bondreferencedata.hpp
+ * Reference data for the on-the-run treasuries traded by the system.
+ * Products are identified by a small dense index so that services can keep
+ * per-product state in flat arrays instead of string keyed maps.
+ */
+#ifndef BOND_REFERENCE_DATA_HPP
+#define BOND_REFERENCE_DATA_HPP
+
+#include <string>
+
+#include "products.hpp"
+
+using namespace std;
+
+// Number of on-the-run bonds, indexed 2Y, 3Y, 5Y, 7Y, 10Y, 30Y
+const int BOND_COUNT = 6;
+
+// Tenor of the bond at a product index
+inline const char* GetBondTenor(int index)
+{
+  static const char* tenors[BOND_COUNT] = { "2Y", "3Y", "5Y", "7Y", "10Y", "30Y" };
+  return tenors[index];
+}
+
+// CUSIP of the bond at a product index
+inline const char* GetBondCusip(int index)
+{
+  static const char* cusips[BOND_COUNT] = { "912828F62", "9128283G3", "9128283C2", "9128283D0", "9128283F5", "912810RZ3" };
+  return cusips[index];
+}
+
+// Get the product index for a tenor such as "10Y", or -1 if it is not traded
+inline int GetBondIndex(const char* tenor, size_t length)
+{
+  if(length == 2 && tenor[1] == 'Y')
+  {
+    switch(tenor[0])
+    {
+      case '2': return 0;
+      case '3': return 1;
+      case '5': return 2;
+      case '7': return 3;
+    }
+  }
+  else if(length == 3 && tenor[1] == '0' && tenor[2] == 'Y')
+  {
+    switch(tenor[0])
+    {
+      case '1': return 4;
+      case '3': return 5;
+    }
+  }
+  return -1;
+}
+
+inline int GetBondIndex(const string &tenor)
+{
+  return GetBondIndex(tenor.data(), tenor.size());
+}
+
+// Get the bond at a product index. The bonds are built once and shared.
+inline const Bond& GetReferenceBond(int index)
+{
+  static const Bond bonds[BOND_COUNT] = {
+    Bond("2Y", CUSIP, "T", 0.015, date(2019,Oct,31)),
+    Bond("3Y", CUSIP, "T", 0.0175, date(2020,Nov,15)),
+    Bond("5Y", CUSIP, "T", 0.02, date(2022,Oct,31)),
+    Bond("7Y", CUSIP, "T", 0.0225, date(2024,Oct,31)),
+    Bond("10Y", CUSIP, "T", 0.0225, date(2027,Nov,15)),
+    Bond("30Y", CUSIP, "T", 0.0275, date(2047,Nov,15))
+  };
+  return bonds[index];
+}
+
+// Get the product of type T at a product index, for types that hold a product by its index
+template<typename T>
+const T& GetReferenceProduct(int index);
+
+template<>
+inline const Bond& GetReferenceProduct<Bond>(int index)
+{
+  return GetReferenceBond(index);
+}
+
+// Number of trading books trades are booked into, indexed TRSY1, TRSY2, TRSY3
+const int BOOK_COUNT = 3;
+
+// Name of the book at a book index
+inline const char* GetBookName(int index)
+{
+  static const char* books[BOOK_COUNT] = { "TRSY1", "TRSY2", "TRSY3" };
+  return books[index];
+}
+
+// Get the book index for a book name, or -1 if it is not one of the books
+inline int GetBookIndex(const string &book)
+{
+  if(book.size() == 5 && book.compare(0, 4, "TRSY") == 0 && book[4] >= '1' && book[4] < '1' + BOOK_COUNT)
+  {
+    return book[4] - '1';
+  }
+  return -1;
+}
+
+#endif
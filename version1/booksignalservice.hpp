@@ -0,0 +1,257 @@
+/**
+ * booksignalservice.hpp
+ * Defines the data types and Service for order book microstructure signals.
+ *
+ * On every book update the service recomputes, for the product, the depth imbalance and
+ * depth weighted spread over the five levels of each side, as fixed length loops over
+ * the level arrays that the compiler can vectorise. It also updates decayed rates of the
+ * size taken off the touch (queue depletion) and of touch changes, in O(1) from the touch
+ * of the book before. The signals go to the listeners after each update.
+ */
+#ifndef BOOK_SIGNAL_SERVICE_HPP
+#define BOOK_SIGNAL_SERVICE_HPP
+
+#include <vector>
+#include <cmath>
+#include <stdint.h>
+
+#include "soa.hpp"
+#include "bondreferencedata.hpp"
+#include "marketdataservice.hpp"
+#include "priceanalyticsservice.hpp"
+
+using namespace std;
+
+/**
+ * Microstructure signals of a product after a book update.
+ */
+struct BookSignals
+{
+  int productIndex;
+  int64_t timestamp;          // tick clock of the update, in nanoseconds
+  long updates;               // book updates seen
+  double imbalance;           // bid size / total size over every level, 0.5 when balanced
+  double touchImbalance;      // bid size / total size at the touch
+  double depthWeightedSpread; // size weighted offer - size weighted bid
+  double bidDepletionRate;    // size taken off the best bid per second, decayed
+  double offerDepletionRate;  // size taken off the best offer per second, decayed
+  double topChangeRate;       // changes of the touch per second, decayed
+};
+
+class BondBookSignalService
+{
+
+public:
+
+  // ctor; rates decay with a time constant of decayNanos on the tick clock. With a market
+  // data service the touch is read from its top of book, and is otherwise found from each
+  // book.
+  BondBookSignalService(int64_t _decayNanos = 1000000000LL, const BondMarketDataService *_marketData = 0);
+
+  // Update the signals of a product from its latest book, at a time in nanoseconds, and
+  // publish them to the listeners
+  void OnBook(const BondOrderBook &book, int64_t nanos);
+
+  // Compute the imbalance and depth weighted spread of a book, which need no history.
+  // Returns false for a book without both sides.
+  static bool ComputeDepthSignals(const BondOrderBook &book, BookSignals &signals);
+
+  // Get the latest signals of a product. Call from the thread delivering market data.
+  const BookSignals& GetSignals(int productIndex) const;
+
+  // Get the latest signals of a product
+  virtual BookSignals& GetData(string key);
+
+  // Add a listener to the Service for callbacks on add, remove, and update events
+  // for data to the Service.
+  virtual void AddListener(ServiceListener<BookSignals> *listener);
+
+  // Get all listeners on the Service.
+  virtual const vector< ServiceListener<BookSignals>* >& GetListeners() const;
+
+private:
+
+  // History of a product that the rates are updated from
+  struct SignalState
+  {
+    TopOfBook lastTop;
+    int64_t lastNanos;          // -1 before the first update
+    double bidDepleted;         // decayed sums
+    double offerDepleted;
+    double topChanges;
+  };
+
+  const BondMarketDataService *marketData;
+  double decayRate;           // 1 / time constant, per nanosecond
+  double ratePerSecond;       // decayed sum to rate per second
+  SignalState states[BOND_COUNT];
+  BookSignals signals[BOND_COUNT];
+  BookSignals emptySignals;
+  vector< ServiceListener<BookSignals>* > SignalListeners;
+
+};
+
+BondBookSignalService::BondBookSignalService(int64_t _decayNanos, const BondMarketDataService *_marketData) :
+  marketData(_marketData)
+{
+  _decayNanos = _decayNanos > 0 ? _decayNanos : 1;
+  decayRate = 1.0 / _decayNanos;
+  ratePerSecond = 1e9 / _decayNanos;
+  for(int p = 0; p<BOND_COUNT; p++)
+  {
+    states[p] = SignalState();
+    states[p].lastNanos = -1;
+    signals[p] = BookSignals();
+    signals[p].productIndex = p;
+    signals[p].imbalance = 0.5;
+    signals[p].touchImbalance = 0.5;
+  }
+  emptySignals = BookSignals();
+  emptySignals.productIndex = -1;
+}
+
+void BondBookSignalService::OnBook(const BondOrderBook &book, int64_t nanos)
+{
+  int index = book.GetProductIndex();
+  if(index < 0 || index >= BOND_COUNT)
+  {
+    return;
+  }
+
+  SignalState &state = states[index];
+  BookSignals &signal = signals[index];
+  ComputeDepthSignals(book, signal);
+  TopOfBook top = marketData ? marketData->GetTopOfBook(index) : GetTopOfBook(book);
+
+  // Size taken off a touch that stayed at its price, or the whole queue of a touch that
+  // moved away from the other side. A touch that improved took nothing.
+  double bidDepleted = 0, offerDepleted = 0, topChanged = 0;
+  const TopOfBook &last = state.lastTop;
+  if(state.lastNanos >= 0)
+  {
+    if(last.bidLevel >= 0)
+    {
+      bidDepleted = top.bidLevel < 0 || top.bid < last.bid ? last.bidSize
+        : top.bid == last.bid && top.bidSize < last.bidSize ? last.bidSize - top.bidSize : 0;
+    }
+    if(last.offerLevel >= 0)
+    {
+      offerDepleted = top.offerLevel < 0 || top.offer > last.offer ? last.offerSize
+        : top.offer == last.offer && top.offerSize < last.offerSize ? last.offerSize - top.offerSize : 0;
+    }
+    topChanged = top.IsSameTouch(last) ? 0 : 1;
+  }
+
+  // One decay for every rate: each decayed sum falls by the time elapsed, then takes this
+  // update. A late update from another clock is counted without decay.
+  int64_t elapsed = state.lastNanos < 0 || nanos < state.lastNanos ? 0 : nanos - state.lastNanos;
+  double decay = exp(-elapsed * decayRate);
+  state.bidDepleted = state.bidDepleted * decay + bidDepleted;
+  state.offerDepleted = state.offerDepleted * decay + offerDepleted;
+  state.topChanges = state.topChanges * decay + topChanged;
+  state.lastTop = top;
+  state.lastNanos = nanos > state.lastNanos ? nanos : state.lastNanos;
+
+  double touchSize = top.bidSize + top.offerSize;
+  signal.timestamp = nanos;
+  signal.updates++;
+  signal.touchImbalance = touchSize > 0 ? top.bidSize / touchSize : 0.5;
+  signal.bidDepletionRate = state.bidDepleted * ratePerSecond;
+  signal.offerDepletionRate = state.offerDepleted * ratePerSecond;
+  signal.topChangeRate = state.topChanges * ratePerSecond;
+
+  for(int i = 0; i<SignalListeners.size(); i++)
+  {
+    SignalListeners[i]->ProcessAdd(signal);
+  }
+}
+
+bool BondBookSignalService::ComputeDepthSignals(const BondOrderBook &book, BookSignals &signals)
+{
+  const int DEPTH = BondOrderBook::DEPTH;
+  const array<TickPrice, DEPTH> &bidPrices = book.GetBidPrices();
+  const array<long, DEPTH> &bidSizes = book.GetBidSizes();
+  const array<TickPrice, DEPTH> &offerPrices = book.GetOfferPrices();
+  const array<long, DEPTH> &offerSizes = book.GetOfferSizes();
+  int bidLevels = book.GetBidLevels(), offerLevels = book.GetOfferLevels();
+
+  // Whole-depth loops, with levels past the end of a side weighted zero, so that there is
+  // no data dependent branch to stop the compiler vectorising them
+  double bidNotional = 0, bidSize = 0, offerNotional = 0, offerSize = 0;
+  for(int i = 0; i<DEPTH; i++)
+  {
+    double bidWeight = i < bidLevels ? double(bidSizes[i]) : 0.0;
+    double offerWeight = i < offerLevels ? double(offerSizes[i]) : 0.0;
+    bidNotional += double(bidPrices[i].GetTicks()) * bidWeight;
+    bidSize += bidWeight;
+    offerNotional += double(offerPrices[i].GetTicks()) * offerWeight;
+    offerSize += offerWeight;
+  }
+  if(bidSize <= 0 || offerSize <= 0)
+  {
+    signals.imbalance = 0.5;
+    signals.depthWeightedSpread = 0;
+    return false;
+  }
+
+  signals.imbalance = bidSize / (bidSize + offerSize);
+  signals.depthWeightedSpread = (offerNotional / offerSize - bidNotional / bidSize) * TickPrice::TICK_SIZE;
+  return true;
+}
+
+const BookSignals& BondBookSignalService::GetSignals(int productIndex) const
+{
+  return productIndex < 0 || productIndex >= BOND_COUNT ? emptySignals : signals[productIndex];
+}
+
+BookSignals& BondBookSignalService::GetData(string key)
+{
+  int index = GetBondIndex(key);
+  return index < 0 ? emptySignals : signals[index];
+}
+
+void BondBookSignalService::AddListener(ServiceListener<BookSignals> *listener)
+{
+  SignalListeners.push_back(listener);
+}
+
+const vector< ServiceListener<BookSignals>* >& BondBookSignalService::GetListeners() const
+{
+  return SignalListeners;
+}
+
+
+/**
+ * Feeds every book, whole or updated, into the signals at the time it arrives.
+ */
+class BondMarketDataSignalServiceListener : public ServiceListener< BondOrderBook >
+{
+  public:
+
+    BondMarketDataSignalServiceListener(BondBookSignalService* SignalService_):SignalService(SignalService_){};
+
+  // Listener callback to process an add event to the Service
+  virtual void ProcessAdd(BondOrderBook &data)
+  {
+    SignalService->OnBook(data, BondPriceAnalyticsService::Now());
+  }
+
+  // Listener callback to process a remove event to the Service
+  virtual void ProcessRemove(BondOrderBook &data)
+  {
+
+  }
+
+  // Listener callback to process an update event to the Service
+  virtual void ProcessUpdate(BondOrderBook &data)
+  {
+    ProcessAdd(data);
+  }
+
+  private:
+
+  BondBookSignalService* SignalService;
+
+};
+
+#endif
@@ -0,0 +1,530 @@
+/**
+ * csvingest.hpp
+ * Zero-copy ingest of the comma separated input files (price.txt, marketdata_backup.txt,
+ * trades.txt and inquiries.txt).
+ *
+ * Files are memory mapped and read sequentially. Newlines and commas are found sixteen
+ * bytes at a time with SSE2, fields are handed out as views into the mapping and numbers
+ * are parsed straight into preallocated records without building any strings.
+ */
+#ifndef CSV_INGEST_HPP
+#define CSV_INGEST_HPP
+
+#include <string>
+#include <cstring>
+#include <cstdlib>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "bondreferencedata.hpp"
+#include "tickprice.hpp"
+
+using namespace std;
+
+// Number of levels on each side of a market data line
+const int MARKET_DATA_DEPTH = 5;
+
+// Number of readable bytes guaranteed past the end of the input, so that the parsers
+// can load whole words without checking where a field ends
+const size_t CSV_PADDING = 32;
+
+/**
+ * A read-only memory mapping of a whole file, followed by at least CSV_PADDING zero bytes.
+ * A missing or empty file maps to an empty range.
+ */
+class MappedFile
+{
+
+public:
+
+  // ctor mapping the file at the given path
+  MappedFile(const char *path);
+
+  ~MappedFile();
+
+  // Get the first byte of the file
+  const char* GetData() const;
+
+  // Get the size of the file in bytes
+  size_t GetSize() const;
+
+private:
+  MappedFile(const MappedFile &);
+  MappedFile& operator=(const MappedFile &);
+
+  const char *data;
+  size_t size;
+  size_t reserved;
+
+};
+
+MappedFile::MappedFile(const char *path) : data(0), size(0), reserved(0)
+{
+  int fd = open(path, O_RDONLY);
+  if(fd < 0)
+  {
+    return;
+  }
+
+  struct stat info;
+  if(fstat(fd, &info) == 0 && info.st_size > 0)
+  {
+    // reserve zeroed pages for the padding, then map the file over the start of them
+    size_t pageSize = sysconf(_SC_PAGESIZE);
+    size_t length = ((info.st_size + CSV_PADDING + pageSize - 1) / pageSize) * pageSize;
+    void *region = mmap(0, length, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if(region != MAP_FAILED)
+    {
+      void *mapping = mmap(region, info.st_size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0);
+      if(mapping != MAP_FAILED)
+      {
+        madvise(mapping, info.st_size, MADV_SEQUENTIAL);
+        data = static_cast<const char*>(mapping);
+        size = info.st_size;
+        reserved = length;
+      }
+      else
+      {
+        munmap(region, length);
+      }
+    }
+  }
+  close(fd);
+}
+
+MappedFile::~MappedFile()
+{
+  if(data != 0)
+  {
+    munmap(const_cast<char*>(data), reserved);
+  }
+}
+
+const char* MappedFile::GetData() const
+{
+  return data;
+}
+
+size_t MappedFile::GetSize() const
+{
+  return size;
+}
+
+/**
+ * A field of a line, as a view into the mapped file.
+ * The number parsers may read up to CSV_PADDING bytes past the end of a field.
+ */
+struct CsvField
+{
+  const char *begin;
+  const char *end;
+
+  size_t Length() const { return end - begin; }
+
+  bool Equals(const char *text) const
+  {
+    size_t length = strlen(text);
+    return Length() == length && memcmp(begin, text, length) == 0;
+  }
+
+  string ToString() const { return string(begin, end); }
+};
+
+/**
+ * Splits a range of bytes into lines and comma separated fields.
+ * The range must be followed by CSV_PADDING readable bytes, as a MappedFile is.
+ */
+class CsvReader
+{
+
+public:
+
+  // ctor over the bytes in [_begin, _begin + _size)
+  CsvReader(const char *_begin, size_t _size);
+
+  // Split the next line into at most maxFields fields, ignoring any further fields.
+  // An empty line yields no fields. Returns false once the input is exhausted.
+  bool NextLine(CsvField *fields, int maxFields, int &fieldCount);
+
+private:
+  const char *cursor;
+  const char *end;
+
+};
+
+CsvReader::CsvReader(const char *_begin, size_t _size) : cursor(_begin), end(_begin + _size)
+{
+}
+
+bool CsvReader::NextLine(CsvField *fields, int maxFields, int &fieldCount)
+{
+  if(cursor >= end)
+  {
+    return false;
+  }
+
+  const char *fieldBegin = cursor;
+  const char *p = cursor;
+  const char *lineEnd = end;
+  int count = 0;
+
+#ifdef __SSE2__
+  const __m128i commas = _mm_set1_epi8(',');
+  const __m128i newlines = _mm_set1_epi8('\n');
+
+  while(p + 16 <= end && lineEnd == end)
+  {
+    __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    unsigned int commaMask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, commas));
+    unsigned int newlineMask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, newlines));
+
+    // only the commas before the first newline belong to this line
+    if(newlineMask != 0)
+    {
+      commaMask &= (newlineMask & -newlineMask) - 1;
+      lineEnd = p + __builtin_ctz(newlineMask);
+    }
+
+    while(commaMask != 0)
+    {
+      const char *hit = p + __builtin_ctz(commaMask);
+      if(count < maxFields)
+      {
+        fields[count].begin = fieldBegin;
+        fields[count].end = hit;
+        count++;
+      }
+      fieldBegin = hit + 1;
+      commaMask &= commaMask - 1;
+    }
+    p += 16;
+  }
+#endif
+
+  if(lineEnd == end)
+  {
+    for(; p < end; p++)
+    {
+      if(*p == '\n')
+      {
+        lineEnd = p;
+        break;
+      }
+      if(*p == ',')
+      {
+        if(count < maxFields)
+        {
+          fields[count].begin = fieldBegin;
+          fields[count].end = p;
+          count++;
+        }
+        fieldBegin = p + 1;
+      }
+    }
+  }
+
+  cursor = lineEnd == end ? end : lineEnd + 1;
+
+  // the last field runs to the end of the line, without any carriage return
+  const char *lastEnd = lineEnd;
+  if(lastEnd > fieldBegin && lastEnd[-1] == '\r')
+  {
+    lastEnd--;
+  }
+  if(count == 0 && lastEnd == fieldBegin)
+  {
+    fieldCount = 0;
+    return true;
+  }
+  if(count < maxFields)
+  {
+    fields[count].begin = fieldBegin;
+    fields[count].end = lastEnd;
+    count++;
+  }
+  fieldCount = count;
+  return true;
+}
+
+// Digits are converted eight at a time from a little-endian word of characters, which
+// may read past the end of a field; see CSV_PADDING.
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define CSV_SWAR_DIGITS 1
+#endif
+
+// Eight '0' characters packed into a word
+const uint64_t ZERO_DIGITS = 0x3030303030303030ULL;
+
+// Check that the eight characters packed into a word are all digits
+inline bool IsEightDigits(uint64_t chunk)
+{
+  return (((chunk & 0xF0F0F0F0F0F0F0F0ULL) | (((chunk + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4)) == 0x3333333333333333ULL);
+}
+
+// Convert the eight digits packed into a word, most significant digit first
+inline uint32_t ParseEightDigits(uint64_t chunk)
+{
+  const uint64_t mask = 0x000000FF000000FFULL;
+  const uint64_t mul1 = 100 + (1000000ULL << 32);
+  const uint64_t mul2 = 1 + (10000ULL << 32);
+  chunk -= ZERO_DIGITS;
+  chunk = (chunk * 10) + (chunk >> 8);
+  return uint32_t((((chunk & mask) * mul1) + (((chunk >> 16) & mask) * mul2)) >> 32);
+}
+
+// Mask of the low bits of a word, for any count from 0 to 64 inclusive, without branching
+inline uint64_t LowBitMask(int bits)
+{
+  return ((1ULL << (bits / 2)) << (bits - bits / 2)) - 1;
+}
+
+// Load n <= 8 characters into a word with leading '0' padding, so 99 reads as 00000099
+inline uint64_t LoadDigitsRight(const char *p, int n)
+{
+  uint64_t chunk;
+  memcpy(&chunk, p, 8);
+  int shift = 8 * (8 - n);
+  return ((chunk << (shift / 2)) << (shift - shift / 2)) | (ZERO_DIGITS & LowBitMask(shift));
+}
+
+// Load n <= 8 characters into a word with trailing '0' padding, so 0625 reads as 06250000
+inline uint64_t LoadDigitsLeft(const char *p, int n)
+{
+  uint64_t chunk;
+  memcpy(&chunk, p, 8);
+  uint64_t mask = LowBitMask(8 * n);
+  return (chunk & mask) | (ZERO_DIGITS & ~mask);
+}
+
+// Parse a signed integer field
+inline bool ParseLong(const CsvField &field, long &value)
+{
+  const char *p = field.begin;
+  bool negative = false;
+  if(p < field.end && (*p == '-' || *p == '+'))
+  {
+    negative = *p == '-';
+    p++;
+  }
+  int length = field.end - p;
+  if(length == 0)
+  {
+    return false;
+  }
+
+  long result = 0;
+#ifdef CSV_SWAR_DIGITS
+  if(length <= 16)
+  {
+    uint64_t high = LoadDigitsRight(p, length > 8 ? length - 8 : 0);
+    uint64_t low = LoadDigitsRight(p + (length > 8 ? length - 8 : 0), length > 8 ? 8 : length);
+    if(!IsEightDigits(high) || !IsEightDigits(low))
+    {
+      return false;
+    }
+    result = long(ParseEightDigits(high)) * 100000000 + ParseEightDigits(low);
+    value = negative ? -result : result;
+    return true;
+  }
+#endif
+
+  for(; p < field.end; p++)
+  {
+    unsigned int digit = *p - '0';
+    if(digit > 9)
+    {
+      return false;
+    }
+    result = result * 10 + digit;
+  }
+  value = negative ? -result : result;
+  return true;
+}
+
+// Parse a decimal field such as 99.00390625.
+// Up to seven integer and eight fraction digits are converted as one integer and rounded
+// once by a division by 10^8; anything else, such as exponent notation, goes to strtod.
+inline bool ParseDecimal(const CsvField &field, double &value)
+{
+  const char *p = field.begin;
+  bool negative = false;
+  if(p < field.end && (*p == '-' || *p == '+'))
+  {
+    negative = *p == '-';
+    p++;
+  }
+  int length = field.end - p;
+
+#ifdef CSV_SWAR_DIGITS
+  if(length > 0 && length <= 16)
+  {
+    int integerDigits = length;
+#ifdef __SSE2__
+    __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    unsigned int pointMask = _mm_movemask_epi8(_mm_cmpeq_epi8(block, _mm_set1_epi8('.'))) & ((1u << length) - 1);
+    if(pointMask != 0)
+    {
+      integerDigits = __builtin_ctz(pointMask);
+    }
+#else
+    const char *point = static_cast<const char*>(memchr(p, '.', length));
+    if(point != 0)
+    {
+      integerDigits = point - p;
+    }
+#endif
+    int fractionDigits = integerDigits < length ? length - integerDigits - 1 : 0;
+
+    if(integerDigits <= 7 && fractionDigits <= 8 && integerDigits + fractionDigits > 0)
+    {
+      uint64_t integerChunk = LoadDigitsRight(p, integerDigits);
+      uint64_t fractionChunk = LoadDigitsLeft(p + integerDigits + 1, fractionDigits);
+      if(IsEightDigits(integerChunk) && IsEightDigits(fractionChunk))
+      {
+        uint64_t mantissa = uint64_t(ParseEightDigits(integerChunk)) * 100000000 + ParseEightDigits(fractionChunk);
+        double result = double(mantissa) / 1e8;
+        value = negative ? -result : result;
+        return true;
+      }
+    }
+  }
+#endif
+
+  char buffer[64];
+  size_t size = field.Length();
+  if(length == 0 || size >= sizeof(buffer))
+  {
+    return false;
+  }
+  memcpy(buffer, field.begin, size);
+  buffer[size] = '\0';
+  char *parsedEnd;
+  value = strtod(buffer, &parsedEnd);
+  return parsedEnd == buffer + size;
+}
+
+/**
+ * A parsed line of price.txt: product, cusip, mid, bid/offer spread.
+ */
+struct PriceRecord
+{
+  int productIndex;
+  double mid;
+  double bidOfferSpread;
+};
+
+/**
+ * A parsed line of marketdata_backup.txt: product, stack, cusip, then bid, offer and
+ * quantity for each of the five levels.
+ */
+struct MarketDataRecord
+{
+  int productIndex;
+  double bidPrices[MARKET_DATA_DEPTH];
+  double offerPrices[MARKET_DATA_DEPTH];
+  long quantities[MARKET_DATA_DEPTH];
+};
+
+/**
+ * A parsed line of trades.txt: product, trade id, fractional price, book, quantity, side.
+ * The trade id and book are views into the mapped file.
+ */
+struct TradeRecord
+{
+  int productIndex;
+  CsvField tradeId;
+  TickPrice price;            // parsed from 32nds straight into ticks
+  CsvField book;
+  long quantity;
+  bool isBuy;
+};
+
+/**
+ * A parsed line of inquiries.txt: inquiry id, product, side, quantity, price, state.
+ * The inquiry id and state are views into the mapped file.
+ */
+struct InquiryRecord
+{
+  CsvField inquiryId;
+  int productIndex;
+  bool isBuy;
+  long quantity;
+  double price;
+  CsvField state;
+};
+
+inline bool ParsePriceRecord(const CsvField *fields, int fieldCount, PriceRecord &record)
+{
+  if(fieldCount < 4)
+  {
+    return false;
+  }
+  record.productIndex = GetBondIndex(fields[0].begin, fields[0].Length());
+  return record.productIndex >= 0
+    && ParseDecimal(fields[2], record.mid)
+    && ParseDecimal(fields[3], record.bidOfferSpread);
+}
+
+inline bool ParseMarketDataRecord(const CsvField *fields, int fieldCount, MarketDataRecord &record)
+{
+  if(fieldCount < 3 + 3 * MARKET_DATA_DEPTH)
+  {
+    return false;
+  }
+  record.productIndex = GetBondIndex(fields[0].begin, fields[0].Length());
+  if(record.productIndex < 0)
+  {
+    return false;
+  }
+
+  const CsvField *level = fields + 3;
+  for(int i = 0; i<MARKET_DATA_DEPTH; i++, level += 3)
+  {
+    if(!ParseDecimal(level[0], record.bidPrices[i])
+      || !ParseDecimal(level[1], record.offerPrices[i])
+      || !ParseLong(level[2], record.quantities[i]))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+inline bool ParseTradeRecord(const CsvField *fields, int fieldCount, TradeRecord &record)
+{
+  if(fieldCount < 6)
+  {
+    return false;
+  }
+  record.productIndex = GetBondIndex(fields[0].begin, fields[0].Length());
+  record.tradeId = fields[1];
+  record.book = fields[3];
+  record.isBuy = fields[5].Equals("BUY");
+  return record.productIndex >= 0
+    && TickPrice::Parse(fields[2].begin, fields[2].end, record.price)
+    && ParseLong(fields[4], record.quantity);
+}
+
+inline bool ParseInquiryRecord(const CsvField *fields, int fieldCount, InquiryRecord &record)
+{
+  if(fieldCount < 6 || fields[0].Length() == 0)
+  {
+    return false;
+  }
+  record.inquiryId = fields[0];
+  record.productIndex = GetBondIndex(fields[1].begin, fields[1].Length());
+  record.isBuy = fields[2].Equals("BUY");
+  record.state = fields[5];
+  return record.productIndex >= 0
+    && ParseLong(fields[3], record.quantity)
+    && ParseDecimal(fields[4], record.price);
+}
+
+#endif
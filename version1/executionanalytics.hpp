@@ -0,0 +1,577 @@
+/**
+ * executionanalytics.hpp
+ * Defines the data types and Service for streaming execution quality analytics.
+ *
+ * Every order algo execution decides on is joined with the top of book of its product at
+ * the time of the decision, found in a ring of each product's recent tops of book; a child
+ * order of a sliced parent takes the touch its parent arrived at. Orders sent to venues
+ * and their fills are joined back to that decision by order ID, or by the parent ID of an
+ * order routed from it, and move running sums of quantity sent and filled, slippage
+ * against the arrival mid and share of the arrival spread captured, by product, venue and
+ * algorithm.
+ * Decisions live in a fixed table reused oldest first, so joins do not allocate. Snapshots
+ * of the sums are published on demand or on a timer driven by the event clock.
+ */
+#ifndef EXECUTION_ANALYTICS_HPP
+#define EXECUTION_ANALYTICS_HPP
+
+#include <vector>
+#include <mutex>
+#include <stdint.h>
+
+#include "soa.hpp"
+#include "bondreferencedata.hpp"
+#include "marketdataservice.hpp"
+#include "executionservice.hpp"
+#include "timerwheel.hpp"
+#include "tickprice.hpp"
+
+using namespace std;
+
+// Number of slicing algorithms, NO_SLICING included
+const int SLICE_ALGORITHMS = 4;
+
+// Tops of book kept for each product
+const int EXECUTION_BOOK_HISTORY = 1024;
+
+/**
+ * Execution quality of the orders of a product, venue or algorithm.
+ */
+struct ExecutionQuality
+{
+  long orders;                // sent to venues
+  long sentQuantity;
+  long filledQuantity;
+  long fills;
+  double fillRatio;           // filled / sent
+  double slippageTicks;       // mean per unit filled against the arrival mid, positive for a cost
+  double spreadCapture;       // mean per unit filled of the arrival half spread captured, 1 at the near touch
+};
+
+/**
+ * Snapshot of execution quality by product, venue and algorithm.
+ */
+struct ExecutionAnalytics
+{
+  int64_t timestamp;          // event clock, in nanoseconds, at which the snapshot was taken
+  ExecutionQuality products[BOND_COUNT];
+  ExecutionQuality venues[MARKET_COUNT];
+  ExecutionQuality algorithms[SLICE_ALGORITHMS];
+};
+
+class BondExecutionAnalyticsService : public VenueExecutionListener
+{
+
+public:
+
+  // ctor for a service remembering the last decisionCapacity decisions
+  BondExecutionAnalyticsService(size_t decisionCapacity = 1 << 16);
+
+  // Record the top of book of a product at a time in nanoseconds
+  void OnBook(int productIndex, const TopOfBook &top, int64_t nanos);
+
+  // Record a decision to execute an order by an algorithm, arriving at a time
+  void OnDecision(const ExecutionOrder<Bond> &order, SliceAlgorithm algorithm, int64_t arrivalNanos);
+
+  // Count an order sent to a venue
+  virtual void OnVenueOrder(const ExecutionOrder<Bond> &order, Market venue);
+
+  // Count a fill of an order sent to a venue
+  virtual void OnVenueFill(const ExecutionOrder<Bond> &order, Market venue, TickPrice price, long quantity);
+
+  // Get the top of book of a product at a time, or the oldest kept if the time is earlier.
+  // Returns false if the product has no top of book.
+  bool GetBookAt(int productIndex, int64_t nanos, TopOfBook &top) const;
+
+  // Publish a snapshot to the listeners every interval of the event clock; zero turns the
+  // timer off
+  void SetPublishInterval(int64_t intervalNanos);
+
+  // Snapshot execution quality at the current event clock
+  ExecutionAnalytics GetSnapshot() const;
+
+  // Get the last published snapshot
+  const ExecutionAnalytics& GetPublished() const;
+
+  // Publish a snapshot to the listeners
+  void PublishSnapshot();
+
+  // Add a listener to the Service for callbacks on add, remove, and update events
+  // for data to the Service.
+  virtual void AddListener(ServiceListener<ExecutionAnalytics> *listener);
+
+  // Get all listeners on the Service.
+  virtual const vector< ServiceListener<ExecutionAnalytics>* >& GetListeners() const;
+
+  // Get the name of a slicing algorithm
+  static const char* GetAlgorithmName(int algorithm);
+
+private:
+
+  static const uint32_t EMPTY = 0xFFFFFFFF;
+
+  // Running sums of one product, venue or algorithm
+  struct QualitySums
+  {
+    long orders;
+    long sentQuantity;
+    long filledQuantity;
+    long fills;
+    double slippage;          // ticks times quantity
+    double capture;           // share of the half spread times quantity
+  };
+
+  // An order decided on and the touch it arrived at
+  struct Decision
+  {
+    uint64_t key;             // hash of the order ID
+    TickPrice bid;
+    TickPrice offer;
+    bool twoSided;
+    int productIndex;
+    PricingSide side;
+    SliceAlgorithm algorithm;
+  };
+
+  struct IndexEntry
+  {
+    uint64_t key;
+    uint32_t slot;            // in the decisions, EMPTY for none
+  };
+
+  static uint64_t Hash(const string &orderId);
+  size_t GetBucket(uint64_t key) const;
+  size_t Locate(uint64_t key) const;
+  Decision* Find(uint64_t key);
+  Decision* Decide(const ExecutionOrder<Bond> &order, SliceAlgorithm algorithm, int64_t arrivalNanos);
+  Decision* Join(const ExecutionOrder<Bond> &order);
+  void Tick(int64_t nanos);
+  static ExecutionQuality GetQuality(const QualitySums &sums);
+
+  TopOfBook books[BOND_COUNT][EXECUTION_BOOK_HISTORY];
+  int64_t bookTimes[BOND_COUNT][EXECUTION_BOOK_HISTORY];
+  long bookCounts[BOND_COUNT];
+  vector<Decision> decisions;
+  long decided;
+  size_t lastJoined;
+  vector<IndexEntry> index;
+  size_t indexMask;
+  int indexShift;
+  QualitySums products[BOND_COUNT];
+  QualitySums venues[MARKET_COUNT];
+  QualitySums algorithms[SLICE_ALGORITHMS];
+  int64_t clock;
+  int64_t publishInterval;
+  int64_t lastPublish;
+  ExecutionAnalytics published;
+  vector< ServiceListener<ExecutionAnalytics>* > AnalyticsListeners;
+
+  // Books come from market data and orders from execution, which may be on different
+  // threads. Recursive so that listeners can take snapshots while one is published.
+  mutable recursive_mutex lock;
+
+};
+
+BondExecutionAnalyticsService::BondExecutionAnalyticsService(size_t decisionCapacity) :
+  decisions(decisionCapacity > 0 ? decisionCapacity : 1), decided(0), lastJoined(0), clock(0), publishInterval(0), lastPublish(0)
+{
+  size_t size = 2;
+  indexShift = 63;
+  while(size < 2 * decisions.size())
+  {
+    size <<= 1;
+    indexShift--;
+  }
+  IndexEntry empty = { 0, EMPTY };
+  index.assign(size, empty);
+  indexMask = size - 1;
+
+  QualitySums zero = { 0, 0, 0, 0, 0, 0 };
+  for(int p = 0; p<BOND_COUNT; p++)
+  {
+    bookCounts[p] = 0;
+    products[p] = zero;
+  }
+  for(int v = 0; v<MARKET_COUNT; v++)
+  {
+    venues[v] = zero;
+  }
+  for(int a = 0; a<SLICE_ALGORITHMS; a++)
+  {
+    algorithms[a] = zero;
+  }
+  published = ExecutionAnalytics();
+}
+
+uint64_t BondExecutionAnalyticsService::Hash(const string &orderId)
+{
+  // FNV-1a, never 0
+  uint64_t hash = 14695981039346656037ULL;
+  for(size_t i = 0; i<orderId.size(); i++)
+  {
+    hash = (hash ^ (unsigned char)orderId[i]) * 1099511628211ULL;
+  }
+  return hash ? hash : 1;
+}
+
+size_t BondExecutionAnalyticsService::GetBucket(uint64_t key) const
+{
+  return size_t((key * 0x9E3779B97F4A7C15ULL) >> indexShift);
+}
+
+size_t BondExecutionAnalyticsService::Locate(uint64_t key) const
+{
+  size_t bucket = GetBucket(key);
+  while(index[bucket].slot != EMPTY && index[bucket].key != key)
+  {
+    bucket = (bucket + 1) & indexMask;
+  }
+  return bucket;
+}
+
+BondExecutionAnalyticsService::Decision* BondExecutionAnalyticsService::Find(uint64_t key)
+{
+  size_t bucket = Locate(key);
+  return index[bucket].slot == EMPTY ? 0 : &decisions[index[bucket].slot];
+}
+
+void BondExecutionAnalyticsService::Tick(int64_t nanos)
+{
+  if(nanos > clock)
+  {
+    clock = nanos;
+  }
+  if(publishInterval > 0 && clock - lastPublish >= publishInterval)
+  {
+    PublishSnapshot();
+  }
+}
+
+void BondExecutionAnalyticsService::OnBook(int productIndex, const TopOfBook &top, int64_t nanos)
+{
+  if(productIndex < 0 || productIndex >= BOND_COUNT)
+  {
+    return;
+  }
+  lock_guard<recursive_mutex> guard(lock);
+  long count = bookCounts[productIndex];
+  if(count > 0)
+  {
+    int last = (count - 1) % EXECUTION_BOOK_HISTORY;
+    if(books[productIndex][last].IsSameTouch(top))
+    {
+      return;
+    }
+  }
+  books[productIndex][count % EXECUTION_BOOK_HISTORY] = top;
+  bookTimes[productIndex][count % EXECUTION_BOOK_HISTORY] = nanos;
+  bookCounts[productIndex]++;
+  Tick(nanos);
+}
+
+bool BondExecutionAnalyticsService::GetBookAt(int productIndex, int64_t nanos, TopOfBook &top) const
+{
+  lock_guard<recursive_mutex> guard(lock);
+  long count = bookCounts[productIndex];
+  if(count == 0)
+  {
+    return false;
+  }
+
+  // Books are in time order, so the last at or before the time is found by bisection
+  long low = count > EXECUTION_BOOK_HISTORY ? count - EXECUTION_BOOK_HISTORY : 0, high = count - 1;
+  while(low < high)
+  {
+    long middle = (low + high + 1) / 2;
+    if(bookTimes[productIndex][middle % EXECUTION_BOOK_HISTORY] <= nanos)
+    {
+      low = middle;
+    }
+    else
+    {
+      high = middle - 1;
+    }
+  }
+  top = books[productIndex][low % EXECUTION_BOOK_HISTORY];
+  return true;
+}
+
+BondExecutionAnalyticsService::Decision* BondExecutionAnalyticsService::Decide(const ExecutionOrder<Bond> &order,
+  SliceAlgorithm algorithm, int64_t arrivalNanos)
+{
+  int productIndex = GetBondIndex(order.GetProduct().GetProductId());
+  uint64_t key = Hash(order.GetOrderId());
+  size_t bucket = Locate(key);
+  if(productIndex < 0 || index[bucket].slot != EMPTY)
+  {
+    return productIndex < 0 ? 0 : &decisions[index[bucket].slot];
+  }
+
+  // A child order arrives with its parent, if the parent was decided on
+  Decision arrival;
+  const Decision *parent = order.IsChildOrder() ? Find(Hash(order.GetParentOrderId())) : 0;
+  TopOfBook top;
+  if(parent)
+  {
+    arrival = *parent;
+  }
+  else
+  {
+    arrival.twoSided = GetBookAt(productIndex, arrivalNanos, top) && top.IsTwoSided();
+    arrival.bid = arrival.twoSided ? top.bid : order.GetTickPrice();
+    arrival.offer = arrival.twoSided ? top.offer : order.GetTickPrice();
+  }
+
+  // The oldest decision makes way, and entries after it in the index move back into the gap
+  uint32_t slot = decided++ % decisions.size();
+  if(decided > long(decisions.size()))
+  {
+    size_t gap = Locate(decisions[slot].key);
+    for(size_t next = (gap + 1) & indexMask; index[next].slot != EMPTY; next = (next + 1) & indexMask)
+    {
+      size_t home = GetBucket(index[next].key);
+      if(((next - home) & indexMask) >= ((next - gap) & indexMask))
+      {
+        index[gap] = index[next];
+        gap = next;
+      }
+    }
+    index[gap].slot = EMPTY;
+    bucket = Locate(key);
+  }
+  index[bucket].key = key;
+  index[bucket].slot = slot;
+
+  Decision &decision = decisions[slot];
+  decision.key = key;
+  decision.twoSided = arrival.twoSided;
+  decision.bid = arrival.bid;
+  decision.offer = arrival.offer;
+  decision.productIndex = productIndex;
+  decision.side = order.GetSide();
+  decision.algorithm = algorithm;
+  return &decision;
+}
+
+BondExecutionAnalyticsService::Decision* BondExecutionAnalyticsService::Join(const ExecutionOrder<Bond> &order)
+{
+  // An order is sent and then filled, so the last decision joined is tried first
+  uint64_t key = Hash(order.GetOrderId());
+  if(decisions[lastJoined].key == key)
+  {
+    return &decisions[lastJoined];
+  }
+  Decision *decision = Find(key);
+  if(!decision && order.IsChildOrder())
+  {
+    decision = Find(Hash(order.GetParentOrderId()));
+  }
+  // An order no algorithm decided on arrives now
+  decision = decision ? decision : Decide(order, NO_SLICING, clock);
+  if(decision)
+  {
+    lastJoined = decision - &decisions[0];
+  }
+  return decision;
+}
+
+void BondExecutionAnalyticsService::OnDecision(const ExecutionOrder<Bond> &order, SliceAlgorithm algorithm, int64_t arrivalNanos)
+{
+  lock_guard<recursive_mutex> guard(lock);
+  Decide(order, algorithm, arrivalNanos);
+  Tick(arrivalNanos);
+}
+
+void BondExecutionAnalyticsService::OnVenueOrder(const ExecutionOrder<Bond> &order, Market venue)
+{
+  lock_guard<recursive_mutex> guard(lock);
+  Decision *decision = Join(order);
+  if(!decision)
+  {
+    return;
+  }
+  long quantity = labs(order.GetVisibleQuantity()) + labs(order.GetHiddenQuantity());
+  QualitySums *sums[] = { &products[decision->productIndex], &venues[venue], &algorithms[decision->algorithm] };
+  for(int i = 0; i<3; i++)
+  {
+    sums[i]->orders++;
+    sums[i]->sentQuantity += quantity;
+  }
+}
+
+void BondExecutionAnalyticsService::OnVenueFill(const ExecutionOrder<Bond> &order, Market venue, TickPrice price, long quantity)
+{
+  lock_guard<recursive_mutex> guard(lock);
+  Decision *decision = Join(order);
+  if(!decision)
+  {
+    return;
+  }
+
+  // In ticks, from the arrival mid, to the buyer's cost or the seller's
+  double halfSpread = double((decision->offer - decision->bid).GetTicks()) / 2;
+  double mid = decision->bid.GetTicks() + halfSpread;
+  double slippage = decision->side == BID ? price.GetTicks() - mid : mid - price.GetTicks();
+  double capture = halfSpread > 0 ? -slippage / halfSpread : 0;
+  QualitySums *sums[] = { &products[decision->productIndex], &venues[venue], &algorithms[decision->algorithm] };
+  for(int i = 0; i<3; i++)
+  {
+    sums[i]->filledQuantity += quantity;
+    sums[i]->fills++;
+    sums[i]->slippage += slippage * quantity;
+    sums[i]->capture += capture * quantity;
+  }
+}
+
+ExecutionQuality BondExecutionAnalyticsService::GetQuality(const QualitySums &sums)
+{
+  ExecutionQuality quality;
+  quality.orders = sums.orders;
+  quality.sentQuantity = sums.sentQuantity;
+  quality.filledQuantity = sums.filledQuantity;
+  quality.fills = sums.fills;
+  quality.fillRatio = sums.sentQuantity > 0 ? double(sums.filledQuantity) / sums.sentQuantity : 0;
+  quality.slippageTicks = sums.filledQuantity > 0 ? sums.slippage / sums.filledQuantity : 0;
+  quality.spreadCapture = sums.filledQuantity > 0 ? sums.capture / sums.filledQuantity : 0;
+  return quality;
+}
+
+void BondExecutionAnalyticsService::SetPublishInterval(int64_t intervalNanos)
+{
+  lock_guard<recursive_mutex> guard(lock);
+  publishInterval = intervalNanos;
+  lastPublish = clock;
+}
+
+ExecutionAnalytics BondExecutionAnalyticsService::GetSnapshot() const
+{
+  lock_guard<recursive_mutex> guard(lock);
+  ExecutionAnalytics snapshot;
+  snapshot.timestamp = clock;
+  for(int p = 0; p<BOND_COUNT; p++)
+  {
+    snapshot.products[p] = GetQuality(products[p]);
+  }
+  for(int v = 0; v<MARKET_COUNT; v++)
+  {
+    snapshot.venues[v] = GetQuality(venues[v]);
+  }
+  for(int a = 0; a<SLICE_ALGORITHMS; a++)
+  {
+    snapshot.algorithms[a] = GetQuality(algorithms[a]);
+  }
+  return snapshot;
+}
+
+const ExecutionAnalytics& BondExecutionAnalyticsService::GetPublished() const
+{
+  return published;
+}
+
+void BondExecutionAnalyticsService::PublishSnapshot()
+{
+  lock_guard<recursive_mutex> guard(lock);
+  lastPublish = clock;
+  published = GetSnapshot();
+  for(int i = 0; i<AnalyticsListeners.size(); i++)
+  {
+    AnalyticsListeners[i]->ProcessAdd(published);
+  }
+}
+
+void BondExecutionAnalyticsService::AddListener(ServiceListener<ExecutionAnalytics> *listener)
+{
+  AnalyticsListeners.push_back(listener);
+}
+
+const vector< ServiceListener<ExecutionAnalytics>* >& BondExecutionAnalyticsService::GetListeners() const
+{
+  return AnalyticsListeners;
+}
+
+const char* BondExecutionAnalyticsService::GetAlgorithmName(int algorithm)
+{
+  static const char* names[SLICE_ALGORITHMS] = { "none", "TWAP", "VWAP", "iceberg" };
+  return names[algorithm];
+}
+
+
+/**
+ * Keeps the history of the composite top of book each product's decisions are joined with.
+ */
+class BondMarketDataExecutionAnalyticsListener : public ServiceListener< BondOrderBook >
+{
+  public:
+
+    BondMarketDataExecutionAnalyticsListener(BondExecutionAnalyticsService* AnalyticsService_, const BondMarketDataService* MarketData_):AnalyticsService(AnalyticsService_),MarketData(MarketData_){};
+
+  // Listener callback to process an add event to the Service
+  virtual void ProcessAdd(BondOrderBook &data)
+  {
+    int index = data.GetProductIndex();
+    AnalyticsService->OnBook(index, MarketData->GetTopOfBook(index), TimerWheel::Now());
+  }
+
+  // Listener callback to process a remove event to the Service
+  virtual void ProcessRemove(BondOrderBook &data)
+  {
+
+  }
+
+  // Listener callback to process an update event to the Service
+  virtual void ProcessUpdate(BondOrderBook &data)
+  {
+    ProcessAdd(data);
+  }
+
+  private:
+
+  BondExecutionAnalyticsService* AnalyticsService;
+  const BondMarketDataService* MarketData;
+
+};
+
+
+/**
+ * Records the decisions of algo execution, a child order of a sliced parent arriving when
+ * the parent started.
+ */
+class BondAlgoExecutionAnalyticsListener : public ServiceListener< AlgoExecution<Bond> >
+{
+  public:
+
+    BondAlgoExecutionAnalyticsListener(BondExecutionAnalyticsService* AnalyticsService_, const BondAlgoExecutionService* AlgoExecutionService_):AnalyticsService(AnalyticsService_),AlgoExecutionService(AlgoExecutionService_){};
+
+  // Listener callback to process an add event to the Service
+  virtual void ProcessAdd(AlgoExecution<Bond> &data)
+  {
+    const ExecutionOrder<Bond> &order = data.GetExecutionOrder();
+    const ParentOrder *parent = AlgoExecutionService->FindParent(order.GetOrderId());
+    if(parent && parent->order.GetOrderId() != order.GetOrderId())
+    {
+      // Parents being sliced are not published, so each is decided on with its first child
+      AnalyticsService->OnDecision(parent->order, parent->algorithm, parent->start);
+    }
+    AnalyticsService->OnDecision(order, parent ? parent->algorithm : NO_SLICING, parent ? parent->start : TimerWheel::Now());
+  }
+
+  // Listener callback to process a remove event to the Service
+  virtual void ProcessRemove(AlgoExecution<Bond> &data)
+  {
+
+  }
+
+  // Listener callback to process an update event to the Service
+  virtual void ProcessUpdate(AlgoExecution<Bond> &data)
+  {
+
+  }
+
+  private:
+
+  BondExecutionAnalyticsService* AnalyticsService;
+  const BondAlgoExecutionService* AlgoExecutionService;
+
+};
+
+#endif
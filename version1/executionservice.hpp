@@ -17,8 +17,17 @@
 #include <ratio>
 #include <sstream>
 #include <cstdlib>
+#include <mutex>
 #include "soa.hpp"
 #include "marketdataservice.hpp"
+#include "booksignalservice.hpp"
+#include "orderidservice.hpp"
+#include "matchingengine.hpp"
+#include "timerwheel.hpp"
+#include "orderstore.hpp"
+#include "pretraderisk.hpp"
+#include "stoptrigger.hpp"
+#include "algostrategy.hpp"
 #include "tradebookingservice.hpp"
 
 
@@ -43,11 +52,6 @@ int roll(int min, int max)
 }
 
 
-
-enum OrderType { FOK, IOC, MARKET, LIMIT, STOP };
-
-enum Market { BROKERTEC, ESPEED, CME };
-
 /**
  * An execution order that can be placed on an exchange.
  * Type T is the product type.
@@ -58,13 +62,17 @@ class ExecutionOrder
 
 public:
 
-  // ctor for an order
+  // ctor for an order, with the price rounded to the nearest tick
   ExecutionOrder(const T &_product, PricingSide _side, string _orderId, OrderType _orderType, double _price, double _visibleQuantity, double _hiddenQuantity, string _parentOrderId, bool _isChildOrder);
+  ExecutionOrder(const T &_product, PricingSide _side, string _orderId, OrderType _orderType, TickPrice _price, double _visibleQuantity, double _hiddenQuantity, string _parentOrderId, bool _isChildOrder);
 
   ExecutionOrder(){};
   // Get the product
   const T& GetProduct() const;
 
+  // Get the side of the book the order rests on
+  PricingSide GetSide() const;
+
   // Get the order ID
   const string& GetOrderId() const;
 
@@ -74,6 +82,9 @@ public:
   // Get the price on this order
   double GetPrice() const;
 
+  // Get the price on this order in ticks
+  TickPrice GetTickPrice() const;
+
   // Get the visible quantity on this order
   long GetVisibleQuantity() const;
 
@@ -91,7 +102,7 @@ private:
   PricingSide side;
   string orderId;
   OrderType orderType;
-  double price;
+  TickPrice price;
   double visibleQuantity;
   double hiddenQuantity;
   string parentOrderId;
@@ -156,7 +167,8 @@ public:
       return executionOrder.IsChildOrder();
     }
 
-    ExecutionOrder<T> GetExecutionOrder()
+    // Get the execution order, without copying it
+    const ExecutionOrder<T>& GetExecutionOrder() const
     {
       return executionOrder;
     }
@@ -164,18 +176,320 @@ public:
 };
 
 
+// How a parent order is sliced into child orders: not at all, evenly over time, over time
+// following a volume curve, or a visible clip at a time, replenished as it fills
+enum SliceAlgorithm { NO_SLICING, TWAP, VWAP, ICEBERG };
+
+/**
+ * A parent order being sliced into child orders.
+ */
+struct ParentOrder
+{
+  ExecutionOrder<Bond> order;
+  SliceAlgorithm algorithm;
+  long quantity;              // to execute in all
+  long sent;                  // in child orders
+  long filled;
+  long clip;                  // visible size of an iceberg
+  int64_t start;
+  int64_t duration;
+  int slices;
+  int nextSlice;              // of TWAP and VWAP
+  uint64_t timer;             // of the next TWAP or VWAP slice
+  vector<string> children;
+};
+
 class BondAlgoExecutionService
 {
 private:
   std::map<string, AlgoExecution<Bond> > AlgoExecutionMP;
   vector< ServiceListener< AlgoExecution<Bond> >* > BondAlgoExecutionServiceListener;
+  const BondMarketDataService* MarketData;
+  OrderIdService LocalOrderIds;         // used when no order ID service is given
+  OrderIdService* OrderIds;
+  BookSignals Signals[BOND_COUNT];      // latest microstructure signals
+  long SkippedUpdates;
+
+  // Parent orders being sliced, in slots reused once done, found by parent and child ID,
+  // with the next slice of each on a timer keyed by its slot
+  TimerWheel SliceTimers;
+  vector<ParentOrder> Parents;
+  vector<int> FreeParents;
+  unordered_map<string,int> ParentSlots;
+  vector<double> VolumeCurve;           // share of volume traded by the end of each bucket
+  SliceAlgorithm Slicing;               // of the orders of GetBestExecution
+  SpreadCaptureStrategy DefaultStrategy;  // on every product, for callers giving no strategy
+  int64_t SliceDuration;
+  int SliceCount;
+
+  // Slices are sent from the thread delivering books, and from a timer once books stop.
+  // Recursive, as listeners of a child order may fill it and start or end parents.
+  recursive_mutex SlicingLock;
+
+  // Send a child order of a parent
+  void SendChild(int slot, long quantity)
+  {
+    ParentOrder &parent = Parents[slot];
+    const ExecutionOrder<Bond> &order = parent.order;
+    long sign = order.GetVisibleQuantity() < 0 || order.GetHiddenQuantity() < 0 ? -1 : 1;
+    string childId = OrderIdService::ToString(OrderIds->NextId());
+    AlgoExecution<Bond> child(ExecutionOrder<Bond>(order.GetProduct(), order.GetSide(), childId, order.GetOrderType(),
+      order.GetTickPrice(), sign * quantity, 0, order.GetOrderId(), true));
+    parent.sent += quantity;
+    parent.children.push_back(childId);
+    ParentSlots[childId] = slot;
+    AlgoExecutionMP.insert(std::pair<string,AlgoExecution<Bond> >(childId, child));
+    for(int i = 0; i<BondAlgoExecutionServiceListener.size(); i++)
+    {
+      BondAlgoExecutionServiceListener[i]->ProcessAdd(child);
+    }
+  }
+
+  // Keep the buy and sell of GetBestExecution, then slice them or send them to the listeners
+  void SendBestExecution(std::vector< AlgoExecution<Bond> > &bestOrder)
+  {
+    AlgoExecutionMP.insert(std::pair<string,AlgoExecution<Bond> >(bestOrder[0].GetOrderId(), bestOrder[0]));
+    AlgoExecutionMP.insert(std::pair<string,AlgoExecution<Bond> >(bestOrder[1].GetOrderId(), bestOrder[1]));
+    if(Slicing != NO_SLICING)
+    {
+      int64_t now = TimerWheel::Now();
+      StartParent(bestOrder[0].GetExecutionOrder(), Slicing, SliceDuration, SliceCount, now);
+      StartParent(bestOrder[1].GetExecutionOrder(), Slicing, SliceDuration, SliceCount, now);
+      return;
+    }
+    for(int i = 0; i<BondAlgoExecutionServiceListener.size();i++)
+    {
+      BondAlgoExecutionServiceListener[i]->ProcessAdd(bestOrder[0]);
+      BondAlgoExecutionServiceListener[i]->ProcessAdd(bestOrder[1]);
+    }
+  }
+
+  // Share of the day's volume traded by a fraction of the way through it
+  double GetVolumeShare(double fraction) const
+  {
+    double position = fraction * VolumeCurve.size();
+    int bucket = int(position);
+    if(bucket >= int(VolumeCurve.size()))
+    {
+      return 1;
+    }
+    double before = bucket > 0 ? VolumeCurve[bucket - 1] : 0;
+    return before + (VolumeCurve[bucket] - before) * (position - bucket);
+  }
+
+  // Send the next TWAP or VWAP slice of a parent, sized so that the parent has sent its
+  // share of the quantity by the end of the slice, and time the slice after it
+  void SendSlice(int slot)
+  {
+    ParentOrder &parent = Parents[slot];
+    double fraction = double(parent.nextSlice + 1) / parent.slices;
+    long target = parent.nextSlice + 1 == parent.slices ? parent.quantity
+      : long(parent.quantity * (parent.algorithm == VWAP ? GetVolumeShare(fraction) : fraction));
+    parent.nextSlice++;
+    if(target > parent.sent)
+    {
+      SendChild(slot, target - parent.sent);
+    }
+
+    // Listeners of the child may have started parents, moving the slots
+    ParentOrder &sliced = Parents[slot];
+    if(sliced.nextSlice < sliced.slices)
+    {
+      sliced.timer = SliceTimers.Schedule(sliced.start + sliced.duration * sliced.nextSlice / sliced.slices, slot);
+    }
+    else
+    {
+      EndParent(slot);
+    }
+  }
+
+  // Forget a parent and its children
+  void EndParent(int slot)
+  {
+    ParentOrder &parent = Parents[slot];
+    ParentSlots.erase(parent.order.GetOrderId());
+    for(int i = 0; i<parent.children.size(); i++)
+    {
+      ParentSlots.erase(parent.children[i]);
+    }
+    parent.children.clear();
+    FreeParents.push_back(slot);
+  }
  
 public:
-  BondAlgoExecutionService ()
+  // ctor; with a market data service the top of book is read from its cache rather than
+  // found from the book. Order IDs come from the order ID service given, or else from one
+  // of the service's own in epoch 0.
+  BondAlgoExecutionService (const BondMarketDataService* MarketData_ = 0, OrderIdService* OrderIds_ = 0) :
+    MarketData(MarketData_), LocalOrderIds(0), OrderIds(OrderIds_ ? OrderIds_ : &LocalOrderIds),
+    SliceTimers(1000000), Slicing(NO_SLICING), SliceDuration(0), SliceCount(1)
   {
     AlgoExecutionMP = std::map<string,AlgoExecution<Bond> >();
+    SkippedUpdates = 0;
+    for(int i = 0; i<BOND_COUNT; i++)
+    {
+      Signals[i] = BookSignals();
+      Signals[i].productIndex = i;
+    }
+    // Treasuries trade most at the open and the close
+    double buckets[] = { 0.14, 0.11, 0.09, 0.08, 0.07, 0.07, 0.08, 0.09, 0.11, 0.16 };
+    SetVolumeCurve(vector<double>(buckets, buckets + 10));
   };
 
+  // Slice the orders of GetBestExecution into child orders over durationNanos, instead of
+  // sending them whole
+  void SetSlicing(SliceAlgorithm algorithm, int64_t durationNanos, int slices)
+  {
+    Slicing = algorithm;
+    SliceDuration = durationNanos;
+    SliceCount = slices > 0 ? slices : 1;
+  }
+
+  // Set the volume VWAP follows, traded in each of a number of equal buckets of time
+  void SetVolumeCurve(const vector<double> &bucketVolumes)
+  {
+    double total = 0;
+    for(int i = 0; i<bucketVolumes.size(); i++)
+    {
+      total += bucketVolumes[i];
+    }
+    VolumeCurve.clear();
+    double traded = 0;
+    for(int i = 0; i<bucketVolumes.size() && total > 0; i++)
+    {
+      traded += bucketVolumes[i];
+      VolumeCurve.push_back(traded / total);
+    }
+  }
+
+  // Start slicing a parent order. TWAP and VWAP send slices child orders, the first now and
+  // the rest through durationNanos. An iceberg shows the visible quantity of the order, or
+  // else a slice of it, and sends the next clip once all it has sent is filled. Returns
+  // false for an order with no quantity, or one already being sliced.
+  bool StartParent(const ExecutionOrder<Bond> &order, SliceAlgorithm algorithm, int64_t durationNanos, int slices, int64_t nowNanos)
+  {
+    lock_guard<recursive_mutex> guard(SlicingLock);
+    long visible = labs(order.GetVisibleQuantity()), hidden = labs(order.GetHiddenQuantity());
+    if(visible + hidden == 0 || ParentSlots.count(order.GetOrderId()) != 0)
+    {
+      return false;
+    }
+    int slot = Parents.size();
+    if(FreeParents.empty())
+    {
+      Parents.push_back(ParentOrder());
+    }
+    else
+    {
+      slot = FreeParents.back();
+      FreeParents.pop_back();
+    }
+
+    ParentOrder &parent = Parents[slot];
+    parent.order = order;
+    parent.algorithm = algorithm;
+    parent.quantity = visible + hidden;
+    parent.sent = 0;
+    parent.filled = 0;
+    parent.slices = slices > 0 ? slices : 1;
+    parent.clip = hidden > 0 ? visible : (parent.quantity + parent.slices - 1) / parent.slices;
+    parent.start = nowNanos;
+    parent.duration = durationNanos;
+    parent.nextSlice = 0;
+    ParentSlots[order.GetOrderId()] = slot;
+
+    if(algorithm == ICEBERG)
+    {
+      SendChild(slot, parent.clip < parent.quantity ? parent.clip : parent.quantity);
+    }
+    else
+    {
+      SendSlice(slot);
+    }
+    return true;
+  }
+
+  // Send the slices that are due by nowNanos, from any thread. Returns the number sent.
+  int OnTimer(int64_t nowNanos)
+  {
+    lock_guard<recursive_mutex> guard(SlicingLock);
+    return SliceTimers.Advance(nowNanos, [this](uint64_t slot) { SendSlice(int(slot)); });
+  }
+
+  // End every parent order still being sliced without sending the rest of it, e.g. once
+  // market data has stopped. Child orders already sent are left as they are. Returns the
+  // number of parents ended.
+  size_t CancelParents()
+  {
+    lock_guard<recursive_mutex> guard(SlicingLock);
+    vector<bool> free(Parents.size(), false);
+    for(int i = 0; i<FreeParents.size(); i++)
+    {
+      free[FreeParents[i]] = true;
+    }
+    size_t cancelled = 0;
+    for(int slot = 0; slot<Parents.size(); slot++)
+    {
+      if(free[slot])
+      {
+        continue;
+      }
+      if(Parents[slot].algorithm != ICEBERG)
+      {
+        SliceTimers.Cancel(Parents[slot].timer);
+      }
+      EndParent(slot);
+      cancelled++;
+    }
+    return cancelled;
+  }
+
+  // Count a fill of a child order, or of an order routed from one, against its parent. An
+  // iceberg whose clips have all filled shows the next one.
+  void OnFill(const ExecutionOrder<Bond> &fill)
+  {
+    lock_guard<recursive_mutex> guard(SlicingLock);
+    unordered_map<string,int>::iterator found = ParentSlots.find(fill.GetParentOrderId());
+    if(found == ParentSlots.end())
+    {
+      found = ParentSlots.find(fill.GetOrderId());
+    }
+    if(found == ParentSlots.end())
+    {
+      return;
+    }
+    int slot = found->second;
+    ParentOrder &parent = Parents[slot];
+    parent.filled += labs(fill.GetVisibleQuantity());
+    if(parent.algorithm != ICEBERG || parent.filled < parent.sent)
+    {
+      return;
+    }
+    if(parent.sent < parent.quantity)
+    {
+      long left = parent.quantity - parent.sent;
+      SendChild(slot, parent.clip < left ? parent.clip : left);
+    }
+    else
+    {
+      EndParent(slot);
+    }
+  }
+
+  // Find the parent order being sliced that has an ID, or a child order with it. Returns 0
+  // for none.
+  const ParentOrder* FindParent(const string &orderId) const
+  {
+    unordered_map<string,int>::const_iterator found = ParentSlots.find(orderId);
+    return found == ParentSlots.end() ? 0 : &Parents[found->second];
+  }
+
+  // Get the number of parent orders being sliced
+  size_t GetActiveParents() const
+  {
+    return Parents.size() - FreeParents.size();
+  }
+
 
   // Add a listener to the Service for callbacks on add, remove, and update events
   // for data to the Service.
@@ -190,255 +504,153 @@ public:
       return BondAlgoExecutionServiceListener;
   }
 
-  std::vector< AlgoExecution<Bond> > GetBestExecution(OrderBook<Bond> orderBook)
+  // Get the buy and sell a strategy decides on for a book, or none
+  template<typename Strategy>
+  std::vector< AlgoExecution<Bond> > GetBestExecution(const BondOrderBook &orderBook, const Strategy &strategy)
   {
+    std::vector< AlgoExecution<Bond> > res;
+    int productIndex = orderBook.GetProductIndex();
+    TopOfBook top = MarketData ? MarketData->GetTopOfBook(productIndex) : GetTopOfBook(orderBook);
 
-      std::vector< AlgoExecution<Bond> > res;
-
-      Bond product = orderBook.GetProduct();
-      vector<Order> bidStack = orderBook.GetBidStack();
-      vector<Order> offerStack = orderBook.GetOfferStack();
-      int bestIdx;
-
-      for(int i = 0; i<bidStack.size();i++)
-      {
-        if(offerStack[i].GetPrice()-bidStack[i].GetPrice() == 0.00390625)
-        {
-          bestIdx = i;
-          break;
-        }
-      }
+    StrategyOrders orders;
+    if(!strategy.Decide(productIndex, orderBook, top, Signals[productIndex], orders))
+    {
+      return res;
+    }
 
-      long quant = bidStack[bestIdx].GetQuantity();
-      double buyPrice = bidStack[bestIdx].GetPrice();
-      double sellPrice = offerStack[bestIdx].GetPrice();
+    // Every order has an ID of its own, so none is dropped by the maps keyed on them
+    const Bond &product = orderBook.GetProduct();
+    string buyparentOrderId = OrderIdService::ToString(OrderIds->NextId());
+    res.push_back(ExecutionOrder<Bond>(product, BID, buyparentOrderId, orders.orderType, orders.buyPrice,
+      orders.quantity, 0, buyparentOrderId, false));
+    string sellparentOrderId = OrderIdService::ToString(OrderIds->NextId());
+    res.push_back(ExecutionOrder<Bond>(product, OFFER, sellparentOrderId, orders.orderType, orders.sellPrice,
+      -orders.quantity, 0, sellparentOrderId, false));
+    return res;
+  }
 
-      string productType = product.GetProductId();
+  // Get the buy and sell of spread capture with its default parameters
+  std::vector< AlgoExecution<Bond> > GetBestExecution(const BondOrderBook &orderBook)
+  {
+    return GetBestExecution(orderBook, DefaultStrategy);
+  }
 
-      PricingSide side1 = BID;
-      PricingSide side2 = OFFER;
-      OrderType orderType = LIMIT;
-      double visibleQuantity = quant;
-      double hiddenQuantity = 0;
-      
-      bool isChildOrder = false;
+  void AddExecutionOrder( BondOrderBook& data )
+  {
+    AddExecutionOrder(data, DefaultStrategy);
+  }
 
-      if(productType == "2Y")
-      {
-        
-        BondIdType idType = CUSIP;
-        date maturityDate(2019,Oct,31);
-        Bond bond2Y("2Y", idType,"T", 0.015, maturityDate);
-            
-        
-        high_resolution_clock::time_point now = high_resolution_clock::now();
-        std::time_t now_c = std::chrono::high_resolution_clock::to_time_t(now);
-        char ch[64];
-        strftime(ch, sizeof(ch), "%Y-%m-%d %H-%M-%S", localtime(&now_c)); //年-月-日 时-分-秒
-    
-        auto key1 = hash<string>{}(ch);
-        std::stringstream ss1;
-        ss1  << key1;
-        std::string OrderId1 = ss1.str();
-        std::string cusip = "912828F62";
-    
-        string buyparentOrderId = cusip+OrderId1;
-        ExecutionOrder<Bond> obj1 = ExecutionOrder<Bond>(bond2Y,side1,buyparentOrderId,orderType,buyPrice,quant,0,buyparentOrderId,isChildOrder);
-
-        //str2 = datetime.datetime.now().strftime("%Y-%T");
-        high_resolution_clock::time_point now2 = high_resolution_clock::now();
-        std::time_t now_c2 = std::chrono::high_resolution_clock::to_time_t(now2);
-        char ch2[64];
-        strftime(ch2, sizeof(ch2), "%Y-%m-%d %H-%M-%S", localtime(&now_c2)); //年-月-日 时-分-秒
-    
-        auto key2 = hash<string>{}(ch2);
-        std::stringstream ss2;
-        ss2  << key2;
-        std::string OrderId2 = ss2.str();
-        string sellparentOrderId = "912828F62"+OrderId2;
-        ExecutionOrder<Bond> obj2 = ExecutionOrder<Bond>(bond2Y,side2,sellparentOrderId,orderType,sellPrice,-quant,0,sellparentOrderId,isChildOrder);  
-       
-        res.push_back(obj1);
-        res.push_back(obj2);
-        return res; 
-      }
-     /* else if(productType == "3Y")
-      {
-        
-        BondIdType idType = CUSIP;
-        date maturityDate(2020,Nov,15);
-        Bond bond3Y("3Y", idType, "T", 0.0175, maturityDate);
-            
-        
-
-       // str1 = datetime.datetime.now().strftime("%Y-%T");
-        auto key1 = hash(str1);
-        std::stringstream ss1;
-        ss1  << key1;
-        std::string OrderId1 = ss1.str();
-        
-        string buyparentOrderId = "9128283G3"+OrderId1;
-
-        ExecutionOrder<Bond> obj1 = ExecutionOrder<Bond>(bond3Y,side1,buyparentOrderId,orderType,buyPrice,quant,0,buyparentOrderId,isChildOrder);
-
-        //str2 = datetime.datetime.now().strftime("%Y-%T");
-        auto key2 = hash(str2);
-        std::stringstream ss1;
-        ss1  << key2;
-        std::string OrderId2 = ss2.str();
-        string sellparentOrderId = "9128283G3"+OrderId2;
-        ExecutionOrder<Bond> obj2 = ExecutionOrder<Bond>(bond3Y,side2,sellparentOrderId,orderType,sellPrice,quant,0,sellparentOrderId,isChildOrder);  
-        res.push_back(obj1);
-        res.push_back(obj2);
-        return res; 
-      }
-       else if(productType == "5Y")
-      {
-        
-        BondIdType idType = CUSIP;
-        date maturityDate(2022,Oct,31);
-        Bond bond5Y("5Y", idType, "T", 0.02, maturityDate);
-            
-       // str1 = datetime.datetime.now().strftime("%Y-%T");
-        auto key1 = hash(str1);
-        std::stringstream ss1;
-        ss1  << key1;
-        std::string OrderId1 = ss1.str();
-        
-        string buyparentOrderId = "9128283C2"+OrderId1;
-        ExecutionOrder<Bond> obj1 = ExecutionOrder<Bond>(bond5Y,side1,buyparentOrderId,orderType,buyPrice,quant,0,buyparentOrderId,isChildOrder);
-
-        //str2 = datetime.datetime.now().strftime("%Y-%T");
-        auto key2 = hash(str2);
-        std::stringstream ss1;
-        ss1  << key2;
-        std::string OrderId2 = ss2.str();
-        string sellparentOrderId = "9128283C2"+OrderId2;
-        ExecutionOrder<Bond> obj2 = ExecutionOrder<Bond>(bond5Y,side2,sellparentOrderId,orderType,sellPrice,quant,0,sellparentOrderId,isChildOrder);  
-        res.push_back(obj1);
-        res.push_back(obj2);
-        return res; 
-      }
-       else if(productType == "7Y")
-      {
-        
-        BondIdType idType = CUSIP;
-        date maturityDate(2024,Oct,31);
-        Bond bond7Y("7Y", idType, "T", 0.0225, maturityDate);
-            
-        //str1 = datetime.datetime.now().strftime("%Y-%T");
-        auto key1 = hash(str1);
-        std::stringstream ss1;
-        ss1  << key1;
-        std::string OrderId1 = ss1.str();
-        
-        string buyparentOrderId = "9128283D0"+OrderId1;
-        ExecutionOrder<Bond> obj1 = ExecutionOrder<Bond>(bond7Y,side1,buyparentOrderId,orderType,buyPrice,quant,0,buyparentOrderId,isChildOrder);
-
-        //str2 = datetime.datetime.now().strftime("%Y-%T");
-        auto key2 = hash(str2);
-        std::stringstream ss1;
-        ss1  << key2;
-        std::string OrderId2 = ss2.str();
-        string sellparentOrderId = "9128283D0"+OrderId2;
-        ExecutionOrder<Bond> obj2 = ExecutionOrder<Bond>(bond7Y,side2,sellparentOrderId,orderType,sellPrice,quant,0,sellparentOrderId,isChildOrder);  
-        res.push_back(obj1);
-        res.push_back(obj2);
-        return res; 
-      }
-       else if(productType == "10Y")
-      {
-        
-       BondIdType idType = CUSIP;
-       date maturityDate(2027,Nov,15);
-       Bond bond10Y("10Y", idType, "T", 0.0225, maturityDate);
-            
-        //str1 = datetime.datetime.now().strftime("%Y-%T");
-        auto key1 = hash(str1);
-        std::stringstream ss1;
-        ss1  << key1;
-        std::string OrderId1 = ss1.str();
-        
-        string buyparentOrderId = "9128283F5"+OrderId1;
-        ExecutionOrder<Bond> obj1 = ExecutionOrder<Bond>(bond10Y,side1,buyparentOrderId,orderType,buyPrice,quant,0,buyparentOrderId,isChildOrder);
-
-       // str2 = datetime.datetime.now().strftime("%Y-%T");
-        auto key2 = hash(str2);
-        std::stringstream ss1;
-        ss1  << key2;
-        std::string OrderId2 = ss2.str();
-        string sellparentOrderId = "9128283F5"+OrderId2;
-        ExecutionOrder<Bond> obj2 = ExecutionOrder<Bond>(bond10Y,side2,sellparentOrderId,orderType,sellPrice,quant,0,sellparentOrderId,isChildOrder);  
-        res.push_back(obj1);
-        res.push_back(obj2);
-        return res; 
-      }
-       else if(productType == "30Y")
-      {
-        
-        BondIdType idType = CUSIP;
-        date maturityDate(2047,Nov,15);
-        Bond bond30Y("30Y", idType, "T", 0.0275, maturityDate);
-            
-        //str1 = datetime.datetime.now().strftime("%Y-%T");
-        auto key1 = hash(str1);
-        std::stringstream ss1;
-        ss1  << key1;
-        std::string OrderId1 = ss1.str();
-        
-        string buyparentOrderId = "912810RZ3"+OrderId1;
-        ExecutionOrder<Bond> obj1 = ExecutionOrder<Bond>(bond30Y,side1,buyparentOrderId,orderType,buyPrice,quant,0,buyparentOrderId,isChildOrder);
-
-        //str2 = datetime.datetime.now().strftime("%Y-%T");
-        auto key2 = hash(str2);
-        std::stringstream ss1;
-        ss1  << key2;
-        std::string OrderId2 = ss2.str();
-        string sellparentOrderId = "912810RZ3"+OrderId2;
-        ExecutionOrder<Bond> obj2 = ExecutionOrder<Bond>(bond30Y,side2,sellparentOrderId,orderType,sellPrice,quant,0,sellparentOrderId,isChildOrder);  
-        res.push_back(obj1);
-        res.push_back(obj2);
-        return res; 
-      }*/
-  }
-
-  void AddExecutionOrder( OrderBook<Bond>& data )
-  {
-    std::vector< AlgoExecution<Bond> > bestOrder = GetBestExecution(data);
-    AlgoExecutionMP.insert(std::pair<string,AlgoExecution<Bond> >(bestOrder[0].GetOrderId(), bestOrder[0]));
-    AlgoExecutionMP.insert(std::pair<string,AlgoExecution<Bond> >(bestOrder[1].GetOrderId(), bestOrder[1]));
-    
+  template<typename Strategy>
+  void AddExecutionOrder( BondOrderBook& data, const Strategy &strategy )
+  {
+    lock_guard<recursive_mutex> guard(SlicingLock);
+    // Slices come due between books, and go out on the book after, or on the timer
+    if(SliceTimers.GetTimers() > 0)
+    {
+      OnTimer(TimerWheel::Now());
+    }
+    std::vector< AlgoExecution<Bond> > bestOrder = GetBestExecution(data, strategy);
+    if(bestOrder.empty())
+    {
+      return;
+    }
     std::cout<<bestOrder[0].GetOrderId()<<std::endl;
     std::cout<<bestOrder[1].GetOrderId()<<std::endl;
-    OnMessage(data);
+    SendBestExecution(bestOrder);
     std::cout<<"trade executed"<<std::endl;
 
   }
 
 
-  void OnMessage(OrderBook<Bond> orderBook)
+  // An update that changed only levels deeper than the strategy reads would give the same
+  // decision again, so it is skipped. The levels are those of the book the update is to,
+  // which is the book the strategy decides on.
+  void OnBookUpdate( BondOrderBook& data )
   {
-    //to be developed
-    
-    std::vector< AlgoExecution<Bond> > bestOrder = GetBestExecution(orderBook);
-    AlgoExecutionMP.insert(std::pair<string,AlgoExecution<Bond> >(bestOrder[0].GetOrderId(), bestOrder[0]));
-    AlgoExecutionMP.insert(std::pair<string,AlgoExecution<Bond> >(bestOrder[1].GetOrderId(), bestOrder[1]));
-    if(BondAlgoExecutionServiceListener.size()!=0)
+    OnBookUpdate(data, DefaultStrategy);
+  }
+
+  template<typename Strategy>
+  void OnBookUpdate( BondOrderBook& data, const Strategy &strategy )
+  {
+    int depth = strategy.GetBookDepth();
+    if(data.GetChangedLevel(BID) >= depth && data.GetChangedLevel(OFFER) >= depth)
     {
-    for(int i = 0; i<BondAlgoExecutionServiceListener.size();i++)
+      SkippedUpdates++;
+      return;
+    }
+    AddExecutionOrder(data, strategy);
+  }
+
+  // Number of book updates skipped by OnBookUpdate
+  long GetSkippedUpdates() const
+  {
+    return SkippedUpdates;
+  }
+
+  // Keep the latest microstructure signals of a product
+  void OnSignals(const BookSignals &signals)
+  {
+    if(signals.productIndex >= 0 && signals.productIndex < BOND_COUNT)
     {
-    
-      BondAlgoExecutionServiceListener[i]->ProcessAdd(bestOrder[0]);
-      BondAlgoExecutionServiceListener[i]->ProcessAdd(bestOrder[1]);
-      
+      Signals[signals.productIndex] = signals;
     }
+  }
+
+  // Get the latest microstructure signals of a product
+  const BookSignals& GetSignals(int productIndex) const
+  {
+    return Signals[productIndex];
+  }
+
+  void OnMessage(BondOrderBook &orderBook)
+  {
+    OnMessage(orderBook, DefaultStrategy);
+  }
+
+  template<typename Strategy>
+  void OnMessage(BondOrderBook &orderBook, const Strategy &strategy)
+  {
+    lock_guard<recursive_mutex> guard(SlicingLock);
+    std::vector< AlgoExecution<Bond> > bestOrder = GetBestExecution(orderBook, strategy);
+    if(bestOrder.empty())
+    {
+      return;
     }
+    SendBestExecution(bestOrder);
   }
 
 };
 
 
-class BondMarketDataAlgoExecutionServiceListener : public ServiceListener< OrderBook <Bond> >
+class BondSignalAlgoExecutionServiceListener : public ServiceListener< BookSignals >
+{
+    private:
+      BondAlgoExecutionService* AlgoExecutionService;
+    public:
+      BondSignalAlgoExecutionServiceListener(BondAlgoExecutionService* AlgoExecutionService_):AlgoExecutionService(AlgoExecutionService_){};
+
+  // Listener callback to process an add event to the Service
+  virtual void ProcessAdd(BookSignals &data)
+  {
+    AlgoExecutionService->OnSignals(data);
+  }
+
+  // Listener callback to process a remove event to the Service
+  virtual void ProcessRemove(BookSignals &data)
+  {
+
+  }
+
+  // Listener callback to process an update event to the Service
+  virtual void ProcessUpdate(BookSignals &data)
+  {
+    ProcessAdd(data);
+  }
+};
+
+
+class BondMarketDataAlgoExecutionServiceListener : public ServiceListener< BondOrderBook >
 {
     private:
       BondAlgoExecutionService* AlgoExecutionService;
@@ -446,7 +658,7 @@ class BondMarketDataAlgoExecutionServiceListener : public ServiceListener< Order
       BondMarketDataAlgoExecutionServiceListener(BondAlgoExecutionService* AlgoExecutionService_):AlgoExecutionService(AlgoExecutionService_){};
     
     // Listener callback to process an add event to the Service
-  virtual void ProcessAdd(OrderBook<Bond> &data)
+  virtual void ProcessAdd(BondOrderBook &data)
   {
     //std::cout<<"Listern 1"<<std::endl;
     AlgoExecutionService->AddExecutionOrder(data);
@@ -454,15 +666,55 @@ class BondMarketDataAlgoExecutionServiceListener : public ServiceListener< Order
   }
 
   // Listener callback to process a remove event to the Service
-  virtual void ProcessRemove(OrderBook<Bond> &data)
+  virtual void ProcessRemove(BondOrderBook &data)
   {
 
   }
 
   // Listener callback to process an update event to the Service
-  virtual void ProcessUpdate(OrderBook<Bond> &data)
+  virtual void ProcessUpdate(BondOrderBook &data)
+  {
+    AlgoExecutionService->OnBookUpdate(data);
+  }
+};
+
+
+/**
+ * Executes the books of a group of products on a strategy, compiled into the callback for
+ * each strategy and group.
+ */
+template<typename Strategy, ProductGroup Group = ALL_PRODUCTS>
+class BondMarketDataStrategyAlgoExecutionServiceListener : public ServiceListener< BondOrderBook >
+{
+    private:
+      BondAlgoExecutionService* AlgoExecutionService;
+      const Strategy* AlgoStrategy;
+    public:
+      BondMarketDataStrategyAlgoExecutionServiceListener(BondAlgoExecutionService* AlgoExecutionService_, const Strategy* AlgoStrategy_):
+        AlgoExecutionService(AlgoExecutionService_), AlgoStrategy(AlgoStrategy_){};
+
+  // Listener callback to process an add event to the Service
+  virtual void ProcessAdd(BondOrderBook &data)
   {
+    if(IsInGroup(Group, data.GetProductIndex()))
+    {
+      AlgoExecutionService->AddExecutionOrder(data, *AlgoStrategy);
+    }
+  }
+
+  // Listener callback to process a remove event to the Service
+  virtual void ProcessRemove(BondOrderBook &data)
+  {
+
+  }
 
+  // Listener callback to process an update event to the Service
+  virtual void ProcessUpdate(BondOrderBook &data)
+  {
+    if(IsInGroup(Group, data.GetProductIndex()))
+    {
+      AlgoExecutionService->OnBookUpdate(data, *AlgoStrategy);
+    }
   }
 };
 
@@ -473,6 +725,25 @@ class BondMarketDataAlgoExecutionServiceListener : public ServiceListener< Order
 
 
 
+/**
+ * Listens to the orders an execution service sends to venues, and to their fills.
+ */
+class VenueExecutionListener
+{
+
+public:
+
+  virtual ~VenueExecutionListener() {}
+
+  // An order sent to a venue
+  virtual void OnVenueOrder(const ExecutionOrder<Bond> &order, Market venue) = 0;
+
+  // A fill of an order sent to a venue
+  virtual void OnVenueFill(const ExecutionOrder<Bond> &order, Market venue, TickPrice price, long quantity) = 0;
+
+};
+
+
 /**
  * Service for executing orders on an exchange.
  * Keyed on product identifier.
@@ -497,9 +768,242 @@ class BondExecutionService : public ExecutionService< Bond >
   map<string,ExecutionOrder<Bond> > ExecutionOrderMP;
   map<string,Trade<Bond> > ExecutionTradeMP;
   vector< ServiceListener< ExecutionOrder<Bond> >* > BondExecutionServiceListener;
+  vector< ServiceListener<ExecutionReport>* > ReportListeners;
+  vector<VenueExecutionListener*> VenueListeners;
+  MatchingEngine* Exchanges[MARKET_COUNT];
+  unordered_map<uint64_t, ExecutionOrder<Bond> > LiveOrders;   // sent to an exchange and not yet done
+  uint64_t NextOrderId;
+  OrderStore Orders;                                           // state of every order sent
+  BondPreTradeRiskGate* RiskGate;
+
+  // A stop order held until market data reaches its price, and the market it goes to
+  struct HeldStop
+  {
+    ExecutionOrder<Bond> order;
+    Market market;
+  };
+  StopTriggerEngine<HeldStop> StopOrders;
+  const BondMarketDataService* StopMarketData;                 // 0 to execute stops as they come
+  BondOrderBook QuotedBooks[MARKET_COUNT][BOND_COUNT];
+  vector<uint64_t> QuoteIds[MARKET_COUNT][BOND_COUNT];
+  uint64_t NextQuoteId;
+  bool ProcessingReports;
+
+  // Send a request to an exchange, taking its reports while there is no room for it
+  void Send(MatchingEngine* exchange, const EngineRequest& request)
+  {
+    while(!exchange->Submit(request))
+    {
+      ProcessReports();
+      if(exchange->IsRunning())
+      {
+        this_thread::yield();
+      }
+      else
+      {
+        exchange->Poll();
+      }
+    }
+  }
+
+  // Process what was sent to an exchange with no thread of its own
+  void PollExchange(MatchingEngine* exchange)
+  {
+    if(!exchange->IsRunning())
+    {
+      while(exchange->Poll() > 0)
+      {
+      }
+    }
+  }
+
+  // Book a fill of an order sent to an exchange, as a child order with an ID of its own.
+  // The fill of a child order is a child of the child's parent, where it counts.
+  void BookFill(const ExecutionOrder<Bond>& order, const ExecutionReport& report)
+  {
+    long quant = report.side == OFFER ? -report.quantity : report.quantity;
+    string tradeId = OrderIdService::ToString(report.executionId) + (report.side == BID ? "B" : "S");
+    string book = GetBookName(rand() % BOOK_COUNT);
+    ExecutionTradeMP.insert(std::pair<string,Trade<Bond> >(tradeId, Trade<Bond>(order.GetProduct(),tradeId,report.price,book,quant,quant < 0 ? SELL : BUY)));
+    ExecutionOrder<Bond> fill(order.GetProduct(),report.side,tradeId,order.GetOrderType(),report.price,quant,0,
+      order.IsChildOrder() ? order.GetParentOrderId() : order.GetOrderId(),true);
+    for(int i = 0; i<VenueListeners.size(); i++)
+    {
+      VenueListeners[i]->OnVenueFill(order, report.venue, report.price, report.quantity);
+    }
+    OnMessage(fill);
+  }
 
   public:
 
+  // Quotes get IDs of their own, with the top bit set, apart from those of orders
+  BondExecutionService():NextOrderId(0),RiskGate(0),StopMarketData(0),NextQuoteId(uint64_t(1) << 63),ProcessingReports(false)
+  {
+    for(int i = 0; i<MARKET_COUNT; i++)
+    {
+      Exchanges[i] = 0;
+    }
+  }
+
+  // Send orders for a market to a matching engine, instead of filling them in full at
+  // their price
+  void AddExchange(Market market, MatchingEngine* exchange)
+  {
+    Exchanges[market] = exchange;
+  }
+
+  // Replace the quotes of a product on the exchange of a venue with the levels of the
+  // venue's book, as the liquidity orders sent there trade against. Quotes get no reports.
+  void QuoteBook(const BondOrderBook& book, Market venue)
+  {
+    MatchingEngine* exchange = Exchanges[venue];
+    int index = book.GetProductIndex();
+    BondOrderBook& quoted = QuotedBooks[venue][index];
+    if(!exchange || (quoted.GetBidLevels() == book.GetBidLevels() && quoted.GetOfferLevels() == book.GetOfferLevels()
+      && quoted.GetBidPrices() == book.GetBidPrices() && quoted.GetBidSizes() == book.GetBidSizes()
+      && quoted.GetOfferPrices() == book.GetOfferPrices() && quoted.GetOfferSizes() == book.GetOfferSizes()))
+    {
+      return;
+    }
+    quoted = book;
+
+    vector<uint64_t>& quotes = QuoteIds[venue][index];
+    for(int i = 0; i<quotes.size(); i++)
+    {
+      EngineRequest cancel = { CANCEL_ORDER, quotes[i], index, BID, LIMIT, TickPrice(), 0, true };
+      Send(exchange, cancel);
+    }
+    quotes.clear();
+    for(int i = 0; i<book.GetBidLevels() + book.GetOfferLevels(); i++)
+    {
+      bool bid = i < book.GetBidLevels();
+      int level = bid ? i : i - book.GetBidLevels();
+      EngineRequest quote = { NEW_ORDER, NextQuoteId++, index, bid ? BID : OFFER, LIMIT,
+        bid ? book.GetBidPrice(level) : book.GetOfferPrice(level), bid ? book.GetBidSize(level) : book.GetOfferSize(level), true };
+      Send(exchange, quote);
+      quotes.push_back(quote.orderId);
+    }
+    PollExchange(exchange);
+  }
+
+  // Check every order against a risk gate before it is executed
+  void SetRiskGate(BondPreTradeRiskGate* gate)
+  {
+    RiskGate = gate;
+  }
+
+  // Hold stop orders until the top of book of a product in market data reaches their
+  // price, then execute them as market orders
+  void HoldStops(const BondMarketDataService* marketData)
+  {
+    StopMarketData = marketData;
+  }
+
+  // Execute the stops held for a product that the top of its book has reached. Returns
+  // the number executed.
+  int TriggerStops(int productIndex)
+  {
+    if(!StopMarketData || StopOrders.GetStops() == 0)
+    {
+      return 0;
+    }
+    return StopOrders.OnTopOfBook(productIndex, StopMarketData->GetTopOfBook(productIndex), [this](HeldStop &stop)
+    {
+      const ExecutionOrder<Bond> &held = stop.order;
+      ExecutionOrder<Bond> order(held.GetProduct(), held.GetSide(), held.GetOrderId(), MARKET, held.GetTickPrice(),
+        held.GetVisibleQuantity(), held.GetHiddenQuantity(), held.GetParentOrderId(), held.IsChildOrder());
+      ExecuteOrder(order, stop.market);
+    });
+  }
+
+  // Get the number of stop orders held
+  size_t GetHeldStops() const
+  {
+    return StopOrders.GetStops();
+  }
+
+  // Get the number of stop orders triggered
+  long GetTriggeredStops() const
+  {
+    return StopOrders.GetTriggered();
+  }
+
+  // Add a listener for every order sent to a venue and every fill of one, on an exchange
+  // or not
+  void AddVenueListener(VenueExecutionListener *listener)
+  {
+    VenueListeners.push_back(listener);
+  }
+
+  // Add a listener for every execution report of the exchanges
+  void AddReportListener(ServiceListener<ExecutionReport> *listener)
+  {
+    ReportListeners.push_back(listener);
+  }
+
+  // Take the reports of every exchange, book their fills and pass them to report listeners.
+  // Call from the thread executing orders. Returns the number of reports.
+  int ProcessReports()
+  {
+    // Listeners of fills may send orders, which take reports themselves; those are left to
+    // the call already taking them
+    if(ProcessingReports)
+    {
+      return 0;
+    }
+    ProcessingReports = true;
+    int processed = 0;
+    ExecutionReport report;
+    for(int m = 0; m<MARKET_COUNT; m++)
+    {
+      while(Exchanges[m] && Exchanges[m]->PollReport(report))
+      {
+        processed++;
+        OrderRecord* record = Orders.Find(report.orderId);
+        long leaves = record ? record->GetLeavesQuantity() : 0;
+        Orders.Apply(report);
+        if(RiskGate && record)
+        {
+          // What the order no longer has working, filled or done, is given back to the gate
+          OrderRecord* after = Orders.Find(report.orderId);
+          RiskGate->Release(report.productIndex, report.side, leaves - (after ? after->GetLeavesQuantity() : 0));
+        }
+        unordered_map<uint64_t, ExecutionOrder<Bond> >::iterator found = LiveOrders.find(report.orderId);
+        if(found == LiveOrders.end())
+        {
+          continue;
+        }
+        ExecutionOrder<Bond> order = found->second;
+        if(report.leavesQuantity == 0)
+        {
+          LiveOrders.erase(found);
+        }
+        if(report.type == ORDER_FILLED)
+        {
+          BookFill(order, report);
+        }
+        for(int i = 0; i<ReportListeners.size(); i++)
+        {
+          ReportListeners[i]->ProcessAdd(report);
+        }
+      }
+    }
+    ProcessingReports = false;
+    return processed;
+  }
+
+  // Number of orders sent to exchanges and not yet done
+  size_t GetLiveOrders() const
+  {
+    return LiveOrders.size();
+  }
+
+  // Get the state of the orders sent, open and recently done
+  const OrderStore& GetOrderStore() const
+  {
+    return Orders;
+  }
+
   // Get data on our service given a key
   virtual ExecutionOrder<Bond>& GetData(string key)
   {
@@ -542,12 +1046,66 @@ class BondExecutionService : public ExecutionService< Bond >
 
   void ExecuteOrder( ExecutionOrder<Bond>& order, Market market)
   {
+      MatchingEngine* exchange = Exchanges[market];
+      int productIndex = GetBondIndex(order.GetProduct().GetProductId());
+      if(StopMarketData && order.GetOrderType() == STOP && productIndex >= 0)
+      {
+        // Checked against risk once triggered, which may be at once
+        HeldStop stop = { order, market };
+        StopOrders.Add(productIndex, order.GetSide(), order.GetTickPrice(), stop);
+        TriggerStops(productIndex);
+        return;
+      }
+      if(RiskGate && RiskGate->Check(productIndex, order.GetSide(), order.GetTickPrice(),
+        labs(order.GetVisibleQuantity()) + labs(order.GetHiddenQuantity()), TimerWheel::Now()) != RISK_PASSED)
+      {
+        uint64_t orderId = ++NextOrderId;
+        Orders.Add(orderId, 0, productIndex, order.GetSide(), order.GetOrderType(), market, order.GetTickPrice(),
+          labs(order.GetVisibleQuantity()) + labs(order.GetHiddenQuantity()));
+        Orders.Reject(orderId);
+        return;
+      }
+      for(int i = 0; i<VenueListeners.size(); i++)
+      {
+        VenueListeners[i]->OnVenueOrder(order, market);
+      }
+      if(exchange)
+      {
+        // Fills come back as reports, whenever the exchange gets to the order. An exchange
+        // with no thread of its own is polled here.
+        long quantity = labs(order.GetVisibleQuantity()) + labs(order.GetHiddenQuantity());
+        EngineRequest request = { NEW_ORDER, ++NextOrderId, productIndex,
+          order.GetSide(), order.GetOrderType(), order.GetTickPrice(), quantity };
+        Orders.Add(request.orderId, 0, request.productIndex, request.side, request.orderType, market, request.price, quantity);
+        LiveOrders.insert(std::pair<uint64_t, ExecutionOrder<Bond> >(request.orderId, order));
+        Send(exchange, request);
+        PollExchange(exchange);
+        ProcessReports();
+        return;
+      }
+
       Bond product = order.GetProduct();
       string tradeId = order.GetOrderId();
       double tradePrice = order.GetPrice();
       long quant = order.GetVisibleQuantity();
       string productId = product.GetProductId();
 
+      // Filled in full at its price, straight away
+      uint64_t orderId = ++NextOrderId;
+      if(quant != 0 && Orders.Add(orderId, 0, productIndex, order.GetSide(), order.GetOrderType(), market,
+        order.GetTickPrice(), labs(quant)))
+      {
+        Orders.Fill(orderId, order.GetTickPrice(), labs(quant));
+      }
+      if(RiskGate)
+      {
+        RiskGate->Release(productIndex, order.GetSide(), labs(quant) + labs(order.GetHiddenQuantity()));
+      }
+      for(int i = 0; i<VenueListeners.size() && quant != 0; i++)
+      {
+        VenueListeners[i]->OnVenueFill(order, market, order.GetTickPrice(), labs(quant));
+      }
+
       int bookNum = roll(1,3);
       string book;
 
@@ -647,14 +1205,22 @@ class BondAlgoExecutionExecutionServiceListener : public ServiceListener< AlgoEx
 {
   private:
       BondExecutionService* ExecutionService;
+      const BondMarketDataService* MarketData;
     public:
-      BondAlgoExecutionExecutionServiceListener(BondExecutionService* ExecutionService_):ExecutionService(ExecutionService_){};
+      // ctor; with a market data service each order goes to the venue showing the most size
+      // at its price in the composite book, and otherwise to CME
+      BondAlgoExecutionExecutionServiceListener(BondExecutionService* ExecutionService_, const BondMarketDataService* MarketData_ = 0):ExecutionService(ExecutionService_),MarketData(MarketData_){};
     
     // Listener callback to process an add event to the Service
   virtual void ProcessAdd( AlgoExecution<Bond> &data)
   {
     Market mkt = CME;
     ExecutionOrder<Bond> executedOrder = data.GetExecutionOrder();
+    int index = GetBondIndex(executedOrder.GetProduct().GetProductId());
+    if(MarketData && index >= 0)
+    {
+      MarketData->GetCompositeBook(index).GetLargestVenue(executedOrder.GetSide(), executedOrder.GetTickPrice(), mkt);
+    }
     //std::cout<<"Listern 1"<<std::endl;
     ExecutionService->ExecuteOrder(executedOrder,mkt);
     //std::cout<<"Listern 2"<<std::endl;
@@ -677,6 +1243,100 @@ class BondAlgoExecutionExecutionServiceListener : public ServiceListener< AlgoEx
 
 
 
+/**
+ * Counts fills against the parent orders of algo execution.
+ */
+class BondExecutionAlgoExecutionServiceListener : public ServiceListener< ExecutionOrder<Bond> >
+{
+  private:
+      BondAlgoExecutionService* AlgoExecutionService;
+    public:
+      BondExecutionAlgoExecutionServiceListener(BondAlgoExecutionService* AlgoExecutionService_):AlgoExecutionService(AlgoExecutionService_){};
+
+    // Listener callback to process an add event to the Service
+  virtual void ProcessAdd(ExecutionOrder<Bond> &data)
+  {
+    AlgoExecutionService->OnFill(data);
+  }
+
+  // Listener callback to process a remove event to the Service
+  virtual void ProcessRemove(ExecutionOrder<Bond> &data)
+  {
+
+  }
+
+  // Listener callback to process an update event to the Service
+  virtual void ProcessUpdate(ExecutionOrder<Bond> &data)
+  {
+
+  }
+};
+
+
+/**
+ * Triggers the stop orders held by the execution service as the top of book moves.
+ */
+class BondMarketDataStopExecutionServiceListener : public ServiceListener< BondOrderBook >
+{
+  private:
+      BondExecutionService* ExecutionService;
+    public:
+      BondMarketDataStopExecutionServiceListener(BondExecutionService* ExecutionService_):ExecutionService(ExecutionService_){};
+
+    // Listener callback to process an add event to the Service
+  virtual void ProcessAdd(BondOrderBook &data)
+  {
+    ExecutionService->TriggerStops(data.GetProductIndex());
+  }
+
+  // Listener callback to process a remove event to the Service
+  virtual void ProcessRemove(BondOrderBook &data)
+  {
+
+  }
+
+  // Listener callback to process an update event to the Service
+  virtual void ProcessUpdate(BondOrderBook &data)
+  {
+    ProcessAdd(data);
+  }
+};
+
+
+/**
+ * Quotes the book of every venue into the venue's exchange, if it has one.
+ */
+class BondMarketDataExecutionServiceListener : public ServiceListener< BondOrderBook >
+{
+  private:
+      BondExecutionService* ExecutionService;
+      const BondMarketDataService* MarketData;
+    public:
+      BondMarketDataExecutionServiceListener(BondExecutionService* ExecutionService_, const BondMarketDataService* MarketData_):ExecutionService(ExecutionService_),MarketData(MarketData_){};
+
+    // Listener callback to process an add event to the Service
+  virtual void ProcessAdd(BondOrderBook &data)
+  {
+    for(int v = 0; v<MARKET_COUNT; v++)
+    {
+      ExecutionService->QuoteBook(MarketData->GetVenueBook(Market(v), data.GetProductIndex()), Market(v));
+    }
+  }
+
+  // Listener callback to process a remove event to the Service
+  virtual void ProcessRemove(BondOrderBook &data)
+  {
+
+  }
+
+  // Listener callback to process an update event to the Service
+  virtual void ProcessUpdate(BondOrderBook &data)
+  {
+    ProcessAdd(data);
+  }
+};
+
+
 class BondExecutionTradeBookingServiceListener : public ServiceListener < ExecutionOrder<Bond> >
 {
   private:
@@ -808,6 +1468,20 @@ class BondExecutionTradeBookingServiceListener : public ServiceListener < Execut
 template<typename T>
 ExecutionOrder<T>::ExecutionOrder(const T &_product, PricingSide _side, string _orderId, OrderType _orderType, double _price, double _visibleQuantity, double _hiddenQuantity, string _parentOrderId, bool _isChildOrder) :
   product(_product)
+{
+  side = _side;
+  orderId = _orderId;
+  orderType = _orderType;
+  price = TickPrice::FromDouble(_price);
+  visibleQuantity = _visibleQuantity;
+  hiddenQuantity = _hiddenQuantity;
+  parentOrderId = _parentOrderId;
+  isChildOrder = _isChildOrder;
+}
+
+template<typename T>
+ExecutionOrder<T>::ExecutionOrder(const T &_product, PricingSide _side, string _orderId, OrderType _orderType, TickPrice _price, double _visibleQuantity, double _hiddenQuantity, string _parentOrderId, bool _isChildOrder) :
+  product(_product)
 {
   side = _side;
   orderId = _orderId;
@@ -825,6 +1499,12 @@ const T& ExecutionOrder<T>::GetProduct() const
   return product;
 }
 
+template<typename T>
+PricingSide ExecutionOrder<T>::GetSide() const
+{
+  return side;
+}
+
 template<typename T>
 const string& ExecutionOrder<T>::GetOrderId() const
 {
@@ -839,6 +1519,12 @@ OrderType ExecutionOrder<T>::GetOrderType() const
 
 template<typename T>
 double ExecutionOrder<T>::GetPrice() const
+{
+  return price.ToDouble();
+}
+
+template<typename T>
+TickPrice ExecutionOrder<T>::GetTickPrice() const
 {
   return price;
 }
@@ -0,0 +1,206 @@
+/**
+ * fairvalueengine.hpp
+ * Defines a fair-value engine that prices products from their market data order books.
+ *
+ * For every book the engine computes a micro-price, weighting the volume weighted bid and
+ * offer of all five levels by the size on the opposite side, and an imbalance adjusted
+ * mid, moving the touch mid towards the side with less size. The touch is read from the
+ * top of book cache of the market data service when the engine is given one. The micro-price is sent to
+ * the pricing service as the mid whenever it has moved by at least a configurable
+ * fraction of a tick since the last price sent.
+ */
+#ifndef FAIR_VALUE_ENGINE_HPP
+#define FAIR_VALUE_ENGINE_HPP
+
+#include <cmath>
+
+#include "soa.hpp"
+#include "bondreferencedata.hpp"
+#include "marketdataservice.hpp"
+#include "pricingservice.hpp"
+
+using namespace std;
+
+// Levels looked at on each side of a book
+const int FAIR_VALUE_DEPTH = 5;
+
+// Treasury tick: 1/256th, the smallest increment quoted (a "+" is half of a 1/32nd, 4/256)
+const double BOND_TICK_SIZE = 1.0 / 256;
+
+/**
+ * Fair value of a product from its latest book.
+ */
+struct FairValue
+{
+  double microPrice;          // size weighted across levels
+  double imbalanceMid;        // touch mid adjusted for depth imbalance
+  double imbalance;           // bid size / total size, 0.5 when balanced
+  double bidOfferSpread;      // best offer - best bid
+  double lastSentPrice;       // micro-price last sent to pricing
+  bool sent;                  // has a price been sent yet?
+};
+
+class BondFairValueEngine : public ServiceListener< BondOrderBook >
+{
+
+public:
+
+  // ctor sending prices to a pricing service, once the fair value has moved by
+  // tickFraction ticks. The touch comes from the market data service's top of book if
+  // one is given, and is otherwise found from each book.
+  BondFairValueEngine(BondPricingService &_pricingService, double _tickFraction = 0.5, const BondMarketDataService *_marketData = 0);
+
+  // Change the move, in ticks, needed before a new price is sent
+  void SetTickFraction(double _tickFraction);
+
+  // Get the latest fair value of a product
+  const FairValue& GetFairValue(int productIndex) const;
+
+  // Number of books priced and number of prices sent to pricing
+  long GetBooksPriced() const;
+  long GetPricesSent() const;
+
+  // Compute the fair value of a book, without sending it anywhere. Returns false for an
+  // empty book.
+  static bool ComputeFairValue(const BondOrderBook &book, FairValue &fairValue);
+
+  // Compute the fair value of a book whose top of book is already known
+  static bool ComputeFairValue(const BondOrderBook &book, const TopOfBook &top, FairValue &fairValue);
+
+  // Listener callback to process an add event to the Service
+  virtual void ProcessAdd(BondOrderBook &data);
+
+  // Listener callback to process a remove event to the Service
+  virtual void ProcessRemove(BondOrderBook &data) {}
+
+  // Listener callback to process an update event to the Service
+  virtual void ProcessUpdate(BondOrderBook &data);
+
+private:
+  BondPricingService &pricingService;
+  const BondMarketDataService *marketData;
+  double threshold;
+  FairValue fairValues[BOND_COUNT];
+  long booksPriced;
+  long pricesSent;
+
+};
+
+BondFairValueEngine::BondFairValueEngine(BondPricingService &_pricingService, double _tickFraction, const BondMarketDataService *_marketData) :
+  pricingService(_pricingService), marketData(_marketData), booksPriced(0), pricesSent(0)
+{
+  SetTickFraction(_tickFraction);
+  for(int i = 0; i<BOND_COUNT; i++)
+  {
+    fairValues[i] = FairValue();
+  }
+}
+
+void BondFairValueEngine::SetTickFraction(double _tickFraction)
+{
+  threshold = _tickFraction * BOND_TICK_SIZE;
+}
+
+const FairValue& BondFairValueEngine::GetFairValue(int productIndex) const
+{
+  return fairValues[productIndex];
+}
+
+long BondFairValueEngine::GetBooksPriced() const
+{
+  return booksPriced;
+}
+
+long BondFairValueEngine::GetPricesSent() const
+{
+  return pricesSent;
+}
+
+bool BondFairValueEngine::ComputeFairValue(const BondOrderBook &book, FairValue &fairValue)
+{
+  return ComputeFairValue(book, GetTopOfBook(book), fairValue);
+}
+
+bool BondFairValueEngine::ComputeFairValue(const BondOrderBook &book, const TopOfBook &top, FairValue &fairValue)
+{
+  // Convert the levels into flat arrays of doubles, with missing levels at zero size, so
+  // that the sums below are fixed length loops the compiler can vectorise
+  double bidPrices[FAIR_VALUE_DEPTH] = {}, bidSizes[FAIR_VALUE_DEPTH] = {};
+  double offerPrices[FAIR_VALUE_DEPTH] = {}, offerSizes[FAIR_VALUE_DEPTH] = {};
+  int bidLevels = book.GetBidLevels() < FAIR_VALUE_DEPTH ? book.GetBidLevels() : FAIR_VALUE_DEPTH;
+  int offerLevels = book.GetOfferLevels() < FAIR_VALUE_DEPTH ? book.GetOfferLevels() : FAIR_VALUE_DEPTH;
+  if(bidLevels == 0 || offerLevels == 0 || !top.IsTwoSided())
+  {
+    return false;
+  }
+  for(int i = 0; i<bidLevels; i++)
+  {
+    bidPrices[i] = book.GetBidPrice(i).ToDouble();
+    bidSizes[i] = book.GetBidSize(i);
+  }
+  for(int i = 0; i<offerLevels; i++)
+  {
+    offerPrices[i] = book.GetOfferPrice(i).ToDouble();
+    offerSizes[i] = book.GetOfferSize(i);
+  }
+
+  double bestBid = top.bid.ToDouble(), bestOffer = top.offer.ToDouble();
+  double bidNotional = 0, bidSize = 0, offerNotional = 0, offerSize = 0;
+  for(int i = 0; i<FAIR_VALUE_DEPTH; i++)
+  {
+    bidNotional += bidPrices[i] * bidSizes[i];
+    bidSize += bidSizes[i];
+    offerNotional += offerPrices[i] * offerSizes[i];
+    offerSize += offerSizes[i];
+  }
+  if(bidSize <= 0 || offerSize <= 0)
+  {
+    return false;
+  }
+
+  double totalSize = bidSize + offerSize;
+  double imbalance = bidSize / totalSize;
+  double spread = bestOffer - bestBid;
+
+  // Heavier bids pull the fair value towards the offer, and the other way round
+  fairValue.microPrice = (bidNotional / bidSize) * (1 - imbalance) + (offerNotional / offerSize) * imbalance;
+  fairValue.imbalanceMid = (bestBid + bestOffer) * 0.5 + (imbalance - 0.5) * spread;
+  fairValue.imbalance = imbalance;
+  fairValue.bidOfferSpread = spread;
+  return true;
+}
+
+void BondFairValueEngine::ProcessAdd(BondOrderBook &data)
+{
+  int index = data.GetProductIndex();
+  if(index < 0 || index >= BOND_COUNT)
+  {
+    return;
+  }
+
+  FairValue &fairValue = fairValues[index];
+  TopOfBook top = marketData ? marketData->GetTopOfBook(index) : GetTopOfBook(data);
+  if(!ComputeFairValue(data, top, fairValue))
+  {
+    return;
+  }
+  booksPriced++;
+
+  if(fairValue.sent && fabs(fairValue.microPrice - fairValue.lastSentPrice) < threshold)
+  {
+    return;
+  }
+
+  fairValue.lastSentPrice = fairValue.microPrice;
+  fairValue.sent = true;
+  pricesSent++;
+  Price<Bond> price(data.GetProduct(), fairValue.microPrice, fairValue.bidOfferSpread);
+  pricingService.OnMessage(price);
+}
+
+void BondFairValueEngine::ProcessUpdate(BondOrderBook &data)
+{
+  ProcessAdd(data);
+}
+
+#endif
@@ -0,0 +1,44 @@
+/**
+ * feedconverter.cpp
+ * Converts the input feeds between the text files and the binary format of binaryfeed.hpp.
+ *
+ * Usage: ./feedconverter tobinary <price|marketdata|trade|inquiry> <text file> <binary file>
+ *        ./feedconverter totext <price|marketdata|trade|inquiry|bar> <binary file> <text file>
+ */
+
+#include <string>
+#include <cstdio>
+
+#include "binaryfeed.hpp"
+
+using namespace std;
+
+int main(int argc, char *argv[])
+{
+  if(argc != 5)
+  {
+    fprintf(stderr, "usage: %s tobinary|totext price|marketdata|trade|inquiry|bar <input> <output>\n", argv[0]);
+    return 1;
+  }
+
+  string direction = argv[1];
+  string type = argv[2];
+  long records = -1;
+  if(direction == "tobinary")
+  {
+    records = ConvertFeedToBinary(type, argv[3], argv[4]);
+  }
+  else if(direction == "totext")
+  {
+    records = ConvertFeedToText(type, argv[3], argv[4]);
+  }
+
+  if(records < 0)
+  {
+    fprintf(stderr, "could not convert %s feed %s\n", type.c_str(), argv[3]);
+    return 1;
+  }
+
+  printf("%ld %s records written to %s\n", records, type.c_str(), argv[4]);
+  return 0;
+}
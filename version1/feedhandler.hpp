@@ -0,0 +1,951 @@
+/**
+ * feedhandler.hpp
+ * Defines an incremental market data feed with per-product sequence numbers, the shared
+ * memory rings it is carried on, a publisher that turns books into the feed, and the feed
+ * handler that applies it to the market data service.
+ *
+ * A feed has two channels, each a ring in a shared memory file: level updates, and a loop
+ * of book snapshots. The producer of a ring never waits, so a consumer that falls a whole
+ * ring behind loses messages, as it would lose packets. The handler applies each product's
+ * updates in sequence order, holding any that arrive early. When a missing update has not
+ * turned up within a few messages, the product is recovering: its updates are held, and
+ * the book the service has stays as it was, until a snapshot at or past the gap replaces
+ * it and the held updates after the snapshot are applied. Recovery takes at most one
+ * snapshot interval after the gap is found. A handler that joins a feed already under way
+ * starts every product this way; one that opens it before the first update applies the
+ * updates from the first, on the empty books the service starts with.
+ */
+#ifndef FEED_HANDLER_HPP
+#define FEED_HANDLER_HPP
+
+#include <string>
+#include <cstring>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <stdint.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "soa.hpp"
+#include "bondreferencedata.hpp"
+#include "marketdataservice.hpp"
+
+using namespace std;
+
+// Flag on the last update of a book change. The updates before it are applied with it.
+const uint8_t END_OF_EVENT = 1;
+
+/**
+ * A level update of a product's book, the ith of the product's updates from 1.
+ */
+struct BookUpdateMessage
+{
+  uint64_t sequence;
+  uint8_t productIndex;
+  uint8_t side;           // PricingSide
+  uint8_t action;         // BookAction
+  uint8_t level;
+  uint8_t flags;          // END_OF_EVENT
+  uint8_t padding[3];
+  int64_t price;          // ticks
+  int64_t size;
+};
+
+/**
+ * A product's whole book as of one of its updates.
+ */
+struct BookSnapshotMessage
+{
+  uint64_t sequence;      // last update of the product included
+  uint8_t productIndex;
+  uint8_t bidLevels;
+  uint8_t offerLevels;
+  uint8_t padding[5];
+  int64_t bidPrices[MARKET_DATA_DEPTH];
+  int64_t bidSizes[MARKET_DATA_DEPTH];
+  int64_t offerPrices[MARKET_DATA_DEPTH];
+  int64_t offerSizes[MARKET_DATA_DEPTH];
+};
+
+static_assert(sizeof(BookUpdateMessage) == 32, "BookUpdateMessage layout changed");
+static_assert(sizeof(BookSnapshotMessage) == 16 + 4 * 8 * MARKET_DATA_DEPTH, "BookSnapshotMessage layout changed");
+
+/**
+ * A ring of messages of type M in a shared memory file, with one producer and one
+ * consumer, which may be in different processes. Each slot holds the position of its
+ * message, which the consumer checks before and after copying the message out, so that a
+ * message overwritten while it was read is counted as lost rather than returned torn.
+ */
+template<typename M>
+class FeedRing
+{
+
+public:
+
+  // ctor for a ring not yet mapped
+  FeedRing();
+
+  ~FeedRing();
+
+  // Create the ring at a path, replacing any file there, with room for capacity messages
+  // rounded up to a power of two. For the producer.
+  bool Create(const char *path, uint32_t capacity);
+
+  // Map a ring that a producer has created, to read from the next message it publishes.
+  // For the consumer. Returns false until the producer has created it.
+  bool Open(const char *path);
+
+  // Is the ring mapped?
+  bool IsValid() const;
+
+  // Get the number of messages published before the next one to read
+  uint64_t GetPosition() const;
+
+  // Get the number of consumers that have opened the ring
+  uint32_t GetConsumers() const;
+
+  // Publish a message. A consumer a whole ring behind loses the oldest messages.
+  void Publish(const M &message);
+
+  // Mark the end of the messages
+  void Close();
+
+  // Read the next message. Returns 1 for a message, 0 if there is none yet, and -1 once
+  // the ring is closed and read to the end.
+  int Poll(M &message);
+
+  // Get the number of messages overwritten before they were read
+  uint64_t GetLost() const;
+
+private:
+  FeedRing(const FeedRing &);
+  FeedRing& operator=(const FeedRing &);
+
+  static_assert(sizeof(M) % 8 == 0, "ring messages are copied in eight byte words");
+  static const int WORDS = sizeof(M) / 8;
+  static const uint32_t MAGIC = 0x31474e52;    // "RNG1"
+
+  struct Header
+  {
+    atomic<uint32_t> magic;       // set last by the producer
+    uint32_t messageSize;
+    uint32_t capacity;
+    atomic<uint32_t> consumers;   // opened by Open
+    char padding[48];
+    atomic<uint64_t> published;   // messages published, on a cache line of its own
+    atomic<uint32_t> closed;
+    char padding2[52];
+  };
+
+  struct Slot
+  {
+    atomic<uint64_t> position;    // position of the message + 1, 0 while it is written
+    atomic<uint64_t> words[WORDS];
+  };
+
+  bool Map(int fd, size_t size);
+
+  Header *header;
+  Slot *slots;
+  size_t length;
+  uint64_t mask;
+  uint64_t position;
+  uint64_t lost;
+
+};
+
+template<typename M>
+FeedRing<M>::FeedRing() : header(0), slots(0), length(0), mask(0), position(0), lost(0)
+{
+}
+
+template<typename M>
+FeedRing<M>::~FeedRing()
+{
+  if(header)
+  {
+    munmap(header, length);
+  }
+}
+
+template<typename M>
+bool FeedRing<M>::Map(int fd, size_t size)
+{
+  void *mapping = mmap(0, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if(mapping == MAP_FAILED)
+  {
+    return false;
+  }
+  header = static_cast<Header*>(mapping);
+  slots = reinterpret_cast<Slot*>(static_cast<char*>(mapping) + sizeof(Header));
+  length = size;
+  return true;
+}
+
+template<typename M>
+bool FeedRing<M>::Create(const char *path, uint32_t capacity)
+{
+  uint32_t size = 1;
+  while(size < capacity)
+  {
+    size <<= 1;
+  }
+
+  // A new file, so that a consumer still mapping the last one is not written over
+  unlink(path);
+  int fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0644);
+  if(fd < 0)
+  {
+    return false;
+  }
+  size_t bytes = sizeof(Header) + size_t(size) * sizeof(Slot);
+  if(ftruncate(fd, bytes) != 0)
+  {
+    close(fd);
+    return false;
+  }
+  if(!Map(fd, bytes))
+  {
+    return false;
+  }
+
+  // The file is zeroed: nothing published, and no slot holding a message
+  header->messageSize = sizeof(M);
+  header->capacity = size;
+  header->magic.store(MAGIC, memory_order_release);
+  mask = size - 1;
+  return true;
+}
+
+template<typename M>
+bool FeedRing<M>::Open(const char *path)
+{
+  int fd = open(path, O_RDWR);
+  if(fd < 0)
+  {
+    return false;
+  }
+  struct stat info;
+  if(fstat(fd, &info) != 0 || size_t(info.st_size) < sizeof(Header) || !Map(fd, info.st_size))
+  {
+    return false;
+  }
+
+  if(header->magic.load(memory_order_acquire) != MAGIC || header->messageSize != sizeof(M)
+    || length < sizeof(Header) + size_t(header->capacity) * sizeof(Slot))
+  {
+    munmap(header, length);
+    header = 0;
+    return false;
+  }
+  mask = header->capacity - 1;
+  position = header->published.load(memory_order_acquire);
+  header->consumers.fetch_add(1, memory_order_release);
+  return true;
+}
+
+template<typename M>
+bool FeedRing<M>::IsValid() const
+{
+  return header != 0;
+}
+
+template<typename M>
+uint64_t FeedRing<M>::GetPosition() const
+{
+  return position;
+}
+
+template<typename M>
+uint32_t FeedRing<M>::GetConsumers() const
+{
+  return header->consumers.load(memory_order_acquire);
+}
+
+template<typename M>
+void FeedRing<M>::Publish(const M &message)
+{
+  uint64_t next = header->published.load(memory_order_relaxed);
+  Slot &slot = slots[next & mask];
+  uint64_t words[WORDS];
+  memcpy(words, &message, sizeof(M));
+
+  slot.position.store(0, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  for(int i = 0; i<WORDS; i++)
+  {
+    slot.words[i].store(words[i], memory_order_relaxed);
+  }
+  slot.position.store(next + 1, memory_order_release);
+  header->published.store(next + 1, memory_order_release);
+}
+
+template<typename M>
+void FeedRing<M>::Close()
+{
+  header->closed.store(1, memory_order_release);
+}
+
+template<typename M>
+int FeedRing<M>::Poll(M &message)
+{
+  for(;;)
+  {
+    uint64_t published = header->published.load(memory_order_acquire);
+    if(position == published)
+    {
+      return header->closed.load(memory_order_acquire) && position == header->published.load(memory_order_acquire) ? -1 : 0;
+    }
+    if(published - position > mask + 1)
+    {
+      lost += published - (mask + 1) - position;
+      position = published - (mask + 1);
+    }
+
+    Slot &slot = slots[position & mask];
+    uint64_t words[WORDS];
+    uint64_t before = slot.position.load(memory_order_acquire);
+    for(int i = 0; i<WORDS; i++)
+    {
+      words[i] = slot.words[i].load(memory_order_relaxed);
+    }
+    atomic_thread_fence(memory_order_acquire);
+    uint64_t after = slot.position.load(memory_order_relaxed);
+
+    position++;
+    if(before == position && after == before)
+    {
+      memcpy(&message, words, sizeof(M));
+      return 1;
+    }
+    lost++;
+  }
+}
+
+template<typename M>
+uint64_t FeedRing<M>::GetLost() const
+{
+  return lost;
+}
+
+// Path of each channel's ring, from the prefix of a feed
+inline string GetUpdateChannel(const string &prefix)
+{
+  return prefix + ".updates";
+}
+
+inline string GetSnapshotChannel(const string &prefix)
+{
+  return prefix + ".snapshots";
+}
+
+// Messages each channel's ring holds
+const uint32_t UPDATE_RING_CAPACITY = 1 << 16;
+const uint32_t SNAPSHOT_RING_CAPACITY = 1 << 10;
+
+
+/**
+ * Publishes books as a feed: each book as the level updates from the last book of its
+ * product, and every so many updates a snapshot of every product. To exercise the feed
+ * handler it can leave out one update in dropEvery, and send one in reorderEvery after the
+ * update that follows it.
+ */
+class BondMarketDataFeedPublisher
+{
+
+public:
+
+  // ctor publishing to the rings of a feed prefix, with a snapshot of every product after
+  // every snapshotInterval updates. A dropEvery or reorderEvery of 0 sends every update,
+  // in order.
+  BondMarketDataFeedPublisher(const string &prefix, int _snapshotInterval = 1024, int _dropEvery = 0, int _reorderEvery = 0);
+
+  // Were both rings created?
+  bool IsValid() const;
+
+  // Wait up to waitNanos for a number of consumers to open the update channel, so that
+  // they read it from the first update. Returns false if they do not.
+  bool WaitForConsumers(uint32_t consumers, int64_t waitNanos);
+
+  // Publish the changes of a book since the last book of its product
+  void Send(const BondOrderBook &book);
+
+  // Publish a snapshot of every product on the snapshot channel
+  void SendSnapshots();
+
+  // Publish any update held back, a last round of snapshots, and the end of both channels
+  void Close();
+
+  // Number of updates published, and left out
+  long GetUpdatesSent() const;
+  long GetUpdatesDropped() const;
+
+private:
+  void Emit(const BookUpdateMessage &message);
+
+  FeedRing<BookUpdateMessage> updateRing;
+  FeedRing<BookSnapshotMessage> snapshotRing;
+  int snapshotInterval;
+  int dropEvery;
+  int reorderEvery;
+  BondOrderBook lastBooks[BOND_COUNT];
+  uint64_t sequences[BOND_COUNT];
+  BookUpdateMessage held;
+  bool holding;
+  long emitted;
+  long sinceSnapshot;
+  long updatesSent;
+  long updatesDropped;
+
+};
+
+BondMarketDataFeedPublisher::BondMarketDataFeedPublisher(const string &prefix, int _snapshotInterval, int _dropEvery, int _reorderEvery) :
+  snapshotInterval(_snapshotInterval > 0 ? _snapshotInterval : 1), dropEvery(_dropEvery), reorderEvery(_reorderEvery),
+  holding(false), emitted(0), sinceSnapshot(0), updatesSent(0), updatesDropped(0)
+{
+  updateRing.Create(GetUpdateChannel(prefix).c_str(), UPDATE_RING_CAPACITY);
+  snapshotRing.Create(GetSnapshotChannel(prefix).c_str(), SNAPSHOT_RING_CAPACITY);
+  for(int i = 0; i<BOND_COUNT; i++)
+  {
+    lastBooks[i] = BondOrderBook(i);
+    sequences[i] = 0;
+  }
+}
+
+bool BondMarketDataFeedPublisher::IsValid() const
+{
+  return updateRing.IsValid() && snapshotRing.IsValid();
+}
+
+bool BondMarketDataFeedPublisher::WaitForConsumers(uint32_t consumers, int64_t waitNanos)
+{
+  chrono::steady_clock::time_point deadline = chrono::steady_clock::now() + chrono::nanoseconds(waitNanos);
+  while(updateRing.GetConsumers() < consumers)
+  {
+    if(chrono::steady_clock::now() >= deadline)
+    {
+      return false;
+    }
+    this_thread::sleep_for(chrono::milliseconds(1));
+  }
+  return true;
+}
+
+void BondMarketDataFeedPublisher::Send(const BondOrderBook &book)
+{
+  int index = book.GetProductIndex();
+  if(index < 0 || index >= BOND_COUNT)
+  {
+    return;
+  }
+
+  BookUpdate updates[2 * MARKET_DATA_DEPTH];
+  int count = DiffOrderBooks(lastBooks[index], book, updates);
+  lastBooks[index] = book;
+  for(int i = 0; i<count; i++)
+  {
+    BookUpdateMessage message = BookUpdateMessage();
+    message.sequence = ++sequences[index];
+    message.productIndex = index;
+    message.side = updates[i].side;
+    message.action = updates[i].action;
+    message.level = updates[i].level;
+    message.flags = i == count - 1 ? END_OF_EVENT : 0;
+    message.price = updates[i].price.GetTicks();
+    message.size = updates[i].size;
+    Emit(message);
+  }
+}
+
+void BondMarketDataFeedPublisher::Emit(const BookUpdateMessage &message)
+{
+  emitted++;
+  if(dropEvery > 0 && emitted % dropEvery == 0)
+  {
+    updatesDropped++;
+  }
+  else if(reorderEvery > 0 && emitted % reorderEvery == 0 && !holding)
+  {
+    held = message;
+    holding = true;
+  }
+  else
+  {
+    updateRing.Publish(message);
+    updatesSent++;
+    if(holding)
+    {
+      updateRing.Publish(held);
+      updatesSent++;
+      holding = false;
+    }
+  }
+
+  if(++sinceSnapshot >= snapshotInterval)
+  {
+    SendSnapshots();
+  }
+}
+
+void BondMarketDataFeedPublisher::SendSnapshots()
+{
+  sinceSnapshot = 0;
+  for(int p = 0; p<BOND_COUNT; p++)
+  {
+    if(sequences[p] == 0)
+    {
+      continue;
+    }
+    const BondOrderBook &book = lastBooks[p];
+    BookSnapshotMessage snapshot = BookSnapshotMessage();
+    snapshot.sequence = sequences[p];
+    snapshot.productIndex = p;
+    snapshot.bidLevels = book.GetBidLevels();
+    snapshot.offerLevels = book.GetOfferLevels();
+    for(int i = 0; i<MARKET_DATA_DEPTH; i++)
+    {
+      snapshot.bidPrices[i] = book.GetBidPrice(i).GetTicks();
+      snapshot.bidSizes[i] = book.GetBidSize(i);
+      snapshot.offerPrices[i] = book.GetOfferPrice(i).GetTicks();
+      snapshot.offerSizes[i] = book.GetOfferSize(i);
+    }
+    snapshotRing.Publish(snapshot);
+  }
+}
+
+void BondMarketDataFeedPublisher::Close()
+{
+  if(holding)
+  {
+    updateRing.Publish(held);
+    updatesSent++;
+    holding = false;
+  }
+  SendSnapshots();
+  updateRing.Close();
+  snapshotRing.Close();
+}
+
+long BondMarketDataFeedPublisher::GetUpdatesSent() const
+{
+  return updatesSent;
+}
+
+long BondMarketDataFeedPublisher::GetUpdatesDropped() const
+{
+  return updatesDropped;
+}
+
+
+/**
+ * Counts of what a feed handler has done with its messages.
+ */
+struct FeedHandlerStats
+{
+  long messages;              // read from the update channel
+  long updates;               // applied to the books
+  long reordered;             // held until the updates before them came, then applied
+  long duplicates;            // already in the book, dropped
+  long gaps;                  // recoveries started
+  long recoveries;            // recoveries finished by a snapshot
+  long snapshots;             // applied to books, including the first of each product
+  uint64_t lost;              // overwritten in a ring before they were read
+  int64_t maxRecoveryNanos;   // from finding a gap to applying the snapshot
+  int64_t totalRecoveryNanos;
+};
+
+class BondMarketDataFeedHandler : public Connector < BondOrderBook >
+{
+
+public:
+
+  // ctor applying the feed at a prefix to the books of a venue. An update that arrives
+  // ahead of its product's sequence is held; once reorderWindow updates of the product are
+  // held, or the oldest has been held for gapNanos, the missing one is taken as lost.
+  BondMarketDataFeedHandler(BondMarketDataService &_service, const string &_prefix, Market _venue = BROKERTEC,
+    int _reorderWindow = 8, int64_t _gapNanos = 1000000);
+
+  virtual void Publish(BondOrderBook &data) {}
+
+  // Map both channels, waiting up to openNanos for the producer to create them
+  bool Open(int64_t openNanos = 0);
+
+  // Apply the feed until both channels are closed and read, waiting up to openNanos for
+  // the producer to create them. Returns without applying anything if it does not.
+  void Subscribe(int64_t openNanos = 10000000000LL);
+
+  // Read what both channels have. Returns false once both are closed and read.
+  bool Poll();
+
+  // Apply an update from the update channel
+  void OnUpdateMessage(const BookUpdateMessage &message);
+
+  // Take a snapshot from the snapshot channel, and apply it if its product needs it
+  void OnSnapshotMessage(const BookSnapshotMessage &message);
+
+  // Is a product waiting for a snapshot, with its book as of before the gap?
+  bool IsRecovering(int productIndex) const;
+
+  // Get the counts so far
+  const FeedHandlerStats& GetStats() const;
+
+private:
+
+  // Updates of a product held ahead of its sequence, in a slot by sequence
+  static const int HELD_UPDATES = 256;
+
+  struct ProductFeed
+  {
+    uint64_t expected;        // next sequence to apply, 0 before the first snapshot of a feed joined late
+    bool recovering;
+    int64_t recoveryStart;    // -1 when waiting for the first snapshot
+    int held;                 // updates held at or past expected
+    int64_t heldSince;
+    int eventCount;           // updates of the book change in progress
+    BookUpdate event[2 * MARKET_DATA_DEPTH];
+    BookSnapshotMessage snapshot;   // latest, sequence 0 before the first
+    BookUpdateMessage buffer[HELD_UPDATES];
+  };
+
+  static int64_t Now();
+  void Apply(ProductFeed &feed, const BookUpdateMessage &message);
+  void Drain(ProductFeed &feed);
+  void StartRecovery(ProductFeed &feed);
+  void Recover(ProductFeed &feed);
+  void CountHeld(ProductFeed &feed);
+
+  BondMarketDataService &service;
+  string prefix;
+  Market venue;
+  int reorderWindow;
+  int64_t gapNanos;
+  FeedRing<BookUpdateMessage> updateRing;
+  FeedRing<BookSnapshotMessage> snapshotRing;
+  bool updatesOpen;
+  bool snapshotsOpen;
+  vector<ProductFeed> feeds;
+  FeedHandlerStats stats;
+
+};
+
+BondMarketDataFeedHandler::BondMarketDataFeedHandler(BondMarketDataService &_service, const string &_prefix, Market _venue,
+  int _reorderWindow, int64_t _gapNanos) :
+  service(_service), prefix(_prefix), venue(_venue), reorderWindow(_reorderWindow > 0 ? _reorderWindow : 1),
+  gapNanos(_gapNanos), updatesOpen(true), snapshotsOpen(true), feeds(BOND_COUNT), stats()
+{
+  reorderWindow = reorderWindow < HELD_UPDATES ? reorderWindow : HELD_UPDATES - 1;
+  for(int p = 0; p<BOND_COUNT; p++)
+  {
+    ProductFeed &feed = feeds[p];
+    feed = ProductFeed();
+    feed.recovering = true;
+    feed.recoveryStart = -1;
+  }
+}
+
+int64_t BondMarketDataFeedHandler::Now()
+{
+  return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+bool BondMarketDataFeedHandler::Open(int64_t openNanos)
+{
+  int64_t deadline = Now() + openNanos;
+  for(;;)
+  {
+    if(!updateRing.IsValid() && updateRing.Open(GetUpdateChannel(prefix).c_str()) && updateRing.GetPosition() == 0)
+    {
+      // Nothing published yet: every product starts from its first update
+      for(int p = 0; p<BOND_COUNT; p++)
+      {
+        feeds[p].expected = 1;
+        feeds[p].recovering = false;
+      }
+    }
+    if(!snapshotRing.IsValid())
+    {
+      snapshotRing.Open(GetSnapshotChannel(prefix).c_str());
+    }
+    if(updateRing.IsValid() && snapshotRing.IsValid())
+    {
+      return true;
+    }
+    if(Now() >= deadline)
+    {
+      return false;
+    }
+    this_thread::sleep_for(chrono::milliseconds(1));
+  }
+}
+
+void BondMarketDataFeedHandler::Subscribe(int64_t openNanos)
+{
+  if(!Open(openNanos))
+  {
+    return;
+  }
+  while(Poll())
+  {
+  }
+}
+
+bool BondMarketDataFeedHandler::Poll()
+{
+  // Updates first, in batches, so that a snapshot is looked at once the gap it is for
+  // has been found
+  bool read = false;
+  BookUpdateMessage update;
+  for(int i = 0; i<64 && updatesOpen; i++)
+  {
+    int result = updateRing.Poll(update);
+    if(result < 0)
+    {
+      // Snapshots already taken may show updates lost at the end
+      updatesOpen = false;
+      for(int p = 0; p<BOND_COUNT; p++)
+      {
+        ProductFeed &feed = feeds[p];
+        if(!feed.recovering && feed.snapshot.sequence >= feed.expected)
+        {
+          StartRecovery(feed);
+        }
+      }
+    }
+    if(result <= 0)
+    {
+      break;
+    }
+    OnUpdateMessage(update);
+    stats.messages++;
+    read = true;
+  }
+
+  BookSnapshotMessage snapshot;
+  while(snapshotsOpen)
+  {
+    int result = snapshotRing.Poll(snapshot);
+    if(result <= 0)
+    {
+      snapshotsOpen = result == 0;
+      break;
+    }
+    OnSnapshotMessage(snapshot);
+    read = true;
+  }
+  stats.lost = updateRing.GetLost() + snapshotRing.GetLost();
+
+  // An update missing while later ones wait is lost once it is gapNanos late
+  int64_t now = -1;
+  for(int p = 0; p<BOND_COUNT; p++)
+  {
+    ProductFeed &feed = feeds[p];
+    if(feed.held > 0 && !feed.recovering)
+    {
+      now = now < 0 ? Now() : now;
+      if(now - feed.heldSince >= gapNanos)
+      {
+        StartRecovery(feed);
+      }
+    }
+  }
+
+  if(!read && (updatesOpen || snapshotsOpen))
+  {
+    this_thread::yield();
+  }
+  return updatesOpen || snapshotsOpen;
+}
+
+void BondMarketDataFeedHandler::OnUpdateMessage(const BookUpdateMessage &message)
+{
+  if(message.productIndex >= BOND_COUNT)
+  {
+    return;
+  }
+  ProductFeed &feed = feeds[message.productIndex];
+  if(message.sequence < feed.expected)
+  {
+    stats.duplicates++;
+    return;
+  }
+  if(!feed.recovering && message.sequence == feed.expected)
+  {
+    Apply(feed, message);
+    feed.expected++;
+    Drain(feed);
+    return;
+  }
+
+  // Early, or waiting for a snapshot: hold it in the slot of its sequence. A slot holding
+  // an older update keeps the newer one, which any snapshot that helps will be before.
+  BookUpdateMessage &slot = feed.buffer[message.sequence % HELD_UPDATES];
+  if(slot.sequence == message.sequence)
+  {
+    stats.duplicates++;
+    return;
+  }
+  if(slot.sequence < feed.expected || slot.sequence == 0)
+  {
+    feed.held++;
+  }
+  if(slot.sequence < message.sequence)
+  {
+    slot = message;
+  }
+  if(feed.held == 1)
+  {
+    feed.heldSince = Now();
+  }
+  if(!feed.recovering && feed.held >= reorderWindow)
+  {
+    StartRecovery(feed);
+  }
+}
+
+void BondMarketDataFeedHandler::OnSnapshotMessage(const BookSnapshotMessage &message)
+{
+  if(message.productIndex >= BOND_COUNT)
+  {
+    return;
+  }
+  ProductFeed &feed = feeds[message.productIndex];
+  if(message.sequence <= feed.snapshot.sequence)
+  {
+    return;
+  }
+  feed.snapshot = message;
+
+  // Once the update channel has closed, a snapshot ahead of the book shows updates lost at
+  // the end, which no later update would reveal
+  if(!feed.recovering && !updatesOpen && message.sequence >= feed.expected)
+  {
+    StartRecovery(feed);
+  }
+  else if(feed.recovering)
+  {
+    Recover(feed);
+  }
+}
+
+void BondMarketDataFeedHandler::Recover(ProductFeed &feed)
+{
+  // Only a snapshot that includes the missing update helps
+  const BookSnapshotMessage &snapshot = feed.snapshot;
+  if(snapshot.sequence == 0 || snapshot.sequence < feed.expected)
+  {
+    return;
+  }
+
+  BondOrderBook book(snapshot.productIndex);
+  int bidLevels = snapshot.bidLevels < MARKET_DATA_DEPTH ? snapshot.bidLevels : MARKET_DATA_DEPTH;
+  int offerLevels = snapshot.offerLevels < MARKET_DATA_DEPTH ? snapshot.offerLevels : MARKET_DATA_DEPTH;
+  for(int i = 0; i<bidLevels; i++)
+  {
+    book.SetBid(i, TickPrice::FromTicks(snapshot.bidPrices[i]), snapshot.bidSizes[i]);
+  }
+  for(int i = 0; i<offerLevels; i++)
+  {
+    book.SetOffer(i, TickPrice::FromTicks(snapshot.offerPrices[i]), snapshot.offerSizes[i]);
+  }
+  service.OnMessage(book, venue);
+  stats.snapshots++;
+
+  feed.expected = snapshot.sequence + 1;
+  feed.eventCount = 0;
+  CountHeld(feed);
+  Drain(feed);
+
+  // Updates still held past another gap are waited for as before, unless there are
+  // already enough of them to take the gap as lost; then the next snapshot is needed
+  if(feed.held >= reorderWindow)
+  {
+    return;
+  }
+  feed.recovering = false;
+  if(feed.recoveryStart >= 0)
+  {
+    int64_t nanos = Now() - feed.recoveryStart;
+    stats.recoveries++;
+    stats.totalRecoveryNanos += nanos;
+    stats.maxRecoveryNanos = nanos > stats.maxRecoveryNanos ? nanos : stats.maxRecoveryNanos;
+  }
+}
+
+void BondMarketDataFeedHandler::Apply(ProductFeed &feed, const BookUpdateMessage &message)
+{
+  BookUpdate &update = feed.event[feed.eventCount++];
+  update.productIndex = message.productIndex;
+  update.side = PricingSide(message.side);
+  update.action = BookAction(message.action);
+  update.level = message.level;
+  update.price = TickPrice::FromTicks(message.price);
+  update.size = message.size;
+  stats.updates++;
+
+  // The book changes all at once at the end of the event, so that listeners never see
+  // half of a change
+  if((message.flags & END_OF_EVENT) || feed.eventCount == 2 * MARKET_DATA_DEPTH)
+  {
+    service.OnUpdates(feed.event, feed.eventCount, venue);
+    feed.eventCount = 0;
+  }
+}
+
+void BondMarketDataFeedHandler::Drain(ProductFeed &feed)
+{
+  int drained = 0;
+  for(; feed.held > 0; drained++)
+  {
+    const BookUpdateMessage &slot = feed.buffer[feed.expected % HELD_UPDATES];
+    if(slot.sequence != feed.expected)
+    {
+      break;
+    }
+    Apply(feed, slot);
+    feed.expected++;
+    feed.held--;
+  }
+  stats.reordered += drained;
+
+  // Updates still held wait from now for the next one missing
+  if(drained > 0 && feed.held > 0)
+  {
+    feed.heldSince = Now();
+  }
+}
+
+void BondMarketDataFeedHandler::StartRecovery(ProductFeed &feed)
+{
+  // The book stays as of the last whole change before the gap, unless the snapshot
+  // channel is already past it
+  feed.recovering = true;
+  feed.recoveryStart = Now();
+  feed.eventCount = 0;
+  stats.gaps++;
+  Recover(feed);
+}
+
+void BondMarketDataFeedHandler::CountHeld(ProductFeed &feed)
+{
+  feed.held = 0;
+  for(int i = 0; i<HELD_UPDATES; i++)
+  {
+    feed.held += feed.buffer[i].sequence >= feed.expected ? 1 : 0;
+  }
+}
+
+bool BondMarketDataFeedHandler::IsRecovering(int productIndex) const
+{
+  return productIndex >= 0 && productIndex < BOND_COUNT && feeds[productIndex].recovering;
+}
+
+const FeedHandlerStats& BondMarketDataFeedHandler::GetStats() const
+{
+  return stats;
+}
+
+#endif
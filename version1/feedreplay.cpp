@@ -0,0 +1,102 @@
+/**
+ * feedreplay.cpp
+ * Replays a binary market data feed (see binaryfeed.hpp) as the incremental feed of
+ * feedhandler.hpp, for a feed handler reading the same prefix.
+ *
+ * Usage: ./feedreplay <marketdata.bin> [prefix] [--rate books per second] [--snapshots updates]
+ *                     [--drop every] [--reorder every] [--wait handlers]
+ * The prefix defaults to /dev/shm/bondmarketdata. Books are sent as fast as possible unless
+ * a rate is given. One update in every --drop is left out and one in every --reorder is
+ * sent late, to exercise recovery. With --wait, nothing is sent until that many handlers
+ * have opened the feed, for at most a minute, so that they read it from the first update;
+ * a handler that opens it later starts from the snapshots.
+ */
+
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <chrono>
+#include <thread>
+
+#include "binaryfeed.hpp"
+#include "feedhandler.hpp"
+
+using namespace std;
+
+int main(int argc, char *argv[])
+{
+  if(argc < 2)
+  {
+    fprintf(stderr, "usage: %s <marketdata.bin> [prefix] [--rate n] [--snapshots n] [--drop n] [--reorder n] [--wait n]\n", argv[0]);
+    return 1;
+  }
+
+  string prefix = "/dev/shm/bondmarketdata";
+  long rate = 0;
+  int snapshots = 1024, drop = 0, reorder = 0, handlers = 0;
+  for(int i = 2; i<argc; i++)
+  {
+    string arg = argv[i];
+    if(arg.compare(0, 2, "--") != 0)
+    {
+      prefix = arg;
+    }
+    else if(i + 1 < argc)
+    {
+      long value = atol(argv[++i]);
+      if(arg == "--rate") rate = value;
+      else if(arg == "--snapshots") snapshots = value;
+      else if(arg == "--drop") drop = value;
+      else if(arg == "--reorder") reorder = value;
+      else if(arg == "--wait") handlers = value;
+    }
+  }
+
+  BinaryFeedReader<OrderBookFeedRecord> reader(argv[1]);
+  if(!reader.IsValid())
+  {
+    fprintf(stderr, "could not read market data feed %s\n", argv[1]);
+    return 1;
+  }
+  BondMarketDataFeedPublisher publisher(prefix, snapshots, drop, reorder);
+  if(!publisher.IsValid())
+  {
+    fprintf(stderr, "could not create the rings of feed %s\n", prefix.c_str());
+    return 1;
+  }
+  if(handlers > 0 && !publisher.WaitForConsumers(handlers, 60000000000LL))
+  {
+    fprintf(stderr, "no handler opened feed %s, sending anyway\n", prefix.c_str());
+  }
+
+  chrono::steady_clock::time_point start = chrono::steady_clock::now();
+  long books = 0;
+  for(const OrderBookFeedRecord *record = reader.Begin(); record != reader.End(); record++, books++)
+  {
+    if(!IsValidFeedRecord(*record))
+    {
+      continue;
+    }
+    BondOrderBook book(record->productIndex);
+    for(int i = 0; i<MARKET_DATA_DEPTH; i++)
+    {
+      book.SetBid(i,TickPrice::FromDouble(record->bidPrices[i]),record->quantities[i]);
+      book.SetOffer(i,TickPrice::FromDouble(record->offerPrices[i]),record->quantities[i]);
+    }
+    if(rate > 0)
+    {
+      this_thread::sleep_until(start + chrono::nanoseconds(books * 1000000000LL / rate));
+    }
+    publisher.Send(book);
+  }
+  publisher.Close();
+
+  // A handler already reading keeps its mapping; one started later should not find a
+  // closed feed
+  unlink(GetUpdateChannel(prefix).c_str());
+  unlink(GetSnapshotChannel(prefix).c_str());
+
+  printf("%ld books sent to %s as %ld updates, %ld left out\n", books, prefix.c_str(),
+    publisher.GetUpdatesSent(), publisher.GetUpdatesDropped());
+  return 0;
+}
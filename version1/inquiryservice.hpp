@@ -9,6 +9,9 @@
 
 
 #include "tradebookingservice.hpp"
+#include "marketdataservice.hpp"
+#include "csvingest.hpp"
+#include "binaryfeed.hpp"
 #include <memory>
 
 
@@ -136,25 +139,9 @@ public:
       return BondInquiryMP[key];
   }
 
-  // The callback that a Connector should invoke for any new or updated data
-  virtual void OnMessage(Inquiry<Bond> &data)
-  {
-    AddInquiry(data);
-     if(InquiryListener.size()!=0)
-    {
-    for(int i = 0; i<InquiryListener.size();i++)
-    {
-      InquiryListener[i]->ProcessAdd(data);
-    }
-    }
-
-    InquiryState state2 = QUOTED;
-    string inquiryId = data.GetInquiryId();
-    UpdateState(inquiryId, state2);
-    Inquiry<Bond> query =GetData(inquiryId); 
-    
-    publishCon->Publish(query);
-  }
+  // The callback that a Connector should invoke for any new or updated data.
+  // Defined after BondInquiryServiceConnector, which it publishes to.
+  virtual void OnMessage(Inquiry<Bond> &data);
 
   // Add a listener to the Service for callbacks on add, remove, and update events
   // for data to the Service.
@@ -178,7 +165,7 @@ public:
 
 class BondInquiryServiceConnector : Connector < Inquiry<Bond> >
 {
-private:
+protected:
   BondInquiryService* inquiryService;
 public:
 
@@ -229,141 +216,111 @@ public:
 
   void Subscribe()
   {
-    string line;
-    std::ifstream file("inquiries.txt");
+    MappedFile file("inquiries.txt");
+    CsvReader reader(file.GetData(), file.GetSize());
+    CsvField fields[6];
+    int fieldCount;
+    InquiryRecord record;
 
-    while(getline(file,line))
-  {
-    
-        std::stringstream linestream(line);
-
-        std::string inquiryId;
-        std::string productId;
-        std::string side;
-        std::string quant;
-        std::string price;
-        std::string state;
+    while(reader.NextLine(fields, 6, fieldCount))
+    {
+      if(!ParseInquiryRecord(fields, fieldCount, record))
+      {
+        continue;
+      }
 
-        std::getline(linestream,inquiryId,',');
-        std::getline(linestream,productId,',');
-        std::getline(linestream,side,',');
-        std::getline(linestream,quant,',');
-        std::getline(linestream,price,',');
-        std::getline(linestream,state,',');
+      Side pside = record.isBuy ? BUY : SELL;
 
-        Side pside;
+      InquiryState pstate = RECEIVED;
+      if(record.state.Equals("QUOTED"))
+      {
+        pstate = QUOTED;
+      }
+      else if(record.state.Equals("DONE"))
+      {
+        pstate = DONE;
+      }
+      else if(record.state.Equals("REJECTED"))
+      {
+        pstate = REJECTED;
+      }
+      else if(record.state.Equals("CUSTOMER_REJECTED"))
+      {
+        pstate = CUSTOMER_REJECTED;
+      }
 
-        if(side == "BUY")
-        {
-          pside = BUY;
-        }
-        else
-        {
-          pside = SELL;
-        }
+      Inquiry<Bond> obj = Inquiry<Bond>(record.inquiryId.ToString(),GetReferenceBond(record.productIndex),pside,record.quantity,record.price,pstate);
+      inquiryService->OnMessage(obj);
+    }
+  }
+};
 
-        InquiryState pstate;
 
-        if(state == "RECEIVED")
-        {
-          pstate = RECEIVED;
-        }
-        else if(state == "QUOTED")
-        {
-          pstate = QUOTED;
-        }
-        else if(state == "DONE")
-        {
-          pstate = DONE;
-        }
-        else if(state == "REJECTED")
-        {
-          pstate = REJECTED;
-        }
-        else if(state == "CUSTOMER_REJECTED")
-        {
-          pstate = CUSTOMER_REJECTED;
-        }
+/**
+ * Replays a binary inquiry feed (see binaryfeed.hpp) into the inquiry service.
+ * Quotes are published the same way as for the text feed.
+ */
+class BondInquiryServiceBinaryConnector : public BondInquiryServiceConnector
+{
+private:
+  string path;
+public:
 
+  BondInquiryServiceBinaryConnector(const string &path_ = "inquiries.bin"):path(path_){}
 
-        long quantity = atol(quant.c_str());
-        double quote = stod(price);
+  void Subscribe()
+  {
+    BinaryFeedReader<InquiryFeedRecord> reader(path.c_str());
+    for(const InquiryFeedRecord *record = reader.Begin(); record != reader.End(); record++)
+    {
+      if(!IsValidFeedRecord(*record))
+      {
+        continue;
+      }
+      Side pside = record->side == 0 ? BUY : SELL;
+      InquiryState pstate = InquiryState(record->state);
+      string inquiryId(record->inquiryId, IdentifierLength(record->inquiryId, sizeof(record->inquiryId)));
 
-        if(!inquiryId.empty())
-        {
-          if(productId == "2Y")
-          {
-            BondIdType idType = CUSIP;
-            date maturityDate(2019,Oct,31);
-            Bond bond2Y("2Y", idType,"T", 0.015, maturityDate);
-
-            Inquiry<Bond> obj = Inquiry<Bond>(inquiryId,bond2Y,pside,quantity,quote,pstate);
-            inquiryService->OnMessage(obj);
-          }
-          else if(productId == "3Y")
-          {
-            BondIdType idType = CUSIP;
-            date maturityDate(2020,Nov,15);
-            Bond bond3Y("3Y", idType, "T", 0.0175, maturityDate);
-
-            Inquiry<Bond> obj = Inquiry<Bond>(inquiryId,bond3Y,pside,quantity,quote,pstate);
-            inquiryService->OnMessage(obj);
-
-          }
-          else if (productId == "5Y")
-          {
-            BondIdType idType = CUSIP;
-            date maturityDate(2022,Oct,31);
-            Bond bond5Y("5Y", idType, "T", 0.02, maturityDate);
-
-            Inquiry<Bond> obj = Inquiry<Bond>(inquiryId,bond5Y,pside,quantity,quote,pstate);
-            inquiryService->OnMessage(obj);
-          }
-          else if(productId == "7Y")
-          {
-            BondIdType idType = CUSIP;
-            date maturityDate(2024,Oct,31);
-            Bond bond7Y("7Y", idType, "T", 0.0225, maturityDate);
-
-            Inquiry<Bond> obj = Inquiry<Bond>(inquiryId,bond7Y,pside,quantity,quote,pstate);
-            inquiryService->OnMessage(obj);
-
-          }
-          else if(productId == "10Y")
-          {
-            BondIdType idType = CUSIP;
-            date maturityDate(2027,Nov,15);
-            Bond bond10Y("10Y", idType, "T", 0.0225, maturityDate);
-
-            Inquiry<Bond> obj = Inquiry<Bond>(inquiryId,bond10Y,pside,quantity,quote,pstate);
-            inquiryService->OnMessage(obj);
-
-          }
-          else if(productId == "30Y")
-          {
-            BondIdType idType = CUSIP;
-            date maturityDate(2047,Nov,15);
-            Bond bond30Y("30Y", idType, "T", 0.0275, maturityDate);
-
-            Inquiry<Bond> obj = Inquiry<Bond>(inquiryId,bond30Y,pside,quantity,quote,pstate);
-            inquiryService->OnMessage(obj);
-          }
-         }
-      } 
+      Inquiry<Bond> obj = Inquiry<Bond>(inquiryId,GetReferenceBond(record->productIndex),pside,record->quantity,record->price,pstate);
+      inquiryService->OnMessage(obj);
     }
+  }
 };
 
 
+
+
+void BondInquiryService::OnMessage(Inquiry<Bond> &data)
+{
+  AddInquiry(data);
+   if(InquiryListener.size()!=0)
+  {
+  for(int i = 0; i<InquiryListener.size();i++)
+  {
+    InquiryListener[i]->ProcessAdd(data);
+  }
+  }
+
+  InquiryState state2 = QUOTED;
+  string inquiryId = data.GetInquiryId();
+  UpdateState(inquiryId, state2);
+  Inquiry<Bond> query =GetData(inquiryId); 
+  
+  publishCon->Publish(query);
+}
 class BondInquiryServiceListener : public ServiceListener<Inquiry<Bond> >
 {
 
 private:
 
   BondInquiryService* InquiryService;
+  const BondMarketDataService* MarketData;
 
 public:
 
-  BondInquiryServiceListener(BondInquiryService* InquiryService_):InquiryService(InquiryService_){};
+  // ctor; with a market data service inquiries are quoted at the touch, read lock-free from
+  // its top of book cache, and otherwise at 100
+  BondInquiryServiceListener(BondInquiryService* InquiryService_, const BondMarketDataService* MarketData_ = 0):InquiryService(InquiryService_),MarketData(MarketData_){};
 
   // Listener callback to process an add event to the Service
   virtual void ProcessAdd(Inquiry<Bond> &data)
@@ -371,9 +328,19 @@ public:
       InquiryState state1 = RECEIVED;
       double price = 100;
       string inquiryId = data.GetInquiryId();
+      int index = GetBondIndex(data.GetProduct().GetProductId());
+      if(MarketData != 0 && index >= 0)
+      {
+        // A customer buying is offered our offer, one selling is bid our bid
+        TopOfBook top = MarketData->GetTopOfBook(index);
+        if(top.IsTwoSided())
+        {
+          price = data.GetSide() == BUY ? top.offer.ToDouble() : top.bid.ToDouble();
+        }
+      }
       if(data.GetState() == state1)
       {
-        InquiryService->SendQuote(inquiryId,100);  
+        InquiryService->SendQuote(inquiryId,price);  
       }
       std::cout<<"quote sent"<<std::endl;
       
@@ -13,9 +13,23 @@
 
 #include "pricingservice.hpp"
 #include "streamingservice.hpp"
+#include "priceconflation.hpp"
+#include "fairvalueengine.hpp"
+#include "priceanalyticsservice.hpp"
+#include "barservice.hpp"
+#include "booksignalservice.hpp"
+#include "feedhandler.hpp"
+#include "orderidservice.hpp"
+#include "smartorderrouter.hpp"
+#include "pretraderisk.hpp"
+#include "executionanalytics.hpp"
 #include "inquiryservice.hpp"
 //#include "riskservice.hpp"
 
+#include <thread>
+#include <atomic>
+#include <chrono>
+
 /*
 #include <string>
 #include <vector>
@@ -29,8 +43,60 @@
 
 
 
-int main()
+using namespace std::chrono;
+
+/**
+ * Records when the first quote of a kind goes out, for the startup report.
+ */
+template<typename V>
+class FirstQuoteListener : public ServiceListener<V>
+{
+public:
+  FirstQuoteListener() : quoted(false) {}
+
+  virtual void ProcessAdd(V &data)
+  {
+    bool expected = false;
+    if(quoted.compare_exchange_strong(expected, true))
+    {
+      firstQuote = steady_clock::now();
+    }
+  }
+
+  virtual void ProcessRemove(V &data) {}
+
+  virtual void ProcessUpdate(V &data) {}
+
+  // Milliseconds from start to the first quote, or -1 if nothing was quoted
+  double GetMillis(steady_clock::time_point start) const
+  {
+    return quoted ? duration<double, std::milli>(firstQuote - start).count() : -1;
+  }
+
+private:
+  std::atomic<bool> quoted;
+  steady_clock::time_point firstQuote;
+};
+
+
+// Usage: ./test [--concurrent] [--feed prefix] [--exchange] [--slice twap|vwap|iceberg]
+// Feeds are read one after another, or each on its own thread with --concurrent. With
+// --feed, market data comes from the incremental feed at the prefix, sent by feedreplay,
+// instead of marketdata_backup.txt. With --exchange, orders go to a matching engine per
+// venue, quoting the venue's books, and only their fills are booked. With --slice, algo
+// execution orders are sliced into ten child orders over a second.
+int main(int argc, char *argv[])
 {
+	bool concurrent = false, exchange = false, risk = false;
+	std::string feedPrefix, slicing;
+	for(int i = 1; i<argc; i++)
+	{
+		if(std::string(argv[i]) == "--concurrent") concurrent = true;
+		else if(std::string(argv[i]) == "--feed" && i + 1 < argc) feedPrefix = argv[++i];
+		else if(std::string(argv[i]) == "--exchange") exchange = true;
+		else if(std::string(argv[i]) == "--slice" && i + 1 < argc) slicing = argv[++i];
+		else if(std::string(argv[i]) == "--risk") risk = true;
+	}
 
 	
 	BondTradeBookingService bookingService;
@@ -51,24 +117,95 @@ int main()
 
 	
 	BondTradeBookingServiceConnector BookingServiceCon(bookingService);
-	BookingServiceCon.Subscribe();
 	
 
 	BondMarketDataService marketdataService;
+
+	// Venue books are quoted into the exchanges before anything trades on them
+	BondExecutionService executionService;
+	BondMarketDataExecutionServiceListener myListener18(&executionService, &marketdataService);
+	std::vector<MatchingEngine*> exchanges;
+	if(exchange)
+	{
+		for(int v = 0; v<MARKET_COUNT; v++)
+		{
+			exchanges.push_back(new MatchingEngine(Market(v), 1 << 16));
+			exchanges.back()->Start();
+			executionService.AddExchange(Market(v), exchanges.back());
+		}
+		marketdataService.AddListener(&myListener18);
+	}
+
+	// Stop orders wait in the execution service until the top of book reaches them
+	executionService.HoldStops(&marketdataService);
+	BondMarketDataStopExecutionServiceListener myListener21(&executionService);
+	marketdataService.AddListener(&myListener21);
+
+	// Orders pass limits on their size, notional, position, PV01 and rate, kept on the trades booked
+	BondPreTradeRiskGate riskGate;
+	BondTradeBookingRiskGateListener myListener20(&riskGate);
+	if(risk)
+	{
+		RiskLimits productLimits = { 20000000, 25000000.0, 100000000, 250000.0, 10000 };
+		RiskLimits bookLimits = { 0, 0, 300000000, 1000000.0, 0 };
+		for(int p = 0; p<BOND_COUNT; p++)
+		{
+			riskGate.SetProductLimits(p, productLimits);
+		}
+		for(int b = 0; b<BOOK_COUNT; b++)
+		{
+			riskGate.SetBookLimits(b, bookLimits);
+		}
+		bookingService.AddListener(&myListener20);
+		executionService.SetRiskGate(&riskGate);
+	}
 	
-	BondAlgoExecutionService AlgoExecutionService;
-	BondMarketDataAlgoExecutionServiceListener myListener2(&AlgoExecutionService);
+	// Order IDs carry a restart epoch kept in orderid.epoch, so no two runs share one
+	uint32_t epoch = 0;
+	if(!OrderIdService::NextEpoch("orderid.epoch", epoch))
+	{
+		std::cerr<<"could not take the next restart epoch from orderid.epoch"<<std::endl;
+		return 1;
+	}
+	OrderIdService orderIds(epoch);
+
+	// Algo execution, fair value and inquiry quotes read the top of book cache of market data
+	BondAlgoExecutionService AlgoExecutionService(&marketdataService, &orderIds);
+	if(!slicing.empty())
+	{
+		AlgoExecutionService.SetSlicing(slicing == "vwap" ? VWAP : slicing == "iceberg" ? ICEBERG : TWAP, 1000000000LL, 10);
+	}
+
+	// Execution quality joins each decision with the top of book it was made on, so books are
+	// recorded and decisions seen before anything is sent
+	BondExecutionAnalyticsService executionAnalytics;
+	BondMarketDataExecutionAnalyticsListener myListener22(&executionAnalytics, &marketdataService);
+	marketdataService.AddListener(&myListener22);
+	BondAlgoExecutionAnalyticsListener myListener23(&executionAnalytics, &AlgoExecutionService);
+	AlgoExecutionService.AddListener(&myListener23);
+	executionService.AddVenueListener(&executionAnalytics);
+
+	// Spread capture runs on every tenor, the front end and the long end each on a strategy
+	// of their own so that they can be tuned apart
+	SpreadCaptureStrategy frontEndStrategy, longEndStrategy;
+	BondMarketDataStrategyAlgoExecutionServiceListener<SpreadCaptureStrategy, FRONT_END> myListener2(&AlgoExecutionService, &frontEndStrategy);
 	marketdataService.AddListener(&myListener2);
-	
-	BondExecutionService executionService;
-	BondAlgoExecutionExecutionServiceListener myListener3(&executionService);
+	BondMarketDataStrategyAlgoExecutionServiceListener<SpreadCaptureStrategy, LONG_END> myListener24(&AlgoExecutionService, &longEndStrategy);
+	marketdataService.AddListener(&myListener24);
+
+	// Algo execution orders are split across venues by their books, latency, fees and fill rates
+	BondSmartOrderRouter orderRouter(&executionService, &marketdataService, &orderIds);
+	orderRouter.SetVenueProfile(BROKERTEC, 30000, 0.002);
+	orderRouter.SetVenueProfile(ESPEED, 50000, 0.0015);
+	orderRouter.SetVenueProfile(CME, 80000, 0.001);
+	executionService.AddReportListener(&orderRouter);
+	BondAlgoExecutionRouterListener myListener3(&orderRouter);
 	AlgoExecutionService.AddListener(&myListener3);
 
 	BondExecutionTradeBookingServiceListener myListener4(&bookingService);
 	executionService.AddListener(&myListener4);
-
-	BondMarketDataServiceConnector marketdataServiceCon(marketdataService);
-	marketdataServiceCon.Subscribe();
+	BondExecutionAlgoExecutionServiceListener myListener19(&AlgoExecutionService);
+	executionService.AddListener(&myListener19);
 
 	BondPricingService pricingService;
 	BondAlgoStreamService AlgoStreamService;
@@ -77,17 +214,63 @@ int main()
 	BondAlgoStreamStreamServiceListener myListener6(&BondstreamService);
 	AlgoStreamService.AddListener(&myListener6);
 
+	// Consumers read prices through a conflating cache: the algo stream is drained on every
+	// tick, the GUI at most every 300ms and only sees the newest price per product
+	BondPriceConflationCache priceCache;
+	pricingService.AddListener(&priceCache);
+
 	BondPricingAlgoStreamServiceListener myListener5(&AlgoStreamService);
-	pricingService.AddListener(&myListener5);
+	priceCache.AddConsumer(&myListener5, 0);
 
 
 	GUIServiceConnector publishCon;
 	GUIService bondGUIService(publishCon);
 	BondPricingGUIServiceListener myListener7(&bondGUIService);
-	pricingService.AddListener(&myListener7);
+	priceCache.AddConsumer(&myListener7, 300);
+
+	// Rolling analytics see every price and every book, and publish once a second
+	BondPriceAnalyticsService analyticsService;
+	analyticsService.SetPublishInterval(1000000000LL);
+	BondPricingAnalyticsServiceListener myListener11(&analyticsService);
+	pricingService.AddListener(&myListener11);
+	BondMarketDataAnalyticsServiceListener myListener12(&analyticsService);
+	marketdataService.AddListener(&myListener12);
+
+	// Microstructure signals of every book, decayed over a second, for algo execution and
+	// algo streaming
+	BondBookSignalService signalService(1000000000LL, &marketdataService);
+	BondMarketDataSignalServiceListener myListener15(&signalService);
+	marketdataService.AddListener(&myListener15);
+	BondSignalAlgoExecutionServiceListener myListener16(&AlgoExecutionService);
+	signalService.AddListener(&myListener16);
+	BondSignalAlgoStreamServiceListener myListener17(&AlgoStreamService);
+	signalService.AddListener(&myListener17);
+
+	// One second and 100 tick bars of internal prices, and one second, 100 tick and 10MM
+	// volume bars of fills, persisted to bars.bin
+	BondBarService barService;
+	barService.AddSeries(TIME_BARS, 1000000000LL, BAR_SOURCE_PRICING);
+	barService.AddSeries(TICK_BARS, 100, BAR_SOURCE_PRICING);
+	barService.AddSeries(TIME_BARS, 1000000000LL, BAR_SOURCE_FILLS);
+	barService.AddSeries(TICK_BARS, 100, BAR_SOURCE_FILLS);
+	barService.AddSeries(VOLUME_BARS, 10000000, BAR_SOURCE_FILLS);
+	BondBarHistoricalDataListener barFile("bars.bin");
+	barService.AddListener(&barFile);
+	BondPricingBarServiceListener myListener13(&barService);
+	pricingService.AddListener(&myListener13);
+	BondExecutionBarServiceListener myListener14(&barService);
+	executionService.AddVenueListener(&myListener14);
+
+	// Books are priced into the pricing service as well as price.txt
+	BondFairValueEngine fairValueEngine(pricingService, 0.5, &marketdataService);
+	marketdataService.AddListener(&fairValueEngine);
+
+	// Consecutive snapshots are sent as level updates, so that books whose top levels did
+	// not move are not executed on again
+	BondMarketDataServiceConnector marketdataServiceCon(marketdataService, true);
+	BondMarketDataFeedHandler feedHandler(marketdataService, feedPrefix);
 
 	BondPricingServiceConnector PricingServiceCon(pricingService);
-	PricingServiceCon.Subscribe();
 
 
 	
@@ -100,9 +283,139 @@ int main()
 	BondInquiryService inquiryService(&inquiryServiceCon);
 	inquiryServiceCon.SetInquiryService(&inquiryService);
 
-	BondInquiryServiceListener myListener8(&inquiryService);
+	BondInquiryServiceListener myListener8(&inquiryService, &marketdataService);
 	inquiryService.AddListener(&myListener8);
-	inquiryServiceCon.Subscribe();
+
+	// Quotes are two-way price streams and responses to customer inquiries
+	FirstQuoteListener< PriceStream<Bond> > firstStreamQuote;
+	BondstreamService.AddListener(&firstStreamQuote);
+	FirstQuoteListener< Inquiry<Bond> > firstInquiryQuote;
+	inquiryService.AddListener(&firstInquiryQuote);
+
+	steady_clock::time_point start = steady_clock::now();
+
+	// Timers run every millisecond while the feeds are read: throttled price consumers get
+	// the last price of a burst once their throttle runs out, time bars close at the end of
+	// their interval even if the product has stopped ticking, and slices of parent orders go
+	// out when due even once books stop. Slices are sent between books, under the lock the
+	// market data service holds while it delivers one.
+	std::atomic<bool> ingesting(true);
+	std::thread timerThread([&]()
+	{
+		while(ingesting.load())
+		{
+			priceCache.OnTimer(TimerWheel::Now());
+			barService.CloseElapsedBars(BondPriceAnalyticsService::Now());
+			{
+				std::lock_guard<std::recursive_mutex> books(marketdataService.GetDeliveryLock());
+				AlgoExecutionService.OnTimer(TimerWheel::Now());
+			}
+			std::this_thread::sleep_for(milliseconds(1));
+		}
+	});
+
+	if(concurrent)
+	{
+		// Booking and pricing are shared between threads: booking takes file trades and
+		// execution fills, pricing takes price.txt and the fair-value engine. Both lock.
+		std::thread bookingThread(&BondTradeBookingServiceConnector::Subscribe, &BookingServiceCon);
+		std::thread marketdataThread = feedPrefix.empty() ? std::thread(&BondMarketDataServiceConnector::Subscribe, &marketdataServiceCon)
+			: std::thread(&BondMarketDataFeedHandler::Subscribe, &feedHandler, 10000000000LL);
+		std::thread pricingThread(&BondPricingServiceConnector::Subscribe, &PricingServiceCon);
+		std::thread inquiryThread(&BondInquiryServiceConnector::Subscribe, &inquiryServiceCon);
+		bookingThread.join();
+		marketdataThread.join();
+		pricingThread.join();
+		inquiryThread.join();
+	}
+	else
+	{
+		BookingServiceCon.Subscribe();
+		if(feedPrefix.empty())
+		{
+			marketdataServiceCon.Subscribe();
+		}
+		else
+		{
+			feedHandler.Subscribe();
+		}
+		PricingServiceCon.Subscribe();
+		inquiryServiceCon.Subscribe();
+	}
+	// Parents whose slices are not all out by the end of the feeds are cancelled
+	ingesting.store(false);
+	timerThread.join();
+	size_t cancelledParents = AlgoExecutionService.CancelParents();
+	for(int v = 0; v<exchanges.size(); v++)
+	{
+		exchanges[v]->Stop();
+	}
+	executionService.ProcessReports();
+	priceCache.DrainAll();
+	barService.Flush();
+	barFile.Close();
+	double startupMillis = duration<double, std::milli>(steady_clock::now() - start).count();
+
+	std::cout<<"routed "<<orderRouter.GetChildOrders()<<" child orders, "<<cancelledParents<<" parent orders cancelled unfinished"<<std::endl;
+	std::cout<<"prices: "<<pricingService.GetSequence()<<" stored";
+	for(int p = 0; p<BOND_COUNT; p++)
+	{
+		VersionedPrice latest = pricingService.GetVersionedPrice(p);
+		if(latest.sequence != 0)
+		{
+			std::cout<<", "<<GetBondTenor(p)<<" "<<latest.price.GetMid();
+		}
+	}
+	std::cout<<std::endl;
+	std::cout<<"stops: "<<executionService.GetHeldStops()<<" held, "<<executionService.GetTriggeredStops()<<" triggered"<<std::endl;
+	const ExecutionAnalytics quality = executionAnalytics.GetSnapshot();
+	for(int v = 0; v<MARKET_COUNT; v++)
+	{
+		const ExecutionQuality &venue = quality.venues[v];
+		static const char* VENUES[MARKET_COUNT] = { "BrokerTec", "eSpeed", "CME" };
+		std::cout<<"venue "<<VENUES[v]<<": "<<venue.orders<<" orders, fill ratio "<<venue.fillRatio<<", slippage "<<venue.slippageTicks
+			<<" ticks, spread capture "<<venue.spreadCapture<<std::endl;
+	}
+	for(int a = 0; a<SLICE_ALGORITHMS; a++)
+	{
+		const ExecutionQuality &algorithm = quality.algorithms[a];
+		if(algorithm.orders > 0)
+		{
+			std::cout<<"algorithm "<<BondExecutionAnalyticsService::GetAlgorithmName(a)<<": "<<algorithm.orders<<" orders, fill ratio "
+				<<algorithm.fillRatio<<", slippage "<<algorithm.slippageTicks<<" ticks, spread capture "<<algorithm.spreadCapture<<std::endl;
+		}
+	}
+	std::cout<<"orders: "<<executionService.GetOrderStore().GetOpenOrders()<<" open, "<<executionService.GetOrderStore().GetDoneOrders()<<" done"<<std::endl;
+	std::cout<<(concurrent ? "concurrent" : "serial")<<" ingest: startup "<<startupMillis<<" ms, first stream quote "
+		<<firstStreamQuote.GetMillis(start)<<" ms, first inquiry quote "<<firstInquiryQuote.GetMillis(start)<<" ms"<<std::endl;
+	if(!feedPrefix.empty())
+	{
+		const FeedHandlerStats &feedStats = feedHandler.GetStats();
+		std::cout<<"feed: "<<feedStats.updates<<" updates, "<<feedStats.reordered<<" reordered, "<<feedStats.gaps<<" gaps, "
+			<<feedStats.lost<<" lost in the ring, longest recovery "<<feedStats.maxRecoveryNanos / 1000<<" us"<<std::endl;
+	}
+	if(risk)
+	{
+		std::cout<<"risk: rejected";
+		for(int c = RISK_UNKNOWN_PRODUCT; c<RISK_CHECKS; c++)
+		{
+			std::cout<<(c > RISK_UNKNOWN_PRODUCT ? ", " : " ")<<riskGate.GetRejected(RiskCheck(c))<<" on "<<BondPreTradeRiskGate::GetCheckName(RiskCheck(c));
+		}
+		std::cout<<std::endl;
+	}
+	if(exchange)
+	{
+		std::cout<<"exchanges: "<<executionService.GetLiveOrders()<<" orders left working, fill rates";
+		for(int v = 0; v<MARKET_COUNT; v++)
+		{
+			std::cout<<" "<<orderRouter.GetFillRate(Market(v));
+		}
+		std::cout<<std::endl;
+		for(int v = 0; v<exchanges.size(); v++)
+		{
+			delete exchanges[v];
+		}
+	}
 
 	////auto inquiryService_ptr = std::make_shared(inquiryService);
 
@@ -14,15 +14,30 @@
 #include <map>
 #include <fstream>
 #include <cstring>
+#include <array>
+#include <atomic>
+#include <mutex>
+#include <type_traits>
+#include <stdint.h>
 
 #include "soa.hpp"
 #include "products.hpp"
+#include "bondreferencedata.hpp"
+#include "csvingest.hpp"
+#include "binaryfeed.hpp"
+#include "tickprice.hpp"
 
 using namespace std;
 
 // Side for market data
 enum PricingSide { BID, OFFER };
 
+// Venues that send market data and take orders
+enum Market { BROKERTEC, ESPEED, CME };
+
+// Number of venues
+const int MARKET_COUNT = 3;
+
 /**
  * A market data order with price, quantity, and side.
  */
@@ -31,12 +46,16 @@ class Order
 
 public:
 
-  // ctor for an order
+  // ctor for an order, with the price rounded to the nearest tick
   Order(double _price, long _quantity, PricingSide _side);
+  Order(TickPrice _price, long _quantity, PricingSide _side);
 
   // Get the price on the order
   double GetPrice() const;
 
+  // Get the price on the order in ticks
+  TickPrice GetTickPrice() const;
+
   // Get the quantity on the order
   long GetQuantity() const;
 
@@ -44,7 +63,7 @@ public:
   PricingSide GetSide() const;
 
 private:
-  double price;
+  TickPrice price;
   long quantity;
   PricingSide side;
 
@@ -52,6 +71,13 @@ private:
 
 
 Order::Order(double _price, long _quantity, PricingSide _side)
+{
+  price = TickPrice::FromDouble(_price);
+  quantity = _quantity;
+  side = _side;
+}
+
+Order::Order(TickPrice _price, long _quantity, PricingSide _side)
 {
   price = _price;
   quantity = _quantity;
@@ -59,6 +85,11 @@ Order::Order(double _price, long _quantity, PricingSide _side)
 }
 
 double Order::GetPrice() const
+{
+  return price.ToDouble();
+}
+
+TickPrice Order::GetTickPrice() const
 {
   return price;
 }
@@ -119,12 +150,408 @@ const Order& BidOffer::GetOfferOrder() const
 
 
 
+// Change made to a price level
+enum BookAction { ADD_LEVEL, MODIFY_LEVEL, DELETE_LEVEL };
+
+/**
+ * An update to one price level of a book. Levels are positions on a side, 0 at the top.
+ * Adding a level pushes the levels at and below it down one, deleting one pulls them up.
+ */
+struct BookUpdate
+{
+  int productIndex;
+  PricingSide side;
+  BookAction action;
+  int level;
+  TickPrice price;            // ignored for DELETE_LEVEL
+  long size;                  // ignored for DELETE_LEVEL
+};
+
+
+/**
+ * Order book of a fixed depth, held inline as parallel arrays of level prices and sizes.
+ * The product is held by its reference data index, so the book is trivially copyable: a
+ * copy is a memcpy with no allocation. Levels are in the order given, not sorted.
+ * Type T is the product type, and Depth the most levels on each side. A Depth of 0 is the
+ * order book with a bid and offer stack of any depth, below.
+ */
+template<typename T, int Depth = 0>
+class OrderBook
+{
+
+public:
+
+  // Most levels on each side
+  static const int DEPTH = Depth;
+
+  // ctor for an empty book with no product
+  OrderBook();
+
+  // ctor for an empty book of the product at a reference data index
+  OrderBook(int _productIndex);
+
+  // Get the product
+  const T& GetProduct() const;
+
+  // Get the reference data index of the product
+  int GetProductIndex() const;
+
+  // Get the number of levels on each side
+  int GetBidLevels() const;
+  int GetOfferLevels() const;
+
+  // Get the price and size at a level
+  TickPrice GetBidPrice(int level) const;
+  long GetBidSize(int level) const;
+  TickPrice GetOfferPrice(int level) const;
+  long GetOfferSize(int level) const;
+
+  // Get the prices and sizes of every level, for loops over the whole side
+  const array<TickPrice, Depth>& GetBidPrices() const;
+  const array<long, Depth>& GetBidSizes() const;
+  const array<TickPrice, Depth>& GetOfferPrices() const;
+  const array<long, Depth>& GetOfferSizes() const;
+
+  // Set a level below Depth, adding the levels up to it if the side is shorter
+  void SetBid(int level, TickPrice price, long size);
+  void SetOffer(int level, TickPrice price, long size);
+
+  // Apply a level update in place. A level added to a full side drops the deepest level.
+  // Returns false, leaving the book as it was, if the level is out of range.
+  bool Apply(const BookUpdate &update);
+
+  // Get the shallowest level of a side changed since ClearChanges, or Depth if none was
+  int GetChangedLevel(PricingSide side) const;
+
+  // Mark every level unchanged
+  void ClearChanges();
+
+  // Remove every level
+  void Clear();
+
+private:
+  array<TickPrice, Depth> bidPrices;
+  array<long, Depth> bidSizes;
+  array<TickPrice, Depth> offerPrices;
+  array<long, Depth> offerSizes;
+  int32_t productIndex;
+  int16_t bidLevels;
+  int16_t offerLevels;
+  int8_t changedBidLevel;
+  int8_t changedOfferLevel;
+
+};
+
+template<typename T, int Depth>
+OrderBook<T, Depth>::OrderBook() :
+  bidPrices(), bidSizes(), offerPrices(), offerSizes(), productIndex(-1), bidLevels(0), offerLevels(0),
+  changedBidLevel(Depth), changedOfferLevel(Depth)
+{
+}
+
+template<typename T, int Depth>
+OrderBook<T, Depth>::OrderBook(int _productIndex) :
+  bidPrices(), bidSizes(), offerPrices(), offerSizes(), productIndex(_productIndex), bidLevels(0), offerLevels(0),
+  changedBidLevel(Depth), changedOfferLevel(Depth)
+{
+}
+
+template<typename T, int Depth>
+const T& OrderBook<T, Depth>::GetProduct() const
+{
+  return GetReferenceProduct<T>(productIndex);
+}
+
+template<typename T, int Depth>
+int OrderBook<T, Depth>::GetProductIndex() const
+{
+  return productIndex;
+}
+
+template<typename T, int Depth>
+int OrderBook<T, Depth>::GetBidLevels() const
+{
+  return bidLevels;
+}
+
+template<typename T, int Depth>
+int OrderBook<T, Depth>::GetOfferLevels() const
+{
+  return offerLevels;
+}
+
+template<typename T, int Depth>
+TickPrice OrderBook<T, Depth>::GetBidPrice(int level) const
+{
+  return bidPrices[level];
+}
+
+template<typename T, int Depth>
+long OrderBook<T, Depth>::GetBidSize(int level) const
+{
+  return bidSizes[level];
+}
+
+template<typename T, int Depth>
+TickPrice OrderBook<T, Depth>::GetOfferPrice(int level) const
+{
+  return offerPrices[level];
+}
+
+template<typename T, int Depth>
+long OrderBook<T, Depth>::GetOfferSize(int level) const
+{
+  return offerSizes[level];
+}
+
+template<typename T, int Depth>
+const array<TickPrice, Depth>& OrderBook<T, Depth>::GetBidPrices() const
+{
+  return bidPrices;
+}
+
+template<typename T, int Depth>
+const array<long, Depth>& OrderBook<T, Depth>::GetBidSizes() const
+{
+  return bidSizes;
+}
+
+template<typename T, int Depth>
+const array<TickPrice, Depth>& OrderBook<T, Depth>::GetOfferPrices() const
+{
+  return offerPrices;
+}
+
+template<typename T, int Depth>
+const array<long, Depth>& OrderBook<T, Depth>::GetOfferSizes() const
+{
+  return offerSizes;
+}
+
+template<typename T, int Depth>
+void OrderBook<T, Depth>::SetBid(int level, TickPrice price, long size)
+{
+  bidPrices[level] = price;
+  bidSizes[level] = size;
+  bidLevels = level < bidLevels ? bidLevels : level + 1;
+  changedBidLevel = level < changedBidLevel ? level : changedBidLevel;
+}
+
+template<typename T, int Depth>
+void OrderBook<T, Depth>::SetOffer(int level, TickPrice price, long size)
+{
+  offerPrices[level] = price;
+  offerSizes[level] = size;
+  offerLevels = level < offerLevels ? offerLevels : level + 1;
+  changedOfferLevel = level < changedOfferLevel ? level : changedOfferLevel;
+}
+
+template<typename T, int Depth>
+bool OrderBook<T, Depth>::Apply(const BookUpdate &update)
+{
+  bool bid = update.side == BID;
+  array<TickPrice, Depth> &prices = bid ? bidPrices : offerPrices;
+  array<long, Depth> &sizes = bid ? bidSizes : offerSizes;
+  int16_t &levels = bid ? bidLevels : offerLevels;
+  int8_t &changed = bid ? changedBidLevel : changedOfferLevel;
+  int level = update.level;
+
+  switch(update.action)
+  {
+    case ADD_LEVEL:
+      if(level < 0 || level > levels || level >= Depth)
+      {
+        return false;
+      }
+      for(int i = levels < Depth ? levels : Depth - 1; i > level; i--)
+      {
+        prices[i] = prices[i - 1];
+        sizes[i] = sizes[i - 1];
+      }
+      prices[level] = update.price;
+      sizes[level] = update.size;
+      levels = levels < Depth ? levels + 1 : Depth;
+      break;
+
+    case MODIFY_LEVEL:
+      if(level < 0 || level >= levels)
+      {
+        return false;
+      }
+      prices[level] = update.price;
+      sizes[level] = update.size;
+      break;
+
+    case DELETE_LEVEL:
+      if(level < 0 || level >= levels)
+      {
+        return false;
+      }
+      for(int i = level; i < levels - 1; i++)
+      {
+        prices[i] = prices[i + 1];
+        sizes[i] = sizes[i + 1];
+      }
+      levels--;
+      break;
+  }
+
+  changed = level < changed ? level : changed;
+  return true;
+}
+
+template<typename T, int Depth>
+int OrderBook<T, Depth>::GetChangedLevel(PricingSide side) const
+{
+  return side == BID ? changedBidLevel : changedOfferLevel;
+}
+
+template<typename T, int Depth>
+void OrderBook<T, Depth>::ClearChanges()
+{
+  changedBidLevel = Depth;
+  changedOfferLevel = Depth;
+}
+
+template<typename T, int Depth>
+void OrderBook<T, Depth>::Clear()
+{
+  bidLevels = 0;
+  offerLevels = 0;
+  changedBidLevel = 0;
+  changedOfferLevel = 0;
+}
+
+// Diff one side of two books into level updates, comparing levels by position
+template<int Depth>
+int DiffBookSide(int productIndex, PricingSide side,
+  const array<TickPrice, Depth> &previousPrices, const array<long, Depth> &previousSizes, int previousLevels,
+  const array<TickPrice, Depth> &nextPrices, const array<long, Depth> &nextSizes, int nextLevels,
+  BookUpdate *updates)
+{
+  int count = 0;
+  int common = previousLevels < nextLevels ? previousLevels : nextLevels;
+  for(int i = 0; i<common; i++)
+  {
+    if(previousPrices[i] != nextPrices[i] || previousSizes[i] != nextSizes[i])
+    {
+      BookUpdate update = { productIndex, side, MODIFY_LEVEL, i, nextPrices[i], nextSizes[i] };
+      updates[count++] = update;
+    }
+  }
+  for(int i = common; i<nextLevels; i++)
+  {
+    BookUpdate update = { productIndex, side, ADD_LEVEL, i, nextPrices[i], nextSizes[i] };
+    updates[count++] = update;
+  }
+  // Deepest first, so that no deletion moves a level still to be deleted
+  for(int i = previousLevels - 1; i >= common; i--)
+  {
+    BookUpdate update = { productIndex, side, DELETE_LEVEL, i, TickPrice(), 0 };
+    updates[count++] = update;
+  }
+  return count;
+}
+
+// Diff two books of a product into the level updates that turn the first into the second,
+// for sources that only send snapshots. Levels are compared by position, so a level
+// inserted near the top shows up as a change to every level below it. Writes at most
+// 2 * Depth updates and returns how many.
+template<typename T, int Depth>
+int DiffOrderBooks(const OrderBook<T, Depth> &previous, const OrderBook<T, Depth> &next, BookUpdate *updates)
+{
+  int count = DiffBookSide<Depth>(next.GetProductIndex(), BID,
+    previous.GetBidPrices(), previous.GetBidSizes(), previous.GetBidLevels(),
+    next.GetBidPrices(), next.GetBidSizes(), next.GetBidLevels(), updates);
+  return count + DiffBookSide<Depth>(next.GetProductIndex(), OFFER,
+    previous.GetOfferPrices(), previous.GetOfferSizes(), previous.GetOfferLevels(),
+    next.GetOfferPrices(), next.GetOfferSizes(), next.GetOfferLevels(), updates + count);
+}
+
+// Merge one side of a book into sorted levels of distinct prices, best first, with the
+// sizes at a price summed, and return the number of levels. Each level is placed by its
+// rank, the number of levels ahead of it, which is a fixed Depth x Depth loop of compares
+// with no data dependent branches, and equal prices are then folded into one level.
+template<int Depth>
+int AggregateBookSide(const array<TickPrice, Depth> &prices, const array<long, Depth> &sizes, int levels,
+  bool bestIsHighest, array<TickPrice, Depth> &aggregatedPrices, array<long, Depth> &aggregatedSizes)
+{
+  int64_t ticks[Depth];
+  int64_t sorted[Depth];
+  long sortedSizes[Depth];
+  for(int i = 0; i<Depth; i++)
+  {
+    // Negate bids so that both sides sort ascending, and put missing levels last so that
+    // the rank loop below runs over the full depth without a mask
+    int64_t tick = bestIsHighest ? -prices[i].GetTicks() : prices[i].GetTicks();
+    ticks[i] = i < levels ? tick : INT64_MAX;
+  }
+  for(int i = 0; i<Depth; i++)
+  {
+    int rank = 0;
+    for(int j = 0; j<Depth; j++)
+    {
+      rank += (ticks[j] < ticks[i]) | ((ticks[j] == ticks[i]) & (j < i));
+    }
+    sorted[rank] = ticks[i];
+    sortedSizes[rank] = i < levels ? sizes[i] : 0;
+  }
+
+  // A price equal to the one before folds into its level, otherwise the level before is
+  // complete and a new one starts
+  int count = 0;
+  int64_t last = 0;
+  long total = 0;
+  for(int i = 0; i<levels; i++)
+  {
+    if(i > 0 && sorted[i] != last)
+    {
+      aggregatedPrices[count] = TickPrice::FromTicks(bestIsHighest ? -last : last);
+      aggregatedSizes[count] = total;
+      count++;
+      total = 0;
+    }
+    total += sortedSizes[i];
+    last = sorted[i];
+  }
+  if(levels > 0)
+  {
+    aggregatedPrices[count] = TickPrice::FromTicks(bestIsHighest ? -last : last);
+    aggregatedSizes[count] = total;
+    count++;
+  }
+  return count;
+}
+
+// Aggregate a book: each side sorted best first, with one level per price holding the
+// total size at that price
+template<typename T, int Depth>
+OrderBook<T, Depth> AggregateOrderBook(const OrderBook<T, Depth> &book)
+{
+  array<TickPrice, Depth> prices;
+  array<long, Depth> sizes;
+  OrderBook<T, Depth> aggregated(book.GetProductIndex());
+
+  int levels = AggregateBookSide<Depth>(book.GetBidPrices(), book.GetBidSizes(), book.GetBidLevels(), true, prices, sizes);
+  for(int i = 0; i<levels; i++)
+  {
+    aggregated.SetBid(i, prices[i], sizes[i]);
+  }
+  levels = AggregateBookSide<Depth>(book.GetOfferPrices(), book.GetOfferSizes(), book.GetOfferLevels(), false, prices, sizes);
+  for(int i = 0; i<levels; i++)
+  {
+    aggregated.SetOffer(i, prices[i], sizes[i]);
+  }
+  return aggregated;
+}
+
+
 /**
  * Order book with a bid and offer stack.
  * Type T is the product type.
  */
 template<typename T>
-class OrderBook
+class OrderBook<T, 0>
 {
 
 public:
@@ -153,47 +580,449 @@ private:
 
 
 template<typename T>
-OrderBook<T>::OrderBook(const T &_product, const vector<Order> &_bidStack, const vector<Order> &_offerStack) :
+OrderBook<T, 0>::OrderBook(const T &_product, const vector<Order> &_bidStack, const vector<Order> &_offerStack) :
   product(_product), bidStack(_bidStack), offerStack(_offerStack)
 {
 }
 
 template<typename T>
-const T& OrderBook<T>::GetProduct() const
+const T& OrderBook<T, 0>::GetProduct() const
 {
   return product;
 }
 
 template<typename T>
-const vector<Order>& OrderBook<T>::GetBidStack() const
+const vector<Order>& OrderBook<T, 0>::GetBidStack() const
 {
   return bidStack;
 }
 
 template<typename T>
-const vector<Order>& OrderBook<T>::GetOfferStack() const
+const vector<Order>& OrderBook<T, 0>::GetOfferStack() const
 {
   return offerStack;
 }
 
 
 
+// The five-level book of the market data feed
+typedef OrderBook<Bond, MARKET_DATA_DEPTH> BondOrderBook;
+
+static_assert(is_trivially_copyable<BondOrderBook>::value, "books are copied as plain memory");
+static_assert(sizeof(BondOrderBook) <= 192, "a five-level book fits in three cache lines");
+
+
+/**
+ * Best bid and offer of a product, with their sizes and the levels they are at.
+ */
+struct TopOfBook
+{
+  TickPrice bid;
+  long bidSize;
+  TickPrice offer;
+  long offerSize;
+  int bidLevel;               // -1 when there are no bids
+  int offerLevel;             // -1 when there are no offers
+
+  // ctor for an empty book
+  TopOfBook() : bidSize(0), offerSize(0), bidLevel(-1), offerLevel(-1) {}
+
+  // Is there a price on both sides?
+  bool IsTwoSided() const { return bidLevel >= 0 && offerLevel >= 0; }
+
+  // Best offer - best bid
+  TickPrice GetSpread() const { return offer - bid; }
+
+  // Are the best prices and their sizes the same as another's, wherever they are in the book?
+  bool IsSameTouch(const TopOfBook &other) const
+  {
+    return bid == other.bid && bidSize == other.bidSize && offer == other.offer && offerSize == other.offerSize;
+  }
+};
+
+inline bool operator==(const TopOfBook &a, const TopOfBook &b)
+{
+  return a.bid == b.bid && a.bidSize == b.bidSize && a.offer == b.offer && a.offerSize == b.offerSize
+    && a.bidLevel == b.bidLevel && a.offerLevel == b.offerLevel;
+}
+
+inline bool operator!=(const TopOfBook &a, const TopOfBook &b)
+{
+  return !(a == b);
+}
+
+// Find the top of a book: the highest bid and the lowest offer, each with the sizes of
+// every level at its price summed, at the first level it is on. The levels of the market
+// data feed need not be sorted, so every level is looked at.
+template<typename T, int Depth>
+TopOfBook GetTopOfBook(const OrderBook<T, Depth> &book)
+{
+  TopOfBook top;
+  for(int i = 0; i<book.GetBidLevels(); i++)
+  {
+    if(top.bidLevel >= 0 && book.GetBidPrice(i) == top.bid)
+    {
+      top.bidSize += book.GetBidSize(i);
+    }
+    else if(top.bidLevel < 0 || book.GetBidPrice(i) > top.bid)
+    {
+      top.bid = book.GetBidPrice(i);
+      top.bidSize = book.GetBidSize(i);
+      top.bidLevel = i;
+    }
+  }
+  for(int i = 0; i<book.GetOfferLevels(); i++)
+  {
+    if(top.offerLevel >= 0 && book.GetOfferPrice(i) == top.offer)
+    {
+      top.offerSize += book.GetOfferSize(i);
+    }
+    else if(top.offerLevel < 0 || book.GetOfferPrice(i) < top.offer)
+    {
+      top.offer = book.GetOfferPrice(i);
+      top.offerSize = book.GetOfferSize(i);
+      top.offerLevel = i;
+    }
+  }
+  return top;
+}
+
+/**
+ * Latest top of book of each product behind a seqlock per product. There is one writer,
+ * the thread delivering market data, and any number of readers on other threads, which
+ * never lock: a reader that overlaps a write sees an odd or changed sequence and retries.
+ */
+class TopOfBookCache
+{
+
+public:
+
+  TopOfBookCache();
+
+  // Publish the top of book of a product. Called by the market data thread only.
+  void Update(int productIndex, const TopOfBook &top);
+
+  // Read the top of book of a product from any thread
+  TopOfBook Get(int productIndex) const;
+
+private:
+
+  // Fields are relaxed atomics so that a torn read is a retry rather than a data race.
+  // A slot per cache line keeps a write to one product from disturbing readers of another.
+  struct alignas(64) Slot
+  {
+    atomic<uint64_t> sequence;
+    atomic<int64_t> bid;
+    atomic<int64_t> bidSize;
+    atomic<int64_t> offer;
+    atomic<int64_t> offerSize;
+    atomic<int32_t> bidLevel;
+    atomic<int32_t> offerLevel;
+  };
+
+  Slot slots[BOND_COUNT];
+
+};
+
+inline TopOfBookCache::TopOfBookCache()
+{
+  for(int i = 0; i<BOND_COUNT; i++)
+  {
+    Slot &slot = slots[i];
+    slot.sequence.store(0, memory_order_relaxed);
+    slot.bid.store(0, memory_order_relaxed);
+    slot.bidSize.store(0, memory_order_relaxed);
+    slot.offer.store(0, memory_order_relaxed);
+    slot.offerSize.store(0, memory_order_relaxed);
+    slot.bidLevel.store(-1, memory_order_relaxed);
+    slot.offerLevel.store(-1, memory_order_relaxed);
+  }
+}
+
+inline void TopOfBookCache::Update(int productIndex, const TopOfBook &top)
+{
+  Slot &slot = slots[productIndex];
+  uint64_t sequence = slot.sequence.load(memory_order_relaxed);
+  slot.sequence.store(sequence + 1, memory_order_relaxed);
+  atomic_thread_fence(memory_order_release);
+  slot.bid.store(top.bid.GetTicks(), memory_order_relaxed);
+  slot.bidSize.store(top.bidSize, memory_order_relaxed);
+  slot.offer.store(top.offer.GetTicks(), memory_order_relaxed);
+  slot.offerSize.store(top.offerSize, memory_order_relaxed);
+  slot.bidLevel.store(top.bidLevel, memory_order_relaxed);
+  slot.offerLevel.store(top.offerLevel, memory_order_relaxed);
+  slot.sequence.store(sequence + 2, memory_order_release);
+}
+
+inline TopOfBook TopOfBookCache::Get(int productIndex) const
+{
+  const Slot &slot = slots[productIndex];
+  TopOfBook top;
+  uint64_t before, after;
+  do
+  {
+    before = slot.sequence.load(memory_order_acquire);
+    top.bid = TickPrice::FromTicks(slot.bid.load(memory_order_relaxed));
+    top.bidSize = slot.bidSize.load(memory_order_relaxed);
+    top.offer = TickPrice::FromTicks(slot.offer.load(memory_order_relaxed));
+    top.offerSize = slot.offerSize.load(memory_order_relaxed);
+    top.bidLevel = slot.bidLevel.load(memory_order_relaxed);
+    top.offerLevel = slot.offerLevel.load(memory_order_relaxed);
+    atomic_thread_fence(memory_order_acquire);
+    after = slot.sequence.load(memory_order_relaxed);
+  } while((before & 1) != 0 || before != after);
+  return top;
+}
+
+
+
+/**
+ * A price level of a composite book: the size at a price summed across venues, and the
+ * part of it each venue shows.
+ */
+struct CompositeLevel
+{
+  TickPrice price;
+  long size;
+  long venueSizes[MARKET_COUNT];
+  int venueLevels;            // venue book levels at this price; the level goes at 0
+
+  // Get the venue showing the most size at this price
+  Market GetLargestVenue() const;
+};
+
+inline Market CompositeLevel::GetLargestVenue() const
+{
+  int largest = 0;
+  for(int v = 1; v<MARKET_COUNT; v++)
+  {
+    largest = venueSizes[v] > venueSizes[largest] ? v : largest;
+  }
+  return Market(largest);
+}
+
+/**
+ * Book of a product across venues. The levels of every venue book are merged into one level
+ * per price, sorted best first, keeping the size each venue shows at the price. Venue
+ * levels are added and removed one at a time, so a change on one venue moves only the
+ * levels it touches instead of merging every venue again.
+ * Type T is the product type, and Depth the most prices on each side, which is at most the
+ * venue book depth times the number of venues.
+ */
+template<typename T, int Depth>
+class CompositeOrderBook
+{
+
+public:
+
+  // Most prices on each side
+  static const int DEPTH = Depth;
+
+  // ctor for an empty book with no product
+  CompositeOrderBook();
+
+  // ctor for an empty book of the product at a reference data index
+  CompositeOrderBook(int _productIndex);
+
+  // Get the product
+  const T& GetProduct() const;
+
+  // Get the reference data index of the product
+  int GetProductIndex() const;
+
+  // Get the number of prices on a side
+  int GetLevels(PricingSide side) const;
+
+  // Get a level of a side, 0 being the best price
+  const CompositeLevel& GetLevel(PricingSide side, int level) const;
+
+  // Find the level of a side at a price, or -1 if no venue shows the price
+  int FindLevel(PricingSide side, TickPrice price) const;
+
+  // Find the venue showing the most size at a price. Returns false if no venue shows it.
+  bool GetLargestVenue(PricingSide side, TickPrice price, Market &venue) const;
+
+  // Add a venue book level. Returns false, leaving the book as it was, if the side is full.
+  bool Add(Market venue, PricingSide side, TickPrice price, long size);
+
+  // Take out a venue book level added before. Returns false if there is no level at the price.
+  bool Remove(Market venue, PricingSide side, TickPrice price, long size);
+
+  // Change the size of a venue book level added before, whose price has not changed
+  bool Resize(Market venue, PricingSide side, TickPrice price, long sizeChange);
+
+  // Remove every level
+  void Clear();
+
+private:
+  CompositeLevel bids[Depth];
+  CompositeLevel offers[Depth];
+  int32_t productIndex;
+  int16_t bidLevels;
+  int16_t offerLevels;
+
+};
+
+template<typename T, int Depth>
+CompositeOrderBook<T, Depth>::CompositeOrderBook() :
+  productIndex(-1), bidLevels(0), offerLevels(0)
+{
+}
+
+template<typename T, int Depth>
+CompositeOrderBook<T, Depth>::CompositeOrderBook(int _productIndex) :
+  productIndex(_productIndex), bidLevels(0), offerLevels(0)
+{
+}
+
+template<typename T, int Depth>
+const T& CompositeOrderBook<T, Depth>::GetProduct() const
+{
+  return GetReferenceProduct<T>(productIndex);
+}
+
+template<typename T, int Depth>
+int CompositeOrderBook<T, Depth>::GetProductIndex() const
+{
+  return productIndex;
+}
+
+template<typename T, int Depth>
+int CompositeOrderBook<T, Depth>::GetLevels(PricingSide side) const
+{
+  return side == BID ? bidLevels : offerLevels;
+}
+
+template<typename T, int Depth>
+const CompositeLevel& CompositeOrderBook<T, Depth>::GetLevel(PricingSide side, int level) const
+{
+  return side == BID ? bids[level] : offers[level];
+}
+
+template<typename T, int Depth>
+int CompositeOrderBook<T, Depth>::FindLevel(PricingSide side, TickPrice price) const
+{
+  const CompositeLevel *levels = side == BID ? bids : offers;
+  int count = side == BID ? bidLevels : offerLevels;
+  for(int i = 0; i<count; i++)
+  {
+    if(levels[i].price == price)
+    {
+      return i;
+    }
+  }
+  return -1;
+}
+
+template<typename T, int Depth>
+bool CompositeOrderBook<T, Depth>::GetLargestVenue(PricingSide side, TickPrice price, Market &venue) const
+{
+  int level = FindLevel(side, price);
+  if(level < 0)
+  {
+    return false;
+  }
+  venue = GetLevel(side, level).GetLargestVenue();
+  return true;
+}
+
+template<typename T, int Depth>
+bool CompositeOrderBook<T, Depth>::Add(Market venue, PricingSide side, TickPrice price, long size)
+{
+  CompositeLevel *levels = side == BID ? bids : offers;
+  int16_t &count = side == BID ? bidLevels : offerLevels;
+
+  // Skip the better prices: higher bids or lower offers
+  int i = 0;
+  while(i < count && (side == BID ? levels[i].price > price : levels[i].price < price))
+  {
+    i++;
+  }
+  if(i == count || levels[i].price != price)
+  {
+    if(count == Depth)
+    {
+      return false;
+    }
+    for(int j = count; j > i; j--)
+    {
+      levels[j] = levels[j - 1];
+    }
+    levels[i] = CompositeLevel();
+    levels[i].price = price;
+    count++;
+  }
+  levels[i].size += size;
+  levels[i].venueSizes[venue] += size;
+  levels[i].venueLevels++;
+  return true;
+}
+
+template<typename T, int Depth>
+bool CompositeOrderBook<T, Depth>::Remove(Market venue, PricingSide side, TickPrice price, long size)
+{
+  CompositeLevel *levels = side == BID ? bids : offers;
+  int16_t &count = side == BID ? bidLevels : offerLevels;
+  int i = FindLevel(side, price);
+  if(i < 0)
+  {
+    return false;
+  }
+  levels[i].size -= size;
+  levels[i].venueSizes[venue] -= size;
+  if(--levels[i].venueLevels == 0)
+  {
+    for(int j = i; j < count - 1; j++)
+    {
+      levels[j] = levels[j + 1];
+    }
+    count--;
+  }
+  return true;
+}
+
+template<typename T, int Depth>
+bool CompositeOrderBook<T, Depth>::Resize(Market venue, PricingSide side, TickPrice price, long sizeChange)
+{
+  int i = FindLevel(side, price);
+  if(i < 0)
+  {
+    return false;
+  }
+  CompositeLevel &level = side == BID ? bids[i] : offers[i];
+  level.size += sizeChange;
+  level.venueSizes[venue] += sizeChange;
+  return true;
+}
+
+template<typename T, int Depth>
+void CompositeOrderBook<T, Depth>::Clear()
+{
+  bidLevels = 0;
+  offerLevels = 0;
+}
+
+// The book of every venue's five-level books merged
+typedef CompositeOrderBook<Bond, MARKET_COUNT * MARKET_DATA_DEPTH> BondCompositeBook;
+
+
+
 /**
  * Market Data Service which distributes market data
  * Keyed on product identifier.
  * Type T is the product type.
  */
 template<typename T>
-class MarketDataService : public Service<string,OrderBook <T> >
+class MarketDataService : public Service<string,OrderBook <T, MARKET_DATA_DEPTH> >
 {
 
 public:
 
   // Get the best bid/offer order
- // virtual const BidOffer& GetBestBidOffer(const string &productId) = 0;
+  virtual BidOffer GetBestBidOffer(const string &productId) = 0;
 
   // Aggregate the order book
-  virtual const OrderBook<T>& AggregateDepth(const string &productId) = 0;
+  virtual const OrderBook<T, MARKET_DATA_DEPTH>& AggregateDepth(const string &productId) = 0;
 
 };
 
@@ -203,16 +1032,37 @@ class BondMarketDataService : public MarketDataService < Bond >
 
 public:
 
-  virtual OrderBook<Bond>& GetData(string key)
+  BondMarketDataService() : AggregatedValid(0)
+  {
+    for(int i = 0; i<BOND_COUNT; i++)
+    {
+      for(int v = 0; v<MARKET_COUNT; v++)
+      {
+        MarketDataBooks[v][i] = BondOrderBook(i);
+      }
+      CompositeBooks[i] = BondCompositeBook(i);
+      LastVenues[i] = BROKERTEC;
+    }
+  }
+
+  // Get the latest book of a product, from the venue that last sent one
+  virtual BondOrderBook& GetData(string key)
   {
-    return MarketDataMP[key];
+    int index = GetBondIndex(key);
+    return index < 0 ? EmptyBook : MarketDataBooks[LastVenues[index]][index];
   }
 
   // The callback that a Connector should invoke for any new or updated data
-  virtual void OnMessage(OrderBook<Bond> &data)
+  virtual void OnMessage(BondOrderBook &data)
   {
-    
-    UpdateMD(data);
+    OnMessage(data, BROKERTEC);
+  }
+
+  // The callback for a book from a venue
+  void OnMessage(BondOrderBook &data, Market venue)
+  {
+    lock_guard<recursive_mutex> guard(DeliveryLock);
+    UpdateMD(data, venue);
 
 
 
@@ -234,277 +1084,379 @@ public:
   }
 
 
-  void UpdateMD(OrderBook<Bond> &data)
+  // Store the book of a product from a venue, patching the composite book with the levels
+  // that changed
+  void UpdateMD(BondOrderBook &data, Market venue = BROKERTEC)
   {
+    int index = data.GetProductIndex();
+    if(index >= 0 && index < BOND_COUNT)
+    {
+      BondOrderBook &book = MarketDataBooks[venue][index];
+      PatchComposite(index, venue, BID, book.GetBidPrices(), book.GetBidSizes(), book.GetBidLevels(),
+        data.GetBidPrices(), data.GetBidSizes(), data.GetBidLevels());
+      PatchComposite(index, venue, OFFER, book.GetOfferPrices(), book.GetOfferSizes(), book.GetOfferLevels(),
+        data.GetOfferPrices(), data.GetOfferSizes(), data.GetOfferLevels());
+      book = data;
+      VenueTops[venue][index] = ::GetTopOfBook(book);
+      TopOfBooks.Update(index, ConsolidateTop(index));
+      LastVenues[index] = venue;
+      AggregatedValid &= ~(1u << index);
+    }
+  }
 
-    string productId = data.GetProduct().GetProductId();
-
-    if(MarketDataMP.find(productId)== MarketDataMP.end())
-    {  
+  // Apply level updates from a venue to its stored books in place. Each book they touch
+  // then goes to the listeners once, as an update, with GetChangedLevel giving the
+  // shallowest level changed on each side so that listeners can skip work when only deep
+  // levels moved.
+  void OnUpdates(const BookUpdate *updates, int count, Market venue = BROKERTEC)
+  {
+    lock_guard<recursive_mutex> guard(DeliveryLock);
+    uint32_t touched = 0;     // bit per product index
+    for(int i = 0; i<count; i++)
+    {
+      const BookUpdate &update = updates[i];
+      int index = update.productIndex;
+      if(index < 0 || index >= BOND_COUNT)
+      {
+        continue;
+      }
+      BondOrderBook &book = MarketDataBooks[venue][index];
+      if((touched & (1u << index)) == 0)
+      {
+        book.ClearChanges();
+        touched |= 1u << index;
+        AggregatedValid &= ~(1u << index);
+      }
 
-      MarketDataMP.insert(std::pair<string,OrderBook<Bond> >(productId, data));
+      // The level the update replaces, deletes or pushes off a full side leaves the
+      // composite book, and the level it sets joins it
+      bool bid = update.side == BID;
+      int levels = bid ? book.GetBidLevels() : book.GetOfferLevels();
+      int replaced = update.action != ADD_LEVEL ? update.level : (levels == MARKET_DATA_DEPTH ? levels - 1 : -1);
+      TickPrice price = replaced >= 0 && replaced < levels ? (bid ? book.GetBidPrice(replaced) : book.GetOfferPrice(replaced)) : TickPrice();
+      long size = replaced >= 0 && replaced < levels ? (bid ? book.GetBidSize(replaced) : book.GetOfferSize(replaced)) : 0;
+      if(!book.Apply(update))
+      {
+        continue;
+      }
+      if(update.action == MODIFY_LEVEL && update.price == price)
+      {
+        CompositeBooks[index].Resize(venue, update.side, price, update.size - size);
+        continue;
+      }
+      if(replaced >= 0)
+      {
+        CompositeBooks[index].Remove(venue, update.side, price, size);
+      }
+      if(update.action != DELETE_LEVEL)
+      {
+        CompositeBooks[index].Add(venue, update.side, update.price, update.size);
+      }
     }
-    else
+
+    for(; touched != 0; touched &= touched - 1)
     {
-      MarketDataMP[productId] = data;
+      int index = __builtin_ctz(touched);
+      BondOrderBook &book = MarketDataBooks[venue][index];
+      VenueTops[venue][index] = ::GetTopOfBook(book);
+      TopOfBooks.Update(index, ConsolidateTop(index));
+      LastVenues[index] = venue;
+      for(int i = 0; i<MarketDataListeners.size();i++)
+      {
+        MarketDataListeners[i]->ProcessUpdate(book);
+      }
     }
   }
 
+  // Apply a single level update
+  void OnUpdate(BookUpdate &update, Market venue = BROKERTEC)
+  {
+    OnUpdates(&update, 1, venue);
+  }
+
   // Add a listener to the Service for callbacks on add, remove, and update events
   // for data to the Service.
-  virtual void AddListener(ServiceListener< OrderBook<Bond> > *listener)
+  virtual void AddListener(ServiceListener< BondOrderBook > *listener)
   {
     MarketDataListeners.push_back(listener);
   }
 
   // Get all listeners on the Service.
-  virtual const vector< ServiceListener< OrderBook<Bond> >* >& GetListeners() const
+  virtual const vector< ServiceListener< BondOrderBook >* >& GetListeners() const
   {
     return MarketDataListeners;
   }
 
-/*
+  // Get the top of book of a product across venues, without locking, from any thread.
+  // Its levels are levels of the composite book.
+  TopOfBook GetTopOfBook(int productIndex) const
+  {
+    return TopOfBooks.Get(productIndex);
+  }
 
-  // Get the best bid/offer order
-  virtual const BidOffer& GetBestBidOffer(const string &productId)
+  // Get the latest book of a product from a venue
+  const BondOrderBook& GetVenueBook(Market venue, int productIndex) const
   {
-      OrderBook<Bond> currentOrder = MarketDataMP[productId];
-      vector<Order> bidStack = MarketDataMP[productId].GetBidStack();
-      vector<Order> offerStack = MarketDataMP[productId].GetOfferStack();
-      int idx=0;
-      double spread = offerStack[0].GetPrice() - bidStack[0].GetPrice();
+    return MarketDataBooks[venue][productIndex];
+  }
 
-      for(int i = 0; i< bidStack.size(); i++)
-      {
-        double res = offerStack[i].GetPrice() - bidStack[i].GetPrice();
-        if(res <= spread)
-        {
-          spread = res;
-          idx = i;
-        }
-      }
+  // Get the lock held while a book is stored and given to the listeners. Another thread
+  // acting on what the listeners keep, e.g. a timer, takes it to run between books.
+  recursive_mutex& GetDeliveryLock() const
+  {
+    return DeliveryLock;
+  }
 
+  // Get the book of a product across venues. Call from the thread delivering market data,
+  // or under the delivery lock.
+  const BondCompositeBook& GetCompositeBook(int productIndex) const
+  {
+    return CompositeBooks[productIndex];
+  }
 
-      const BidOffer bestBidOffer(bidStack[idx],offerStack[idx]);
-      return bestBidOffer;
+  // Get the best bid/offer order
+  virtual BidOffer GetBestBidOffer(const string &productId)
+  {
+    int index = GetBondIndex(productId);
+    TopOfBook top = index < 0 ? TopOfBook() : TopOfBooks.Get(index);
+    return BidOffer(Order(top.bid, top.bidSize, BID), Order(top.offer, top.offerSize, OFFER));
+  }
 
+  // Aggregate the order book: levels sorted best first, one per price, with the sizes at
+  // a price summed. The result is cached until the next update of the product. Call from
+  // the thread delivering market data.
+  virtual const BondOrderBook& AggregateDepth(const string &productId)
+  {
+    int index = GetBondIndex(productId);
+    if(index < 0)
+    {
+      return EmptyBook;
+    }
+    if((AggregatedValid & (1u << index)) == 0)
+    {
+      AggregatedBooks[index] = AggregateOrderBook(MarketDataBooks[LastVenues[index]][index]);
+      AggregatedValid |= 1u << index;
+    }
+    return AggregatedBooks[index];
+  }
 
+private:
 
+  // Patch the composite book of a product with one side of a venue book that changed from
+  // the previous levels to the next, comparing levels by position
+  void PatchComposite(int index, Market venue, PricingSide side,
+    const array<TickPrice, MARKET_DATA_DEPTH> &previousPrices, const array<long, MARKET_DATA_DEPTH> &previousSizes, int previousLevels,
+    const array<TickPrice, MARKET_DATA_DEPTH> &nextPrices, const array<long, MARKET_DATA_DEPTH> &nextSizes, int nextLevels)
+  {
+    BondCompositeBook &composite = CompositeBooks[index];
+    int levels = previousLevels > nextLevels ? previousLevels : nextLevels;
+    for(int i = 0; i<levels; i++)
+    {
+      if(i < previousLevels && i < nextLevels && previousPrices[i] == nextPrices[i])
+      {
+        if(previousSizes[i] != nextSizes[i])
+        {
+          composite.Resize(venue, side, nextPrices[i], nextSizes[i] - previousSizes[i]);
+        }
+        continue;
+      }
+      if(i < previousLevels)
+      {
+        composite.Remove(venue, side, previousPrices[i], previousSizes[i]);
+      }
+      if(i < nextLevels)
+      {
+        composite.Add(venue, side, nextPrices[i], nextSizes[i]);
+      }
+    }
   }
-  */
 
-  // Aggregate the order book
-  virtual const OrderBook<Bond>& AggregateDepth(const string &productId)
+  // The top of book across venues: the best of each venue's top, with the sizes of the
+  // venues at that price summed, at its level in the composite book
+  TopOfBook ConsolidateTop(int index) const
   {
+    TopOfBook top;
+    for(int v = 0; v<MARKET_COUNT; v++)
+    {
+      const TopOfBook &venueTop = VenueTops[v][index];
+      if(venueTop.bidLevel >= 0 && (top.bidLevel < 0 || venueTop.bid >= top.bid))
+      {
+        top.bidSize = top.bidLevel >= 0 && venueTop.bid == top.bid ? top.bidSize + venueTop.bidSize : venueTop.bidSize;
+        top.bid = venueTop.bid;
+        top.bidLevel = 0;
+      }
+      if(venueTop.offerLevel >= 0 && (top.offerLevel < 0 || venueTop.offer <= top.offer))
+      {
+        top.offerSize = top.offerLevel >= 0 && venueTop.offer == top.offer ? top.offerSize + venueTop.offerSize : venueTop.offerSize;
+        top.offer = venueTop.offer;
+        top.offerLevel = 0;
+      }
+    }
+    top.bidLevel = top.bidLevel < 0 ? -1 : CompositeBooks[index].FindLevel(BID, top.bid);
+    top.offerLevel = top.offerLevel < 0 ? -1 : CompositeBooks[index].FindLevel(OFFER, top.offer);
+    return top;
+  }
 
-    return MarketDataMP[productId];
+  // Latest book of each product from each venue, by venue and product index
+  BondOrderBook MarketDataBooks[MARKET_COUNT][BOND_COUNT];
+  BondOrderBook EmptyBook;
+  Market LastVenues[BOND_COUNT];
 
-  }
+  mutable recursive_mutex DeliveryLock;
 
-private:
+  // Books across venues, patched on every venue change
+  BondCompositeBook CompositeBooks[BOND_COUNT];
+  TopOfBook VenueTops[MARKET_COUNT][BOND_COUNT];
+  TopOfBookCache TopOfBooks;
 
-  map<string,OrderBook<Bond> > MarketDataMP;
-  std::vector< ServiceListener< OrderBook<Bond> >* > MarketDataListeners;
+  // Aggregated books, valid for the products whose bit is set
+  BondOrderBook AggregatedBooks[BOND_COUNT];
+  uint32_t AggregatedValid;
+  std::vector< ServiceListener< BondOrderBook >* > MarketDataListeners;
 
 };
 
 
 
 
-class BondMarketDataServiceConnector : public Connector < OrderBook <Bond> >
+/**
+ * Sends the snapshots of a source that only provides snapshots to the market data
+ * service as level updates: the first snapshot of a product whole, and each later one as
+ * its differences from the one before. One differ serves one venue.
+ */
+class BondOrderBookDiffer
 {
 private:
-  BondMarketDataService bondMDService;
+  BondOrderBook lastBooks[BOND_COUNT];
+  bool seen[BOND_COUNT];
 
 public:
-  BondMarketDataServiceConnector( BondMarketDataService& _myline):bondMDService(_myline){}; 
-  virtual void Publish(OrderBook<Bond>& data){};
-
-  void Subscribe()
+  BondOrderBookDiffer()
   {
-    string line;
-    std::ifstream file("marketdata_backup.txt");
+    for(int i = 0; i<BOND_COUNT; i++)
+    {
+      seen[i] = false;
+    }
+  }
 
-    while(getline(file,line))
+  void Send(BondMarketDataService &service, BondOrderBook &book, Market venue = BROKERTEC)
   {
-    
-    if(!line.empty())
-    {
-      std::stringstream linestream(line);
-
-      std::string product;
-      std::string stack;
-      std::string productID;
-
-      std::string bid1;
-      std::string offer1;
-      std::string quant1;
-
-      std::string bid2;
-      std::string offer2;
-      std::string quant2;
-
-      std::string bid3;
-      std::string offer3;
-      std::string quant3;
-
-      std::string bid4;
-      std::string offer4;
-      std::string quant4;
-
-      std::string bid5;
-      std::string offer5;
-      std::string quant5;
-
-      std::getline(linestream,product,',');
-      std::getline(linestream,stack,',');
-      std::getline(linestream,productID,',');
-
-      std::getline(linestream,bid1,',');
-      std::getline(linestream,offer1,',');
-      std::getline(linestream,quant1,',');
-      
-      std::getline(linestream,bid2,',');
-      std::getline(linestream,offer2,',');
-      std::getline(linestream,quant2,',');
-      
-      std::getline(linestream,bid3,',');
-      std::getline(linestream,offer3,',');
-      std::getline(linestream,quant3,',');
-      
-      std::getline(linestream,bid4,',');
-      std::getline(linestream,offer4,',');
-      std::getline(linestream,quant4,',');
-      
-      std::getline(linestream,bid5,',');
-      std::getline(linestream,offer5,',');
-      std::getline(linestream,quant5,',');
-      
-      long quantity1 = atol(quant1.c_str());
-      long quantity2 = atol(quant2.c_str());
-      long quantity3 = atol(quant3.c_str());
-      long quantity4 = atol(quant4.c_str());
-      long quantity5 = atol(quant5.c_str());
-
-      double bid_1 = stod(bid1);
-      double offer_1 = stod(offer1);
-      double bid_2 = stod(bid2);
-      double offer_2 = stod(offer2);
-      double bid_3 = stod(bid3);
-      double offer_3 = stod(offer3);
-      double bid_4 = stod(bid4);
-      double offer_4 = stod(offer4);
-      double bid_5 = stod(bid5);
-      double offer_5 = stod(offer5);
-
-     
-
-      PricingSide pSide1 = BID;
-      PricingSide pSide2 = OFFER;
-
-
-      Order bidOrder1(bid_1,quantity1,pSide1);
-      Order offerOrder1(offer_1,quantity1,pSide2);
-
-
-      Order bidOrder2(bid_2,quantity2,pSide1);
-      Order offerOrder2(offer_2,quantity2,pSide2);
-
-      Order bidOrder3(bid_3,quantity3,pSide1);
-      Order offerOrder3(offer_3,quantity3,pSide2);
-
-      Order bidOrder4(bid_4,quantity4,pSide1);
-      Order offerOrder4(offer_4,quantity4,pSide2);
-
-      Order bidOrder5(bid_5,quantity5,pSide1);
-      Order offerOrder5(offer_5,quantity5,pSide2);
-
-      const vector<Order> bidStack = {bidOrder1,bidOrder2,bidOrder3,bidOrder4,bidOrder5 };
-
-      const vector<Order> offerStack = {offerOrder1,offerOrder2,offerOrder3,offerOrder4,offerOrder5};
-
-    if(!product.empty())
+    int index = book.GetProductIndex();
+    if(index < 0 || index >= BOND_COUNT || !seen[index])
     {
-        if(product == "2Y")
+      if(index >= 0 && index < BOND_COUNT)
       {
+        lastBooks[index] = book;
+        seen[index] = true;
+      }
+      service.OnMessage(book, venue);
+      return;
+    }
 
-            BondIdType idType = CUSIP;
-            date maturityDate(2019,Oct,31);
-            const Bond bond2Y("2Y", idType,"T", 0.015, maturityDate);
-                
-
+    BookUpdate updates[2 * MARKET_DATA_DEPTH];
+    int count = DiffOrderBooks(lastBooks[index], book, updates);
+    lastBooks[index] = book;
+    if(count > 0)
+    {
+      service.OnUpdates(updates, count, venue);
+    }
+  }
+};
 
-            OrderBook<Bond> obj1 = OrderBook<Bond>(bond2Y,bidStack,offerStack);
 
-            bondMDService.OnMessage(obj1);
-            std::cout<<"updated"<<std::endl;
-      }
-      else if (product == "3Y")
-      {
+class BondMarketDataServiceConnector : public Connector < BondOrderBook >
+{
+private:
+  BondMarketDataService& bondMDService;
+  bool sendUpdates;
+  Market venue;
+  BondOrderBookDiffer differ;
 
-            BondIdType idType = CUSIP;
-            date maturityDate(2020,Nov,15);
-            const Bond bond3Y("3Y", idType, "T", 0.0175, maturityDate);
-            
-            OrderBook<Bond> obj1 = OrderBook<Bond>(bond3Y,bidStack,offerStack);
+public:
+  // ctor; with _sendUpdates the snapshots in the file are sent as level updates. The books
+  // are attributed to a venue.
+  BondMarketDataServiceConnector( BondMarketDataService& _myline, bool _sendUpdates = false, Market _venue = BROKERTEC):bondMDService(_myline),sendUpdates(_sendUpdates),venue(_venue){}; 
+  virtual void Publish(BondOrderBook& data){};
 
-            bondMDService.OnMessage(obj1);
+  void Subscribe()
+  {
+    MappedFile file("marketdata_backup.txt");
+    CsvReader reader(file.GetData(), file.GetSize());
+    CsvField fields[3 + 3 * MARKET_DATA_DEPTH];
+    int fieldCount;
+    MarketDataRecord record;
 
+    while(reader.NextLine(fields, 3 + 3 * MARKET_DATA_DEPTH, fieldCount))
+    {
+      if(!ParseMarketDataRecord(fields, fieldCount, record))
+      {
+        continue;
+      }
 
+      BondOrderBook book(record.productIndex);
+      for(int i = 0; i<MARKET_DATA_DEPTH; i++)
+      {
+        book.SetBid(i,TickPrice::FromDouble(record.bidPrices[i]),record.quantities[i]);
+        book.SetOffer(i,TickPrice::FromDouble(record.offerPrices[i]),record.quantities[i]);
       }
-      else if (product == "5Y")
+      if(sendUpdates)
       {
-            BondIdType idType = CUSIP;
-            date maturityDate(2022,Oct,31);
-            const Bond bond5Y("5Y", idType, "T", 0.02, maturityDate);
-
-            OrderBook<Bond> obj1 = OrderBook<Bond>(bond5Y,bidStack,offerStack);
-
-            bondMDService.OnMessage(obj1);
-
+        differ.Send(bondMDService, book, venue);
       }
-      else if (product == "7Y")
+      else
       {
-            BondIdType idType = CUSIP;
-            date maturityDate(2024,Oct,31);
-            const Bond bond7Y("7Y", idType, "T", 0.0225, maturityDate);
-
-            OrderBook<Bond> obj1 = OrderBook<Bond>(bond7Y,bidStack,offerStack);
+        bondMDService.OnMessage(book, venue);
+      }
+    }
+  }
 
-            bondMDService.OnMessage(obj1);
 
-      }
-      else if (product == "10Y")
-      {
+};
 
-            BondIdType idType = CUSIP;
-            date maturityDate(2027,Nov,15);
-            const Bond bond10Y("10Y", idType, "T", 0.0225, maturityDate);
 
-            OrderBook<Bond> obj1 = OrderBook<Bond>(bond10Y,bidStack,offerStack);
+/**
+ * Replays a binary five-level book feed (see binaryfeed.hpp) into the market data service.
+ */
+class BondMarketDataServiceBinaryConnector : public Connector < BondOrderBook >
+{
+private:
+  BondMarketDataService& bondMDService;
+  string path;
+  bool sendUpdates;
+  Market venue;
+  BondOrderBookDiffer differ;
 
-            bondMDService.OnMessage(obj1);
+public:
+  // ctor; with _sendUpdates the snapshots in the feed are sent as level updates. The books
+  // are attributed to a venue.
+  BondMarketDataServiceBinaryConnector( BondMarketDataService& _myline, const string &_path = "marketdata.bin", bool _sendUpdates = false, Market _venue = BROKERTEC):bondMDService(_myline),path(_path),sendUpdates(_sendUpdates),venue(_venue){};
+  virtual void Publish(BondOrderBook& data){};
 
+  void Subscribe()
+  {
+    BinaryFeedReader<OrderBookFeedRecord> reader(path.c_str());
+    for(const OrderBookFeedRecord *record = reader.Begin(); record != reader.End(); record++)
+    {
+      if(!IsValidFeedRecord(*record))
+      {
+        continue;
       }
-      else if (product == "30Y")
+      BondOrderBook book(record->productIndex);
+      for(int i = 0; i<MARKET_DATA_DEPTH; i++)
       {
-
-            BondIdType idType = CUSIP;
-            date maturityDate(2047,Nov,15);
-            const Bond bond30Y("30Y", idType, "T", 0.0275, maturityDate);
-
-            OrderBook<Bond> obj1 = OrderBook<Bond>(bond30Y,bidStack,offerStack);
-
-            bondMDService.OnMessage(obj1);
-
+        book.SetBid(i,TickPrice::FromDouble(record->bidPrices[i]),record->quantities[i]);
+        book.SetOffer(i,TickPrice::FromDouble(record->offerPrices[i]),record->quantities[i]);
+      }
+      if(sendUpdates)
+      {
+        differ.Send(bondMDService, book, venue);
+      }
+      else
+      {
+        bondMDService.OnMessage(book, venue);
       }
     }
-      
   }
-    
-}
-}
-
 
 };
 
@@ -0,0 +1,685 @@
+/**
+ * matchingengine.hpp
+ * Defines an in-process price-time priority matching engine, which stands in for a venue.
+ *
+ * Each product has a book of price levels on each side, in maps keyed so that the best
+ * level comes first, with the orders of a level in an intrusive list, oldest first.
+ * Resting orders come from a pool, and an index by order ID finds one to cancel in O(1).
+ * Stop orders wait in books of their own, by trigger price, and go in as market orders
+ * once a trade reaches it. Requests go to the engine and execution reports come back
+ * through single producer, single consumer queues, so the engine can run on a thread of
+ * its own with its clients never waiting on it.
+ */
+#ifndef MATCHING_ENGINE_HPP
+#define MATCHING_ENGINE_HPP
+
+#include <vector>
+#include <map>
+#include <unordered_map>
+#include <atomic>
+#include <thread>
+#include <stdint.h>
+
+#include "soa.hpp"
+#include "bondreferencedata.hpp"
+#include "marketdataservice.hpp"
+#include "tickprice.hpp"
+
+using namespace std;
+
+// Order types: fill or kill, immediate or cancel, market, limit and stop
+enum OrderType { FOK, IOC, MARKET, LIMIT, STOP };
+
+// Request to a matching engine
+enum EngineRequestType { NEW_ORDER, CANCEL_ORDER };
+
+/**
+ * A new order or a cancel for a matching engine. Orders on the BID side buy, and on the
+ * OFFER side sell.
+ */
+struct EngineRequest
+{
+  EngineRequestType type;
+  uint64_t orderId;           // unique per engine; the order to cancel for a cancel
+  int productIndex;
+  PricingSide side;
+  OrderType orderType;
+  TickPrice price;            // limit price, or the trigger price of a STOP
+  long quantity;
+  bool unreported;            // an order of another participant, which gets no reports
+};
+
+// What happened to an order
+enum ExecutionReportType { ORDER_ACCEPTED, ORDER_FILLED, ORDER_CANCELLED, ORDER_REJECTED, ORDER_TRIGGERED };
+
+/**
+ * A report on one order from a matching engine. A fill gives both orders of it a report
+ * with the same execution ID.
+ */
+struct ExecutionReport
+{
+  ExecutionReportType type;
+  Market venue;
+  uint64_t orderId;
+  uint64_t executionId;       // of a fill, with the venue in the top byte
+  int productIndex;
+  PricingSide side;
+  TickPrice price;            // of a fill
+  long quantity;              // filled, or cancelled
+  long leavesQuantity;        // left to fill after this report, 0 once the order is done
+};
+
+/**
+ * A bounded queue between one producing and one consuming thread.
+ */
+template<typename T>
+class SpscQueue
+{
+
+public:
+
+  // ctor for a queue of capacity items, rounded up to a power of two
+  SpscQueue(size_t capacity);
+
+  // Add an item. Returns false, leaving the queue as it was, when it is full.
+  bool TryPush(const T &item);
+
+  // Take the oldest item. Returns false when the queue is empty.
+  bool TryPop(T &item);
+
+  // Is the queue empty? Exact only on the consumer's thread.
+  bool IsEmpty() const;
+
+private:
+  vector<T> items;
+  size_t mask;
+  atomic<size_t> head;        // next to pop, written by the consumer
+  char padding[64];
+  atomic<size_t> tail;        // next to push, written by the producer
+  char padding2[64];
+
+};
+
+template<typename T>
+SpscQueue<T>::SpscQueue(size_t capacity) : head(0), tail(0)
+{
+  size_t size = 1;
+  while(size < capacity)
+  {
+    size <<= 1;
+  }
+  items.resize(size);
+  mask = size - 1;
+}
+
+template<typename T>
+bool SpscQueue<T>::TryPush(const T &item)
+{
+  size_t position = tail.load(memory_order_relaxed);
+  if(position - head.load(memory_order_acquire) > mask)
+  {
+    return false;
+  }
+  items[position & mask] = item;
+  tail.store(position + 1, memory_order_release);
+  return true;
+}
+
+template<typename T>
+bool SpscQueue<T>::TryPop(T &item)
+{
+  size_t position = head.load(memory_order_relaxed);
+  if(position == tail.load(memory_order_acquire))
+  {
+    return false;
+  }
+  item = items[position & mask];
+  head.store(position + 1, memory_order_release);
+  return true;
+}
+
+template<typename T>
+bool SpscQueue<T>::IsEmpty() const
+{
+  return head.load(memory_order_relaxed) == tail.load(memory_order_acquire);
+}
+
+
+class MatchingEngine
+{
+
+public:
+
+  // ctor for the engine of a venue, with room for orderCapacity resting and stop orders
+  // and queueCapacity requests and reports in flight
+  MatchingEngine(Market _venue, size_t _orderCapacity = 1 << 20, size_t _queueCapacity = 1 << 16);
+
+  ~MatchingEngine();
+
+  // Get the venue
+  Market GetVenue() const;
+
+  // Send a request, from the client's thread. Returns false when the queue is full.
+  bool Submit(const EngineRequest &request);
+
+  // Take the next execution report, on the client's thread
+  bool PollReport(ExecutionReport &report);
+
+  // Process up to maxRequests queued requests on the calling thread, and return how many
+  // were. Nothing is processed while earlier reports wait for room in the report queue.
+  int Poll(int maxRequests = 256);
+
+  // Poll on a thread of the engine's own, until Stop
+  void Start();
+
+  // Process every request already submitted, then stop the engine's thread
+  void Stop();
+
+  // Is the engine polling on a thread of its own?
+  bool IsRunning() const;
+
+  // Process a request now, on the calling thread, with its reports queued as usual
+  void Process(const EngineRequest &request);
+
+  // Get the best price of a side of a product's book, and the quantity at it. Returns
+  // false for an empty side. Call from the thread processing requests.
+  bool GetBest(int productIndex, PricingSide side, TickPrice &price, long &quantity) const;
+
+  // Get the last trade price of a product. Returns false before its first trade.
+  bool GetLastTrade(int productIndex, TickPrice &price) const;
+
+  // Number of orders resting or waiting on a trigger
+  size_t GetOpenOrders() const;
+
+private:
+  MatchingEngine(const MatchingEngine &);
+  MatchingEngine& operator=(const MatchingEngine &);
+
+  struct PriceLevel;
+
+  struct RestingOrder
+  {
+    uint64_t orderId;
+    RestingOrder *prev;       // in its level, oldest first
+    RestingOrder *next;       // and in the free list
+    PriceLevel *level;
+    long quantity;            // left to fill
+    int productIndex;
+    PricingSide side;
+    bool stop;                // waiting on its trigger
+    bool unreported;
+  };
+
+  struct PriceLevel
+  {
+    TickPrice price;
+    long quantity;
+    RestingOrder *head;
+    RestingOrder *tail;
+  };
+
+  // Levels by priority key: the ticks of offers and buy stops, the negated ticks of bids
+  // and sell stops, so that the level to match or trigger first is always the first
+  typedef map<int64_t, PriceLevel> LevelMap;
+
+  struct ProductBook
+  {
+    LevelMap bids;
+    LevelMap offers;
+    LevelMap buyStops;        // trigger once a trade is at or above their price
+    LevelMap sellStops;       // trigger once a trade is at or below their price
+    TickPrice lastTrade;
+    bool traded;
+  };
+
+  static int64_t GetKey(PricingSide side, TickPrice price, bool stop);
+  LevelMap& GetLevels(ProductBook &book, PricingSide side, bool stop);
+  void AddOrder(const EngineRequest &request, bool stop);
+  void Match(const EngineRequest &request);
+  void Cancel(const EngineRequest &request);
+  void Unlink(RestingOrder *order);
+  void TriggerStops(int productIndex);
+  void TakeStops(LevelMap &stops);
+  long GetAvailable(const ProductBook &book, PricingSide side, TickPrice limit, bool limited, long wanted) const;
+  void Report(ExecutionReportType type, const EngineRequest &request, uint64_t executionId, TickPrice price,
+    long quantity, long leavesQuantity);
+  void Report(ExecutionReportType type, const RestingOrder &order, uint64_t executionId, TickPrice price,
+    long quantity, long leavesQuantity);
+  void Stage(const ExecutionReport &report);
+  bool Flush();
+
+  Market venue;
+  vector<RestingOrder> pool;
+  RestingOrder *freeOrders;
+  unordered_map<uint64_t, RestingOrder*> openOrders;
+  ProductBook books[BOND_COUNT];
+  vector<EngineRequest> triggered;
+  uint64_t executions;
+  SpscQueue<EngineRequest> requests;
+  SpscQueue<ExecutionReport> reports;
+  vector<ExecutionReport> staged;     // reports waiting for room in the queue
+  size_t stagedSent;
+  atomic<bool> running;
+  thread worker;
+
+};
+
+MatchingEngine::MatchingEngine(Market _venue, size_t _orderCapacity, size_t _queueCapacity) :
+  venue(_venue), pool(_orderCapacity > 0 ? _orderCapacity : 1), freeOrders(0), executions(uint64_t(_venue) << 56),
+  requests(_queueCapacity), reports(_queueCapacity), stagedSent(0), running(false)
+{
+  for(size_t i = pool.size(); i-- > 0;)
+  {
+    pool[i].next = freeOrders;
+    freeOrders = &pool[i];
+  }
+  openOrders.reserve(pool.size());
+  for(int p = 0; p<BOND_COUNT; p++)
+  {
+    books[p].traded = false;
+  }
+}
+
+MatchingEngine::~MatchingEngine()
+{
+  Stop();
+}
+
+Market MatchingEngine::GetVenue() const
+{
+  return venue;
+}
+
+bool MatchingEngine::Submit(const EngineRequest &request)
+{
+  return requests.TryPush(request);
+}
+
+bool MatchingEngine::PollReport(ExecutionReport &report)
+{
+  return reports.TryPop(report);
+}
+
+int MatchingEngine::Poll(int maxRequests)
+{
+  if(!Flush())
+  {
+    return 0;
+  }
+  int processed = 0;
+  EngineRequest request;
+  while(processed < maxRequests && requests.TryPop(request))
+  {
+    Process(request);
+    processed++;
+    if(!Flush())
+    {
+      break;
+    }
+  }
+  return processed;
+}
+
+void MatchingEngine::Start()
+{
+  if(running.exchange(true))
+  {
+    return;
+  }
+  worker = thread([this]()
+  {
+    while(running.load(memory_order_acquire))
+    {
+      if(Poll() == 0)
+      {
+        this_thread::yield();
+      }
+    }
+    // Whatever was submitted before Stop is processed, as far as the reports fit
+    while(Poll() > 0)
+    {
+    }
+  });
+}
+
+void MatchingEngine::Stop()
+{
+  if(running.exchange(false))
+  {
+    worker.join();
+  }
+}
+
+bool MatchingEngine::IsRunning() const
+{
+  return running.load(memory_order_relaxed);
+}
+
+void MatchingEngine::Process(const EngineRequest &request)
+{
+  if(request.type == CANCEL_ORDER)
+  {
+    Cancel(request);
+    return;
+  }
+
+  if(request.productIndex < 0 || request.productIndex >= BOND_COUNT || request.quantity <= 0
+    || openOrders.count(request.orderId) != 0)
+  {
+    Report(ORDER_REJECTED, request, 0, request.price, 0, 0);
+    return;
+  }
+
+  ProductBook &book = books[request.productIndex];
+  Report(ORDER_ACCEPTED, request, 0, request.price, 0, request.quantity);
+  if(request.orderType == STOP)
+  {
+    // A stop whose price has already traded goes in at once
+    bool buy = request.side == BID;
+    if(!book.traded || (buy ? book.lastTrade < request.price : book.lastTrade > request.price))
+    {
+      AddOrder(request, true);
+      return;
+    }
+    Report(ORDER_TRIGGERED, request, 0, request.price, 0, request.quantity);
+    EngineRequest market = request;
+    market.orderType = MARKET;
+    Match(market);
+  }
+  else
+  {
+    Match(request);
+  }
+
+  // Each trade may trigger stops, whose own trades may trigger more
+  TriggerStops(request.productIndex);
+}
+
+int64_t MatchingEngine::GetKey(PricingSide side, TickPrice price, bool stop)
+{
+  // Resting bids and sell stops are best at the highest price
+  return (side == BID) != stop ? -price.GetTicks() : price.GetTicks();
+}
+
+MatchingEngine::LevelMap& MatchingEngine::GetLevels(ProductBook &book, PricingSide side, bool stop)
+{
+  if(stop)
+  {
+    return side == BID ? book.buyStops : book.sellStops;
+  }
+  return side == BID ? book.bids : book.offers;
+}
+
+void MatchingEngine::AddOrder(const EngineRequest &request, bool stop)
+{
+  RestingOrder *order = freeOrders;
+  if(!order)
+  {
+    Report(ORDER_CANCELLED, request, 0, request.price, request.quantity, 0);
+    return;
+  }
+  freeOrders = order->next;
+
+  LevelMap &levels = GetLevels(books[request.productIndex], request.side, stop);
+  LevelMap::iterator found = levels.find(GetKey(request.side, request.price, stop));
+  if(found == levels.end())
+  {
+    PriceLevel empty = { request.price, 0, 0, 0 };
+    found = levels.insert(found, LevelMap::value_type(GetKey(request.side, request.price, stop), empty));
+  }
+  PriceLevel &level = found->second;
+
+  order->orderId = request.orderId;
+  order->prev = level.tail;
+  order->next = 0;
+  order->level = &level;
+  order->quantity = request.quantity;
+  order->productIndex = request.productIndex;
+  order->side = request.side;
+  order->stop = stop;
+  order->unreported = request.unreported;
+  if(level.tail)
+  {
+    level.tail->next = order;
+  }
+  else
+  {
+    level.head = order;
+  }
+  level.tail = order;
+  level.quantity += request.quantity;
+  openOrders[request.orderId] = order;
+}
+
+long MatchingEngine::GetAvailable(const ProductBook &book, PricingSide side, TickPrice limit, bool limited, long wanted) const
+{
+  const LevelMap &levels = side == BID ? book.offers : book.bids;
+  long available = 0;
+  for(LevelMap::const_iterator it = levels.begin(); it != levels.end() && available < wanted; ++it)
+  {
+    if(limited && (side == BID ? it->second.price > limit : it->second.price < limit))
+    {
+      break;
+    }
+    available += it->second.quantity;
+  }
+  return available;
+}
+
+void MatchingEngine::Match(const EngineRequest &request)
+{
+  ProductBook &book = books[request.productIndex];
+  bool buy = request.side == BID;
+  bool limited = request.orderType != MARKET;
+  long quantity = request.quantity;
+
+  if(request.orderType == FOK && GetAvailable(book, request.side, request.price, limited, quantity) < quantity)
+  {
+    Report(ORDER_CANCELLED, request, 0, request.price, quantity, 0);
+    return;
+  }
+
+  LevelMap &levels = buy ? book.offers : book.bids;
+  while(quantity > 0 && !levels.empty())
+  {
+    LevelMap::iterator best = levels.begin();
+    PriceLevel &level = best->second;
+    if(limited && (buy ? level.price > request.price : level.price < request.price))
+    {
+      break;
+    }
+
+    while(quantity > 0 && level.head)
+    {
+      RestingOrder *resting = level.head;
+      long fill = quantity < resting->quantity ? quantity : resting->quantity;
+      uint64_t executionId = ++executions;
+      quantity -= fill;
+      resting->quantity -= fill;
+      level.quantity -= fill;
+      Report(ORDER_FILLED, *resting, executionId, level.price, fill, resting->quantity);
+      Report(ORDER_FILLED, request, executionId, level.price, fill, quantity);
+      if(resting->quantity == 0)
+      {
+        level.head = resting->next;
+        if(level.head)
+        {
+          level.head->prev = 0;
+        }
+        else
+        {
+          level.tail = 0;
+        }
+        openOrders.erase(resting->orderId);
+        resting->next = freeOrders;
+        freeOrders = resting;
+      }
+    }
+    book.lastTrade = level.price;
+    book.traded = true;
+    if(!level.head)
+    {
+      levels.erase(best);
+    }
+  }
+
+  if(quantity == 0)
+  {
+    return;
+  }
+  if(request.orderType == LIMIT)
+  {
+    EngineRequest rest = request;
+    rest.quantity = quantity;
+    AddOrder(rest, false);
+  }
+  else
+  {
+    Report(ORDER_CANCELLED, request, 0, request.price, quantity, 0);
+  }
+}
+
+void MatchingEngine::Cancel(const EngineRequest &request)
+{
+  unordered_map<uint64_t, RestingOrder*>::iterator found = openOrders.find(request.orderId);
+  if(found == openOrders.end())
+  {
+    Report(ORDER_REJECTED, request, 0, request.price, 0, 0);
+    return;
+  }
+
+  RestingOrder *order = found->second;
+  openOrders.erase(found);
+  Report(ORDER_CANCELLED, *order, 0, order->level->price, order->quantity, 0);
+  Unlink(order);
+}
+
+void MatchingEngine::Unlink(RestingOrder *order)
+{
+  PriceLevel &level = *order->level;
+  (order->prev ? order->prev->next : level.head) = order->next;
+  (order->next ? order->next->prev : level.tail) = order->prev;
+  level.quantity -= order->quantity;
+  if(!level.head)
+  {
+    GetLevels(books[order->productIndex], order->side, order->stop).erase(GetKey(order->side, level.price, order->stop));
+  }
+  order->next = freeOrders;
+  freeOrders = order;
+}
+
+void MatchingEngine::TriggerStops(int productIndex)
+{
+  ProductBook &book = books[productIndex];
+  while(book.traded)
+  {
+    // Buy stops at or below the last trade, then sell stops at or above it, each level
+    // oldest first
+    triggered.clear();
+    while(!book.buyStops.empty() && book.buyStops.begin()->second.price <= book.lastTrade)
+    {
+      TakeStops(book.buyStops);
+    }
+    while(!book.sellStops.empty() && book.sellStops.begin()->second.price >= book.lastTrade)
+    {
+      TakeStops(book.sellStops);
+    }
+    if(triggered.empty())
+    {
+      return;
+    }
+
+    // Matching the triggered orders can trigger more, so they are copied out first
+    vector<EngineRequest> orders(triggered);
+    for(size_t i = 0; i<orders.size(); i++)
+    {
+      Report(ORDER_TRIGGERED, orders[i], 0, orders[i].price, 0, orders[i].quantity);
+      Match(orders[i]);
+    }
+  }
+}
+
+void MatchingEngine::TakeStops(LevelMap &stops)
+{
+  PriceLevel &level = stops.begin()->second;
+  while(level.head)
+  {
+    RestingOrder *order = level.head;
+    EngineRequest request = { NEW_ORDER, order->orderId, order->productIndex, order->side, MARKET, level.price, order->quantity, order->unreported };
+    triggered.push_back(request);
+    level.head = order->next;
+    openOrders.erase(order->orderId);
+    order->next = freeOrders;
+    freeOrders = order;
+  }
+  stops.erase(stops.begin());
+}
+
+void MatchingEngine::Report(ExecutionReportType type, const EngineRequest &request, uint64_t executionId, TickPrice price,
+  long quantity, long leavesQuantity)
+{
+  if(!request.unreported)
+  {
+    ExecutionReport report = { type, venue, request.orderId, executionId, request.productIndex, request.side, price, quantity, leavesQuantity };
+    Stage(report);
+  }
+}
+
+void MatchingEngine::Report(ExecutionReportType type, const RestingOrder &order, uint64_t executionId, TickPrice price,
+  long quantity, long leavesQuantity)
+{
+  if(!order.unreported)
+  {
+    ExecutionReport report = { type, venue, order.orderId, executionId, order.productIndex, order.side, price, quantity, leavesQuantity };
+    Stage(report);
+  }
+}
+
+void MatchingEngine::Stage(const ExecutionReport &report)
+{
+  if(staged.size() == stagedSent && reports.TryPush(report))
+  {
+    return;
+  }
+  staged.push_back(report);
+}
+
+bool MatchingEngine::Flush()
+{
+  while(stagedSent < staged.size() && reports.TryPush(staged[stagedSent]))
+  {
+    stagedSent++;
+  }
+  if(stagedSent < staged.size())
+  {
+    return false;
+  }
+  staged.clear();
+  stagedSent = 0;
+  return true;
+}
+
+bool MatchingEngine::GetBest(int productIndex, PricingSide side, TickPrice &price, long &quantity) const
+{
+  const LevelMap &levels = side == BID ? books[productIndex].bids : books[productIndex].offers;
+  if(levels.empty())
+  {
+    return false;
+  }
+  price = levels.begin()->second.price;
+  quantity = levels.begin()->second.quantity;
+  return true;
+}
+
+bool MatchingEngine::GetLastTrade(int productIndex, TickPrice &price) const
+{
+  price = books[productIndex].lastTrade;
+  return books[productIndex].traded;
+}
+
+size_t MatchingEngine::GetOpenOrders() const
+{
+  return openOrders.size();
+}
+
+#endif
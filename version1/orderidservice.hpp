@@ -0,0 +1,169 @@
+/**
+ * orderidservice.hpp
+ * Defines the service that hands out order IDs.
+ *
+ * An order ID is 64 bits: a restart epoch in the top 24 bits and a sequence number in the
+ * low 40. Each thread takes a block of sequence numbers from a shared counter, with one
+ * atomic add, and hands IDs out of it with no shared writes at all. IDs are unique across
+ * threads, increase on each thread, and, as the epoch goes up on every restart, are above
+ * every ID of the runs before. They are formatted only where a string is needed.
+ */
+#ifndef ORDER_ID_SERVICE_HPP
+#define ORDER_ID_SERVICE_HPP
+
+#include <string>
+#include <cstdio>
+#include <cerrno>
+#include <atomic>
+#include <stdint.h>
+
+using namespace std;
+
+// Characters in a formatted order ID: 16 hex digits
+const int ORDER_ID_WIDTH = 16;
+
+class OrderIdService
+{
+
+public:
+
+  // Bits of the ID below the epoch
+  static const int SEQUENCE_BITS = 40;
+  static const uint32_t EPOCH_MASK = (1u << (64 - SEQUENCE_BITS)) - 1;
+
+  // ctor for the IDs of a restart epoch, taken by each thread blockSize at a time
+  OrderIdService(uint32_t _epoch, uint32_t _blockSize = 1024);
+
+  // Get a new ID, from any thread
+  uint64_t NextId();
+
+  // Get the restart epoch of this run
+  uint32_t GetEpoch() const;
+
+  // Get the restart epoch and sequence number of an ID
+  static uint32_t GetEpoch(uint64_t id);
+  static uint64_t GetSequence(uint64_t id);
+
+  // Take the epoch after the one stored in a file, 1 if there is no file, and store it back.
+  // The file is replaced by renaming a new one over it, so it always holds an epoch.
+  // Returns false if the file cannot be read or written, or its epoch is the last there is,
+  // since the IDs of an earlier run could then be handed out again.
+  static bool NextEpoch(const char *path, uint32_t &epoch);
+
+  // Format an ID as ORDER_ID_WIDTH hex digits and a NUL
+  static void Format(uint64_t id, char *buffer);
+
+  // Format an ID as a string of ORDER_ID_WIDTH hex digits
+  static string ToString(uint64_t id);
+
+private:
+  OrderIdService(const OrderIdService &);
+  OrderIdService& operator=(const OrderIdService &);
+
+  // Sequence numbers a thread has left to hand out, and the service they are from
+  struct IdBlock
+  {
+    uint64_t owner;
+    uint64_t next;
+    uint64_t end;
+  };
+
+  uint64_t instance;          // tells the blocks of each service apart
+  uint64_t epochBits;
+  uint32_t blockSize;
+  atomic<uint64_t> nextBlock;
+
+};
+
+OrderIdService::OrderIdService(uint32_t _epoch, uint32_t _blockSize) :
+  epochBits(uint64_t(_epoch & EPOCH_MASK) << SEQUENCE_BITS), blockSize(_blockSize > 0 ? _blockSize : 1), nextBlock(1)
+{
+  static atomic<uint64_t> instances(0);
+  instance = ++instances;
+}
+
+uint64_t OrderIdService::NextId()
+{
+  static thread_local IdBlock block = { 0, 0, 0 };
+  if(block.owner != instance || block.next == block.end)
+  {
+    block.owner = instance;
+    block.next = nextBlock.fetch_add(blockSize, memory_order_relaxed);
+    block.end = block.next + blockSize;
+  }
+  return epochBits | block.next++;
+}
+
+uint32_t OrderIdService::GetEpoch() const
+{
+  return uint32_t(epochBits >> SEQUENCE_BITS);
+}
+
+uint32_t OrderIdService::GetEpoch(uint64_t id)
+{
+  return uint32_t(id >> SEQUENCE_BITS);
+}
+
+uint64_t OrderIdService::GetSequence(uint64_t id)
+{
+  return id & ((uint64_t(1) << SEQUENCE_BITS) - 1);
+}
+
+bool OrderIdService::NextEpoch(const char *path, uint32_t &epoch)
+{
+  unsigned long last = 0;
+  FILE *file = fopen(path, "r");
+  if(file)
+  {
+    bool read = fscanf(file, "%lu", &last) == 1;
+    fclose(file);
+    if(!read)
+    {
+      return false;
+    }
+  }
+  else if(errno != ENOENT)
+  {
+    return false;
+  }
+  if(last >= EPOCH_MASK)
+  {
+    return false;
+  }
+
+  string written = string(path) + ".tmp";
+  file = fopen(written.c_str(), "w");
+  if(!file)
+  {
+    return false;
+  }
+  bool stored = fprintf(file, "%lu\n", last + 1) > 0;
+  stored = fclose(file) == 0 && stored;
+  if(!stored || rename(written.c_str(), path) != 0)
+  {
+    remove(written.c_str());
+    return false;
+  }
+  epoch = uint32_t(last + 1);
+  return true;
+}
+
+void OrderIdService::Format(uint64_t id, char *buffer)
+{
+  static const char DIGITS[] = "0123456789ABCDEF";
+  for(int i = ORDER_ID_WIDTH - 1; i >= 0; i--)
+  {
+    buffer[i] = DIGITS[id & 0xF];
+    id >>= 4;
+  }
+  buffer[ORDER_ID_WIDTH] = '\0';
+}
+
+string OrderIdService::ToString(uint64_t id)
+{
+  char buffer[ORDER_ID_WIDTH + 1];
+  Format(id, buffer);
+  return string(buffer, ORDER_ID_WIDTH);
+}
+
+#endif
@@ -0,0 +1,335 @@
+/**
+ * orderstore.hpp
+ * Defines the store of orders and their lifecycle.
+ *
+ * Each order is a fixed size record, in a slab allocated up front, found by its integer
+ * ID through an open addressing hash index with linear probing, kept at most half full.
+ * An order is new, partially filled, filled, cancelled or rejected, and keeps its filled
+ * quantity and notional. Once done, its record moves to a ring of the most recent done
+ * orders and its slab slot and index entry are reused, so the hot table only ever holds
+ * open orders and memory stays as allocated.
+ */
+#ifndef ORDER_STORE_HPP
+#define ORDER_STORE_HPP
+
+#include <vector>
+#include <stdint.h>
+
+#include "soa.hpp"
+#include "marketdataservice.hpp"
+#include "matchingengine.hpp"
+#include "tickprice.hpp"
+
+using namespace std;
+
+// Lifecycle of an order: New, then PartiallyFilled, then Filled, Cancelled or Rejected
+enum OrderState { STATE_NEW, STATE_PARTIALLY_FILLED, STATE_FILLED, STATE_CANCELLED, STATE_REJECTED };
+
+/**
+ * An order and how far it has got.
+ */
+struct OrderRecord
+{
+  uint64_t orderId;
+  uint64_t parentId;          // 0 for an order with no parent
+  int64_t filledTicks;        // notional filled, in ticks times quantity
+  TickPrice price;
+  long quantity;
+  long filledQuantity;
+  int productIndex;
+  PricingSide side;
+  OrderType orderType;
+  Market venue;
+  OrderState state;
+
+  // Get the quantity left to fill
+  long GetLeavesQuantity() const { return state < STATE_FILLED ? quantity - filledQuantity : 0; }
+
+  // Get the average fill price, or 0 before the first fill
+  double GetAveragePrice() const { return filledQuantity > 0 ? double(filledTicks) / filledQuantity / TickPrice::TICKS_PER_POINT : 0; }
+
+  // Is the order filled, cancelled or rejected?
+  bool IsDone() const { return state >= STATE_FILLED; }
+};
+
+class OrderStore
+{
+
+public:
+
+  // ctor for a store of at most capacity open orders, keeping the last archiveCapacity done
+  OrderStore(size_t _capacity = 1 << 16, size_t _archiveCapacity = 1 << 16);
+
+  // Add a new order. Returns its record, or 0 when the ID is 0 or taken or the store is
+  // full.
+  OrderRecord* Add(uint64_t orderId, uint64_t parentId, int productIndex, PricingSide side, OrderType orderType,
+    Market venue, TickPrice price, long quantity);
+
+  // Find an open order. Returns 0 for one that is done or was never added.
+  OrderRecord* Find(uint64_t orderId);
+
+  // Find an order among those done most recently, newest first. This searches the archive
+  // and is for the cold path.
+  const OrderRecord* FindArchived(uint64_t orderId) const;
+
+  // Fill some of an open order at a price. Returns false if the order is not open or the
+  // quantity is more than it has left.
+  bool Fill(uint64_t orderId, TickPrice price, long quantity);
+
+  // Cancel what is left of an open order
+  bool Cancel(uint64_t orderId);
+
+  // Reject a new order
+  bool Reject(uint64_t orderId);
+
+  // Change the price and total quantity of an open order. The quantity cannot go below
+  // what has been filled; at exactly that, the order is filled.
+  bool Amend(uint64_t orderId, TickPrice price, long quantity);
+
+  // Move an order on by an execution report of an exchange. Returns false for a report the
+  // order's state does not allow.
+  bool Apply(const ExecutionReport &report);
+
+  // Get the number of open orders
+  size_t GetOpenOrders() const;
+
+  // Get the number of orders done, archived or since dropped from the archive
+  long GetDoneOrders() const;
+
+  // Get the bytes of memory the store holds
+  size_t GetMemory() const;
+
+private:
+
+  static const uint32_t EMPTY = 0xFFFFFFFF;
+
+  struct IndexEntry
+  {
+    uint64_t orderId;
+    uint32_t slot;            // in the slab, EMPTY for none
+  };
+
+  size_t GetBucket(uint64_t orderId) const;
+  size_t Locate(uint64_t orderId) const;
+  void Archive(size_t bucket);
+
+  vector<OrderRecord> slab;
+  vector<uint32_t> freeSlots;
+  vector<IndexEntry> index;
+  size_t indexMask;
+  int indexShift;
+  vector<OrderRecord> archive;
+  long doneOrders;
+
+};
+
+OrderStore::OrderStore(size_t _capacity, size_t _archiveCapacity) :
+  slab(_capacity > 0 ? _capacity : 1), archive(_archiveCapacity > 0 ? _archiveCapacity : 1), doneOrders(0)
+{
+  freeSlots.reserve(slab.size());
+  for(size_t i = slab.size(); i-- > 0;)
+  {
+    freeSlots.push_back(uint32_t(i));
+  }
+  size_t size = 2;
+  indexShift = 63;
+  while(size < 2 * slab.size())
+  {
+    size <<= 1;
+    indexShift--;
+  }
+  IndexEntry empty = { 0, EMPTY };
+  index.assign(size, empty);
+  indexMask = size - 1;
+}
+
+size_t OrderStore::GetBucket(uint64_t orderId) const
+{
+  // Fibonacci hashing spreads sequential IDs across the table
+  return size_t((orderId * 0x9E3779B97F4A7C15ULL) >> indexShift);
+}
+
+size_t OrderStore::Locate(uint64_t orderId) const
+{
+  size_t bucket = GetBucket(orderId);
+  while(index[bucket].slot != EMPTY && index[bucket].orderId != orderId)
+  {
+    bucket = (bucket + 1) & indexMask;
+  }
+  return bucket;
+}
+
+OrderRecord* OrderStore::Add(uint64_t orderId, uint64_t parentId, int productIndex, PricingSide side, OrderType orderType,
+  Market venue, TickPrice price, long quantity)
+{
+  if(orderId == 0 || freeSlots.empty())
+  {
+    return 0;
+  }
+  size_t bucket = Locate(orderId);
+  if(index[bucket].slot != EMPTY)
+  {
+    return 0;
+  }
+
+  uint32_t slot = freeSlots.back();
+  freeSlots.pop_back();
+  index[bucket].orderId = orderId;
+  index[bucket].slot = slot;
+  OrderRecord &record = slab[slot];
+  record.orderId = orderId;
+  record.parentId = parentId;
+  record.filledTicks = 0;
+  record.price = price;
+  record.quantity = quantity;
+  record.filledQuantity = 0;
+  record.productIndex = productIndex;
+  record.side = side;
+  record.orderType = orderType;
+  record.venue = venue;
+  record.state = STATE_NEW;
+  return &record;
+}
+
+OrderRecord* OrderStore::Find(uint64_t orderId)
+{
+  size_t bucket = Locate(orderId);
+  return index[bucket].slot == EMPTY ? 0 : &slab[index[bucket].slot];
+}
+
+const OrderRecord* OrderStore::FindArchived(uint64_t orderId) const
+{
+  long kept = doneOrders < long(archive.size()) ? doneOrders : long(archive.size());
+  for(long i = 1; i <= kept; i++)
+  {
+    const OrderRecord &record = archive[(doneOrders - i) % archive.size()];
+    if(record.orderId == orderId)
+    {
+      return &record;
+    }
+  }
+  return 0;
+}
+
+void OrderStore::Archive(size_t bucket)
+{
+  uint32_t slot = index[bucket].slot;
+  archive[doneOrders++ % archive.size()] = slab[slot];
+  freeSlots.push_back(slot);
+
+  // Entries after the one taken out move back into the gap, if their home bucket is not
+  // between the gap and where they are
+  size_t gap = bucket;
+  for(size_t next = (gap + 1) & indexMask; index[next].slot != EMPTY; next = (next + 1) & indexMask)
+  {
+    size_t home = GetBucket(index[next].orderId);
+    if(((next - home) & indexMask) >= ((next - gap) & indexMask))
+    {
+      index[gap] = index[next];
+      gap = next;
+    }
+  }
+  index[gap].slot = EMPTY;
+}
+
+bool OrderStore::Fill(uint64_t orderId, TickPrice price, long quantity)
+{
+  size_t bucket = Locate(orderId);
+  if(index[bucket].slot == EMPTY)
+  {
+    return false;
+  }
+  OrderRecord &record = slab[index[bucket].slot];
+  if(quantity <= 0 || quantity > record.quantity - record.filledQuantity)
+  {
+    return false;
+  }
+  record.filledQuantity += quantity;
+  record.filledTicks += price.GetTicks() * quantity;
+  record.state = record.filledQuantity == record.quantity ? STATE_FILLED : STATE_PARTIALLY_FILLED;
+  if(record.state == STATE_FILLED)
+  {
+    Archive(bucket);
+  }
+  return true;
+}
+
+bool OrderStore::Cancel(uint64_t orderId)
+{
+  size_t bucket = Locate(orderId);
+  if(index[bucket].slot == EMPTY)
+  {
+    return false;
+  }
+  slab[index[bucket].slot].state = STATE_CANCELLED;
+  Archive(bucket);
+  return true;
+}
+
+bool OrderStore::Reject(uint64_t orderId)
+{
+  size_t bucket = Locate(orderId);
+  if(index[bucket].slot == EMPTY || slab[index[bucket].slot].state != STATE_NEW)
+  {
+    return false;
+  }
+  slab[index[bucket].slot].state = STATE_REJECTED;
+  Archive(bucket);
+  return true;
+}
+
+bool OrderStore::Amend(uint64_t orderId, TickPrice price, long quantity)
+{
+  size_t bucket = Locate(orderId);
+  if(index[bucket].slot == EMPTY)
+  {
+    return false;
+  }
+  OrderRecord &record = slab[index[bucket].slot];
+  if(quantity < record.filledQuantity || quantity <= 0)
+  {
+    return false;
+  }
+  record.price = price;
+  record.quantity = quantity;
+  if(record.filledQuantity == quantity)
+  {
+    record.state = STATE_FILLED;
+    Archive(bucket);
+  }
+  return true;
+}
+
+bool OrderStore::Apply(const ExecutionReport &report)
+{
+  switch(report.type)
+  {
+    case ORDER_FILLED:
+      return Fill(report.orderId, report.price, report.quantity);
+    case ORDER_CANCELLED:
+      return Cancel(report.orderId);
+    case ORDER_REJECTED:
+      return Reject(report.orderId);
+    default:
+      // Accepted and triggered orders stay new
+      return Find(report.orderId) != 0;
+  }
+}
+
+size_t OrderStore::GetOpenOrders() const
+{
+  return slab.size() - freeSlots.size();
+}
+
+long OrderStore::GetDoneOrders() const
+{
+  return doneOrders;
+}
+
+size_t OrderStore::GetMemory() const
+{
+  return slab.size() * sizeof(OrderRecord) + freeSlots.capacity() * sizeof(uint32_t)
+    + index.size() * sizeof(IndexEntry) + archive.size() * sizeof(OrderRecord);
+}
+
+#endif
@@ -0,0 +1,378 @@
+/**
+ * pretraderisk.hpp
+ * Defines the pre-trade risk gate orders pass before they are executed.
+ *
+ * An order is checked against the limits of its product and of every book: its quantity
+ * and notional, the position it would leave, the PV01 of that position and the rate of
+ * orders. Orders are only booked once filled, so until then an order could end up in any
+ * book, and the resulting position of a book counts every order working in the product.
+ *
+ * Positions, working quantities and order rates are atomic counters, updated on fills
+ * and on orders getting done without locking. An order reserves its quantity before it
+ * is checked, and gives it back if it fails, so orders checked at once on several threads
+ * cannot between them pass a limit. Limits are kept in a copy that is never changed once
+ * published: setting a limit publishes a new copy, and checks read whichever copy is
+ * current without waiting on the writer.
+ */
+#ifndef PRE_TRADE_RISK_HPP
+#define PRE_TRADE_RISK_HPP
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <cstdlib>
+#include <stdint.h>
+
+#include "soa.hpp"
+#include "bondreferencedata.hpp"
+#include "marketdataservice.hpp"
+#include "tradebookingservice.hpp"
+#include "tickprice.hpp"
+
+using namespace std;
+
+// Outcome of a pre-trade check, the limit an order failed or RISK_PASSED
+enum RiskCheck { RISK_PASSED, RISK_UNKNOWN_PRODUCT, RISK_ORDER_QUANTITY, RISK_ORDER_NOTIONAL, RISK_POSITION, RISK_PV01,
+  RISK_ORDER_RATE, RISK_CHECKS };
+
+/**
+ * Limits of a product or a book. A limit of 0 is no limit.
+ */
+struct RiskLimits
+{
+  long maxOrderQuantity;      // face value of an order
+  double maxOrderNotional;    // face value times price of an order
+  long maxPosition;           // absolute position of a product once working orders fill
+  double maxPV01;             // absolute PV01 once working orders fill
+  long maxOrderRate;          // orders per second
+};
+
+class BondPreTradeRiskGate
+{
+
+public:
+
+  // ctor for a gate with no limits, and the PV01 per unit of the risk service for every bond
+  BondPreTradeRiskGate();
+
+  ~BondPreTradeRiskGate();
+
+  // Set the limits of a product
+  void SetProductLimits(int productIndex, const RiskLimits &limits);
+
+  // Set the limits of a book
+  void SetBookLimits(int bookIndex, const RiskLimits &limits);
+
+  // Set the PV01 of a unit of face value of a product
+  void SetPV01(int productIndex, double pv01);
+
+  // Get the limits of a product
+  RiskLimits GetProductLimits(int productIndex) const;
+
+  // Get the limits of a book
+  RiskLimits GetBookLimits(int bookIndex) const;
+
+  // Check an order buying on the BID side or selling on the OFFER side at nowNanos. An
+  // order that passes is working until Release gives its quantity back.
+  RiskCheck Check(int productIndex, PricingSide side, TickPrice price, long quantity, int64_t nowNanos);
+
+  // Give back quantity of a working order, filled or done
+  void Release(int productIndex, PricingSide side, long quantity);
+
+  // Move positions by a trade booked
+  void OnTrade(const Trade<Bond> &trade);
+
+  // Get the position of a product in a book
+  long GetPosition(int productIndex, int bookIndex) const;
+
+  // Get the position of a product across books
+  long GetPosition(int productIndex) const;
+
+  // Get the quantity of a product working on a side
+  long GetWorkingQuantity(int productIndex, PricingSide side) const;
+
+  // Get the number of orders that failed a check
+  long GetRejected(RiskCheck check) const;
+
+  // Get the name of a check
+  static const char* GetCheckName(RiskCheck check);
+
+private:
+  BondPreTradeRiskGate(const BondPreTradeRiskGate &);
+  BondPreTradeRiskGate& operator=(const BondPreTradeRiskGate &);
+
+  // Every limit, published together
+  struct RiskConfig
+  {
+    RiskLimits products[BOND_COUNT];
+    RiskLimits books[BOOK_COUNT];
+    double pv01[BOND_COUNT];
+  };
+
+  // Orders in the current second
+  struct RateWindow
+  {
+    atomic<int64_t> second;
+    atomic<long> count;
+  };
+
+  RiskConfig* Edit();
+  void Publish(RiskConfig *config);
+  static long CountOrder(RateWindow &rate, int64_t second);
+  RiskCheck CheckLimits(const RiskLimits &limits, long quantity, double notional, long position, double pv01, long rate) const;
+
+  atomic<const RiskConfig*> config;
+  vector<RiskConfig*> configs;          // every copy published, freed with the gate
+  mutex editing;                        // between writers only
+  atomic<long> positions[BOND_COUNT][BOOK_COUNT];
+  atomic<long> productPositions[BOND_COUNT];   // in every book, named or not
+  atomic<long> working[BOND_COUNT][2];
+  RateWindow productRates[BOND_COUNT];
+  RateWindow orderRate;                 // of every order, which could go to any book
+  atomic<long> rejected[RISK_CHECKS];
+
+};
+
+BondPreTradeRiskGate::BondPreTradeRiskGate()
+{
+  RiskConfig *initial = new RiskConfig();
+  for(int p = 0; p<BOND_COUNT; p++)
+  {
+    initial->pv01[p] = 0.0021;
+    productPositions[p].store(0);
+    working[p][BID].store(0);
+    working[p][OFFER].store(0);
+    productRates[p].second.store(0);
+    productRates[p].count.store(0);
+    for(int b = 0; b<BOOK_COUNT; b++)
+    {
+      positions[p][b].store(0);
+    }
+  }
+  orderRate.second.store(0);
+  orderRate.count.store(0);
+  for(int c = 0; c<RISK_CHECKS; c++)
+  {
+    rejected[c].store(0);
+  }
+  configs.push_back(initial);
+  config.store(initial);
+}
+
+BondPreTradeRiskGate::~BondPreTradeRiskGate()
+{
+  for(size_t i = 0; i<configs.size(); i++)
+  {
+    delete configs[i];
+  }
+}
+
+BondPreTradeRiskGate::RiskConfig* BondPreTradeRiskGate::Edit()
+{
+  return new RiskConfig(*config.load(memory_order_acquire));
+}
+
+void BondPreTradeRiskGate::Publish(RiskConfig *edited)
+{
+  // Checks may still be reading the copy replaced, so it is kept until the gate goes
+  configs.push_back(edited);
+  config.store(edited, memory_order_release);
+}
+
+void BondPreTradeRiskGate::SetProductLimits(int productIndex, const RiskLimits &limits)
+{
+  lock_guard<mutex> lock(editing);
+  RiskConfig *edited = Edit();
+  edited->products[productIndex] = limits;
+  Publish(edited);
+}
+
+void BondPreTradeRiskGate::SetBookLimits(int bookIndex, const RiskLimits &limits)
+{
+  lock_guard<mutex> lock(editing);
+  RiskConfig *edited = Edit();
+  edited->books[bookIndex] = limits;
+  Publish(edited);
+}
+
+void BondPreTradeRiskGate::SetPV01(int productIndex, double pv01)
+{
+  lock_guard<mutex> lock(editing);
+  RiskConfig *edited = Edit();
+  edited->pv01[productIndex] = pv01;
+  Publish(edited);
+}
+
+RiskLimits BondPreTradeRiskGate::GetProductLimits(int productIndex) const
+{
+  return config.load(memory_order_acquire)->products[productIndex];
+}
+
+RiskLimits BondPreTradeRiskGate::GetBookLimits(int bookIndex) const
+{
+  return config.load(memory_order_acquire)->books[bookIndex];
+}
+
+long BondPreTradeRiskGate::CountOrder(RateWindow &rate, int64_t second)
+{
+  // The thread moving the window on starts its count again; orders counted by others in
+  // between are lost, so a limit can be passed by the few orders checked at that moment
+  int64_t current = rate.second.load(memory_order_relaxed);
+  if(current < second && rate.second.compare_exchange_strong(current, second, memory_order_relaxed))
+  {
+    rate.count.store(0, memory_order_relaxed);
+  }
+  return rate.count.fetch_add(1, memory_order_relaxed) + 1;
+}
+
+RiskCheck BondPreTradeRiskGate::CheckLimits(const RiskLimits &limits, long quantity, double notional, long position,
+  double pv01, long rate) const
+{
+  if(limits.maxOrderQuantity > 0 && quantity > limits.maxOrderQuantity)
+  {
+    return RISK_ORDER_QUANTITY;
+  }
+  if(limits.maxOrderNotional > 0 && notional > limits.maxOrderNotional)
+  {
+    return RISK_ORDER_NOTIONAL;
+  }
+  if(limits.maxPosition > 0 && labs(position) > limits.maxPosition)
+  {
+    return RISK_POSITION;
+  }
+  if(limits.maxPV01 > 0 && (pv01 < 0 ? -pv01 : pv01) > limits.maxPV01)
+  {
+    return RISK_PV01;
+  }
+  if(limits.maxOrderRate > 0 && rate > limits.maxOrderRate)
+  {
+    return RISK_ORDER_RATE;
+  }
+  return RISK_PASSED;
+}
+
+RiskCheck BondPreTradeRiskGate::Check(int productIndex, PricingSide side, TickPrice price, long quantity, int64_t nowNanos)
+{
+  if(productIndex < 0 || productIndex >= BOND_COUNT)
+  {
+    rejected[RISK_UNKNOWN_PRODUCT].fetch_add(1, memory_order_relaxed);
+    return RISK_UNKNOWN_PRODUCT;
+  }
+  const RiskConfig &limits = *config.load(memory_order_acquire);
+  int64_t second = nowNanos / 1000000000LL;
+  double notional = double(price.GetTicks()) * quantity / TickPrice::TICKS_PER_POINT / 100;
+
+  // Working quantity on the order's side, this order included, is what could fill
+  long sign = side == BID ? 1 : -1;
+  long extra = sign * (working[productIndex][side].fetch_add(quantity, memory_order_relaxed) + quantity);
+  long productRate = CountOrder(productRates[productIndex], second);
+  long allRate = CountOrder(orderRate, second);
+
+  long position = productPositions[productIndex].load(memory_order_relaxed) + extra;
+  RiskCheck result = CheckLimits(limits.products[productIndex], quantity, notional, position,
+    position * limits.pv01[productIndex], productRate);
+  for(int b = 0; b<BOOK_COUNT && result == RISK_PASSED; b++)
+  {
+    double bookPV01 = 0;
+    for(int p = 0; p<BOND_COUNT; p++)
+    {
+      bookPV01 += positions[p][b].load(memory_order_relaxed) * limits.pv01[p];
+    }
+    long bookPosition = positions[productIndex][b].load(memory_order_relaxed) + extra;
+    result = CheckLimits(limits.books[b], quantity, notional, bookPosition,
+      bookPV01 + extra * limits.pv01[productIndex], allRate);
+  }
+
+  if(result != RISK_PASSED)
+  {
+    working[productIndex][side].fetch_sub(quantity, memory_order_relaxed);
+    productRates[productIndex].count.fetch_sub(1, memory_order_relaxed);
+    orderRate.count.fetch_sub(1, memory_order_relaxed);
+    rejected[result].fetch_add(1, memory_order_relaxed);
+  }
+  return result;
+}
+
+void BondPreTradeRiskGate::Release(int productIndex, PricingSide side, long quantity)
+{
+  if(productIndex >= 0 && productIndex < BOND_COUNT)
+  {
+    working[productIndex][side].fetch_sub(quantity, memory_order_relaxed);
+  }
+}
+
+void BondPreTradeRiskGate::OnTrade(const Trade<Bond> &trade)
+{
+  int productIndex = GetBondIndex(trade.GetProduct().GetProductId());
+  if(productIndex < 0)
+  {
+    return;
+  }
+  // Trades carry their direction in their side, whatever the sign of their quantity
+  long quantity = trade.GetSide() == SELL ? -labs(trade.GetQuantity()) : labs(trade.GetQuantity());
+  productPositions[productIndex].fetch_add(quantity, memory_order_relaxed);
+  int bookIndex = GetBookIndex(trade.GetBook());
+  if(bookIndex >= 0)
+  {
+    positions[productIndex][bookIndex].fetch_add(quantity, memory_order_relaxed);
+  }
+}
+
+long BondPreTradeRiskGate::GetPosition(int productIndex, int bookIndex) const
+{
+  return positions[productIndex][bookIndex].load(memory_order_relaxed);
+}
+
+long BondPreTradeRiskGate::GetPosition(int productIndex) const
+{
+  return productPositions[productIndex].load(memory_order_relaxed);
+}
+
+long BondPreTradeRiskGate::GetWorkingQuantity(int productIndex, PricingSide side) const
+{
+  return working[productIndex][side].load(memory_order_relaxed);
+}
+
+long BondPreTradeRiskGate::GetRejected(RiskCheck check) const
+{
+  return rejected[check].load(memory_order_relaxed);
+}
+
+const char* BondPreTradeRiskGate::GetCheckName(RiskCheck check)
+{
+  static const char* names[RISK_CHECKS] = { "passed", "unknown product", "order quantity", "order notional", "position",
+    "PV01", "order rate" };
+  return names[check];
+}
+
+
+/**
+ * Moves the positions of a risk gate by the trades booked.
+ */
+class BondTradeBookingRiskGateListener : public ServiceListener< Trade<Bond> >
+{
+  private:
+      BondPreTradeRiskGate* RiskGate;
+    public:
+      BondTradeBookingRiskGateListener(BondPreTradeRiskGate* RiskGate_):RiskGate(RiskGate_){};
+
+    // Listener callback to process an add event to the Service
+  virtual void ProcessAdd(Trade<Bond> &data)
+  {
+    RiskGate->OnTrade(data);
+  }
+
+  // Listener callback to process a remove event to the Service
+  virtual void ProcessRemove(Trade<Bond> &data)
+  {
+
+  }
+
+  // Listener callback to process an update event to the Service
+  virtual void ProcessUpdate(Trade<Bond> &data)
+  {
+
+  }
+};
+
+#endif
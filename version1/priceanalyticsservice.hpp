@@ -0,0 +1,412 @@
+/**
+ * priceanalyticsservice.hpp
+ * Defines the data types and Service for rolling per-product price analytics.
+ *
+ * Ticks from the pricing and market data services update, for each product and each of
+ * the 1s, 1m and 5m windows, a circular buffer of time buckets held in SoA layout. A tick
+ * touches one bucket and one EWMA per window, so updates are O(1) whatever the rate.
+ * Internal mids and touch mids are different series, so each source keeps buckets, EWMAs
+ * and last prices of its own, and returns are never taken from one to the other.
+ * Snapshots combine the live buckets of a window, and are published on demand or on a
+ * timer driven by the tick clock.
+ */
+#ifndef PRICE_ANALYTICS_SERVICE_HPP
+#define PRICE_ANALYTICS_SERVICE_HPP
+
+#include <vector>
+#include <chrono>
+#include <cmath>
+#include <mutex>
+#include <stdint.h>
+
+#include "soa.hpp"
+#include "bondreferencedata.hpp"
+#include "pricingservice.hpp"
+#include "marketdataservice.hpp"
+
+using namespace std;
+
+// Rolling windows, shortest first
+enum AnalyticsWindow { WINDOW_1S, WINDOW_1M, WINDOW_5M };
+const int ANALYTICS_WINDOWS = 3;
+
+// Series of prices analysed: internal mids from pricing and touch mids from market data
+enum PriceSource { SOURCE_PRICING, SOURCE_MARKET_DATA };
+const int PRICE_SOURCES = 2;
+
+// Buckets per window: a window rolls forward one bucket (1/60th of its length) at a time
+const int ANALYTICS_BUCKETS = 60;
+
+// Window lengths in nanoseconds
+inline int64_t GetWindowNanos(int window)
+{
+  static const int64_t nanos[ANALYTICS_WINDOWS] = { 1000000000LL, 60000000000LL, 300000000000LL };
+  return nanos[window];
+}
+
+/**
+ * Analytics of one product over one window.
+ */
+struct WindowAnalytics
+{
+  long tickCount;
+  double vwap;                // of sized ticks, 0 if there were none
+  double high;
+  double low;
+  double range;               // high - low
+  double ewmaVolatility;      // square root of the exponentially decayed sum of squared returns
+};
+
+/**
+ * Snapshot of the analytics of a product's prices from one source over every window.
+ */
+struct PriceAnalytics
+{
+  int productIndex;
+  PriceSource source;
+  int64_t timestamp;          // tick clock, in nanoseconds, at which the snapshot was taken
+  WindowAnalytics windows[ANALYTICS_WINDOWS];
+};
+
+/**
+ * Time buckets of one product over one window, as parallel arrays, plus the window's EWMA.
+ */
+struct AnalyticsBuckets
+{
+  int64_t bucketIds[ANALYTICS_BUCKETS];     // time / bucket length, -1 when unused
+  uint32_t counts[ANALYTICS_BUCKETS];
+  double notionals[ANALYTICS_BUCKETS];      // sum of price * size
+  double sizes[ANALYTICS_BUCKETS];
+  double highs[ANALYTICS_BUCKETS];
+  double lows[ANALYTICS_BUCKETS];
+  double ewmaVariance;
+};
+
+class BondPriceAnalyticsService
+{
+
+public:
+
+  BondPriceAnalyticsService();
+
+  // Record a tick of a product from a source at a time in nanoseconds. Sized ticks count
+  // towards the VWAP.
+  void OnTick(int productIndex, PriceSource source, int64_t nanos, double price, double size);
+
+  // Publish snapshots of every ticking product and source to the listeners every interval
+  // of the tick clock; zero turns the timer off
+  void SetPublishInterval(int64_t intervalNanos);
+
+  // Snapshot the prices of a product from a source at the current tick clock
+  PriceAnalytics GetSnapshot(int productIndex, PriceSource source = SOURCE_PRICING) const;
+
+  // Get the last published snapshot of the internal prices of a product
+  PriceAnalytics& GetData(string key);
+
+  // Get the last published snapshot of a product from a source
+  const PriceAnalytics& GetPublished(int productIndex, PriceSource source) const;
+
+  // Publish a snapshot of every product and source that has ticked to the listeners
+  void PublishSnapshots();
+
+  // Add a listener to the Service for callbacks on add, remove, and update events
+  // for data to the Service.
+  void AddListener(ServiceListener<PriceAnalytics> *listener);
+
+  // Get all listeners on the Service.
+  const vector< ServiceListener<PriceAnalytics>* >& GetListeners() const;
+
+  // Current time on the tick clock, for listeners feeding live data
+  static int64_t Now();
+
+private:
+  AnalyticsBuckets buckets[BOND_COUNT][PRICE_SOURCES][ANALYTICS_WINDOWS];
+  double lastPrices[BOND_COUNT][PRICE_SOURCES];
+  int64_t lastTimes[BOND_COUNT][PRICE_SOURCES];
+  int64_t bucketNanos[ANALYTICS_WINDOWS];
+  double decayRates[ANALYTICS_WINDOWS];     // 1 / window length
+  int64_t clock;
+  int64_t publishInterval;
+  int64_t lastPublish;
+  PriceAnalytics snapshots[BOND_COUNT][PRICE_SOURCES];
+  PriceAnalytics emptySnapshot;
+  vector< ServiceListener<PriceAnalytics>* > AnalyticsListeners;
+
+  // Ticks come from both the pricing and market data feeds, which may be on different
+  // threads. Recursive so that listeners can take snapshots while one is published.
+  mutable recursive_mutex lock;
+
+};
+
+BondPriceAnalyticsService::BondPriceAnalyticsService() : clock(0), publishInterval(0), lastPublish(0)
+{
+  for(int w = 0; w<ANALYTICS_WINDOWS; w++)
+  {
+    bucketNanos[w] = GetWindowNanos(w) / ANALYTICS_BUCKETS;
+    decayRates[w] = 1.0 / GetWindowNanos(w);
+  }
+  for(int p = 0; p<BOND_COUNT; p++)
+  {
+    for(int s = 0; s<PRICE_SOURCES; s++)
+    {
+      lastPrices[p][s] = 0;
+      lastTimes[p][s] = -1;
+      for(int w = 0; w<ANALYTICS_WINDOWS; w++)
+      {
+        AnalyticsBuckets &window = buckets[p][s][w];
+        for(int b = 0; b<ANALYTICS_BUCKETS; b++)
+        {
+          window.bucketIds[b] = -1;
+        }
+        window.ewmaVariance = 0;
+      }
+      snapshots[p][s] = PriceAnalytics();
+      snapshots[p][s].productIndex = p;
+      snapshots[p][s].source = PriceSource(s);
+    }
+  }
+  emptySnapshot = PriceAnalytics();
+  emptySnapshot.productIndex = -1;
+}
+
+void BondPriceAnalyticsService::OnTick(int productIndex, PriceSource source, int64_t nanos, double price, double size)
+{
+  if(productIndex < 0 || productIndex >= BOND_COUNT || source < 0 || source >= PRICE_SOURCES || price <= 0)
+  {
+    return;
+  }
+
+  lock_guard<recursive_mutex> guard(lock);
+  if(nanos > clock)
+  {
+    clock = nanos;
+  }
+
+  double lastPrice = lastPrices[productIndex][source];
+  int64_t lastTime = lastTimes[productIndex][source];
+  int64_t elapsed = lastTime < 0 || nanos < lastTime ? 0 : nanos - lastTime;
+  double ret = lastPrice > 0 ? (price - lastPrice) / lastPrice : 0;
+  double squaredReturn = ret * ret;
+  double notional = price * size;
+  lastPrices[productIndex][source] = price;
+  lastTimes[productIndex][source] = nanos;
+
+  for(int w = 0; w<ANALYTICS_WINDOWS; w++)
+  {
+    AnalyticsBuckets &window = buckets[productIndex][source][w];
+
+    // Decay the squared returns seen so far by the time elapsed, then add this one
+    window.ewmaVariance = window.ewmaVariance * exp(-elapsed * decayRates[w]) + squaredReturn;
+
+    int64_t bucketId = nanos / bucketNanos[w];
+    int b = bucketId % ANALYTICS_BUCKETS;
+    if(window.bucketIds[b] > bucketId)
+    {
+      // A late tick whose bucket has already rolled out of the window
+      continue;
+    }
+    if(window.bucketIds[b] != bucketId)
+    {
+      // The slot last held a bucket that has rolled out of the window
+      window.bucketIds[b] = bucketId;
+      window.counts[b] = 0;
+      window.notionals[b] = 0;
+      window.sizes[b] = 0;
+      window.highs[b] = price;
+      window.lows[b] = price;
+    }
+    window.counts[b]++;
+    window.notionals[b] += notional;
+    window.sizes[b] += size;
+    window.highs[b] = fmax(window.highs[b], price);
+    window.lows[b] = fmin(window.lows[b], price);
+  }
+
+  if(publishInterval > 0 && clock - lastPublish >= publishInterval)
+  {
+    PublishSnapshots();
+  }
+}
+
+void BondPriceAnalyticsService::SetPublishInterval(int64_t intervalNanos)
+{
+  lock_guard<recursive_mutex> guard(lock);
+  publishInterval = intervalNanos;
+  lastPublish = clock;
+}
+
+PriceAnalytics BondPriceAnalyticsService::GetSnapshot(int productIndex, PriceSource source) const
+{
+  lock_guard<recursive_mutex> guard(lock);
+  PriceAnalytics snapshot = PriceAnalytics();
+  snapshot.productIndex = productIndex;
+  snapshot.source = source;
+  snapshot.timestamp = clock;
+
+  for(int w = 0; w<ANALYTICS_WINDOWS; w++)
+  {
+    const AnalyticsBuckets &window = buckets[productIndex][source][w];
+    int64_t oldest = clock / bucketNanos[w] - ANALYTICS_BUCKETS + 1;
+    oldest = oldest < 0 ? 0 : oldest;
+    long count = 0;
+    double notional = 0, size = 0, high = -HUGE_VAL, low = HUGE_VAL;
+    for(int b = 0; b<ANALYTICS_BUCKETS; b++)
+    {
+      if(window.bucketIds[b] >= oldest)
+      {
+        count += window.counts[b];
+        notional += window.notionals[b];
+        size += window.sizes[b];
+        high = fmax(high, window.highs[b]);
+        low = fmin(low, window.lows[b]);
+      }
+    }
+
+    WindowAnalytics &analytics = snapshot.windows[w];
+    analytics.tickCount = count;
+    analytics.vwap = size > 0 ? notional / size : 0;
+    analytics.high = count > 0 ? high : 0;
+    analytics.low = count > 0 ? low : 0;
+    analytics.range = analytics.high - analytics.low;
+    int64_t elapsed = lastTimes[productIndex][source] < 0 ? 0 : clock - lastTimes[productIndex][source];
+    analytics.ewmaVolatility = sqrt(window.ewmaVariance * exp(-elapsed * decayRates[w]));
+  }
+  return snapshot;
+}
+
+PriceAnalytics& BondPriceAnalyticsService::GetData(string key)
+{
+  int index = GetBondIndex(key);
+  return index < 0 ? emptySnapshot : snapshots[index][SOURCE_PRICING];
+}
+
+const PriceAnalytics& BondPriceAnalyticsService::GetPublished(int productIndex, PriceSource source) const
+{
+  lock_guard<recursive_mutex> guard(lock);
+  return snapshots[productIndex][source];
+}
+
+void BondPriceAnalyticsService::PublishSnapshots()
+{
+  lock_guard<recursive_mutex> guard(lock);
+  lastPublish = clock;
+  for(int p = 0; p<BOND_COUNT; p++)
+  {
+    for(int s = 0; s<PRICE_SOURCES; s++)
+    {
+      if(lastTimes[p][s] < 0)
+      {
+        continue;
+      }
+      snapshots[p][s] = GetSnapshot(p, PriceSource(s));
+      for(int i = 0; i<AnalyticsListeners.size(); i++)
+      {
+        AnalyticsListeners[i]->ProcessAdd(snapshots[p][s]);
+      }
+    }
+  }
+}
+
+void BondPriceAnalyticsService::AddListener(ServiceListener<PriceAnalytics> *listener)
+{
+  AnalyticsListeners.push_back(listener);
+}
+
+const vector< ServiceListener<PriceAnalytics>* >& BondPriceAnalyticsService::GetListeners() const
+{
+  return AnalyticsListeners;
+}
+
+int64_t BondPriceAnalyticsService::Now()
+{
+  return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+
+/**
+ * Feeds internal prices into the analytics as unsized ticks at the mid.
+ */
+class BondPricingAnalyticsServiceListener : public ServiceListener< Price<Bond> >
+{
+  public:
+
+    BondPricingAnalyticsServiceListener(BondPriceAnalyticsService* AnalyticsService_):AnalyticsService(AnalyticsService_){};
+
+  // Listener callback to process an add event to the Service
+  virtual void ProcessAdd(Price<Bond> &data)
+  {
+    int index = GetBondIndex(data.GetProduct().GetProductId());
+    AnalyticsService->OnTick(index, SOURCE_PRICING, BondPriceAnalyticsService::Now(), data.GetMid(), 0);
+  }
+
+  // Listener callback to process a remove event to the Service
+  virtual void ProcessRemove(Price<Bond> &data)
+  {
+
+  }
+
+  // Listener callback to process an update event to the Service
+  virtual void ProcessUpdate(Price<Bond> &data)
+  {
+    ProcessAdd(data);
+  }
+
+  private:
+
+  BondPriceAnalyticsService* AnalyticsService;
+
+};
+
+
+/**
+ * Feeds order books into the analytics as ticks at the touch mid, sized by the touch.
+ */
+class BondMarketDataAnalyticsServiceListener : public ServiceListener< BondOrderBook >
+{
+  public:
+
+    BondMarketDataAnalyticsServiceListener(BondPriceAnalyticsService* AnalyticsService_):AnalyticsService(AnalyticsService_){};
+
+  // Listener callback to process an add event to the Service
+  virtual void ProcessAdd(BondOrderBook &data)
+  {
+    if(data.GetBidLevels() == 0 || data.GetOfferLevels() == 0)
+    {
+      return;
+    }
+
+    // Levels are not guaranteed to be sorted
+    int bestBid = 0, bestOffer = 0;
+    for(int i = 1; i<data.GetBidLevels(); i++)
+    {
+      bestBid = data.GetBidPrice(i) > data.GetBidPrice(bestBid) ? i : bestBid;
+    }
+    for(int i = 1; i<data.GetOfferLevels(); i++)
+    {
+      bestOffer = data.GetOfferPrice(i) < data.GetOfferPrice(bestOffer) ? i : bestOffer;
+    }
+
+    double mid = (data.GetBidPrice(bestBid) + data.GetOfferPrice(bestOffer)).ToDouble() * 0.5;
+    double size = data.GetBidSize(bestBid) + data.GetOfferSize(bestOffer);
+    AnalyticsService->OnTick(data.GetProductIndex(), SOURCE_MARKET_DATA, BondPriceAnalyticsService::Now(), mid, size);
+  }
+
+  // Listener callback to process a remove event to the Service
+  virtual void ProcessRemove(BondOrderBook &data)
+  {
+
+  }
+
+  // Listener callback to process an update event to the Service
+  virtual void ProcessUpdate(BondOrderBook &data)
+  {
+    ProcessAdd(data);
+  }
+
+  private:
+
+  BondPriceAnalyticsService* AnalyticsService;
+
+};
+
+#endif
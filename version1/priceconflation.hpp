@@ -0,0 +1,238 @@
+/**
+ * priceconflation.hpp
+ * Latest-value-wins cache between the pricing service and its consumers.
+ *
+ * The cache listens on the pricing service. Each new price overwrites the slot of its
+ * product and marks the slot dirty for every consumer. A consumer drains only its dirty
+ * slots, so however far it falls behind it sees at most one price per product, and
+ * always the newest one. A throttled consumer left with dirty slots is put on a timer for
+ * the end of its throttle, so the last price of a burst reaches it even if its product
+ * then goes quiet.
+ */
+#ifndef PRICE_CONFLATION_HPP
+#define PRICE_CONFLATION_HPP
+
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include <stdint.h>
+
+#include "soa.hpp"
+#include "bondreferencedata.hpp"
+#include "pricingservice.hpp"
+#include "timerwheel.hpp"
+
+using namespace std;
+
+// Throttle for consumers that call Drain from their own thread rather than being
+// drained by the writer
+const long DRAIN_ON_POLL = -1;
+
+// Most consumers a cache can serve
+const int MAX_PRICE_CONSUMERS = 64;
+
+class BondPriceConflationCache : public ServiceListener< Price<Bond> >
+{
+
+public:
+
+  BondPriceConflationCache() : trailingDrains(1000000), writes(0) {}
+
+  // Register one of up to MAX_PRICE_CONSUMERS consumers and get its id, or -1 past the
+  // limit. A consumer with a throttle of zero or more is drained on the writing thread at
+  // most once every throttleMillis milliseconds, and by OnTimer at the end of a throttle
+  // that left it prices; one with DRAIN_ON_POLL drains itself by calling Drain when it is
+  // ready.
+  int AddConsumer(ServiceListener< Price<Bond> > *listener, long throttleMillis = DRAIN_ON_POLL);
+
+  // Drain the throttled consumers whose throttle has run out by nowNanos on the steady
+  // clock with prices still to deliver. Returns the number of prices delivered.
+  int OnTimer(int64_t nowNanos);
+
+  // Deliver the newest price of every product updated since the consumer last drained.
+  // Returns the number of prices delivered.
+  int Drain(int consumer);
+
+  // Drain every consumer, e.g. at the end of a replay
+  void DrainAll();
+
+  // Number of prices written by the pricing service
+  uint64_t GetWrites() const;
+
+  // Number of prices delivered to a consumer
+  uint64_t GetDeliveries(int consumer) const;
+
+  // Prices written per price delivered to a consumer
+  double GetConflationRatio(int consumer) const;
+
+  // Overwrite the slot of the product and mark it dirty
+  virtual void ProcessAdd(Price<Bond> &data);
+
+  virtual void ProcessRemove(Price<Bond> &data) {}
+
+  virtual void ProcessUpdate(Price<Bond> &data);
+
+private:
+
+  struct Consumer
+  {
+    ServiceListener< Price<Bond> > *listener;
+    long throttleMillis;
+    chrono::steady_clock::time_point lastDrain;
+    uint32_t dirty;          // bit per product index
+    uint64_t deliveries;
+    bool trailing;           // on the timer for a trailing drain
+  };
+
+  mutable mutex lock;
+  mutex delivering[MAX_PRICE_CONSUMERS];  // so the writer and the timer deliver in turn
+  TimerWheel trailingDrains;              // keyed by consumer
+  Price<Bond> slots[BOND_COUNT];
+  vector<Consumer> consumers;
+  uint64_t writes;
+
+};
+
+int BondPriceConflationCache::AddConsumer(ServiceListener< Price<Bond> > *listener, long throttleMillis)
+{
+  lock_guard<mutex> guard(lock);
+  if(consumers.size() >= MAX_PRICE_CONSUMERS)
+  {
+    return -1;
+  }
+  Consumer consumer = { listener, throttleMillis, chrono::steady_clock::time_point(), 0, 0, false };
+  consumers.push_back(consumer);
+  return consumers.size() - 1;
+}
+
+int BondPriceConflationCache::Drain(int consumer)
+{
+  Price<Bond> pending[BOND_COUNT];
+  int count = 0;
+  ServiceListener< Price<Bond> > *listener;
+  lock_guard<mutex> delivery(delivering[consumer]);
+  {
+    lock_guard<mutex> guard(lock);
+    Consumer &target = consumers[consumer];
+    for(uint32_t dirty = target.dirty; dirty != 0; dirty &= dirty - 1)
+    {
+      pending[count++] = slots[__builtin_ctz(dirty)];
+    }
+    target.dirty = 0;
+    target.deliveries += count;
+    target.lastDrain = chrono::steady_clock::now();
+    listener = target.listener;
+  }
+
+  // Deliver outside the lock so a slow consumer never holds up the writes of others
+  for(int i = 0; i<count; i++)
+  {
+    listener->ProcessAdd(pending[i]);
+  }
+  return count;
+}
+
+int BondPriceConflationCache::OnTimer(int64_t nowNanos)
+{
+  uint64_t due = 0;          // bit per consumer
+  {
+    lock_guard<mutex> guard(lock);
+    trailingDrains.Advance(nowNanos, [&](uint64_t consumer)
+    {
+      consumers[consumer].trailing = false;
+      if(consumers[consumer].dirty != 0)
+      {
+        due |= uint64_t(1) << consumer;
+      }
+    });
+  }
+
+  int delivered = 0;
+  for(; due != 0; due &= due - 1)
+  {
+    delivered += Drain(__builtin_ctzll(due));
+  }
+  return delivered;
+}
+
+void BondPriceConflationCache::DrainAll()
+{
+  for(int i = 0; i<consumers.size(); i++)
+  {
+    Drain(i);
+  }
+}
+
+uint64_t BondPriceConflationCache::GetWrites() const
+{
+  lock_guard<mutex> guard(lock);
+  return writes;
+}
+
+uint64_t BondPriceConflationCache::GetDeliveries(int consumer) const
+{
+  lock_guard<mutex> guard(lock);
+  return consumers[consumer].deliveries;
+}
+
+double BondPriceConflationCache::GetConflationRatio(int consumer) const
+{
+  lock_guard<mutex> guard(lock);
+  return consumers[consumer].deliveries == 0 ? 0 : double(writes) / consumers[consumer].deliveries;
+}
+
+void BondPriceConflationCache::ProcessAdd(Price<Bond> &data)
+{
+  int index = GetBondIndex(data.GetProduct().GetProductId());
+  if(index < 0)
+  {
+    return;
+  }
+
+  uint64_t ready = 0;        // bit per consumer
+  {
+    lock_guard<mutex> guard(lock);
+    slots[index] = data;
+    writes++;
+
+    chrono::steady_clock::time_point now = chrono::steady_clock::time_point();
+    for(int i = 0; i<consumers.size(); i++)
+    {
+      Consumer &consumer = consumers[i];
+      consumer.dirty |= 1u << index;
+      if(consumer.throttleMillis == 0)
+      {
+        ready |= uint64_t(1) << i;
+      }
+      else if(consumer.throttleMillis > 0)
+      {
+        if(now == chrono::steady_clock::time_point())
+        {
+          now = chrono::steady_clock::now();
+        }
+        if(now - consumer.lastDrain >= chrono::milliseconds(consumer.throttleMillis))
+        {
+          ready |= uint64_t(1) << i;
+        }
+        else if(!consumer.trailing)
+        {
+          chrono::steady_clock::time_point due = consumer.lastDrain + chrono::milliseconds(consumer.throttleMillis);
+          trailingDrains.Schedule(chrono::duration_cast<chrono::nanoseconds>(due.time_since_epoch()).count(), i);
+          consumer.trailing = true;
+        }
+      }
+    }
+  }
+
+  for(; ready != 0; ready &= ready - 1)
+  {
+    Drain(__builtin_ctzll(ready));
+  }
+}
+
+void BondPriceConflationCache::ProcessUpdate(Price<Bond> &data)
+{
+  ProcessAdd(data);
+}
+
+#endif
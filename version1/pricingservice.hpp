@@ -16,8 +16,15 @@
 #include <cstring>
 #include <chrono>
 #include <thread>
+#include <atomic>
+#include <mutex>
+#include <stdint.h>
 #include "soa.hpp"
 #include "products.hpp"
+#include "csvingest.hpp"
+#include "binaryfeed.hpp"
+#include "bondreferencedata.hpp"
+#include "tickprice.hpp"
 
 using namespace std;
 /**
@@ -32,8 +39,12 @@ public:
 
   // ctor for a price
   Price(const T& _product, double _mid, double _bidOfferSpread);
+
+  // ctor for a price from a bid and offer. The mid is exact, as a half tick is still a
+  // power of two.
+  Price(const T& _product, TickPrice _bid, TickPrice _offer);
   
-  Price(){};
+  Price() : mid(0), bidOfferSpread(0) {};
 
   // Get the product
   const T& GetProduct() const;
@@ -44,6 +55,10 @@ public:
   // Get the bid/offer spread around the mid
   double GetBidOfferSpread() const;
 
+  // Get the bid and offer, rounded to the nearest tick
+  TickPrice GetTickBid() const;
+  TickPrice GetTickOffer() const;
+
 private:
   T product;
   double mid;
@@ -69,6 +84,14 @@ Price<T>::Price(const T &_product, double _mid, double _bidOfferSpread) :
   bidOfferSpread = _bidOfferSpread;
 }
 
+template<typename T>
+Price<T>::Price(const T &_product, TickPrice _bid, TickPrice _offer) :
+  product(_product)
+{
+  mid = (_bid + _offer).ToDouble() * 0.5;
+  bidOfferSpread = (_offer - _bid).ToDouble();
+}
+
 template<typename T>
 const T& Price<T>::GetProduct() const
 {
@@ -87,38 +110,156 @@ double Price<T>::GetBidOfferSpread() const
   return bidOfferSpread;
 }
 
+template<typename T>
+TickPrice Price<T>::GetTickBid() const
+{
+  return TickPrice::FromDouble(mid - bidOfferSpread * 0.5);
+}
+
+template<typename T>
+TickPrice Price<T>::GetTickOffer() const
+{
+  return TickPrice::FromDouble(mid + bidOfferSpread * 0.5);
+}
+
 
 
 
 
+/**
+ * The latest price of a product, with the service sequence number at which it was stored
+ * and the time it was stored. A sequence of zero means no price has arrived yet.
+ */
+struct VersionedPrice
+{
+  Price<Bond> price;
+  uint64_t sequence;
+  chrono::system_clock::time_point timestamp;
+
+  VersionedPrice() : sequence(0) {}
+};
+
+
 class BondPricingService : public PricingService <Bond>
 {
 
-  std::map<string, Price<Bond> > BondPriceMP;  //<2Y, Price<Bond> >
+  // The latest price of a product. The product of a slot never changes, so only the mid,
+  // spread, sequence and timestamp are stored, as relaxed atomics under a sequence lock:
+  // the version is odd while the writer is in the slot, and a reader that sees it odd or
+  // changed reads again. A slot per cache line keeps a write to one product from
+  // disturbing readers of another.
+  struct alignas(64) PriceSlot
+  {
+    std::atomic<uint64_t> version;
+    std::atomic<uint64_t> sequence;
+    std::atomic<double> mid;
+    std::atomic<double> bidOfferSpread;
+    std::atomic<int64_t> timestamp;           // system clock, in its own ticks
+  };
+
+  PriceSlot BondPriceSlots[BOND_COUNT];       // by product index
+  std::atomic<uint64_t> BondPriceSequence;    // sequence of the latest price stored
   std::vector< ServiceListener< Price<Bond> >* > BondPriceListener;
 
+  // Prices arrive both from the price feed and from the fair-value engine, which may be
+  // on different threads. Writers and the listeners downstream run under this lock.
+  std::mutex BondPriceLock;
+
 public:
-  BondPricingService()
+  BondPricingService() : BondPriceSequence(0)
   {
-    BondPriceMP = std::map<string, Price<Bond> >();
     BondPriceListener =std::vector< ServiceListener< Price<Bond> >* > ();
+    for(int i = 0; i<BOND_COUNT; i++)
+    {
+      BondPriceSlots[i].version.store(0, std::memory_order_relaxed);
+      BondPriceSlots[i].sequence.store(0, std::memory_order_relaxed);
+      BondPriceSlots[i].mid.store(0, std::memory_order_relaxed);
+      BondPriceSlots[i].bidOfferSpread.store(0, std::memory_order_relaxed);
+      BondPriceSlots[i].timestamp.store(0, std::memory_order_relaxed);
+    }
   }
 
-  // Get data on our service given a key
+  // Get data on our service given a key. A product that has not been priced yet, or is
+  // not traded, gets an empty price. The price is a copy for the calling thread, good
+  // until its next call.
   virtual Price<Bond>& GetData(string key)
   {
-     if(BondPriceMP.find(key)!=BondPriceMP.end())
+    static thread_local Price<Bond> copy;
+    int index = GetBondIndex(key);
+    copy = index < 0 ? Price<Bond>() : GetVersionedPrice(index).price;
+    return copy;
+  }
+
+  // Get a copy of the latest price of a product with its sequence number and timestamp,
+  // from any thread
+  VersionedPrice GetVersionedPrice(int productIndex) const
+  {
+    const PriceSlot &slot = BondPriceSlots[productIndex];
+    VersionedPrice versioned;
+    uint64_t before, after;
+    double mid, spread;
+    int64_t timestamp;
+    do
+    {
+      before = slot.version.load(std::memory_order_acquire);
+      versioned.sequence = slot.sequence.load(std::memory_order_relaxed);
+      mid = slot.mid.load(std::memory_order_relaxed);
+      spread = slot.bidOfferSpread.load(std::memory_order_relaxed);
+      timestamp = slot.timestamp.load(std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_acquire);
+      after = slot.version.load(std::memory_order_relaxed);
+    } while((before & 1) != 0 || before != after);
+
+    if(versioned.sequence != 0)
     {
-      return BondPriceMP[key];
+      versioned.price = Price<Bond>(GetReferenceBond(productIndex), mid, spread);
+      versioned.timestamp = chrono::system_clock::time_point(chrono::system_clock::duration(timestamp));
     }
-       // return BondPriceMP[key];
+    return versioned;
+  }
+
+  // Get the sequence number of the latest price stored for any product
+  uint64_t GetSequence() const
+  {
+    return BondPriceSequence.load(std::memory_order_acquire);
+  }
+
+  // Has any price been stored since sequence number N?
+  bool HasChangedSince(uint64_t sequence) const
+  {
+    return GetSequence() > sequence;
+  }
+
+  // Has the product been repriced since sequence number N?
+  bool HasChangedSince(int productIndex, uint64_t sequence) const
+  {
+    return HasChangedSince(sequence) && BondPriceSlots[productIndex].sequence.load(std::memory_order_acquire) > sequence;
   }
 
   // The callback that a Connector should invoke for any new or updated data
   virtual void OnMessage(Price<Bond> &data)
   {
+    int index = GetBondIndex(data.GetProduct().GetProductId());
+    if(index < 0)
+    {
+      return;
+    }
 
-    BondPriceMP.insert(std::pair<string,Price<Bond> >(data.GetProduct().GetProductId(), data));
+    std::lock_guard<std::mutex> guard(BondPriceLock);
+
+    // Overwrite the slot, then publish its sequence number so that a reader polling
+    // GetSequence sees the new price
+    PriceSlot &slot = BondPriceSlots[index];
+    uint64_t sequence = BondPriceSequence.load(std::memory_order_relaxed) + 1;
+    uint64_t version = slot.version.load(std::memory_order_relaxed);
+    slot.version.store(version + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.mid.store(data.GetMid(), std::memory_order_relaxed);
+    slot.bidOfferSpread.store(data.GetBidOfferSpread(), std::memory_order_relaxed);
+    slot.timestamp.store(chrono::system_clock::now().time_since_epoch().count(), std::memory_order_relaxed);
+    slot.sequence.store(sequence, std::memory_order_relaxed);
+    slot.version.store(version + 2, std::memory_order_release);
+    BondPriceSequence.store(sequence, std::memory_order_release);
 
     if(BondPriceListener.size()!=0)
     {
@@ -154,7 +295,7 @@ public:
 class BondPricingServiceConnector : public Connector < Price <Bond> >
 {
 private:
-  BondPricingService bondPriceService;
+  BondPricingService& bondPriceService;
 
 public:
   BondPricingServiceConnector( BondPricingService& _myline):bondPriceService(_myline){}; 
@@ -163,110 +304,57 @@ public:
 
   void Subscribe()
   {
-    string line;
-    std::ifstream file("price.txt");
+    MappedFile file("price.txt");
+    CsvReader reader(file.GetData(), file.GetSize());
+    CsvField fields[4];
+    int fieldCount;
+    PriceRecord record;
 
-    while(getline(file,line))
-  {
-    
+    while(reader.NextLine(fields, 4, fieldCount))
+    {
+      std::this_thread::sleep_for(chrono::seconds(1));
 
-    
-    std::this_thread::sleep_for(chrono::seconds(1));
-   
+      if(!ParsePriceRecord(fields, fieldCount, record))
+      {
+        continue;
+      }
 
+      Price<Bond> obj1 = Price<Bond>(GetReferenceBond(record.productIndex),record.mid,record.bidOfferSpread);
+      bondPriceService.OnMessage(obj1);
+    }
+  }
 
-    if(!line.empty())
-    {
-      std::stringstream linestream(line);
+};
 
-      std::string product;
-      std::string cusip;
-      std::string mid;
-      std::string spread;
 
-      
-      std::getline(linestream,product,',');
-      std::getline(linestream,cusip,',');
+/**
+ * Replays a binary price feed (see binaryfeed.hpp) into the pricing service.
+ * Records are read in place from the mapped file, with no pacing between them.
+ */
+class BondPricingServiceBinaryConnector : public Connector < Price <Bond> >
+{
+private:
+  BondPricingService& bondPriceService;
+  string path;
 
-      std::getline(linestream,mid,',');
-      std::getline(linestream,spread,',');
+public:
+  BondPricingServiceBinaryConnector( BondPricingService& _myline, const string &_path = "price.bin"):bondPriceService(_myline),path(_path){};
 
-      double midPrice = stod(mid);
-      double bidofferspread = stod(spread);
+  virtual void Publish(Price<Bond>& data){};
 
-      
-      
-    if(!product.empty())
+  void Subscribe()
+  {
+    BinaryFeedReader<PriceFeedRecord> reader(path.c_str());
+    for(const PriceFeedRecord *record = reader.Begin(); record != reader.End(); record++)
     {
-                if(product == "2Y")
-              {
-
-                    BondIdType idType = CUSIP;
-                    date maturityDate(2019,Oct,31);
-                     const Bond bond2Y("2Y", idType,"T", 0.015, maturityDate);
-                        
-                    Price<Bond> obj1 = Price<Bond>(bond2Y,midPrice,bidofferspread);
-                    bondPriceService.OnMessage(obj1);
-                    //std::cout<<"updated"<<std::endl;
-                    std::cout<<"Price imported"<<std::endl;
-              }
-              else if (product == "3Y")
-              {
-
-                    BondIdType idType = CUSIP;
-                    date maturityDate(2020,Nov,15);
-                    const Bond bond3Y("3Y", idType, "T", 0.0175, maturityDate);
-                    
-                    Price<Bond> obj1 = Price<Bond>(bond3Y,midPrice,bidofferspread);
-                    bondPriceService.OnMessage(obj1);
-
-              }
-              else if (product == "5Y")
-              {
-                    BondIdType idType = CUSIP;
-                    date maturityDate(2022,Oct,31);
-                    const Bond bond5Y("5Y", idType, "T", 0.02, maturityDate);
-
-                    Price<Bond> obj1 = Price<Bond>(bond5Y,midPrice,bidofferspread);
-                    bondPriceService.OnMessage(obj1);
-              }
-              else if (product == "7Y")
-              {
-                    BondIdType idType = CUSIP;
-                    date maturityDate(2024,Oct,31);
-                    const Bond bond7Y("7Y", idType, "T", 0.0225, maturityDate);
-
-                    Price<Bond> obj1 = Price<Bond>(bond7Y,midPrice,bidofferspread);
-                    bondPriceService.OnMessage(obj1);
-              }
-              else if (product == "10Y")
-              {
-
-                    BondIdType idType = CUSIP;
-                    date maturityDate(2027,Nov,15);
-                    const Bond bond10Y("10Y", idType, "T", 0.0225, maturityDate);
-
-                    Price<Bond> obj1 = Price<Bond>(bond10Y,midPrice,bidofferspread);
-                    bondPriceService.OnMessage(obj1);
-
-              }
-              else if (product == "30Y")
-              {
-
-                    BondIdType idType = CUSIP;
-                    date maturityDate(2047,Nov,15);
-                    const Bond bond30Y("30Y", idType, "T", 0.0275, maturityDate);
-
-                    Price<Bond> obj1 = Price<Bond>(bond30Y,midPrice,bidofferspread);
-                    bondPriceService.OnMessage(obj1);
-              }
-    }
-      
+      if(!IsValidFeedRecord(*record))
+      {
+        continue;
+      }
+      Price<Bond> obj1 = Price<Bond>(GetReferenceBond(record->productIndex),record->mid,record->bidOfferSpread);
+      bondPriceService.OnMessage(obj1);
     }
-    
- }
-
- }
+  }
 
 };
 
@@ -0,0 +1,340 @@
+/**
+ * smartorderrouter.hpp
+ * Defines the router that splits algo execution orders across venues.
+ *
+ * A parent order first takes the liquidity each venue's book shows at or better than its
+ * price, cheapest level first once the venue's fee and latency cost are added to the
+ * price. The rest is posted across venues in lots, in proportion to each venue's depth
+ * and fill rate, discounted by its cost. Every venue gets at most one child order, linked
+ * to the parent by its parent order ID. Fill rates are learned from the execution reports
+ * of the venues' exchanges; a venue with no exchange keeps the rate it started with.
+ */
+#ifndef SMART_ORDER_ROUTER_HPP
+#define SMART_ORDER_ROUTER_HPP
+
+#include <cstdlib>
+#include <stdint.h>
+
+#include "soa.hpp"
+#include "bondreferencedata.hpp"
+#include "marketdataservice.hpp"
+#include "orderidservice.hpp"
+#include "matchingengine.hpp"
+#include "executionservice.hpp"
+
+using namespace std;
+
+/**
+ * What it costs to trade on a venue.
+ */
+struct VenueProfile
+{
+  long latencyNanos;          // from sending an order to the venue acting on it
+  double feeTicks;            // per unit filled, negative for a rebate
+};
+
+/**
+ * A venue's share of a parent order.
+ */
+struct RouteSlice
+{
+  Market venue;
+  long quantity;
+  long taken;                 // of the quantity, against liquidity the venue shows
+};
+
+class BondSmartOrderRouter : public ServiceListener<ExecutionReport>
+{
+
+public:
+
+  // ctor for a router sending child orders to an execution service, reading venue books
+  // from market data, posting in lots of lotSize
+  BondSmartOrderRouter(BondExecutionService *_execution, const BondMarketDataService *_marketData,
+    OrderIdService *_orderIds = 0, long _lotSize = 1000000);
+
+  // Set the latency and fee of a venue
+  void SetVenueProfile(Market venue, long latencyNanos, double feeTicks);
+
+  // Get the latency and fee of a venue
+  const VenueProfile& GetVenueProfile(Market venue) const;
+
+  // Set what latency costs, in ticks per unit per microsecond
+  void SetLatencyCost(double ticksPerMicro);
+
+  // Split a quantity of a product across venues, buying on the BID side and selling on
+  // the OFFER side, up to a limit price unless it is a market order. Without split, all of
+  // it goes to one venue. Returns the number of slices, at most one per venue.
+  int Plan(int productIndex, PricingSide side, TickPrice limit, bool market, long quantity, bool split,
+    RouteSlice slices[MARKET_COUNT]) const;
+
+  // Send a parent order as child orders, one per slice of its plan. Fill or kill orders
+  // are not split. Returns the number of child orders.
+  int Route(const ExecutionOrder<Bond> &parent);
+
+  // Get the share of the quantity sent to a venue that filled, recently
+  double GetFillRate(Market venue) const;
+
+  // Get the number of child orders sent
+  long GetChildOrders() const;
+
+  // Learn fill rates from execution reports
+  virtual void ProcessAdd(ExecutionReport &report);
+
+  virtual void ProcessRemove(ExecutionReport &report);
+
+  virtual void ProcessUpdate(ExecutionReport &report);
+
+private:
+  BondSmartOrderRouter(const BondSmartOrderRouter &);
+  BondSmartOrderRouter& operator=(const BondSmartOrderRouter &);
+
+  // Weight of history in the fill rates, per order reported
+  static constexpr double FILL_RATE_DECAY = 0.99;
+
+  // A venue book level that a parent order can take
+  struct TakeLevel
+  {
+    double cost;              // price in ticks plus fee and latency, negated for sells
+    Market venue;
+    long size;
+  };
+
+  double GetCost(int venue) const;
+
+  BondExecutionService *execution;
+  const BondMarketDataService *marketData;
+  OrderIdService localOrderIds;
+  OrderIdService *orderIds;
+  long lotSize;
+  double latencyTicksPerMicro;
+  VenueProfile profiles[MARKET_COUNT];
+  double sentQuantity[MARKET_COUNT];
+  double filledQuantity[MARKET_COUNT];
+  double priorQuantity;       // counted as sent and filled, so new venues start at a rate of 1
+  long childOrders;
+
+};
+
+BondSmartOrderRouter::BondSmartOrderRouter(BondExecutionService *_execution, const BondMarketDataService *_marketData,
+  OrderIdService *_orderIds, long _lotSize) :
+  execution(_execution), marketData(_marketData), localOrderIds(0), orderIds(_orderIds ? _orderIds : &localOrderIds),
+  lotSize(_lotSize > 0 ? _lotSize : 1), latencyTicksPerMicro(0.001), priorQuantity(10.0 * lotSize), childOrders(0)
+{
+  for(int v = 0; v<MARKET_COUNT; v++)
+  {
+    profiles[v].latencyNanos = 0;
+    profiles[v].feeTicks = 0;
+    sentQuantity[v] = 0;
+    filledQuantity[v] = 0;
+  }
+}
+
+void BondSmartOrderRouter::SetVenueProfile(Market venue, long latencyNanos, double feeTicks)
+{
+  profiles[venue].latencyNanos = latencyNanos;
+  profiles[venue].feeTicks = feeTicks;
+}
+
+const VenueProfile& BondSmartOrderRouter::GetVenueProfile(Market venue) const
+{
+  return profiles[venue];
+}
+
+void BondSmartOrderRouter::SetLatencyCost(double ticksPerMicro)
+{
+  latencyTicksPerMicro = ticksPerMicro;
+}
+
+double BondSmartOrderRouter::GetCost(int venue) const
+{
+  return profiles[venue].feeTicks + profiles[venue].latencyNanos / 1000.0 * latencyTicksPerMicro;
+}
+
+double BondSmartOrderRouter::GetFillRate(Market venue) const
+{
+  return (filledQuantity[venue] + priorQuantity) / (sentQuantity[venue] + priorQuantity);
+}
+
+long BondSmartOrderRouter::GetChildOrders() const
+{
+  return childOrders;
+}
+
+int BondSmartOrderRouter::Plan(int productIndex, PricingSide side, TickPrice limit, bool market, long quantity, bool split,
+  RouteSlice slices[MARKET_COUNT]) const
+{
+  const bool buy = side == BID;
+  TakeLevel levels[MARKET_COUNT * MARKET_DATA_DEPTH];
+  int count = 0;
+  long taken[MARKET_COUNT] = {};
+  double weights[MARKET_COUNT];
+
+  // Levels of each venue this order can take, and the venue's weight for posting the rest
+  for(int v = 0; v<MARKET_COUNT; v++)
+  {
+    const BondOrderBook &book = marketData->GetVenueBook(Market(v), productIndex);
+    long depth = 0;
+    for(int i = 0; i<book.GetBidLevels(); i++)
+    {
+      depth += book.GetBidSize(i);
+    }
+    for(int i = 0; i<book.GetOfferLevels(); i++)
+    {
+      depth += book.GetOfferSize(i);
+    }
+    double cost = GetCost(v);
+    weights[v] = (depth + lotSize) * GetFillRate(Market(v)) / (1 + (cost > 0 ? cost : 0));
+
+    int opposite = buy ? book.GetOfferLevels() : book.GetBidLevels();
+    for(int i = 0; i<opposite; i++)
+    {
+      TickPrice price = buy ? book.GetOfferPrice(i) : book.GetBidPrice(i);
+      if(!market && (buy ? price > limit : price < limit))
+      {
+        break;
+      }
+      TakeLevel level = { (buy ? price.GetTicks() : -price.GetTicks()) + cost, Market(v), buy ? book.GetOfferSize(i) : book.GetBidSize(i) };
+      levels[count++] = level;
+    }
+  }
+
+  // Cheapest levels first, and of those at a cost the earliest venue
+  for(int i = 1; i<count; i++)
+  {
+    TakeLevel level = levels[i];
+    int j = i;
+    for(; j > 0 && levels[j - 1].cost > level.cost; j--)
+    {
+      levels[j] = levels[j - 1];
+    }
+    levels[j] = level;
+  }
+  long remaining = quantity;
+  for(int i = 0; i<count && remaining > 0; i++)
+  {
+    long take = levels[i].size < remaining ? levels[i].size : remaining;
+    taken[levels[i].venue] += take;
+    remaining -= take;
+  }
+
+  int best = 0;
+  for(int v = 1; v<MARKET_COUNT; v++)
+  {
+    if(split ? weights[v] > weights[best] : (taken[v] > taken[best] || (taken[v] == taken[best] && weights[v] > weights[best])))
+    {
+      best = v;
+    }
+  }
+  if(!split)
+  {
+    RouteSlice slice = { Market(best), quantity, taken[best] };
+    slices[0] = slice;
+    return 1;
+  }
+
+  // The rest in lots by weight, with what does not make a lot going to the heaviest venue
+  long posted[MARKET_COUNT] = {};
+  double totalWeight = 0;
+  for(int v = 0; v<MARKET_COUNT; v++)
+  {
+    totalWeight += weights[v];
+  }
+  long left = remaining;
+  for(int v = 0; v<MARKET_COUNT && totalWeight > 0; v++)
+  {
+    posted[v] = long(remaining * (weights[v] / totalWeight) / lotSize) * lotSize;
+    left -= posted[v];
+  }
+  posted[best] += left;
+
+  int sliceCount = 0;
+  for(int v = 0; v<MARKET_COUNT; v++)
+  {
+    if(taken[v] + posted[v] > 0)
+    {
+      RouteSlice slice = { Market(v), taken[v] + posted[v], taken[v] };
+      slices[sliceCount++] = slice;
+    }
+  }
+  return sliceCount;
+}
+
+int BondSmartOrderRouter::Route(const ExecutionOrder<Bond> &parent)
+{
+  int index = GetBondIndex(parent.GetProduct().GetProductId());
+  long quantity = labs(parent.GetVisibleQuantity()) + labs(parent.GetHiddenQuantity());
+  RouteSlice slices[MARKET_COUNT];
+  int count = index < 0 || quantity == 0 ? 0 : Plan(index, parent.GetSide(), parent.GetTickPrice(),
+    parent.GetOrderType() == MARKET, quantity, parent.GetOrderType() != FOK, slices);
+  if(count == 0)
+  {
+    ExecutionOrder<Bond> order(parent);
+    execution->ExecuteOrder(order, CME);
+    return 0;
+  }
+
+  // Children carry the sign of the parent's quantity
+  long sign = parent.GetVisibleQuantity() < 0 || parent.GetHiddenQuantity() < 0 ? -1 : 1;
+  for(int i = 0; i<count; i++)
+  {
+    ExecutionOrder<Bond> child(parent.GetProduct(), parent.GetSide(), OrderIdService::ToString(orderIds->NextId()),
+      parent.GetOrderType(), parent.GetTickPrice(), sign * slices[i].quantity, 0, parent.GetOrderId(), true);
+    execution->ExecuteOrder(child, slices[i].venue);
+  }
+  childOrders += count;
+  return count;
+}
+
+void BondSmartOrderRouter::ProcessAdd(ExecutionReport &report)
+{
+  if(report.type == ORDER_ACCEPTED)
+  {
+    sentQuantity[report.venue] = sentQuantity[report.venue] * FILL_RATE_DECAY + report.leavesQuantity;
+    filledQuantity[report.venue] *= FILL_RATE_DECAY;
+  }
+  else if(report.type == ORDER_FILLED)
+  {
+    filledQuantity[report.venue] += report.quantity;
+  }
+}
+
+void BondSmartOrderRouter::ProcessRemove(ExecutionReport &report)
+{
+}
+
+void BondSmartOrderRouter::ProcessUpdate(ExecutionReport &report)
+{
+}
+
+
+/**
+ * Routes the orders of algo execution across venues.
+ */
+class BondAlgoExecutionRouterListener : public ServiceListener< AlgoExecution<Bond> >
+{
+  private:
+      BondSmartOrderRouter* Router;
+    public:
+      BondAlgoExecutionRouterListener(BondSmartOrderRouter* Router_):Router(Router_){};
+
+    // Listener callback to process an add event to the Service
+  virtual void ProcessAdd(AlgoExecution<Bond> &data)
+  {
+    Router->Route(data.GetExecutionOrder());
+  }
+
+  // Listener callback to process a remove event to the Service
+  virtual void ProcessRemove(AlgoExecution<Bond> &data)
+  {
+
+  }
+
+  // Listener callback to process an update event to the Service
+  virtual void ProcessUpdate(AlgoExecution<Bond> &data)
+  {
+
+  }
+};
+
+#endif
@@ -0,0 +1,315 @@
+/**
+ * stoptrigger.hpp
+ * Defines the engine holding stop orders until the market reaches them.
+ *
+ * Stops of each product and side are kept in buckets of one tick each, indexed by price,
+ * with a bit per bucket marking those holding stops. A buy stop triggers once the best
+ * offer rises to its price and a sell stop once the best bid falls to it; sell stops are
+ * kept with their prices negated, so both trigger every bucket at or below a key. Every
+ * bucket below the lowest key a side might hold is known empty, so a top of book that
+ * crosses nothing costs a comparison, and one that does visits the bits of the ticks the
+ * price moved through, 64 at a time, and the stops it triggers. Stops of a bucket trigger
+ * in the order they were added.
+ */
+#ifndef STOP_TRIGGER_HPP
+#define STOP_TRIGGER_HPP
+
+#include <vector>
+#include <stdint.h>
+
+#include "bondreferencedata.hpp"
+#include "marketdataservice.hpp"
+#include "tickprice.hpp"
+
+using namespace std;
+
+template<typename T>
+class StopTriggerEngine
+{
+
+public:
+
+  // ctor for an engine with no stops
+  StopTriggerEngine();
+
+  // Add a stop of a product at a price, buying on the BID side and selling on the OFFER
+  // side, and get a handle to cancel it by
+  uint64_t Add(int productIndex, PricingSide side, TickPrice stopPrice, const T &data);
+
+  // Cancel a stop. Returns false if it has already triggered or been cancelled.
+  bool Cancel(uint64_t handle);
+
+  // Trigger the stops of a product that the top of its book has reached, calling
+  // trigger(data) for each, lowest buy and highest sell stops first. Stops added from
+  // trigger wait for the next top of book. Returns the number of stops triggered.
+  template<typename Trigger>
+  int OnTopOfBook(int productIndex, const TopOfBook &top, Trigger trigger);
+
+  // Get the number of stops resting
+  size_t GetStops() const;
+
+  // Get the number of stops triggered
+  long GetTriggered() const;
+
+private:
+
+  static const uint32_t NONE = 0xFFFFFFFF;
+  static const int INITIAL_BUCKETS = 1024;
+
+  struct Stop
+  {
+    T data;
+    int64_t key;              // price in ticks, negated for sells
+    uint32_t prev;
+    uint32_t next;            // and in the free list
+    uint32_t generation;      // tells a reused stop from the one a handle was for
+    uint16_t ladder;
+    bool resting;
+  };
+
+  // Stops of one product and side, by key
+  struct Ladder
+  {
+    int64_t base;             // key of the first bucket
+    vector<uint32_t> heads;
+    vector<uint32_t> tails;
+    vector<uint64_t> occupied;
+    int64_t lowest;           // no stop has a key below this
+  };
+
+  void Fit(Ladder &ladder, int64_t key);
+  void Unlink(uint32_t index);
+  int Cross(Ladder &ladder, int64_t threshold);
+
+  vector<Stop> stops;
+  uint32_t freeStops;
+  size_t resting;
+  long triggered;
+  Ladder ladders[BOND_COUNT * 2];
+  vector<uint32_t> crossed;
+
+};
+
+template<typename T>
+StopTriggerEngine<T>::StopTriggerEngine() :
+  freeStops(NONE), resting(0), triggered(0)
+{
+  for(int i = 0; i<BOND_COUNT * 2; i++)
+  {
+    ladders[i].base = 0;
+    ladders[i].lowest = INT64_MAX;
+  }
+}
+
+template<typename T>
+void StopTriggerEngine<T>::Fit(Ladder &ladder, int64_t key)
+{
+  int64_t size = ladder.heads.size();
+  if(size > 0 && key >= ladder.base && key < ladder.base + size)
+  {
+    return;
+  }
+
+  // Grown to twice what it needs, on a 64 bucket boundary, with the buckets moved across
+  int64_t first = size > 0 && ladder.base < key ? ladder.base : key - INITIAL_BUCKETS / 2;
+  int64_t end = size > 0 && ladder.base + size > key + 1 ? ladder.base + size : key + INITIAL_BUCKETS / 2;
+  int64_t grown = INITIAL_BUCKETS;
+  while(grown < 2 * (end - first))
+  {
+    grown <<= 1;
+  }
+  int64_t base = first - (grown - (end - first)) / 2;
+  base -= ((base % 64) + 64) % 64;
+  vector<uint32_t> heads(grown + 64, uint32_t(NONE)), tails(grown + 64, uint32_t(NONE));
+  vector<uint64_t> occupied((grown + 64) / 64, 0);
+  for(int64_t b = 0; b<size; b++)
+  {
+    if(ladder.heads[b] != NONE)
+    {
+      int64_t moved = ladder.base + b - base;
+      heads[moved] = ladder.heads[b];
+      tails[moved] = ladder.tails[b];
+      occupied[moved >> 6] |= uint64_t(1) << (moved & 63);
+    }
+  }
+  ladder.base = base;
+  ladder.heads.swap(heads);
+  ladder.tails.swap(tails);
+  ladder.occupied.swap(occupied);
+}
+
+template<typename T>
+uint64_t StopTriggerEngine<T>::Add(int productIndex, PricingSide side, TickPrice stopPrice, const T &data)
+{
+  uint16_t ladderIndex = productIndex * 2 + side;
+  Ladder &ladder = ladders[ladderIndex];
+  int64_t key = side == BID ? stopPrice.GetTicks() : -stopPrice.GetTicks();
+  Fit(ladder, key);
+
+  uint32_t index = freeStops;
+  if(index == NONE)
+  {
+    Stop stop = { data, 0, NONE, NONE, 0, 0, false };
+    index = stops.size();
+    stops.push_back(stop);
+  }
+  else
+  {
+    freeStops = stops[index].next;
+    stops[index].data = data;
+  }
+
+  Stop &stop = stops[index];
+  int64_t bucket = key - ladder.base;
+  stop.key = key;
+  stop.ladder = ladderIndex;
+  stop.resting = true;
+  stop.next = NONE;
+  stop.prev = ladder.tails[bucket];
+  if(stop.prev != NONE)
+  {
+    stops[stop.prev].next = index;
+  }
+  else
+  {
+    ladder.heads[bucket] = index;
+    ladder.occupied[bucket >> 6] |= uint64_t(1) << (bucket & 63);
+  }
+  ladder.tails[bucket] = index;
+  if(key < ladder.lowest)
+  {
+    ladder.lowest = key;
+  }
+  resting++;
+  return (uint64_t(stop.generation) << 32) | index;
+}
+
+template<typename T>
+bool StopTriggerEngine<T>::Cancel(uint64_t handle)
+{
+  uint32_t index = uint32_t(handle);
+  if(index >= stops.size() || !stops[index].resting || stops[index].generation != uint32_t(handle >> 32))
+  {
+    return false;
+  }
+  Unlink(index);
+  return true;
+}
+
+template<typename T>
+void StopTriggerEngine<T>::Unlink(uint32_t index)
+{
+  Stop &stop = stops[index];
+  Ladder &ladder = ladders[stop.ladder];
+  int64_t bucket = stop.key - ladder.base;
+  if(stop.prev != NONE)
+  {
+    stops[stop.prev].next = stop.next;
+  }
+  else
+  {
+    ladder.heads[bucket] = stop.next;
+  }
+  if(stop.next != NONE)
+  {
+    stops[stop.next].prev = stop.prev;
+  }
+  else
+  {
+    ladder.tails[bucket] = stop.prev;
+  }
+  if(ladder.heads[bucket] == NONE)
+  {
+    ladder.occupied[bucket >> 6] &= ~(uint64_t(1) << (bucket & 63));
+  }
+  stop.resting = false;
+  stop.generation++;
+  stop.next = freeStops;
+  freeStops = index;
+  resting--;
+}
+
+template<typename T>
+int StopTriggerEngine<T>::Cross(Ladder &ladder, int64_t threshold)
+{
+  if(threshold < ladder.lowest)
+  {
+    return 0;
+  }
+  int64_t size = ladder.heads.size();
+  int64_t first = ladder.lowest - ladder.base;
+  int64_t last = threshold - ladder.base < size ? threshold - ladder.base : size - 1;
+  ladder.lowest = threshold + 1;
+  int count = 0;
+  for(int64_t word = first >> 6; word <= (last >> 6); word++)
+  {
+    uint64_t bits = ladder.occupied[word];
+    if(word == (first >> 6))
+    {
+      bits &= ~uint64_t(0) << (first & 63);
+    }
+    if(word == (last >> 6) && (last & 63) != 63)
+    {
+      bits &= (uint64_t(1) << ((last & 63) + 1)) - 1;
+    }
+    while(bits)
+    {
+      int64_t bucket = (word << 6) + __builtin_ctzll(bits);
+      bits &= bits - 1;
+      for(uint32_t index = ladder.heads[bucket]; index != NONE; index = stops[index].next)
+      {
+        crossed.push_back(index);
+        count++;
+      }
+    }
+  }
+  return count;
+}
+
+template<typename T>
+template<typename Trigger>
+int StopTriggerEngine<T>::OnTopOfBook(int productIndex, const TopOfBook &top, Trigger trigger)
+{
+  crossed.clear();
+  if(top.offerLevel >= 0)
+  {
+    Cross(ladders[productIndex * 2 + BID], top.offer.GetTicks());
+  }
+  if(top.bidLevel >= 0)
+  {
+    Cross(ladders[productIndex * 2 + OFFER], -top.bid.GetTicks());
+  }
+  if(crossed.empty())
+  {
+    return 0;
+  }
+
+  // Stops are taken out before any triggers, as trigger may add stops
+  vector<T> triggering;
+  triggering.reserve(crossed.size());
+  for(size_t i = 0; i<crossed.size(); i++)
+  {
+    triggering.push_back(stops[crossed[i]].data);
+    Unlink(crossed[i]);
+  }
+  triggered += triggering.size();
+  for(size_t i = 0; i<triggering.size(); i++)
+  {
+    trigger(triggering[i]);
+  }
+  return triggering.size();
+}
+
+template<typename T>
+size_t StopTriggerEngine<T>::GetStops() const
+{
+  return resting;
+}
+
+template<typename T>
+long StopTriggerEngine<T>::GetTriggered() const
+{
+  return triggered;
+}
+
+#endif
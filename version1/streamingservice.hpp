@@ -18,6 +18,7 @@
 
 #include "soa.hpp"
 #include "marketdataservice.hpp"
+#include "booksignalservice.hpp"
 #include "products.hpp"
 #include "pricingservice.hpp"
 
@@ -34,8 +35,9 @@ class PriceStreamOrder
 
 public:
 
-  // ctor for an order
+  // ctor for an order, with the price rounded to the nearest tick
   PriceStreamOrder(double _price, long _visibleQuantity, long _hiddenQuantity, PricingSide _side);
+  PriceStreamOrder(TickPrice _price, long _visibleQuantity, long _hiddenQuantity, PricingSide _side);
   PriceStreamOrder(){};
 
   // The side on this order
@@ -44,6 +46,9 @@ public:
   // Get the price on this order
   double GetPrice() const;
 
+  // Get the price on this order in ticks
+  TickPrice GetTickPrice() const;
+
   // Get the visible quantity on this order
   long GetVisibleQuantity() const;
 
@@ -51,7 +56,7 @@ public:
   long GetHiddenQuantity() const;
 
 private:
-  double price;
+  TickPrice price;
   long visibleQuantity;
   long hiddenQuantity;
   PricingSide side;
@@ -128,8 +133,18 @@ class BondAlgoStreamService
 private:
   std::map<string, AlgoStream > AlgoStreamMP;
   std::vector< ServiceListener< AlgoStream >* > AlgoStreamListeners;
+  BookSignals Signals[BOND_COUNT];      // latest microstructure signals
 public:
 
+  BondAlgoStreamService()
+  {
+    for(int i = 0; i<BOND_COUNT; i++)
+    {
+      Signals[i] = BookSignals();
+      Signals[i].productIndex = i;
+    }
+  }
+
    virtual AlgoStream& GetData(string key)
    {
     return AlgoStreamMP[key];
@@ -182,6 +197,52 @@ public:
      std::cout<<"finally"<<std::endl;
      OnMessage(data);
   }
+
+  // Keep the latest microstructure signals of a product
+  void OnSignals(const BookSignals &signals)
+  {
+    if(signals.productIndex >= 0 && signals.productIndex < BOND_COUNT)
+    {
+      Signals[signals.productIndex] = signals;
+    }
+  }
+
+  // Get the latest microstructure signals of a product
+  const BookSignals& GetSignals(int productIndex) const
+  {
+    return Signals[productIndex];
+  }
+};
+
+
+class BondSignalAlgoStreamServiceListener : public ServiceListener< BookSignals >
+{
+  public:
+
+    BondSignalAlgoStreamServiceListener(BondAlgoStreamService* AlgoStreamService_):AlgoStreamService(AlgoStreamService_){};
+
+  // Listener callback to process an add event to the Service
+  virtual void ProcessAdd(BookSignals &data)
+  {
+    AlgoStreamService->OnSignals(data);
+  }
+
+  // Listener callback to process a remove event to the Service
+  virtual void ProcessRemove(BookSignals &data)
+  {
+
+  }
+
+  // Listener callback to process an update event to the Service
+  virtual void ProcessUpdate(BookSignals &data)
+  {
+    ProcessAdd(data);
+  }
+
+  private:
+
+  BondAlgoStreamService* AlgoStreamService;
+
 };
 
 
@@ -558,6 +619,14 @@ class BondPricingGUIServiceListener : public ServiceListener < Price<Bond> >
 
 
 PriceStreamOrder::PriceStreamOrder(double _price, long _visibleQuantity, long _hiddenQuantity, PricingSide _side)
+{
+  price = TickPrice::FromDouble(_price);
+  visibleQuantity = _visibleQuantity;
+  hiddenQuantity = _hiddenQuantity;
+  side = _side;
+}
+
+PriceStreamOrder::PriceStreamOrder(TickPrice _price, long _visibleQuantity, long _hiddenQuantity, PricingSide _side)
 {
   price = _price;
   visibleQuantity = _visibleQuantity;
@@ -566,6 +635,11 @@ PriceStreamOrder::PriceStreamOrder(double _price, long _visibleQuantity, long _h
 }
 
 double PriceStreamOrder::GetPrice() const
+{
+  return price.ToDouble();
+}
+
+TickPrice PriceStreamOrder::GetTickPrice() const
 {
   return price;
 }
@@ -0,0 +1,209 @@
+/**
+ * tickprice.hpp
+ * Defines a fixed-point price held as a whole number of ticks.
+ *
+ * Treasuries trade in 32nds of a point, quoted to a quarter (1/128th) or eighth (1/256th)
+ * of a 32nd. A price held as an integer count of ticks adds, subtracts and compares
+ * exactly, so spread checks such as "one tick wide" are integer comparisons instead of
+ * floating point equality.
+ */
+#ifndef TICK_PRICE_HPP
+#define TICK_PRICE_HPP
+
+#include <string>
+#include <cmath>
+#include <stdint.h>
+
+using namespace std;
+
+/**
+ * A price as a count of ticks, with TicksPerPoint ticks to a point.
+ * TicksPerPoint is 32, 64, 128 or 256 so that the price can be written in 32nds.
+ */
+template<int TicksPerPoint>
+class FixedTickPrice
+{
+
+  static_assert(TicksPerPoint == 32 || TicksPerPoint == 64 || TicksPerPoint == 128 || TicksPerPoint == 256,
+    "ticks must divide a 32nd into 1, 2, 4 or 8");
+
+public:
+
+  // Ticks in a point and the value of one tick
+  static const int TICKS_PER_POINT = TicksPerPoint;
+  static constexpr double TICK_SIZE = 1.0 / TicksPerPoint;
+
+  // ctor for a zero price
+  FixedTickPrice() : ticks(0) {}
+
+  // Make a price from a count of ticks
+  static FixedTickPrice FromTicks(int64_t ticks);
+
+  // Make a price from a decimal, rounded to the nearest tick
+  static FixedTickPrice FromDouble(double price);
+
+  // Parse a price in 32nds: "99-16+", "100-155", "99-16" or a whole number "100".
+  // Returns false if the text is not such a price or is finer than a tick.
+  static bool Parse(const char *begin, const char *end, FixedTickPrice &price);
+
+  // Get the count of ticks
+  int64_t GetTicks() const;
+
+  // Get the price as a decimal. Exact, since a tick is a power of two.
+  double ToDouble() const;
+
+  // Write the price in 32nds, e.g. 99-16+ for 99 16/32 + 1/64, and return its length.
+  // The third digit counts eighths of a 32nd, with '+' for a half. The buffer must hold
+  // at least 24 characters.
+  int Format(char *buffer) const;
+
+  // Get the price in 32nds
+  string ToString() const;
+
+  FixedTickPrice& operator+=(FixedTickPrice other) { ticks += other.ticks; return *this; }
+  FixedTickPrice& operator-=(FixedTickPrice other) { ticks -= other.ticks; return *this; }
+  FixedTickPrice operator+(FixedTickPrice other) const { return FromTicks(ticks + other.ticks); }
+  FixedTickPrice operator-(FixedTickPrice other) const { return FromTicks(ticks - other.ticks); }
+  FixedTickPrice operator-() const { return FromTicks(-ticks); }
+  FixedTickPrice operator*(int64_t factor) const { return FromTicks(ticks * factor); }
+
+  bool operator==(FixedTickPrice other) const { return ticks == other.ticks; }
+  bool operator!=(FixedTickPrice other) const { return ticks != other.ticks; }
+  bool operator<(FixedTickPrice other) const { return ticks < other.ticks; }
+  bool operator<=(FixedTickPrice other) const { return ticks <= other.ticks; }
+  bool operator>(FixedTickPrice other) const { return ticks > other.ticks; }
+  bool operator>=(FixedTickPrice other) const { return ticks >= other.ticks; }
+
+private:
+  int64_t ticks;
+
+};
+
+// Prices in 1/256ths, the finest increment quoted for treasuries
+typedef FixedTickPrice<256> TickPrice;
+
+template<int TicksPerPoint>
+constexpr double FixedTickPrice<TicksPerPoint>::TICK_SIZE;
+
+template<int TicksPerPoint>
+FixedTickPrice<TicksPerPoint> FixedTickPrice<TicksPerPoint>::FromTicks(int64_t ticks)
+{
+  FixedTickPrice price;
+  price.ticks = ticks;
+  return price;
+}
+
+template<int TicksPerPoint>
+FixedTickPrice<TicksPerPoint> FixedTickPrice<TicksPerPoint>::FromDouble(double price)
+{
+  return FromTicks(llround(price * TicksPerPoint));
+}
+
+template<int TicksPerPoint>
+bool FixedTickPrice<TicksPerPoint>::Parse(const char *begin, const char *end, FixedTickPrice &price)
+{
+  const int TICKS_PER_32ND = TicksPerPoint / 32;
+  const char *p = begin;
+  bool negative = p != end && *p == '-';
+  p += negative;
+
+  int64_t handle = 0;
+  const char *digits = p;
+  for(; p != end && *p >= '0' && *p <= '9'; p++)
+  {
+    handle = handle * 10 + (*p - '0');
+  }
+  if(p == digits)
+  {
+    return false;
+  }
+
+  int64_t ticks = handle * TicksPerPoint;
+  if(p != end)
+  {
+    // Two digits of 32nds, then an optional eighths digit or '+'
+    if(*p != '-' || end - p < 3 || p[1] < '0' || p[1] > '3' || p[2] < '0' || p[2] > '9')
+    {
+      return false;
+    }
+    int thirtySeconds = (p[1] - '0') * 10 + (p[2] - '0');
+    if(thirtySeconds > 31)
+    {
+      return false;
+    }
+    ticks += thirtySeconds * TICKS_PER_32ND;
+    p += 3;
+
+    if(p != end)
+    {
+      int eighths = *p == '+' ? 4 : *p - '0';
+      if(end - p != 1 || eighths < 0 || eighths > 7 || (eighths * TICKS_PER_32ND) % 8 != 0)
+      {
+        return false;
+      }
+      ticks += eighths * TICKS_PER_32ND / 8;
+    }
+  }
+
+  price.ticks = negative ? -ticks : ticks;
+  return true;
+}
+
+template<int TicksPerPoint>
+int64_t FixedTickPrice<TicksPerPoint>::GetTicks() const
+{
+  return ticks;
+}
+
+template<int TicksPerPoint>
+double FixedTickPrice<TicksPerPoint>::ToDouble() const
+{
+  return ticks * TICK_SIZE;
+}
+
+template<int TicksPerPoint>
+int FixedTickPrice<TicksPerPoint>::Format(char *buffer) const
+{
+  const int TICKS_PER_32ND = TicksPerPoint / 32;
+  char *p = buffer;
+  uint64_t magnitude = ticks;
+  if(ticks < 0)
+  {
+    *p++ = '-';
+    magnitude = -uint64_t(ticks);
+  }
+
+  // Handle, written backwards into a scratch area then copied forwards
+  uint64_t handle = magnitude / TicksPerPoint;
+  int remainder = magnitude % TicksPerPoint;
+  char digits[20];
+  int count = 0;
+  do
+  {
+    digits[count++] = '0' + handle % 10;
+    handle /= 10;
+  } while(handle != 0);
+  while(count > 0)
+  {
+    *p++ = digits[--count];
+  }
+
+  int thirtySeconds = remainder / TICKS_PER_32ND;
+  int eighths = remainder % TICKS_PER_32ND * 8 / TICKS_PER_32ND;
+  p[0] = '-';
+  p[1] = '0' + thirtySeconds / 10;
+  p[2] = '0' + thirtySeconds % 10;
+  p[3] = eighths == 4 ? '+' : '0' + eighths;
+  p[4] = '\0';
+  return p + 4 - buffer;
+}
+
+template<int TicksPerPoint>
+string FixedTickPrice<TicksPerPoint>::ToString() const
+{
+  char buffer[24];
+  int length = Format(buffer);
+  return string(buffer, length);
+}
+
+#endif
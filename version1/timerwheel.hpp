@@ -0,0 +1,217 @@
+/**
+ * timerwheel.hpp
+ * Defines a hashed timer wheel.
+ *
+ * Time is cut into ticks, and a timer goes in the slot of the tick it is due on, modulo
+ * the number of slots, in an intrusive list. Scheduling and cancelling are O(1), and each
+ * tick of the clock visits one slot, so a tick costs the timers hashed to its slot, not
+ * every timer pending. Timers due in more ticks than there are slots stay in their slot
+ * until the wheel comes round to their tick. The clock starts at the first Advance, or
+ * just before the first deadline scheduled if that comes first.
+ */
+#ifndef TIMER_WHEEL_HPP
+#define TIMER_WHEEL_HPP
+
+#include <vector>
+#include <chrono>
+#include <stdint.h>
+
+using namespace std;
+
+class TimerWheel
+{
+
+public:
+
+  // ctor for a wheel ticking every tickNanos, with slots rounded up to a power of two
+  TimerWheel(int64_t _tickNanos, int _slots = 256);
+
+  // Schedule a timer for a key, due at deadlineNanos, and get a handle to cancel it by.
+  // A deadline before the next tick is due on the next tick.
+  uint64_t Schedule(int64_t deadlineNanos, uint64_t key);
+
+  // Cancel a timer. Returns false if it has already expired or been cancelled.
+  bool Cancel(uint64_t handle);
+
+  // Move the clock on to nowNanos, calling expire(key) for each timer due, tick by tick.
+  // Timers scheduled from expire are due no earlier than the next tick. Returns the number
+  // of timers that expired.
+  template<typename Expire>
+  int Advance(int64_t nowNanos, Expire expire);
+
+  // Get the number of timers pending
+  size_t GetTimers() const;
+
+  // Get the tick length
+  int64_t GetTickNanos() const;
+
+  // Get the time of the steady clock, in nanoseconds
+  static int64_t Now();
+
+private:
+
+  static const uint32_t NONE = 0xFFFFFFFF;
+
+  struct Timer
+  {
+    uint64_t key;
+    int64_t tick;             // due on
+    uint32_t prev;
+    uint32_t next;            // and in the free list
+    uint32_t generation;      // tells a reused timer from the one a handle was for
+    bool pending;
+  };
+
+  void Unlink(uint32_t index);
+
+  int64_t tickNanos;
+  int64_t currentTick;        // every tick up to this one has expired
+  bool started;
+  vector<Timer> timers;
+  vector<uint32_t> slots;     // first timer of each slot
+  uint32_t mask;
+  uint32_t freeTimers;
+  size_t pending;
+  vector<uint64_t> expired;
+
+};
+
+TimerWheel::TimerWheel(int64_t _tickNanos, int _slots) :
+  tickNanos(_tickNanos > 0 ? _tickNanos : 1), currentTick(0), started(false), freeTimers(NONE), pending(0)
+{
+  uint32_t size = 1;
+  while(size < uint32_t(_slots))
+  {
+    size <<= 1;
+  }
+  slots.assign(size, uint32_t(NONE));
+  mask = size - 1;
+}
+
+uint64_t TimerWheel::Schedule(int64_t deadlineNanos, uint64_t key)
+{
+  if(!started)
+  {
+    currentTick = deadlineNanos / tickNanos - 1;
+    started = true;
+  }
+  uint32_t index = freeTimers;
+  if(index == NONE)
+  {
+    Timer timer = { 0, 0, NONE, NONE, 0, false };
+    index = timers.size();
+    timers.push_back(timer);
+  }
+  else
+  {
+    freeTimers = timers[index].next;
+  }
+
+  Timer &timer = timers[index];
+  int64_t tick = deadlineNanos / tickNanos;
+  timer.key = key;
+  timer.tick = tick > currentTick ? tick : currentTick + 1;
+  timer.pending = true;
+  uint32_t &head = slots[timer.tick & mask];
+  timer.prev = NONE;
+  timer.next = head;
+  if(head != NONE)
+  {
+    timers[head].prev = index;
+  }
+  head = index;
+  pending++;
+  return (uint64_t(timer.generation) << 32) | index;
+}
+
+bool TimerWheel::Cancel(uint64_t handle)
+{
+  uint32_t index = uint32_t(handle);
+  if(index >= timers.size() || !timers[index].pending || timers[index].generation != uint32_t(handle >> 32))
+  {
+    return false;
+  }
+  Unlink(index);
+  return true;
+}
+
+void TimerWheel::Unlink(uint32_t index)
+{
+  Timer &timer = timers[index];
+  if(timer.prev != NONE)
+  {
+    timers[timer.prev].next = timer.next;
+  }
+  else
+  {
+    slots[timer.tick & mask] = timer.next;
+  }
+  if(timer.next != NONE)
+  {
+    timers[timer.next].prev = timer.prev;
+  }
+  timer.pending = false;
+  timer.generation++;
+  timer.next = freeTimers;
+  freeTimers = index;
+  pending--;
+}
+
+template<typename Expire>
+int TimerWheel::Advance(int64_t nowNanos, Expire expire)
+{
+  int64_t nowTick = nowNanos / tickNanos;
+  if(!started)
+  {
+    currentTick = nowTick;
+    started = true;
+    return 0;
+  }
+
+  int count = 0;
+  while(currentTick < nowTick)
+  {
+    currentTick++;
+    if(pending == 0)
+    {
+      currentTick = nowTick;
+      break;
+    }
+
+    // Keys are taken out of the slot first, as expire may schedule into it
+    expired.clear();
+    for(uint32_t index = slots[currentTick & mask]; index != NONE;)
+    {
+      uint32_t next = timers[index].next;
+      if(timers[index].tick <= currentTick)
+      {
+        expired.push_back(timers[index].key);
+        Unlink(index);
+      }
+      index = next;
+    }
+    for(size_t i = 0; i<expired.size(); i++)
+    {
+      expire(expired[i]);
+    }
+    count += expired.size();
+  }
+  return count;
+}
+
+size_t TimerWheel::GetTimers() const
+{
+  return pending;
+}
+
+int64_t TimerWheel::GetTickNanos() const
+{
+  return tickNanos;
+}
+
+int64_t TimerWheel::Now()
+{
+  return chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+#endif
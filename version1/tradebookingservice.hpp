@@ -14,9 +14,13 @@
 #include <map>
 #include <fstream>
 #include <cstring>
+#include <mutex>
 
 #include "soa.hpp"
 #include "products.hpp"
+#include "csvingest.hpp"
+#include "binaryfeed.hpp"
+#include "tickprice.hpp"
 
 
 
@@ -32,8 +36,9 @@ class Trade
 {
 
 public:
-  // ctor for a trade
+  // ctor for a trade, with the price rounded to the nearest tick
   Trade(const T &_product, string _tradeId, double price_, string _book, long _quantity, Side _side);
+  Trade(const T &_product, string _tradeId, TickPrice price_, string _book, long _quantity, Side _side);
 
   Trade(){};
   // Get the product
@@ -52,13 +57,16 @@ public:
   Side GetSide() const;
 
   double GetPrice() const;
+
+  // Get the price in ticks
+  TickPrice GetTickPrice() const;
 private:
   T product;
   string tradeId;
   string book;
   long quantity;
   Side side; 
-  double price;
+  TickPrice price;
 
 };
 
@@ -67,6 +75,17 @@ private:
 template<typename T>
 Trade<T>::Trade(const T &_product, string _tradeId, double price_, string _book, long _quantity, Side _side) :
   product(_product)
+{
+  tradeId = _tradeId;
+  book = _book;
+  quantity = _quantity;
+  side = _side;
+  price = TickPrice::FromDouble(price_);
+}
+
+template<typename T>
+Trade<T>::Trade(const T &_product, string _tradeId, TickPrice price_, string _book, long _quantity, Side _side) :
+  product(_product)
 {
   tradeId = _tradeId;
   book = _book;
@@ -108,6 +127,12 @@ Side Trade<T>::GetSide() const
 
 template<typename T>
 double Trade<T>::GetPrice() const
+{
+  return price.ToDouble();
+}
+
+template<typename T>
+TickPrice Trade<T>::GetTickPrice() const
 {
   return price;
 }
@@ -175,6 +200,11 @@ class BondTradeBookingService : public TradeBookingService<Bond>
 
   std::vector< ServiceListener<Trade<Bond> >* >TradeListeners;
 
+  // Trades arrive both from the trade feed and from execution fills, which may be on
+  // different threads and book directly. Booking and the listeners downstream run under
+  // this lock, which OnMessage holds across its call to BookTrade.
+  std::recursive_mutex BookingLock;
+
 };
 
 
@@ -191,15 +221,13 @@ BondTradeBookingService::BondTradeBookingService()
 
 Trade<Bond>& BondTradeBookingService::GetData(string key)
 {
-  if(TradeMP.find(key)!=TradeMP.end())
-  {
-    return TradeMP[key];
-  }
-  //std::cout<<key<<std::endl;
+  std::lock_guard<std::recursive_mutex> guard(BookingLock);
+  return TradeMP[key];
 }
 
 void BondTradeBookingService::OnMessage(Trade<Bond> &data)
 {
+  std::lock_guard<std::recursive_mutex> guard(BookingLock);
   BookTrade(data);
 
   if(TradeListeners.size()!=0)
@@ -226,6 +254,7 @@ const vector< ServiceListener<Trade<Bond> >* >& BondTradeBookingService::GetList
 // Book the trade
 void BondTradeBookingService::BookTrade( Trade<Bond> &trade)
 {
+  std::lock_guard<std::recursive_mutex> guard(BookingLock);
   TradeMP.insert(pair< string,Trade<Bond> >( trade.GetTradeId(), trade ) );
 } 
   
@@ -234,7 +263,7 @@ class BondTradeBookingServiceConnector: public Connector < Trade<Bond> >
 {
 public:
 
-  BondTradeBookingServiceConnector( BondTradeBookingService& _myline):BondTradeBooking(_myline){}; 
+  BondTradeBookingServiceConnector( BondTradeBookingService& _myline):BondTradeBooking(_myline){};
   virtual void Publish(Trade<Bond>& data){};
 
 
@@ -242,138 +271,58 @@ public:
 
   void Subscribe()
   {
-    string line;
-    std::ifstream file("trades.txt");
-
-    while(getline(file,line))
-  {
-    
-    std::stringstream linestream(line);
-
-    std::string product;
-    std::string tradeID;
-    std::string price;
-    std::string book;
-    std::string quantity;
-    std::string side;
-
-    std::getline(linestream,product,',');
-    std::getline(linestream,tradeID,',');
-    std::getline(linestream,price,',');
-    std::getline(linestream,book,',');
-    std::getline(linestream,quantity,',');
-    std::getline(linestream,side,',');
-   
-    
-   // std::cout<<"here initial "<<side<<std::endl;
-
-
+    MappedFile file("trades.txt");
+    CsvReader reader(file.GetData(), file.GetSize());
+    CsvField fields[6];
+    int fieldCount;
+    TradeRecord record;
 
-    if(!product.empty())
+    while(reader.NextLine(fields, 6, fieldCount))
     {
-
-       long quant = atol(quantity.c_str());
-
-          Side pside;
-          if(side == "BUY")
-          {
-            pside = BUY;
-          }
-          else
-          {
-            pside = SELL;
-          }          
-          std::string delimiter = "-";
-          std::string token1 = price.substr(0,price.find(delimiter));
-          std::string token2 = price.substr(price.find(delimiter)+1,(price.length()-1));
-          
-          double tradedPrice;
-          if(token1.size() ==2)
-          {
-            tradedPrice = double(token1[0]-'0')*10 + double(token1[1]-'0');          
-          }
-          else if(token1.size() == 3)
-          {
-            tradedPrice = double(token1[0]-'0')*100 + double(token1[1]-'0')*10 + double(token1[2]-'0'); 
-          }
-          
-          double xy = (double)(token2[0]-'0')*10+(double)(token2[1]-'0');   //std::string z = token2[2];
-          double z = (double)(token2[2]-'0');
-
-          tradedPrice = tradedPrice + xy / 32 + z/256;
-  
-        if(product == "2Y")
-        {
-          BondIdType idType = CUSIP;
-          date maturityDate(2019,Oct,31);
-          Bond bond2Y("2Y", idType,"T", 0.015, maturityDate);
-          
-          Trade<Bond> obj1 = Trade<Bond>(bond2Y,tradeID,tradedPrice,book,quant,pside);
-          
-          std::cout<<"here 1"<<std::endl;
-
-          BondTradeBooking.OnMessage(obj1);
-
-          std::cout<<"here 2"<<std::endl;
-          //std::cout<<"product: "<<BondTradeBooking.GetData(tradeID).GetTradeId()<<std::endl;
-        }
-
-        else if(product == "3Y")
-        {
-          BondIdType idType = CUSIP;
-          date maturityDate(2020,Nov,15);
-          Bond bond3Y("3Y", idType, "T", 0.0175, maturityDate);
-
-          Trade<Bond> obj1 = Trade<Bond>(bond3Y,tradeID,tradedPrice,book,quant,pside);
-          BondTradeBooking.OnMessage(obj1);
-  
-        }
-
-        else if(product == "5Y")
-        {
-          BondIdType idType = CUSIP;
-          date maturityDate(2022,Oct,31);
-          Bond bond5Y("5Y", idType, "T", 0.02, maturityDate);
-
-          Trade<Bond> obj1 = Trade<Bond>(bond5Y,tradeID,tradedPrice,book,quant,pside);
-          BondTradeBooking.OnMessage(obj1);
-          //myline.push_back(obj1);          
-        }
-        else if(product == "7Y")
-        {
-          BondIdType idType = CUSIP;
-          date maturityDate(2024,Oct,31);
-          Bond bond7Y("7Y", idType, "T", 0.0225, maturityDate);
-          
-          Trade<Bond> obj1 = Trade<Bond>(bond7Y,tradeID,tradedPrice,book,quant,pside);
-          BondTradeBooking.OnMessage(obj1);          
-        }
-        else if(product == "10Y")
-        {
-          BondIdType idType = CUSIP;
-          date maturityDate(2027,Nov,15);
-          Bond bond10Y("10Y", idType, "T", 0.0225, maturityDate);
-
-          Trade<Bond> obj1 = Trade<Bond>(bond10Y,tradeID,tradedPrice,book,quant,pside);
-          BondTradeBooking.OnMessage(obj1);
-        }
-        else if(product == "30Y")
-        {
-          BondIdType idType = CUSIP;
-          date maturityDate(2047,Nov,15);
-          Bond bond30Y("30Y", idType, "T", 0.0275, maturityDate);
-          
-          Trade<Bond> obj1 = Trade<Bond>(bond30Y,tradeID,tradedPrice,book,quant,pside);
-          BondTradeBooking.OnMessage(obj1);
-        }
-
+      if(!ParseTradeRecord(fields, fieldCount, record))
+      {
+        continue;
+      }
+
+      Side pside = record.isBuy ? BUY : SELL;
+      Trade<Bond> obj1 = Trade<Bond>(GetReferenceBond(record.productIndex),record.tradeId.ToString(),record.price,record.book.ToString(),record.quantity,pside);
+      BondTradeBooking.OnMessage(obj1);
     }
   }
+private:
+  BondTradeBookingService& BondTradeBooking;
+};
+
 
+/**
+ * Replays a binary trade feed (see binaryfeed.hpp) into the trade booking service.
+ */
+class BondTradeBookingServiceBinaryConnector: public Connector < Trade<Bond> >
+{
+public:
+
+  BondTradeBookingServiceBinaryConnector( BondTradeBookingService& _myline, const string &_path = "trades.bin"):BondTradeBooking(_myline),path(_path){};
+  virtual void Publish(Trade<Bond>& data){};
 
+  void Subscribe()
+  {
+    BinaryFeedReader<TradeFeedRecord> reader(path.c_str());
+    for(const TradeFeedRecord *record = reader.Begin(); record != reader.End(); record++)
+    {
+      if(!IsValidFeedRecord(*record))
+      {
+        continue;
+      }
+      Side pside = record->side == 0 ? BUY : SELL;
+      string tradeId(record->tradeId, IdentifierLength(record->tradeId, sizeof(record->tradeId)));
+      string book(record->book, IdentifierLength(record->book, sizeof(record->book)));
+      Trade<Bond> obj1 = Trade<Bond>(GetReferenceBond(record->productIndex),tradeId,TickPrice::FromTicks(record->priceTicks),book,record->quantity,pside);
+      BondTradeBooking.OnMessage(obj1);
+    }
   }
 private:
-  BondTradeBookingService BondTradeBooking;
+  BondTradeBookingService& BondTradeBooking;
+  string path;
 };
 
 